@@ -0,0 +1,218 @@
+/**
+ * @file    console_sink.hpp
+ * @ingroup opensource
+ * @brief   Non-blocking buffered console output for the Logger class.
+ *          Producers append to an in-process lock-free ring and return immediately; a background thread drains
+ *          the ring and writes to fd 1/2 in large batches, optionally colored by level. A slow terminal or pipe
+ *          only ever stalls the background thread: when the ring is full, messages are dropped and counted.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) ctrlfrmb 2023-2033
+ */
+
+#pragma once
+
+#ifndef OPEN_SOURCE_CONSOLE_SINK_HPP
+#define OPEN_SOURCE_CONSOLE_SINK_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm_log_ring.hpp"
+
+namespace opensource {
+namespace ctrlfrmb {
+
+// Structure for configuring the console sink
+struct ConsoleSinkConfig {
+    size_t bufferSize;        // Ring capacity in bytes
+    bool useColor;            // Color by severity, only applied when the target fd is a terminal
+    uint8_t stderrSeverity;   // Messages at or above this severity (LogLevel value) go to fd 2, the rest to fd 1
+
+    explicit ConsoleSinkConfig(size_t size = 1024 * 1024, bool color = true, uint8_t errSeverity = 4)
+            : bufferSize(size), useColor(color), stderrSeverity(errSeverity) {}
+};
+
+// Class responsible for writing log messages to the console without blocking the caller
+class ConsoleSink {
+public:
+    explicit ConsoleSink(const ConsoleSinkConfig& config)
+            : config(config), ring("", config.bufferSize, true), stopWriting(false), droppedBytes(0) {
+        out[0].fd = STDOUT_FILENO;
+        out[1].fd = STDERR_FILENO;
+        for (auto& o : out) {
+            o.color = config.useColor && isatty(o.fd);
+            o.buffer.reserve(WRITE_BATCH_SIZE + 4096);
+            openNonBlocking(o);
+        }
+        workerThread = std::thread(&ConsoleSink::processRing, this);
+    }
+
+    // Drains what is already queued, giving up on an fd that stays unwritable for too long
+    ~ConsoleSink() {
+        stopWriting = true;
+        if (workerThread.joinable()) {
+            workerThread.join();
+        }
+        for (auto& o : out) {
+            if (o.nonBlocking) {
+                close(o.fd);
+            }
+        }
+    }
+
+    ConsoleSink(const ConsoleSink&) = delete;
+    ConsoleSink& operator=(const ConsoleSink&) = delete;
+
+    // Queues one line (without trailing newline), returns false if it was dropped
+    bool write(std::string_view message, uint8_t severity) {
+        return ring.write(message, severity);
+    }
+
+    uint64_t written() const { return ring.written(); }
+    uint64_t dropped() const { return ring.dropped(); }
+    uint64_t lostBytes() const { return droppedBytes.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t WRITE_BATCH_SIZE = 64 * 1024;
+    static constexpr int POLL_TIMEOUT_MS = 100;
+    static constexpr int SHUTDOWN_POLL_RETRIES = 10; // Give a stuck fd about a second once stopping
+
+    // Pending output of one file descriptor
+    struct Output {
+        int fd;
+        bool color;
+        bool nonBlocking = false;  // fd is a private non-blocking description owned by the sink
+        bool stuck = false;   // Gave up on this fd while stopping, discard the rest
+        std::string buffer;
+    };
+
+    ConsoleSinkConfig config;
+    ShmLogRing ring;
+    Output out[2];
+    std::atomic<bool> stopWriting;
+    std::atomic<uint64_t> droppedBytes;  // Bytes discarded because the fd failed or stayed unwritable at shutdown
+    std::thread workerThread;
+
+    static const char* colorOf(uint8_t severity) {
+        switch (severity) {
+        case 0: return "\033[90m";   // TRACE
+        case 1: return "\033[36m";   // DEBUG
+        case 2: return "";           // INFO
+        case 3: return "\033[33m";   // WARN
+        case 4: return "\033[31m";   // ERROR
+        default: return "\033[1;31m"; // FATAL
+        }
+    }
+
+    void append(std::string_view message, uint8_t severity) {
+        Output& o = out[severity >= config.stderrSeverity ? 1 : 0];
+        const char* color = o.color ? colorOf(severity) : "";
+        if (*color) {
+            o.buffer += color;
+            o.buffer += message;
+            o.buffer += "\033[0m\n";
+        } else {
+            o.buffer += message;
+            o.buffer += '\n';
+        }
+        if (o.buffer.size() >= WRITE_BATCH_SIZE) {
+            flush(o);
+        }
+    }
+
+    // stdout and stderr usually share their open file description with the shell, so setting O_NONBLOCK on
+    // them would leak into other processes. On Linux, reopening /proc/self/fd/N yields a private description
+    // of the same pipe, terminal or file that can be made non-blocking safely.
+    static void openNonBlocking(Output& o) {
+#if defined(__linux__)
+        struct stat st;
+        if (fstat(o.fd, &st) != 0) {
+            return;
+        }
+        int flags = O_WRONLY | O_NONBLOCK | O_CLOEXEC | O_NOCTTY;
+        if (S_ISREG(st.st_mode)) {
+            flags |= O_APPEND; // A new description starts at offset 0, never overwrite a redirected file
+        }
+        int fd = open(("/proc/self/fd/" + std::to_string(o.fd)).c_str(), flags);
+        if (fd >= 0) {
+            o.fd = fd;
+            o.nonBlocking = true;
+        }
+#else
+        (void)o;
+#endif
+    }
+
+    // Writes the whole buffer with poll() bounding each wait so shutdown can never hang. Without a
+    // non-blocking description, chunks are capped at PIPE_BUF, which cannot block once POLLOUT is reported.
+    void flush(Output& o) {
+        size_t offset = 0;
+        int retries = 0;
+        while (!o.stuck && offset < o.buffer.size()) {
+            pollfd pfd{o.fd, POLLOUT, 0};
+            int ready = poll(&pfd, 1, POLL_TIMEOUT_MS);
+            if (ready == 0) {
+                if (stopWriting.load() && ++retries >= SHUTDOWN_POLL_RETRIES) {
+                    o.stuck = true;
+                    break;
+                }
+                continue;
+            }
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready < 0 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+                break;
+            }
+            size_t chunk = o.buffer.size() - offset;
+            if (!o.nonBlocking && chunk > PIPE_BUF) {
+                chunk = PIPE_BUF;
+            }
+            ssize_t n = ::write(o.fd, o.buffer.data() + offset, chunk);
+            if (n > 0) {
+                offset += static_cast<size_t>(n);
+            } else if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                break;
+            }
+        }
+        if (offset < o.buffer.size()) {
+            droppedBytes.fetch_add(o.buffer.size() - offset, std::memory_order_relaxed);
+        }
+        o.buffer.clear();
+    }
+
+    void processRing() {
+        auto appendRecord = [this](std::string_view message, uint8_t severity) { append(message, severity); };
+        while (true) {
+            bool stopping = stopWriting.load();
+            size_t count = ring.consume(appendRecord, 4096);
+            for (auto& o : out) {
+                if (!o.buffer.empty()) {
+                    flush(o);
+                }
+            }
+            if (count == 0) {
+                if (stopping) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+};
+
+}  // namespace ctrlfrmb
+}  // namespace opensource
+
+#endif // !OPEN_SOURCE_CONSOLE_SINK_HPP
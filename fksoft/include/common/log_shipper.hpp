@@ -0,0 +1,478 @@
+/**
+ * @file    log_shipper.hpp
+ * @ingroup opensource
+ * @brief   Batched log shipping to a local collector over a Unix-domain stream socket.
+ *          Log records are streamed as they are produced, so a collector no longer has to tail and re-parse
+ *          the log files. Producers append to a lock-free ring; a shipper thread keeps every record until the
+ *          collector acknowledges it, sends them in batches (binary or JSON lines), reconnects on failure and
+ *          resumes from the collector's offset. When the collector falls behind, the unacknowledged window
+ *          fills up, the ring fills up and new records are dropped and counted; producers never block.
+ *
+ *          Protocol, all integers little-endian, every frame is [u32 type][u32 body length][body]:
+ *            HELLO  (shipper -> collector)  u32 magic, u16 version, u8 format, u8 0, u64 session,
+ *                                           u16 stream id length, stream id
+ *            RESUME (collector -> shipper)  u64 next sequence the collector expects for (stream id, session)
+ *            DATA   (shipper -> collector)  u64 first sequence, u32 record count, records
+ *            ACK    (collector -> shipper)  u64 next sequence, everything below it is safely received
+ *          Binary records are [u64 unix time ns][u8 severity][u32 length][message],
+ *          JSON records are {"seq":N,"ts":ns,"level":severity,"msg":"..."} followed by '\n'.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) ctrlfrmb 2023-2033
+ */
+
+#pragma once
+
+#ifndef OPEN_SOURCE_LOG_SHIPPER_HPP
+#define OPEN_SOURCE_LOG_SHIPPER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "shm_log_ring.hpp"
+
+namespace opensource {
+namespace ctrlfrmb {
+
+namespace ship {
+
+constexpr uint32_t MAGIC = 0x5348504C; // "LPHS"
+constexpr uint16_t VERSION = 1;
+constexpr size_t FRAME_HEADER_SIZE = 8;
+constexpr size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+enum FrameType : uint32_t {
+    HELLO = 1,
+    RESUME = 2,
+    DATA = 3,
+    ACK = 4
+};
+
+inline void putU16(std::string& out, uint16_t v) {
+    char b[2] = {static_cast<char>(v), static_cast<char>(v >> 8)};
+    out.append(b, 2);
+}
+
+inline void putU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>(v >> (8 * i));
+    }
+}
+
+inline void putU64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        out += static_cast<char>(v >> (8 * i));
+    }
+}
+
+inline uint16_t getU16(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint16_t>(u[0] | (u[1] << 8));
+}
+
+inline uint32_t getU32(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint32_t>(u[0]) | (static_cast<uint32_t>(u[1]) << 8) |
+           (static_cast<uint32_t>(u[2]) << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+inline uint64_t getU64(const char* p) {
+    return static_cast<uint64_t>(getU32(p)) | (static_cast<uint64_t>(getU32(p + 4)) << 32);
+}
+
+// Appends a frame header and returns the offset of its length field, to be patched by endFrame
+inline size_t beginFrame(std::string& out, FrameType type) {
+    putU32(out, type);
+    size_t lengthOffset = out.size();
+    putU32(out, 0);
+    return lengthOffset;
+}
+
+inline void endFrame(std::string& out, size_t lengthOffset) {
+    uint32_t length = static_cast<uint32_t>(out.size() - lengthOffset - 4);
+    for (int i = 0; i < 4; ++i) {
+        out[lengthOffset + i] = static_cast<char>(length >> (8 * i));
+    }
+}
+
+// Appends message as the contents of a JSON string
+inline void appendJsonEscaped(std::string& out, std::string_view message) {
+    static const char* hex = "0123456789abcdef";
+    for (char c : message) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                out += "\\u00";
+                out += hex[(c >> 4) & 0xF];
+                out += hex[c & 0xF];
+            } else {
+                out += c;
+            }
+        }
+    }
+}
+
+}  // namespace ship
+
+// Record encoding used on the wire
+enum class ShipFormat : uint8_t {
+    BINARY = 1,
+    JSON_LINES = 2
+};
+
+// Structure for configuring the log shipper
+struct LogShipperConfig {
+    std::string socketPath;   // Path of the collector's Unix-domain stream socket
+    std::string streamId;     // Name of this producer, the collector keeps resume offsets per stream
+    ShipFormat format;        // Wire encoding of the records
+    size_t bufferSize;        // Lock-free ring between producers and the shipper thread
+    size_t maxPendingBytes;   // Unacknowledged records kept for resending, the backpressure limit
+    size_t maxBatchRecords;   // Records per DATA frame
+    size_t maxBatchBytes;     // Message bytes per DATA frame
+    uint32_t flushIntervalMs; // Longest time a record waits for its batch to fill up
+
+    LogShipperConfig(std::string_view path, std::string_view stream, ShipFormat fmt = ShipFormat::JSON_LINES)
+            : socketPath(path), streamId(stream), format(fmt), bufferSize(4 * 1024 * 1024),
+              maxPendingBytes(16 * 1024 * 1024), maxBatchRecords(1024), maxBatchBytes(256 * 1024),
+              flushIntervalMs(50) {}
+};
+
+// Class responsible for streaming log records to a local collector
+class LogShipper {
+public:
+    explicit LogShipper(const LogShipperConfig& config)
+            : config(config), ring("", config.bufferSize, true), stopShipping(false), sock(-1),
+              session(static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count())),
+              nextSeq(0), sendSeq(0), pendingBytes(0), awaitingResume(false),
+              acked(0), reconnects(0), resent(0), lost(0) {
+        workerThread = std::thread(&LogShipper::processRecords, this);
+    }
+
+    // Tries to deliver what is queued for up to one flush interval, then disconnects
+    ~LogShipper() {
+        stopShipping = true;
+        if (workerThread.joinable()) {
+            workerThread.join();
+        }
+        disconnect();
+    }
+
+    LogShipper(const LogShipper&) = delete;
+    LogShipper& operator=(const LogShipper&) = delete;
+
+    // Queues one record, returns false if it was dropped because the shipper is backed up
+    bool ship(std::string_view message, uint8_t severity) {
+        char head[8];
+        uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+        std::memcpy(head, &ns, sizeof(ns));
+        return ring.write(std::string_view(head, sizeof(head)), message, severity);
+    }
+
+    uint64_t queued() const { return ring.written(); }
+    uint64_t dropped() const { return ring.dropped(); }
+    uint64_t acknowledged() const { return acked.load(std::memory_order_relaxed); }
+    uint64_t reconnectCount() const { return reconnects.load(std::memory_order_relaxed); }
+    uint64_t resentRecords() const { return resent.load(std::memory_order_relaxed); }
+    uint64_t lostRecords() const { return lost.load(std::memory_order_relaxed); }
+    bool connected() const { return sockConnected.load(std::memory_order_relaxed); }
+
+private:
+    // Record kept until the collector acknowledges it
+    struct PendingRecord {
+        uint64_t timestamp;
+        uint8_t severity;
+        std::string message;
+    };
+
+    LogShipperConfig config;
+    ShmLogRing ring;
+    std::atomic<bool> stopShipping;
+    std::atomic<bool> sockConnected{false};
+    bool everConnected = false;
+    std::thread workerThread;
+
+    int sock;
+    uint64_t session;                    // Distinguishes this process run from earlier ones with the same stream id
+    std::deque<PendingRecord> pending;   // Records from ackedSeq() to nextSeq
+    uint64_t nextSeq;                    // Sequence number of the next record taken from the ring
+    uint64_t sendSeq;                    // First record not yet encoded into outBuffer
+    uint64_t sentSeq = 0;                // Records below it were encoded at least once, later ones again are resent
+    size_t pendingBytes;
+    bool awaitingResume;                 // HELLO sent, RESUME not received yet
+    std::string outBuffer;               // Encoded frames not yet written to the socket
+    size_t outOffset = 0;
+    std::string inBuffer;                // Bytes received from the collector
+    std::chrono::steady_clock::time_point oldestUnsent;
+    std::chrono::steady_clock::time_point nextConnectAttempt;
+    std::chrono::milliseconds backoff{100};
+
+    std::atomic<uint64_t> acked;
+    std::atomic<uint64_t> reconnects;
+    std::atomic<uint64_t> resent;
+    std::atomic<uint64_t> lost;
+
+    uint64_t ackedSeq() const {
+        return nextSeq - pending.size();
+    }
+
+    void processRecords() {
+        auto takeRecord = [this](std::string_view record, uint8_t severity) {
+            uint64_t ns;
+            std::memcpy(&ns, record.data(), sizeof(ns));
+            if (pending.empty() || sendSeq == nextSeq) {
+                oldestUnsent = std::chrono::steady_clock::now();
+            }
+            pending.push_back(PendingRecord{ns, severity, std::string(record.substr(sizeof(ns)))});
+            pendingBytes += record.size();
+            ++nextSeq;
+        };
+        std::chrono::steady_clock::time_point stopDeadline;
+        bool stopping = false;
+
+        while (true) {
+            if (!stopping && stopShipping.load()) {
+                stopping = true;
+                stopDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config.flushIntervalMs) +
+                               std::chrono::seconds(1);
+            }
+
+            // Only take records from the ring while the resend window has room, the ring absorbs bursts
+            // and drops once both are full
+            if (pendingBytes < config.maxPendingBytes) {
+                ring.consume(takeRecord, config.maxBatchRecords);
+            }
+
+            if (sock < 0) {
+                connectCollector();
+            }
+            if (sock >= 0 && !awaitingResume && outOffset == outBuffer.size()) {
+                encodeBatch(stopping);
+            }
+
+            bool drained = pending.empty() && ring.written() == nextSeq;
+            if (stopping && (drained || std::chrono::steady_clock::now() >= stopDeadline)) {
+                break;
+            }
+            pollSocket();
+        }
+    }
+
+    void connectCollector() {
+        auto now = std::chrono::steady_clock::now();
+        if (now < nextConnectAttempt) {
+            return;
+        }
+        nextConnectAttempt = now + backoff;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return;
+        }
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, config.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            backoff = std::min(backoff * 2, std::chrono::milliseconds(5000));
+            return;
+        }
+
+        sock = fd;
+        sockConnected = true;
+        if (everConnected) {
+            ++reconnects;
+        }
+        everConnected = true;
+        backoff = std::chrono::milliseconds(100);
+        outBuffer.clear();
+        outOffset = 0;
+        inBuffer.clear();
+
+        size_t lengthOffset = ship::beginFrame(outBuffer, ship::HELLO);
+        ship::putU32(outBuffer, ship::MAGIC);
+        ship::putU16(outBuffer, ship::VERSION);
+        outBuffer += static_cast<char>(config.format);
+        outBuffer += '\0';
+        ship::putU64(outBuffer, session);
+        ship::putU16(outBuffer, static_cast<uint16_t>(config.streamId.size()));
+        outBuffer += config.streamId;
+        ship::endFrame(outBuffer, lengthOffset);
+        awaitingResume = true;
+    }
+
+    void disconnect() {
+        if (sock >= 0) {
+            close(sock);
+            sock = -1;
+            sockConnected = false;
+        }
+        awaitingResume = false;
+        // Everything not acknowledged is sent again after the collector tells where to resume
+        sendSeq = ackedSeq();
+    }
+
+    // Encodes the next DATA frame if a batch is full or its oldest record waited long enough
+    void encodeBatch(bool force) {
+        if (sendSeq >= nextSeq) {
+            return;
+        }
+        size_t unsent = static_cast<size_t>(nextSeq - sendSeq);
+        bool due = force || unsent >= config.maxBatchRecords ||
+                   std::chrono::steady_clock::now() - oldestUnsent >= std::chrono::milliseconds(config.flushIntervalMs);
+        if (!due) {
+            return;
+        }
+
+        outBuffer.clear();
+        outOffset = 0;
+        size_t lengthOffset = ship::beginFrame(outBuffer, ship::DATA);
+        ship::putU64(outBuffer, sendSeq);
+        size_t countOffset = outBuffer.size();
+        ship::putU32(outBuffer, 0);
+
+        uint32_t count = 0;
+        size_t bytes = 0;
+        size_t index = static_cast<size_t>(sendSeq - ackedSeq());
+        while (index < pending.size() && count < config.maxBatchRecords && bytes < config.maxBatchBytes) {
+            const PendingRecord& r = pending[index];
+            if (config.format == ShipFormat::BINARY) {
+                ship::putU64(outBuffer, r.timestamp);
+                outBuffer += static_cast<char>(r.severity);
+                ship::putU32(outBuffer, static_cast<uint32_t>(r.message.size()));
+                outBuffer += r.message;
+            } else {
+                outBuffer += "{\"seq\":";
+                outBuffer += std::to_string(sendSeq + count);
+                outBuffer += ",\"ts\":";
+                outBuffer += std::to_string(r.timestamp);
+                outBuffer += ",\"level\":";
+                outBuffer += std::to_string(r.severity);
+                outBuffer += ",\"msg\":\"";
+                ship::appendJsonEscaped(outBuffer, r.message);
+                outBuffer += "\"}\n";
+            }
+            bytes += r.message.size();
+            ++count;
+            ++index;
+        }
+        for (int i = 0; i < 4; ++i) {
+            outBuffer[countOffset + i] = static_cast<char>(count >> (8 * i));
+        }
+        ship::endFrame(outBuffer, lengthOffset);
+        // disconnect() rewinds sendSeq to the acknowledged records, so count resends against the high-water mark
+        if (sendSeq < sentSeq) {
+            resent += std::min<uint64_t>(sentSeq - sendSeq, count);
+        }
+        sendSeq += count;
+        sentSeq = std::max(sentSeq, sendSeq);
+        oldestUnsent = std::chrono::steady_clock::now();
+    }
+
+    void pollSocket() {
+        if (sock < 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            return;
+        }
+        pollfd pfd{sock, POLLIN, 0};
+        if (outOffset < outBuffer.size()) {
+            pfd.events |= POLLOUT;
+        }
+        int ready = poll(&pfd, 1, 5);
+        if (ready <= 0) {
+            return;
+        }
+        // Read first, a collector may acknowledge and close in one go
+        if (pfd.revents & POLLIN) {
+            char buffer[4096];
+            ssize_t n = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                disconnect();
+                return;
+            }
+            if (n > 0) {
+                inBuffer.append(buffer, static_cast<size_t>(n));
+                parseFrames();
+                if (sock < 0) {
+                    return;
+                }
+            }
+        }
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            disconnect();
+            return;
+        }
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(sock, outBuffer.data() + outOffset, outBuffer.size() - outOffset,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                outOffset += static_cast<size_t>(n);
+            } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                disconnect();
+            }
+        }
+    }
+
+    void parseFrames() {
+        size_t offset = 0;
+        while (inBuffer.size() - offset >= ship::FRAME_HEADER_SIZE) {
+            uint32_t type = ship::getU32(inBuffer.data() + offset);
+            uint32_t length = ship::getU32(inBuffer.data() + offset + 4);
+            if (length != 8 || (type != ship::RESUME && type != ship::ACK)) {
+                disconnect(); // Not a collector speaking this protocol
+                return;
+            }
+            if (inBuffer.size() - offset < ship::FRAME_HEADER_SIZE + length) {
+                break;
+            }
+            uint64_t seq = ship::getU64(inBuffer.data() + offset + ship::FRAME_HEADER_SIZE);
+            offset += ship::FRAME_HEADER_SIZE + length;
+            acknowledge(seq);
+            if (type == ship::RESUME) {
+                if (seq < ackedSeq()) {
+                    // The collector lost records this shipper already saw acknowledged
+                    lost += ackedSeq() - seq;
+                }
+                sendSeq = ackedSeq();
+                awaitingResume = false;
+            }
+        }
+        inBuffer.erase(0, offset);
+    }
+
+    // Releases every record below seq
+    void acknowledge(uint64_t seq) {
+        seq = std::min(seq, nextSeq);
+        while (ackedSeq() < seq) {
+            pendingBytes -= pending.front().message.size() + sizeof(uint64_t);
+            pending.pop_front();
+            ++acked;
+        }
+        if (sendSeq < ackedSeq()) {
+            sendSeq = ackedSeq();
+        }
+    }
+};
+
+}  // namespace ctrlfrmb
+}  // namespace opensource
+
+#endif // !OPEN_SOURCE_LOG_SHIPPER_HPP
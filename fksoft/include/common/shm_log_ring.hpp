@@ -0,0 +1,464 @@
+/**
+ * @file    shm_log_ring.hpp
+ * @ingroup opensource
+ * @brief   Shared-memory log ring for multi-process deployments.
+ *          Any number of processes open the same named ring (POSIX shm_open) and append log records lock-free:
+ *          a record costs one CAS on the shared write cursor, a memcpy and a release store of the record header.
+ *          A single writer process creates the ring and drains it into one FileLogger, which owns file rotation,
+ *          so disk I/O of all processes on a host is consolidated into one writer thread.
+ *          When the ring is full, records are dropped and counted instead of blocking the producer.
+ *          A writer that starts while producers are still attached to a ring of the same name takes that ring
+ *          over instead of replacing it, so nothing they write is lost to an orphaned segment.
+ *          Constructed without a name, the ring lives in private anonymous memory and serves as an
+ *          in-process lock-free queue (see ConsoleSink).
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) ctrlfrmb 2023-2033
+ */
+
+#pragma once
+
+#ifndef OPEN_SOURCE_SHM_LOG_RING_HPP
+#define OPEN_SOURCE_SHM_LOG_RING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_logger.hpp"
+
+namespace opensource {
+namespace ctrlfrmb {
+
+// Control block placed at the start of the shared memory object
+struct ShmLogRingHeader {
+    uint32_t magic;                       // SHM_LOG_RING_MAGIC once the creator finished initialization
+    uint32_t version;                     // Layout version
+    uint64_t capacity;                    // Size of the data area in bytes, power of two
+    std::atomic<int32_t> writerPid;       // Process draining the ring, 0 when none
+    std::atomic<uint32_t> producers;      // Attached producer processes (a crashed one is never subtracted)
+    alignas(64) std::atomic<uint64_t> writePos;  // Reservation cursor shared by all producers
+    alignas(64) std::atomic<uint64_t> readPos;   // Consumer cursor, everything below it may be reused
+    alignas(64) std::atomic<uint64_t> written;   // Records committed by producers
+    std::atomic<uint64_t> dropped;               // Records dropped because the ring was full
+    std::atomic<uint64_t> recovered;             // Times the consumer skipped a record abandoned by a dead producer
+};
+
+class ShmLogRing {
+public:
+    static constexpr uint32_t SHM_LOG_RING_MAGIC = 0x4C4F4752; // "LOGR"
+    static constexpr uint32_t SHM_LOG_RING_VERSION = 2;
+
+    // Creates (owner == true) or attaches to (owner == false) the ring called name, e.g. "/ipcap_log".
+    // An owner takes over an existing ring of the same capacity whose writer is gone, and unlinks the shared
+    // memory object on destruction unless producers are still attached. An empty name creates a
+    // process-private ring. Throws std::runtime_error on failure, e.g. while another writer drains the ring.
+    ShmLogRing(const std::string& name, size_t capacity, bool owner)
+            : name(name), owner(owner || name.empty()), header(nullptr), data(nullptr), mapSize(0), mask(0) {
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory ring needs lock-free 64-bit atomics");
+
+        int fd = -1;
+        if (this->owner) {
+            size_t cap = 4096;
+            while (cap < capacity) {
+                cap <<= 1;
+            }
+            mapSize = sizeof(ShmLogRingHeader) + cap;
+            bool adopted = false;
+            if (name.empty()) {
+                map(-1);
+            } else {
+                fd = shm_open(name.c_str(), O_RDWR, 0);
+                adopted = fd >= 0 && adopt(fd);
+                if (!adopted) {
+                    if (fd >= 0) {
+                        close(fd);
+                        shm_unlink(name.c_str()); // A stale ring nobody can still be writing to
+                    }
+                    fd = createSharedMemory();
+                    map(fd);
+                }
+            }
+            if (!adopted) {
+                header->capacity = cap;
+                header->version = SHM_LOG_RING_VERSION;
+                header->producers.store(0, std::memory_order_relaxed);
+                header->writePos.store(0, std::memory_order_relaxed);
+                header->readPos.store(0, std::memory_order_relaxed);
+                header->written.store(0, std::memory_order_relaxed);
+                header->dropped.store(0, std::memory_order_relaxed);
+                header->recovered.store(0, std::memory_order_relaxed);
+            }
+            header->writerPid.store(name.empty() ? 0 : static_cast<int32_t>(getpid()), std::memory_order_relaxed);
+            // Publish the magic last so producers never attach to a half initialized ring
+            reinterpret_cast<std::atomic<uint32_t>*>(&header->magic)->store(SHM_LOG_RING_MAGIC, std::memory_order_release);
+        } else {
+            fd = shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0) {
+                throw std::runtime_error("shm_open failed for " + name + ": " + std::strerror(errno));
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) <= sizeof(ShmLogRingHeader)) {
+                close(fd);
+                throw std::runtime_error("shared log ring " + name + " is not initialized");
+            }
+            mapSize = static_cast<size_t>(st.st_size);
+            map(fd);
+            uint32_t magic = reinterpret_cast<std::atomic<uint32_t>*>(&header->magic)->load(std::memory_order_acquire);
+            if (magic != SHM_LOG_RING_MAGIC || header->version != SHM_LOG_RING_VERSION ||
+                sizeof(ShmLogRingHeader) + header->capacity != mapSize) {
+                munmap(header, mapSize);
+                throw std::runtime_error("shared log ring " + name + " has an incompatible layout");
+            }
+            header->producers.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        mask = header->capacity - 1;
+        while ((uint64_t(1) << lapShift) < header->capacity) {
+            ++lapShift;
+        }
+    }
+
+    ~ShmLogRing() {
+        bool removeSegment = owner && !name.empty();
+        if (header) {
+            if (!owner) {
+                header->producers.fetch_sub(1, std::memory_order_relaxed);
+            } else if (removeSegment) {
+                header->writerPid.store(0, std::memory_order_relaxed);
+                // Producers still attached keep the ring for the next writer, which takes it over
+                removeSegment = header->producers.load(std::memory_order_relaxed) == 0;
+            }
+            munmap(header, mapSize);
+        }
+        if (removeSegment) {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    ShmLogRing(const ShmLogRing&) = delete;
+    ShmLogRing& operator=(const ShmLogRing&) = delete;
+
+    // Appends one record carrying an optional user tag, returns false (and counts a drop) if the ring is full.
+    // Messages longer than a quarter of the ring are truncated.
+    bool write(std::string_view message, uint8_t tag = 0) {
+        return write(std::string_view(), message, tag);
+    }
+
+    // Appends one record made of head followed by body, e.g. a fixed binary header and the message text
+    bool write(std::string_view head, std::string_view message, uint8_t tag) {
+        size_t length = std::min<size_t>(head.size() + message.size(), header->capacity / 4);
+        uint64_t recordSize = alignRecord(length);
+        uint64_t pos = header->writePos.load(std::memory_order_relaxed);
+        uint64_t padding;
+
+        while (true) {
+            uint64_t contiguous = header->capacity - (pos & mask);
+            padding = recordSize > contiguous ? contiguous : 0; // Records never wrap, pad to the end instead
+            uint64_t readPos = header->readPos.load(std::memory_order_acquire);
+            if (pos + padding + recordSize - readPos > header->capacity) {
+                header->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (header->writePos.compare_exchange_weak(pos, pos + padding + recordSize,
+                                                       std::memory_order_relaxed, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+
+        if (padding) {
+            slot(pos).store(recordWord(pos, padding, PAD_FLAG | COMMIT_FLAG), std::memory_order_release);
+            pos += padding;
+        }
+        // The length goes in first, so a consumer giving up on this record knows how much to skip
+        uint64_t reserved = recordWord(pos, length, (static_cast<uint64_t>(tag) << TAG_SHIFT) | RESERVED_FLAG);
+        slot(pos).store(reserved, std::memory_order_relaxed);
+        char* record = data + (pos & mask) + RECORD_HEADER_SIZE;
+        size_t headLength = std::min(head.size(), length);
+        if (headLength > 0) {
+            std::memcpy(record, head.data(), headLength);
+        }
+        if (length > headLength) {
+            std::memcpy(record + headLength, message.data(), length - headLength);
+        }
+        // Fails only when the consumer took this record for abandoned after STALL_TIMEOUT and skipped it
+        if (!slot(pos).compare_exchange_strong(reserved, reserved | COMMIT_FLAG, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+            header->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        header->written.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Delivers up to maxRecords committed records to handler(std::string_view message, uint8_t tag) in ring
+    // order and releases their space. Must only be called by the single owning consumer.
+    // Returns the number of records delivered.
+    template<typename Handler>
+    size_t consume(Handler&& handler, size_t maxRecords = SIZE_MAX) {
+        uint64_t pos = header->readPos.load(std::memory_order_relaxed);
+        uint64_t end = header->writePos.load(std::memory_order_acquire);
+        size_t delivered = 0;
+
+        while (pos < end && delivered < maxRecords) {
+            uint64_t word = slot(pos).load(std::memory_order_acquire);
+            if (!(word & COMMIT_FLAG)) {
+                // Reserved but not committed yet; a producer that died here would stall the ring forever
+                uint64_t skip = stalled(pos) ? abandoned(pos, end, word) : 0;
+                if (skip == 0) {
+                    break;
+                }
+                clear(pos, skip);
+                header->recovered.fetch_add(1, std::memory_order_relaxed);
+                pos += skip;
+                stallPos = UINT64_MAX;
+                continue;
+            }
+            stallPos = UINT64_MAX;
+
+            uint64_t length = word >> 32;
+            uint64_t recordSize;
+            if (word & PAD_FLAG) {
+                recordSize = length;
+            } else {
+                recordSize = alignRecord(length);
+                handler(std::string_view(data + (pos & mask) + RECORD_HEADER_SIZE, static_cast<size_t>(length)),
+                        static_cast<uint8_t>(word >> TAG_SHIFT));
+                ++delivered;
+            }
+            // Clear the consumed bytes so a future record header at any offset starts out uncommitted
+            clear(pos, recordSize);
+            pos += recordSize;
+        }
+
+        header->readPos.store(pos, std::memory_order_release);
+        return delivered;
+    }
+
+    uint64_t written() const { return header->written.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return header->dropped.load(std::memory_order_relaxed); }
+    uint64_t recovered() const { return header->recovered.load(std::memory_order_relaxed); }
+    size_t capacity() const { return static_cast<size_t>(header->capacity); }
+
+private:
+    static constexpr uint64_t RECORD_HEADER_SIZE = 8;
+    static constexpr uint64_t PAD_FLAG = 1;
+    static constexpr uint64_t COMMIT_FLAG = 2;
+    static constexpr uint64_t RESERVED_FLAG = 4;    // Keeps a reserved header nonzero
+    static constexpr unsigned TAG_SHIFT = 8;
+    static constexpr unsigned LAP_SHIFT = 16;       // Low 16 bits of the lap, so a late commit never hits a reuse
+    static constexpr auto STALL_TIMEOUT = std::chrono::seconds(2);
+
+    std::string name;
+    bool owner;
+    ShmLogRingHeader* header;
+    char* data;
+    size_t mapSize;
+    uint64_t mask;
+    unsigned lapShift{0};            // log2(capacity)
+    uint64_t stallPos{UINT64_MAX};   // Consumer position that was found uncommitted
+    std::chrono::steady_clock::time_point stallSince;
+
+    // Maps the existing ring behind fd if it can be taken over: compatible, of the requested size and without a
+    // live writer. Returns false for a ring that may be replaced, throws if producers still use it
+    bool adopt(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) <= sizeof(ShmLogRingHeader)) {
+            return false;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        auto* existing = static_cast<ShmLogRingHeader*>(addr);
+        uint32_t magic = reinterpret_cast<std::atomic<uint32_t>*>(&existing->magic)->load(std::memory_order_acquire);
+        if (magic != SHM_LOG_RING_MAGIC || existing->version != SHM_LOG_RING_VERSION ||
+            sizeof(ShmLogRingHeader) + existing->capacity != size) {
+            munmap(addr, size);
+            return false;
+        }
+        int32_t pid = existing->writerPid.load(std::memory_order_relaxed);
+        uint32_t producers = existing->producers.load(std::memory_order_relaxed);
+        std::string error;
+        if (pid != 0 && pid != getpid() && (kill(pid, 0) == 0 || errno == EPERM)) {
+            error = "shared log ring " + name + " is already drained by process " + std::to_string(pid);
+        } else if (size != mapSize && producers > 0) {
+            error = "shared log ring " + name + " has " + std::to_string(producers) +
+                    " producers attached with a different capacity";
+        }
+        if (!error.empty()) {
+            munmap(addr, size);
+            close(fd);
+            throw std::runtime_error(error);
+        }
+        if (size != mapSize) {
+            munmap(addr, size);
+            return false;
+        }
+        header = existing;
+        data = static_cast<char*>(addr) + sizeof(ShmLogRingHeader);
+        return true;
+    }
+
+    int createSharedMemory() {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+        if (fd < 0) {
+            throw std::runtime_error("shm_open failed for " + name + ": " + std::strerror(errno));
+        }
+        if (ftruncate(fd, static_cast<off_t>(mapSize)) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::runtime_error("ftruncate failed for " + name + ": " + std::strerror(errno));
+        }
+        return fd;
+    }
+
+    // Maps the ring, fd < 0 maps private anonymous memory
+    void map(int fd) {
+        void* addr = fd < 0 ? mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                            : mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (owner && !name.empty()) {
+                shm_unlink(name.c_str());
+            }
+            throw std::runtime_error("mmap failed for log ring " + name + ": " + std::strerror(errno));
+        }
+        header = static_cast<ShmLogRingHeader*>(addr);
+        data = static_cast<char*>(addr) + sizeof(ShmLogRingHeader);
+    }
+
+    static uint64_t alignRecord(uint64_t length) {
+        return (RECORD_HEADER_SIZE + length + 7) & ~uint64_t(7);
+    }
+
+    std::atomic<uint64_t>& slot(uint64_t pos) {
+        return *reinterpret_cast<std::atomic<uint64_t>*>(data + (pos & mask));
+    }
+
+    // Zeroes size bytes starting at ring position pos, wrapping at the end of the data area
+    void clear(uint64_t pos, uint64_t size) {
+        uint64_t offset = pos & mask;
+        uint64_t first = std::min(size, header->capacity - offset);
+        std::memset(data + offset, 0, static_cast<size_t>(first));
+        std::memset(data, 0, static_cast<size_t>(size - first));
+    }
+
+    // The record header holds the length in the upper half, then the lap of pos, the tag and the flags.
+    // It is never zero once reserved
+    uint64_t recordWord(uint64_t pos, uint64_t length, uint64_t flags) const {
+        return (length << 32) | (((pos >> lapShift) & 0xFFFF) << LAP_SHIFT) | flags;
+    }
+
+    bool stalled(uint64_t pos) {
+        auto now = std::chrono::steady_clock::now();
+        if (stallPos != pos) {
+            stallPos = pos;
+            stallSince = now;
+            return false;
+        }
+        return now - stallSince > STALL_TIMEOUT;
+    }
+
+    // Bytes to skip past the record at pos, which stayed uncommitted for STALL_TIMEOUT, or 0 to keep waiting.
+    // Only ever skips bytes of that record: committed records behind it are still delivered
+    uint64_t abandoned(uint64_t pos, uint64_t end, uint64_t word) {
+        if (word != 0) {
+            // Take the record away from its producer, whose commit then fails. If it committed meanwhile after
+            // all, the exchange fails and the record is delivered as usual
+            if (!slot(pos).compare_exchange_strong(word, 0, std::memory_order_acq_rel)) {
+                return 0;
+            }
+            return alignRecord(word >> 32);
+        }
+        // The producer died before it wrote the header, so it wrote nothing at all. Consumed space is zeroed,
+        // the record ends where the next header starts
+        for (uint64_t next = pos + RECORD_HEADER_SIZE; next < end; next += RECORD_HEADER_SIZE) {
+            uint64_t following = slot(next).load(std::memory_order_acquire);
+            if (following != 0) {
+                bool isHeader = ((following >> LAP_SHIFT) & 0xFFFF) == ((next >> lapShift) & 0xFFFF) &&
+                              (following & (COMMIT_FLAG | RESERVED_FLAG)) != 0;
+                return isHeader ? next - pos : 0;
+            }
+        }
+        return 0;
+    }
+};
+
+// Owns the ring and drains it into a FileLogger on a dedicated thread.
+// Exactly one ShmLogWriter per ring name must run on the host.
+class ShmLogWriter {
+public:
+    // With startWriting false the ring exists but is not drained until start(), e.g. to fork producer
+    // processes before this process has any thread
+    ShmLogWriter(const std::string& name, size_t capacity, FileLoggerConfig config, bool startWriting = true)
+            : ring(name, capacity, true), stopWriting(false) {
+        config.useAsync = false; // This class already is the background writer
+        fileLogger = std::make_unique<FileLogger>(config);
+        if (startWriting) {
+            start();
+        }
+    }
+
+    // Starts draining the ring, does nothing if already started
+    void start() {
+        if (!workerThread.joinable()) {
+            workerThread = std::thread(&ShmLogWriter::processRing, this);
+        }
+    }
+
+    ~ShmLogWriter() {
+        stopWriting = true;
+        if (workerThread.joinable()) {
+            workerThread.join();
+        }
+    }
+
+    const ShmLogRing& getRing() const { return ring; }
+
+private:
+    ShmLogRing ring;
+    std::unique_ptr<FileLogger> fileLogger;
+    std::atomic<bool> stopWriting;
+    std::thread workerThread;
+
+    void processRing() {
+        auto writeRecord = [this](std::string_view message, uint8_t) { fileLogger->write(message); };
+        while (true) {
+            bool stopping = stopWriting.load();
+            if (ring.consume(writeRecord, 4096) == 0) {
+                if (stopping) {
+                    break;
+                }
+                // Producers live in other processes, so poll instead of waiting on a condition variable
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+        fileLogger->flush();
+    }
+};
+
+}  // namespace ctrlfrmb
+}  // namespace opensource
+
+#endif // !OPEN_SOURCE_SHM_LOG_RING_HPP
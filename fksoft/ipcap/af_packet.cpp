@@ -0,0 +1,326 @@
+﻿// af_packet.cpp: Linux AF_PACKET TPACKET_V3 抓包
+//
+#include "af_packet.h"
+
+#if defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace figkey {
+
+AfPacketCapture::~AfPacketCapture() {
+    close();
+}
+
+#if defined(__linux__)
+
+bool AfPacketCapture::open(const std::string& network_name, const AfPacketOptions& options) {
+    close();
+    stopping.store(false);
+    totals = af_packet_stats{};
+
+    ifindex = static_cast<int>(if_nametoindex(network_name.c_str()));
+    if (ifindex == 0) {
+        return fail("unknown interface " + network_name);
+    }
+    // Protocol 0 receives nothing until bind() names the protocol and interface, so no frames of other
+    // interfaces are queued before the ring exists
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0) {
+        return fail("socket(AF_PACKET)");
+    }
+
+    // Map the hardware type to the DLT the rest of ipcap understands
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    std::strncpy(ifr.ifr_name, network_name.c_str(), IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        return fail("SIOCGIFHWADDR");
+    }
+    switch (ifr.ifr_hwaddr.sa_family) {
+    case ARPHRD_ETHER:
+        dlt = DLT_EN10MB;
+        break;
+    case ARPHRD_LOOPBACK:
+        dlt = DLT_EN10MB;  // Linux loopback frames carry an all-zero Ethernet header
+        loopback = true;
+        break;
+    case ARPHRD_NONE:
+    case ARPHRD_PPP:
+        dlt = DLT_RAW;
+        break;
+    default:
+        errno = 0;
+        return fail("unsupported hardware type " + std::to_string(ifr.ifr_hwaddr.sa_family) + " on " + network_name);
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        return fail("PACKET_VERSION TPACKET_V3");
+    }
+
+    // Blocks must be a multiple of the page size, frames only matter for the kernel's sanity checks
+    long pageSize = sysconf(_SC_PAGESIZE);
+    blockSize = static_cast<uint32_t>((options.blockSize + pageSize - 1) / pageSize * pageSize);
+    blockCount = options.blockCount > 0 ? options.blockCount : 1;
+    timeoutMs = options.timeoutMs;
+    const uint32_t frameSize = TPACKET_ALIGNMENT << 7;
+
+    struct tpacket_req3 req;
+    std::memset(&req, 0, sizeof(req));
+    req.tp_block_size = blockSize;
+    req.tp_block_nr = blockCount;
+    req.tp_frame_size = frameSize;
+    req.tp_frame_nr = blockSize / frameSize * blockCount;
+    req.tp_retire_blk_tov = timeoutMs;
+    req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        return fail("PACKET_RX_RING");
+    }
+
+    ringSize = static_cast<size_t>(blockSize) * blockCount;
+    void* mapped = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        ringSize = 0;
+        return fail("mmap of the receive ring");
+    }
+    ring = static_cast<unsigned char*>(mapped);
+    currentBlock = 0;
+
+    struct sockaddr_ll addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        return fail("bind to " + network_name);
+    }
+
+    if (options.promisc) {
+        struct packet_mreq mreq;
+        std::memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            return fail("PACKET_ADD_MEMBERSHIP promisc");
+        }
+    }
+
+    // Joining the group has to come last, the kernel only accepts bound sockets of matching configuration
+    if (options.fanoutGroup != 0) {
+        int fanout = static_cast<int>(options.fanoutMode);
+        if (options.fanoutMode == FanoutMode::HASH) {
+            fanout |= PACKET_FANOUT_FLAG_DEFRAG;
+        }
+        int arg = options.fanoutGroup | (fanout << 16);
+        if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+            return fail("PACKET_FANOUT group " + std::to_string(options.fanoutGroup));
+        }
+    }
+    return true;
+}
+
+void AfPacketCapture::close() {
+    if (ring) {
+        munmap(ring, ringSize);
+        ring = nullptr;
+        ringSize = 0;
+    }
+    if (fd >= 0) {
+        ::close(fd);  // Also drops the promiscuous membership
+        fd = -1;
+    }
+    loopback = false;
+}
+
+int AfPacketCapture::processBlock(unsigned char* block, pcap_handler handler, unsigned char* user,
+                                  BlockDoneHandler block_done) {
+    auto* desc = reinterpret_cast<struct tpacket_block_desc*>(block);
+    uint32_t count = desc->hdr.bh1.num_pkts;
+    auto* hdr = reinterpret_cast<struct tpacket3_hdr*>(block + desc->hdr.bh1.offset_to_first_pkt);
+    int delivered = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        bool skip = false;
+        if (loopback) {
+            auto* sll = reinterpret_cast<const struct sockaddr_ll*>(
+                    reinterpret_cast<unsigned char*>(hdr) + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            skip = sll->sll_pkttype == PACKET_OUTGOING;
+        }
+        if (!skip) {
+            struct pcap_pkthdr pkthdr;
+            pkthdr.ts.tv_sec = static_cast<decltype(pkthdr.ts.tv_sec)>(hdr->tp_sec);
+            pkthdr.ts.tv_usec = static_cast<decltype(pkthdr.ts.tv_usec)>(hdr->tp_nsec / 1000);
+            pkthdr.caplen = hdr->tp_snaplen;
+            pkthdr.len = hdr->tp_len;
+            handler(user, &pkthdr, reinterpret_cast<unsigned char*>(hdr) + hdr->tp_mac);
+            ++delivered;
+        }
+        hdr = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<unsigned char*>(hdr) + hdr->tp_next_offset);
+    }
+
+    if (block_done) {
+        block_done(user);
+    }
+    // The handler has finished with the packet data, give the block back
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    return delivered;
+}
+
+int AfPacketCapture::dispatch(pcap_handler handler, unsigned char* user, BlockDoneHandler block_done) {
+    if (!ring) {
+        error = "capture is not open";
+        return -1;
+    }
+    int delivered = 0;
+    for (uint32_t walked = 0; walked < blockCount; ++walked) {
+        unsigned char* block = ring + static_cast<size_t>(currentBlock) * blockSize;
+        auto* desc = reinterpret_cast<struct tpacket_block_desc*>(block);
+        if ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            if (delivered > 0 || walked > 0) {
+                break;
+            }
+            // Nothing ready yet, the kernel retires a partial block after timeoutMs
+            struct pollfd pfd{fd, POLLIN | POLLERR, 0};
+            int ready = poll(&pfd, 1, static_cast<int>(timeoutMs));
+            if (ready < 0 && errno != EINTR) {
+                fail("poll");
+                return -1;
+            }
+            if (ready > 0 && (pfd.revents & (POLLERR | POLLNVAL))) {
+                errno = 0;
+                fail("socket error on the capture interface");
+                return -1;
+            }
+            if ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                break;
+            }
+        }
+        delivered += processBlock(block, handler, user, block_done);
+        currentBlock = (currentBlock + 1) % blockCount;
+        if (stopping.load(std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    return delivered;
+}
+
+af_packet_stats AfPacketCapture::getStats() {
+    std::lock_guard<std::mutex> lock(statsLock);
+    if (fd >= 0) {
+        // The kernel resets its counters on every read, so they are accumulated here
+        struct tpacket_stats_v3 st;
+        socklen_t len = sizeof(st);
+        if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+            totals.packets += st.tp_packets;
+            totals.drops += st.tp_drops;
+            totals.freezes += st.tp_freeze_q_cnt;
+        }
+    }
+    return totals;
+}
+
+bool AfPacketCapture::setFilter(const struct bpf_program& program) {
+    if (fd < 0) {
+        error = "capture is not open";
+        return false;
+    }
+    return attachFilter(fd, program, error);
+}
+
+bool AfPacketCapture::attachFilter(int socket_fd, const struct bpf_program& program, std::string& error_text) {
+    // struct bpf_insn and struct sock_filter share one layout
+    struct sock_fprog fprog;
+    fprog.len = static_cast<unsigned short>(program.bf_len);
+    fprog.filter = reinterpret_cast<struct sock_filter*>(program.bf_insns);
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) != 0) {
+        error_text = std::string("SO_ATTACH_FILTER: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool AfPacketCapture::fail(const std::string& what) {
+    error = errno != 0 ? what + ": " + std::strerror(errno) : what;
+    close();
+    return false;
+}
+
+#else
+
+bool AfPacketCapture::open(const std::string& network_name, const AfPacketOptions& options) {
+    (void)network_name;
+    (void)options;
+    error = "AF_PACKET capture is only available on Linux";
+    return false;
+}
+
+void AfPacketCapture::close() {
+}
+
+int AfPacketCapture::processBlock(unsigned char* block, pcap_handler handler, unsigned char* user,
+                                  BlockDoneHandler block_done) {
+    (void)block;
+    (void)handler;
+    (void)user;
+    (void)block_done;
+    return 0;
+}
+
+int AfPacketCapture::dispatch(pcap_handler handler, unsigned char* user, BlockDoneHandler block_done) {
+    (void)handler;
+    (void)user;
+    (void)block_done;
+    error = "capture is not open";
+    return -1;
+}
+
+af_packet_stats AfPacketCapture::getStats() {
+    return totals;
+}
+
+bool AfPacketCapture::setFilter(const struct bpf_program& program) {
+    (void)program;
+    error = "capture is not open";
+    return false;
+}
+
+bool AfPacketCapture::attachFilter(int socket_fd, const struct bpf_program& program, std::string& error_text) {
+    (void)socket_fd;
+    (void)program;
+    error_text = "socket filters are only available on Linux";
+    return false;
+}
+
+bool AfPacketCapture::fail(const std::string& what) {
+    error = what;
+    return false;
+}
+
+#endif
+
+int64_t AfPacketCapture::loop(pcap_handler handler, unsigned char* user, BlockDoneHandler block_done) {
+    int64_t total = 0;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        int n = dispatch(handler, user, block_done);
+        if (n < 0) {
+            return -1;
+        }
+        total += n;
+    }
+    return total;
+}
+
+}  // namespace figkey
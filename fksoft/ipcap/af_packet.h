@@ -0,0 +1,123 @@
+﻿/**
+ * @file    af_packet.h
+ * @ingroup figkey
+ * @brief   Linux AF_PACKET capture backend built on a TPACKET_V3 memory-mapped block ring.
+ *          The kernel fills whole blocks of packets and hands each block to user space at once, the packets
+ *          are passed to the handler straight out of the shared ring without being copied. On other platforms
+ *          open() fails and the libpcap backend has to be used.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_AF_PACKET_HPP
+#define FIGKEY_AF_PACKET_HPP
+
+#include <pcap.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace figkey {
+
+// How the kernel spreads packets over the sockets of a fanout group, values match PACKET_FANOUT_*
+enum class FanoutMode : uint16_t {
+    HASH = 0,   // By flow hash, both directions of a flow go to the same socket; fragments are defragmented first
+    LB = 1,     // Round robin, no flow affinity
+    CPU = 2,    // By the CPU that received the packet, pairs with RSS and pinned threads
+    QM = 5      // By the NIC receive queue the packet arrived on
+};
+
+// Geometry of the receive ring and socket options of the AF_PACKET backend
+struct AfPacketOptions {
+    uint32_t blockSize;     // Bytes per block, rounded up to a multiple of the page size
+    uint32_t blockCount;    // Number of blocks in the ring, blockSize * blockCount bytes are locked in memory
+    uint32_t timeoutMs;     // A partially filled block is handed over after this long
+    bool promisc;           // Put the interface into promiscuous mode while the socket is open
+    uint16_t fanoutGroup;   // Join this PACKET_FANOUT group when non-zero
+    FanoutMode fanoutMode;
+
+    AfPacketOptions(uint32_t size = 1024 * 1024, uint32_t count = 64, uint32_t timeout = 100, bool promiscuous = true)
+            : blockSize(size), blockCount(count), timeoutMs(timeout), promisc(promiscuous), fanoutGroup(0),
+              fanoutMode(FanoutMode::HASH) {}
+};
+
+// Kernel counters of an AF_PACKET socket, accumulated since open()
+struct af_packet_stats {
+    uint64_t packets;   // Packets that passed the socket filter, including dropped ones
+    uint64_t drops;     // Packets dropped because no block was free
+    uint64_t freezes;   // Times the queue was frozen because the ring was full
+};
+
+class AfPacketCapture {
+public:
+    // Called after the last packet of a block was delivered, before the block is given back to the kernel
+    using BlockDoneHandler = void (*)(unsigned char* user);
+
+    AfPacketCapture() = default;
+    ~AfPacketCapture();
+
+    AfPacketCapture(const AfPacketCapture&) = delete;
+    AfPacketCapture& operator=(const AfPacketCapture&) = delete;
+
+    // Opens a packet socket bound to network_name and maps its receive ring
+    bool open(const std::string& network_name, const AfPacketOptions& options = AfPacketOptions());
+
+    void close();
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Waits up to timeoutMs for a filled block and hands every packet of all ready blocks to handler. Packet data
+    // stays valid until block_done returns, or until handler returns without one.
+    // Returns the number of packets delivered, -1 on error
+    int dispatch(pcap_handler handler, unsigned char* user, BlockDoneHandler block_done = nullptr);
+
+    // Calls dispatch until breakLoop() is called, returns the number of packets delivered or -1 on error
+    int64_t loop(pcap_handler handler, unsigned char* user, BlockDoneHandler block_done = nullptr);
+
+    // Makes loop() return within one block timeout, safe to call from any thread
+    void breakLoop() { stopping.store(true); }
+
+    // DLT_* of the packets delivered by this socket
+    int linkType() const { return dlt; }
+
+    // Safe to call from any thread while capturing
+    af_packet_stats getStats();
+
+    // Installs a classic BPF program (from pcap_compile) as the socket filter. The kernel swaps programs
+    // atomically, so this is safe while another thread captures; packets already in the ring are kept
+    bool setFilter(const struct bpf_program& program);
+
+    // SO_ATTACH_FILTER on any Linux packet socket, e.g. the one behind a libpcap handle
+    static bool attachFilter(int socket_fd, const struct bpf_program& program, std::string& error_text);
+
+    const std::string& lastError() const { return error; }
+
+private:
+    int fd{-1};
+    int ifindex{0};
+    bool loopback{false};       // Outgoing packets show up twice on loopback, only the incoming copy is kept
+    int dlt{DLT_EN10MB};
+    unsigned char* ring{nullptr};
+    size_t ringSize{0};
+    uint32_t blockSize{0};
+    uint32_t blockCount{0};
+    uint32_t currentBlock{0};   // Next block to look at, blocks are handed over in ring order
+    uint32_t timeoutMs{0};
+    std::atomic<bool> stopping{false};
+    std::mutex statsLock;       // getStats folds the kernel counters into totals
+    af_packet_stats totals{};
+    std::string error;
+
+    // Delivers the packets of one block and returns it to the kernel
+    int processBlock(unsigned char* block, pcap_handler handler, unsigned char* user, BlockDoneHandler block_done);
+
+    bool fail(const std::string& what);
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_AF_PACKET_HPP
@@ -0,0 +1,392 @@
+// app_dissector.cpp: 应用层协议解析 (DNS, HTTP/1, TLS ClientHello)
+//
+
+#include "app_dissector.h"
+#include <algorithm>
+#include <cstring>
+
+namespace figkey {
+
+namespace {
+
+const uint8_t PROTO_TCP = 6;
+const uint8_t PROTO_UDP = 17;
+
+const size_t DNS_HEADER = 12;
+const size_t DNS_MAX_NAME = 255;
+const size_t TLS_RECORD_HEADER = 5;
+const size_t TLS_HANDSHAKE_HEADER = 4;
+const uint16_t TLS_EXT_SERVER_NAME = 0;
+const uint16_t TLS_EXT_SUPPORTED_VERSIONS = 43;
+
+const char* const HTTP_METHODS[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS", "PATCH", "CONNECT", "TRACE"};
+
+inline uint16_t Read16(const unsigned char* p) {
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+inline uint32_t Read24(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) << 16 | static_cast<uint32_t>(p[1]) << 8 | p[2];
+}
+
+// Copies length bytes into a NUL-terminated field of size bytes, cut to fit. Returns false if it was cut
+bool CopyField(char* field, size_t size, const unsigned char* data, size_t length) {
+    size_t copied = std::min(length, size - 1);
+    std::memcpy(field, data, copied);
+    field[copied] = '\0';
+    return copied == length;
+}
+
+bool EqualsIgnoreCase(const unsigned char* data, const char* text, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = data[i];
+        if (c >= 'A' && c <= 'Z') {
+            c = static_cast<unsigned char>(c - 'A' + 'a');
+        }
+        if (c != static_cast<unsigned char>(text[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// End of the line starting at data (the '\n', or length if none), with end trimmed before a '\r'
+size_t FindLine(const unsigned char* data, size_t length, size_t& end) {
+    const void* found = std::memchr(data, '\n', length);
+    size_t eol = found ? static_cast<size_t>(static_cast<const unsigned char*>(found) - data) : length;
+    end = eol > 0 && data[eol - 1] == '\r' ? eol - 1 : eol;
+    return eol;
+}
+
+// One DNS message. A message is taken for DNS if its header is a plausible query or response with a single
+// question whose name, type and class parse
+bool ParseDns(const unsigned char* data, size_t length, flow_app& app) {
+    if (length < DNS_HEADER) {
+        return false;
+    }
+    uint16_t flags = Read16(data + 2);
+    unsigned opcode = (flags >> 11) & 0x0F;
+    if (opcode > 5 || opcode == 3 || (flags & 0x0040) != 0 || Read16(data + 4) != 1) {
+        return false;
+    }
+
+    // The question name, labels joined with dots into a local buffer until the whole question checks out
+    char name[sizeof(app.name)];
+    size_t written = 0;
+    size_t total = 0;
+    bool cut = false;
+    auto append = [&name, &written, &cut](unsigned char c) {
+        if (written + 1 < sizeof(name)) {
+            name[written++] = static_cast<char>(c);
+        }
+        else {
+            cut = true;
+        }
+    };
+    size_t p = DNS_HEADER;
+    while (true) {
+        if (p >= length) {
+            return false;
+        }
+        size_t label = data[p++];
+        if (label == 0) {
+            break;
+        }
+        // Compression pointers and extended label types have no place in the question
+        total += label + 1;
+        if (label > 63 || total > DNS_MAX_NAME || p + label > length) {
+            return false;
+        }
+        if (written > 0) {
+            append('.');
+        }
+        for (size_t i = 0; i < label; ++i) {
+            unsigned char c = data[p + i];
+            if (c <= 0x20 || c >= 0x7F) {
+                return false;
+            }
+            append(c);
+        }
+        p += label;
+    }
+    if (p + 4 > length) {
+        return false;
+    }
+    uint16_t type = Read16(data + p);
+    uint16_t qclass = Read16(data + p + 2) & 0x7FFF;   // mDNS uses the top bit to ask for a unicast reply
+    if (qclass != 1 && qclass != 3 && qclass != 4 && qclass != 255) {
+        return false;
+    }
+
+    name[written] = '\0';
+    if (app.name[0] == '\0') {
+        std::memcpy(app.name, name, written + 1);
+        if (cut) {
+            app.flags |= APP_FLAG_TRUNCATED;
+        }
+    }
+    if (app.type == 0) {
+        app.type = type;
+    }
+    if (flags & 0x8000) {
+        app.flags |= APP_FLAG_RESPONSE;
+        if (app.status == 0) {
+            app.status = static_cast<uint16_t>((flags & 0x0F) + 1);
+        }
+    }
+    return true;
+}
+
+class DnsDissector : public AppDissector {
+public:
+    AppProtocol protocol() const override { return AppProtocol::DNS; }
+
+    bool dissect(uint8_t transport, const unsigned char* data, size_t length, int direction,
+                 flow_app& app) const override {
+        (void)direction;
+        if (transport == PROTO_UDP) {
+            return ParseDns(data, length, app);
+        }
+        // Over TCP each message follows its 2-byte length
+        if (length < 2 + DNS_HEADER) {
+            return false;
+        }
+        size_t message = Read16(data);
+        return message >= DNS_HEADER && ParseDns(data + 2, std::min(message, length - 2), app);
+    }
+};
+
+// HTTP/1.x: a status line, or a request line with a known method followed by the headers, of which Host is kept
+class HttpDissector : public AppDissector {
+public:
+    AppProtocol protocol() const override { return AppProtocol::HTTP; }
+
+    bool dissect(uint8_t transport, const unsigned char* data, size_t length, int direction,
+                 flow_app& app) const override {
+        (void)direction;
+        if (transport != PROTO_TCP) {
+            return false;
+        }
+        if (length >= 12 && std::memcmp(data, "HTTP/1.", 7) == 0) {
+            return parseStatus(data, app);
+        }
+
+        size_t methodLength = 0;
+        for (const char* method : HTTP_METHODS) {
+            size_t size = std::strlen(method);
+            if (length > size && std::memcmp(data, method, size) == 0 && data[size] == ' ') {
+                methodLength = size;
+                break;
+            }
+        }
+        if (methodLength == 0) {
+            return false;
+        }
+        size_t end;
+        size_t eol = FindLine(data, length, end);
+        uint16_t version = 0;
+        if (eol < length) {
+            // A complete request line has to end in the version
+            if (end < methodLength + 11 || std::memcmp(data + end - 9, " HTTP/1.", 8) != 0 ||
+                (data[end - 1] != '0' && data[end - 1] != '1')) {
+                return false;
+            }
+            version = static_cast<uint16_t>(0x0100 | (data[end - 1] - '0'));
+        }
+        else {
+            app.flags |= APP_FLAG_TRUNCATED;
+        }
+        if (app.method[0] == '\0') {
+            CopyField(app.method, sizeof(app.method), data, methodLength);
+        }
+        if (version != 0) {
+            app.version = version;
+        }
+
+        // Headers up to the blank line or the end of the packet
+        for (size_t p = eol + 1; p < length;) {
+            size_t eolHeader = FindLine(data + p, length - p, end);
+            if (end == 0) {
+                break;
+            }
+            if (end >= 5 && EqualsIgnoreCase(data + p, "host:", 5) && app.name[0] == '\0') {
+                size_t from = 5;
+                while (from < end && (data[p + from] == ' ' || data[p + from] == '\t')) {
+                    ++from;
+                }
+                size_t to = end;
+                while (to > from && (data[p + to - 1] == ' ' || data[p + to - 1] == '\t')) {
+                    --to;
+                }
+                if (!CopyField(app.name, sizeof(app.name), data + p + from, to - from) || p + eolHeader >= length) {
+                    app.flags |= APP_FLAG_TRUNCATED;
+                }
+            }
+            p += eolHeader + 1;
+        }
+        return true;
+    }
+
+private:
+    static bool parseStatus(const unsigned char* data, flow_app& app) {
+        if ((data[7] != '0' && data[7] != '1') || data[8] != ' ') {
+            return false;
+        }
+        uint16_t status = 0;
+        for (int i = 9; i < 12; ++i) {
+            if (data[i] < '0' || data[i] > '9') {
+                return false;
+            }
+            status = static_cast<uint16_t>(status * 10 + (data[i] - '0'));
+        }
+        app.flags |= APP_FLAG_RESPONSE;
+        if (app.status == 0) {
+            app.status = status;
+        }
+        if (app.version == 0) {
+            app.version = static_cast<uint16_t>(0x0100 | (data[7] - '0'));
+        }
+        return true;
+    }
+};
+
+// TLS: a handshake record starting a ClientHello, whose server name and highest offered version are kept, or a
+// ServerHello. Whatever the packet cuts off is left out
+class TlsDissector : public AppDissector {
+public:
+    AppProtocol protocol() const override { return AppProtocol::TLS; }
+
+    bool dissect(uint8_t transport, const unsigned char* data, size_t length, int direction,
+                 flow_app& app) const override {
+        (void)direction;
+        if (transport != PROTO_TCP || length < TLS_RECORD_HEADER + TLS_HANDSHAKE_HEADER + 2 || data[0] != 0x16 ||
+            data[1] != 3 || data[2] > 4) {
+            return false;
+        }
+        const unsigned char* handshake = data + TLS_RECORD_HEADER;
+        size_t available = std::min<size_t>(length - TLS_RECORD_HEADER, Read16(data + 3));
+        if (available < TLS_HANDSHAKE_HEADER + 2 || handshake[TLS_HANDSHAKE_HEADER] != 3) {
+            return false;
+        }
+        if (handshake[0] == 2) {
+            app.flags |= APP_FLAG_RESPONSE;
+            return true;
+        }
+        if (handshake[0] != 1) {
+            return false;
+        }
+        const unsigned char* hello = handshake + TLS_HANDSHAKE_HEADER;
+        size_t size = std::min<size_t>(available - TLS_HANDSHAKE_HEADER, Read24(handshake + 1));
+        uint16_t version = Read16(hello);
+        if (!parseClientHello(hello, size, version, app)) {
+            app.flags |= APP_FLAG_TRUNCATED;
+        }
+        if (version > app.version) {
+            app.version = version;
+        }
+        return true;
+    }
+
+private:
+    // Walks the ClientHello to its extensions. Returns false if it ends early
+    static bool parseClientHello(const unsigned char* hello, size_t size, uint16_t& version, flow_app& app) {
+        size_t p = 2 + 32;                              // Version and random
+        if (p + 1 > size) {
+            return false;
+        }
+        p += 1 + hello[p];                              // Session id
+        if (p + 2 > size) {
+            return false;
+        }
+        p += 2 + Read16(hello + p);                     // Cipher suites
+        if (p + 1 > size) {
+            return false;
+        }
+        p += 1 + hello[p];                              // Compression methods
+        if (p + 2 > size) {
+            return p == size;                           // No extensions at all
+        }
+        size_t end = p + 2 + Read16(hello + p);
+        bool complete = end <= size;
+        end = std::min(end, size);
+        for (p += 2; p + 4 <= end;) {
+            uint16_t type = Read16(hello + p);
+            size_t extension = Read16(hello + p + 2);
+            const unsigned char* body = hello + p + 4;
+            if (p + 4 + extension > end) {
+                return false;
+            }
+            if (type == TLS_EXT_SERVER_NAME && extension >= 5 && body[2] == 0 && app.name[0] == '\0') {
+                size_t name = std::min<size_t>(Read16(body + 3), extension - 5);
+                if (!CopyField(app.name, sizeof(app.name), body + 5, name)) {
+                    app.flags |= APP_FLAG_TRUNCATED;
+                }
+            }
+            else if (type == TLS_EXT_SUPPORTED_VERSIONS && extension >= 1) {
+                size_t count = std::min<size_t>(body[0], extension - 1) / 2;
+                for (size_t i = 0; i < count; ++i) {
+                    uint16_t offered = Read16(body + 1 + i * 2);
+                    // Skip GREASE values (RFC 8701), 0x?a?a
+                    if ((offered & 0x0F0F) != 0x0A0A && offered > version) {
+                        version = offered;
+                    }
+                }
+            }
+            p += 4 + extension;
+        }
+        return complete;
+    }
+};
+
+const DnsDissector DNS_DISSECTOR;
+const HttpDissector HTTP_DISSECTOR;
+const TlsDissector TLS_DISSECTOR;
+
+}  // namespace
+
+DissectorRegistry::DissectorRegistry(size_t bytes_per_direction)
+        : limit(static_cast<uint16_t>(std::min<size_t>(bytes_per_direction, 0xFFFF))) {
+    dissectors.push_back(&DNS_DISSECTOR);
+    dissectors.push_back(&HTTP_DISSECTOR);
+    dissectors.push_back(&TLS_DISSECTOR);
+}
+
+void DissectorRegistry::add(const AppDissector* dissector) {
+    if (dissector) {
+        dissectors.push_back(dissector);
+    }
+}
+
+void DissectorRegistry::inspect(flow_record& flow, int direction, const decoded_packet& packet,
+                                const unsigned char* data) const {
+    flow_app& app = flow.app;
+    if (app.scanned[direction] >= limit || packet.payload_length == 0 || !(packet.flags & PKT_FLAG_TRANSPORT) ||
+        (packet.protocol != PROTO_TCP && packet.protocol != PROTO_UDP)) {
+        return;
+    }
+    size_t length = std::min<size_t>(packet.payload_length, limit - app.scanned[direction]);
+    app.scanned[direction] = static_cast<uint16_t>(app.scanned[direction] + length);
+    const unsigned char* payload = data + packet.payload_offset;
+    for (const AppDissector* dissector : dissectors) {
+        uint8_t protocol = static_cast<uint8_t>(dissector->protocol());
+        if (app.protocol != 0 && app.protocol != protocol) {
+            continue;
+        }
+        if (dissector->dissect(packet.protocol, payload, length, direction, app)) {
+            app.protocol = protocol;
+            return;
+        }
+    }
+}
+
+const char* DissectorRegistry::protocolName(uint8_t protocol) {
+    switch (static_cast<AppProtocol>(protocol)) {
+    case AppProtocol::UNKNOWN: return "unknown";
+    case AppProtocol::DNS: return "dns";
+    case AppProtocol::HTTP: return "http";
+    case AppProtocol::TLS: return "tls";
+    }
+    return "other";
+}
+
+}  // namespace figkey
@@ -0,0 +1,85 @@
+/**
+ * @file    app_dissector.h
+ * @ingroup figkey
+ * @brief   Application protocol dissectors that fill flow_record::app from the first payload bytes of a flow.
+ *          Built in are DNS (UDP, and TCP with its length prefix), HTTP/1.x request and status lines with the
+ *          Host header, and the TLS ClientHello with its server name and supported versions. Every dissector
+ *          parses the payload span of one packet in place. Nothing is copied or allocated, only the fields it
+ *          extracts are written to the flow record.
+ *
+ *          DissectorRegistry runs the dissectors on the first N payload bytes of each flow direction and stops
+ *          after that, so a long transfer costs one comparison per packet. Until a protocol is recognized every
+ *          dissector is tried; after that only the one of the flow's protocol. TCP payloads are taken in arrival
+ *          order without reassembly, and a field that runs past the end of its segment is cut short.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_APP_DISSECTOR_HPP
+#define FIGKEY_APP_DISSECTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "flow_table.h"
+#include "packet_decoder.h"
+
+namespace figkey {
+
+enum class AppProtocol : uint8_t {
+    UNKNOWN,
+    DNS,
+    HTTP,
+    TLS
+};
+
+const uint8_t APP_FLAG_RESPONSE = 1u << 0;      // A response (DNS, HTTP) was seen
+const uint8_t APP_FLAG_TRUNCATED = 1u << 1;     // A field ran past the end of its packet or of flow_app::name
+
+// Parser of one application protocol, stateless apart from the flow_app it writes to
+class AppDissector {
+public:
+    virtual ~AppDissector() = default;
+
+    // Protocol written to flow_app::protocol, other dissectors may use values above the built-in ones
+    virtual AppProtocol protocol() const = 0;
+
+    // Parses the payload of one packet sent in direction (0 for endpoint a of the flow key) over transport
+    // (IPPROTO_TCP or IPPROTO_UDP). Returns whether the payload belongs to the protocol, having filled in app;
+    // returns false without touching app otherwise
+    virtual bool dissect(uint8_t transport, const unsigned char* data, size_t length, int direction,
+                         flow_app& app) const = 0;
+};
+
+class DissectorRegistry {
+public:
+    // Registers the built-in dissectors; each flow direction is dissected up to bytes_per_direction payload bytes
+    // (at most 65535)
+    explicit DissectorRegistry(size_t bytes_per_direction = 1024);
+
+    DissectorRegistry(const DissectorRegistry&) = delete;
+    DissectorRegistry& operator=(const DissectorRegistry&) = delete;
+
+    // Adds a dissector, kept alive by the caller, tried after those before it. Call before the capture starts;
+    // a registry in use is read only and may serve any number of threads
+    void add(const AppDissector* dissector);
+
+    // Dissects the payload of packet (data is the buffer it was decoded from) if flow still wants bytes in
+    // direction. Called on the thread that tracks the flow
+    void inspect(flow_record& flow, int direction, const decoded_packet& packet, const unsigned char* data) const;
+
+    size_t bytesPerDirection() const { return limit; }
+
+    static const char* protocolName(uint8_t protocol);
+
+private:
+    std::vector<const AppDissector*> dissectors;
+    uint16_t limit;
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_APP_DISSECTOR_HPP
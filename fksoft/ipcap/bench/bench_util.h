@@ -0,0 +1,44 @@
+/**
+ * @file    bench_util.h
+ * @ingroup figkey
+ * @brief   Helpers shared by the benchmark programs: a reproducible pseudo-random mix for synthetic traffic,
+ *          wall-clock timing and the per-phase throughput line.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_BENCH_UTIL_HPP
+#define FIGKEY_BENCH_UTIL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+namespace figkey {
+namespace bench {
+
+// SplitMix64 finalizer, the same x always gives the same value so runs can be compared
+inline uint64_t SplitMix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// One line per phase: packets, time, Mpps and ns per packet
+inline void Report(const char* phase, uint64_t operations, double seconds) {
+    std::cout << phase << ": " << operations << " packets in " << seconds << " s, " << operations / seconds / 1e6
+              << " Mpps, " << seconds * 1e9 / operations << " ns/packet" << std::endl;
+}
+
+}  // namespace bench
+}  // namespace figkey
+
+#endif // !FIGKEY_BENCH_UTIL_HPP
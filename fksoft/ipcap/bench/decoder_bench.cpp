@@ -0,0 +1,132 @@
+/**
+ * @file    decoder_bench.cpp
+ * @ingroup figkey
+ * @brief   Throughput benchmark for PacketDecoder on replayed traces.
+ *          Loads a pcap/pcapng file into memory with PcapFileReader, decodes every packet repeatedly on one
+ *          core for at least the given time and reports packets/sec, nanoseconds per packet and the mix of
+ *          decode results and protocols seen in the trace.
+ *
+ *          usage: decoder_bench <file.pcap|file.pcapng> [--seconds S]
+ *            --seconds   minimum measuring time per run (default: 2)
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bench_util.h"
+#include "pcap_file.h"
+#include "packet_decoder.h"
+
+using namespace figkey;
+using namespace figkey::bench;
+
+namespace {
+
+// Trace held in memory so the benchmark measures the decoder rather than file I/O
+struct trace_packet {
+    size_t offset;
+    uint32_t caplen;
+    int link_type;
+};
+
+bool loadTrace(const std::string& path, std::vector<unsigned char>& bytes, std::vector<trace_packet>& packets) {
+    PcapFileReader reader;
+    if (!reader.open(path)) {
+        std::cerr << "Couldn't open " << path << ": " << reader.lastError() << std::endl;
+        return false;
+    }
+    file_packet packet;
+    int rc;
+    while ((rc = reader.next(packet)) == 1) {
+        packets.push_back(trace_packet{bytes.size(), packet.header.caplen, packet.link_type});
+        bytes.insert(bytes.end(), packet.data, packet.data + packet.header.caplen);
+    }
+    if (rc < 0) {
+        std::cerr << "Error reading " << path << ": " << reader.lastError() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <file.pcap|file.pcapng> [--seconds S]" << std::endl;
+        return 1;
+    }
+    double minSeconds = 2.0;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc) {
+            minSeconds = std::atof(argv[++i]);
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " <file.pcap|file.pcapng> [--seconds S]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<unsigned char> bytes;
+    std::vector<trace_packet> packets;
+    if (!loadTrace(argv[1], bytes, packets)) {
+        return 1;
+    }
+    if (packets.empty()) {
+        std::cerr << "No packets in " << argv[1] << std::endl;
+        return 1;
+    }
+    std::cout << "Loaded " << packets.size() << " packets, " << bytes.size() << " bytes" << std::endl;
+
+    // One untimed pass for the result mix
+    uint64_t statusCount[5] = {};
+    uint64_t tcp = 0, udp = 0, icmp = 0, other = 0, ipv6 = 0, vlan = 0, fragments = 0;
+    decoded_packet decoded;
+    for (const trace_packet& p : packets) {
+        DecodeStatus status = PacketDecoder::decode(p.link_type, bytes.data() + p.offset, p.caplen, decoded);
+        ++statusCount[static_cast<int>(status)];
+        ipv6 += decoded.ip_version == 6;
+        vlan += (decoded.flags & PKT_FLAG_VLAN) != 0;
+        fragments += (decoded.flags & PKT_FLAG_FRAGMENT) != 0;
+        if (decoded.flags & PKT_FLAG_TRANSPORT) {
+            tcp += decoded.protocol == 6;
+            udp += decoded.protocol == 17;
+            icmp += decoded.protocol == 1 || decoded.protocol == 58;
+        }
+        else {
+            ++other;
+        }
+    }
+
+    uint64_t decodedPackets = 0;
+    uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    do {
+        for (const trace_packet& p : packets) {
+            PacketDecoder::decode(p.link_type, bytes.data() + p.offset, p.caplen, decoded);
+            // Consume a few fields so the decode cannot be optimized away
+            sink += decoded.src_port + decoded.payload_length + decoded.flags;
+        }
+        decodedPackets += packets.size();
+        seconds = Seconds(start);
+    } while (seconds < minSeconds);
+
+    std::cout << "Decoded " << decodedPackets << " packets in " << seconds << " s: " << decodedPackets / seconds / 1e6
+              << " Mpps, " << seconds * 1e9 / decodedPackets << " ns/packet (checksum " << sink << ")" << std::endl;
+    for (int i = 0; i < 5; ++i) {
+        if (statusCount[i] > 0) {
+            std::cout << "  " << PacketDecoder::statusName(static_cast<DecodeStatus>(i)) << ": " << statusCount[i]
+                      << std::endl;
+        }
+    }
+    std::cout << "  tcp " << tcp << ", udp " << udp << ", icmp " << icmp << ", no transport " << other << ", ipv6 "
+              << ipv6 << ", vlan " << vlan << ", fragments " << fragments << std::endl;
+    return 0;
+}
@@ -0,0 +1,171 @@
+﻿/**
+ * @file    flow_bench.cpp
+ * @ingroup figkey
+ * @brief   Throughput benchmark for FlowTable with synthetic flows.
+ *          Creates the given number of concurrent TCP/UDP flows, then measures updates of existing flows in
+ *          random order (both directions) and a churn phase that expires and creates flows at a full table,
+ *          which exercises tombstone cleanup. Every flow is looked up again at the end to check the table.
+ *          A last phase drives FlowExpiry with packet timestamps, short flows come and go on a 1 s idle timeout.
+ *
+ *          usage: flow_bench [--flows N] [--updates N]
+ *            --flows     concurrent flows (default: 4000000)
+ *            --updates   packets per measured phase (default: 20000000)
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "bench_util.h"
+#include "flow_expiry.h"
+#include "flow_table.h"
+
+using namespace figkey;
+using namespace figkey::bench;
+
+namespace {
+
+// Packet of flow id, sent by the client when reply is false
+void MakePacket(uint64_t id, bool reply, decoded_packet& packet) {
+    uint64_t r = SplitMix(id);
+    std::memset(&packet, 0, sizeof(packet));
+    packet.ip_version = 4;
+    packet.protocol = (r & 1) ? 6 : 17;
+    packet.flags = PKT_FLAG_IPV4 | PKT_FLAG_TRANSPORT;
+    packet.tcp_flags = packet.protocol == 6 ? 0x10 : 0;
+    uint32_t client = 0x0a000000u | static_cast<uint32_t>(id & 0xffffff);
+    uint32_t server = 0xc0a80000u | static_cast<uint32_t>((r >> 8) & 0xffff);
+    uint16_t clientPort = static_cast<uint16_t>(1024 + ((r >> 24) % 60000));
+    uint16_t serverPort = static_cast<uint16_t>((r >> 40) & 0x3ff);
+    unsigned char c[4] = {static_cast<unsigned char>(client >> 24), static_cast<unsigned char>(client >> 16),
+                          static_cast<unsigned char>(client >> 8), static_cast<unsigned char>(client)};
+    unsigned char s[4] = {static_cast<unsigned char>(server >> 24), static_cast<unsigned char>(server >> 16),
+                          static_cast<unsigned char>(server >> 8), static_cast<unsigned char>(server)};
+    std::memcpy(reply ? packet.dst_addr : packet.src_addr, c, 4);
+    std::memcpy(reply ? packet.src_addr : packet.dst_addr, s, 4);
+    packet.src_port = reply ? serverPort : clientPort;
+    packet.dst_port = reply ? clientPort : serverPort;
+}
+
+class ExpiryCounter : public FlowExpiryHandler {
+public:
+    void onExpired(const expired_flow* flows, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            packets += flows[i].record->packets[0] + flows[i].record->packets[1];
+        }
+        ++batches;
+    }
+
+    uint64_t packets{0};
+    uint64_t batches{0};
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t flows = 4000000;
+    uint64_t updates = 20000000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--flows" && i + 1 < argc) {
+            flows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--updates" && i + 1 < argc) {
+            updates = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--flows N] [--updates N]" << std::endl;
+            return 1;
+        }
+    }
+    if (flows == 0) {
+        std::cerr << "--flows must be positive" << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    FlowTable table(flows);
+    std::cout << "Table for " << flows << " flows allocated in " << Seconds(start) << " s" << std::endl;
+
+    decoded_packet packet;
+    uint64_t timestamp = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t id = 0; id < flows; ++id) {
+        MakePacket(id, false, packet);
+        table.update(packet, ++timestamp, 60);
+    }
+    Report("insert", flows, Seconds(start));
+
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < updates; ++i) {
+        uint64_t r = SplitMix(i ^ 0x5bd1e995);
+        MakePacket(r % flows, (r >> 63) != 0, packet);
+        table.update(packet, ++timestamp, 1500);
+    }
+    Report("update", updates, Seconds(start));
+
+    // Expire the oldest flow and start a new one, so the live window [first, first + flows) slides
+    uint64_t first = 0;
+    flow_key key;
+    bool reversed;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < updates; ++i) {
+        if ((i & 3) == 0) {
+            MakePacket(first, false, packet);
+            FlowTable::makeKey(packet, key, reversed);
+            if (flow_record* record = table.find(key)) {
+                table.erase(record);
+            }
+            MakePacket(first + flows, false, packet);
+            table.update(packet, ++timestamp, 60);
+            ++first;
+        }
+        else {
+            MakePacket(first + SplitMix(i) % flows, (i & 1) != 0, packet);
+            table.update(packet, ++timestamp, 1500);
+        }
+    }
+    Report("churn", updates, Seconds(start));
+
+    uint64_t missing = 0;
+    for (uint64_t id = first; id < first + flows; ++id) {
+        MakePacket(id, false, packet);
+        FlowTable::makeKey(packet, key, reversed);
+        missing += table.find(key) == nullptr;
+    }
+    std::cout << table.size() << " flows in table, " << missing << " missing, " << table.dropped()
+              << " packets dropped" << std::endl;
+    if (missing != 0 || table.dropped() != 0) {
+        return 1;
+    }
+
+    // One packet per microsecond, four packets per flow spread over 4 ms: about a million flows per second of
+    // packet time, all of them expire one second after their last packet
+    FlowTable aging(flows);
+    ExpiryCounter counter;
+    FlowExpiry expiry(aging, &counter, FlowExpiryOptions(1000, 0, 1000, 10));
+    const uint64_t base = 1700000000ULL * 1000000000ULL;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < updates; ++i) {
+        uint64_t slot = i & 4095;
+        uint64_t id = ((i >> 12) << 10) + (slot & 1023);
+        uint64_t ts = base + i * 1000;
+        MakePacket(id + 100000000, (slot >> 10) & 1, packet);
+        expiry.advance(ts);
+        if (flow_record* record = aging.update(packet, ts, 100)) {
+            expiry.onPacket(record);
+        }
+    }
+    Report("expiry", updates, Seconds(start));
+    uint64_t live = aging.size();
+    expiry.flush();
+    std::cout << expiry.expired() << " flows expired in " << counter.batches << " batches, " << live
+              << " were still open, " << counter.packets << " packets accounted, " << aging.dropped()
+              << " packets dropped" << std::endl;
+    return counter.packets + aging.dropped() == updates ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+﻿/**
+ * @file    hash_bench.cpp
+ * @ingroup figkey
+ * @brief   Speed, symmetry and load balance of the flow hashes used to shard packets over workers.
+ *          Builds Ethernet frames for a synthetic mix of flows: many clients talking to a few servers, which is
+ *          where hashing addresses alone falls short, plus some IPv6. Checks that every hash maps both directions
+ *          of each flow to the same value, times the hash on decoded packets and FlowSharder::route on frames
+ *          (decode included), and prints the per-worker skew report of each hash. The same packets behind a
+ *          Linux cooked, raw IP and BSD loopback header must get the address hash of their Ethernet frame.
+ *
+ *          usage: hash_bench [--flows N] [--packets N] [--workers N]
+ *            --flows     distinct flows (default: 100000)
+ *            --packets   packets routed per hash, flow sizes follow a power law (default: 5000000)
+ *            --workers   workers to shard over (default: 8)
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bench_util.h"
+#include "flow_hash.h"
+#include "packet_decoder.h"
+
+using namespace figkey;
+using namespace figkey::bench;
+
+namespace {
+
+const FlowHashType TYPES[] = {FlowHashType::ADDRESS, FlowHashType::TOEPLITZ, FlowHashType::CRC32C};
+const int LINK_ETHERNET = 1;    // DLT_EN10MB
+const size_t FRAME_SIZE = 78;   // Ethernet, IPv6 and TCP headers; IPv4 frames use the first 54 bytes
+
+// Link types other than Ethernet, by the value capture files carry
+struct link_header {
+    const char* name;
+    int link_type;
+};
+const link_header OTHER_LINKS[] = {{"linux-sll", 113}, {"raw", 101}, {"null", 0}};
+
+// TCP frame of flow id in one direction. One flow in eight is IPv6, clients sit in 10.0.0.0/8 and talk to one
+// of four servers on port 443
+uint32_t MakeFrame(uint64_t id, bool reply, unsigned char* frame) {
+    std::memset(frame, 0, FRAME_SIZE);
+    uint64_t r = SplitMix(id);
+    bool v6 = (id & 7) == 7;
+    unsigned char client[16] = {0};
+    unsigned char server[16] = {0};
+    size_t size = v6 ? 16 : 4;
+    if (v6) {
+        client[0] = 0x20;
+        client[1] = 0x01;
+        std::memcpy(client + 8, &r, 8);
+        server[0] = 0x20;
+        server[1] = 0x01;
+        server[15] = static_cast<unsigned char>(1 + (r >> 62));
+    }
+    else {
+        client[0] = 10;
+        client[1] = static_cast<unsigned char>(r >> 8);
+        client[2] = static_cast<unsigned char>(r >> 16);
+        client[3] = static_cast<unsigned char>(r >> 24);
+        server[0] = 192;
+        server[1] = 168;
+        server[3] = static_cast<unsigned char>(1 + (r >> 62));
+    }
+    uint16_t clientPort = static_cast<uint16_t>(1024 + (r >> 32) % 60000);
+    uint16_t serverPort = 443;
+
+    frame[12] = v6 ? 0x86 : 0x08;
+    frame[13] = v6 ? 0xDD : 0x00;
+    unsigned char* ip = frame + 14;
+    unsigned char* tcp;
+    if (v6) {
+        ip[0] = 0x60;
+        ip[5] = 20;
+        ip[6] = 6;
+        ip[7] = 64;
+        std::memcpy(ip + 8, reply ? server : client, size);
+        std::memcpy(ip + 24, reply ? client : server, size);
+        tcp = ip + 40;
+    }
+    else {
+        ip[0] = 0x45;
+        ip[3] = 40;
+        ip[8] = 64;
+        ip[9] = 6;
+        std::memcpy(ip + 12, reply ? server : client, size);
+        std::memcpy(ip + 16, reply ? client : server, size);
+        tcp = ip + 20;
+    }
+    uint16_t sport = reply ? serverPort : clientPort;
+    uint16_t dport = reply ? clientPort : serverPort;
+    tcp[0] = static_cast<unsigned char>(sport >> 8);
+    tcp[1] = static_cast<unsigned char>(sport);
+    tcp[2] = static_cast<unsigned char>(dport >> 8);
+    tcp[3] = static_cast<unsigned char>(dport);
+    tcp[12] = 0x50;
+    tcp[13] = 0x10;
+    return static_cast<uint32_t>(tcp + 20 - frame);
+}
+
+// Puts the IP packet of an Ethernet frame behind the header of link_type, returns the new length
+uint32_t Relink(int link_type, const unsigned char* frame, uint32_t length, unsigned char* out) {
+    bool v6 = frame[12] == 0x86;
+    uint32_t header = 0;
+    if (link_type == 113) {
+        std::memset(out, 0, 16);
+        out[14] = frame[12];
+        out[15] = frame[13];
+        header = 16;
+    }
+    else if (link_type == 0) {
+        uint32_t family = v6 ? 10 : 2;  // Host byte order
+        std::memcpy(out, &family, 4);
+        header = 4;
+    }
+    std::memcpy(out + header, frame + 14, length - 14);
+    return header + length - 14;
+}
+
+void PrintReport(const shard_report& report) {
+    std::cout << "  skew " << report.skew << " (worker " << report.busiest << " busiest), shares:";
+    for (const auto& load : report.workers) {
+        std::cout << " " << load.share * 100 << "%";
+    }
+    std::cout << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t flows = 100000;
+    uint64_t packets = 5000000;
+    unsigned workers = 8;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--flows" && i + 1 < argc) {
+            flows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--packets" && i + 1 < argc) {
+            packets = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--workers" && i + 1 < argc) {
+            workers = static_cast<unsigned>(std::atoi(argv[++i]));
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--flows N] [--packets N] [--workers N]" << std::endl;
+            return 1;
+        }
+    }
+    if (flows == 0 || workers == 0) {
+        std::cerr << "--flows and --workers must be positive" << std::endl;
+        return 1;
+    }
+
+    static const unsigned char CHECK[] = "123456789";
+    if (FlowHash::crc32c(CHECK, 9) != 0xE3069283 || FlowHash::crc32cPortable(CHECK, 9) != 0xE3069283) {
+        std::cerr << "CRC32C check value mismatch" << std::endl;
+        return 1;
+    }
+    std::cout << "CRC32C " << (FlowHash::hardwareCrc32c() ? "in hardware" : "in software") << std::endl;
+    // First IPv4 example of the Microsoft RSS verification suite, with the usual non-symmetric key
+    static const uint8_t MS_KEY[ToeplitzHash::KEY_SIZE] = {
+        0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+        0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+        0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+    };
+    static const unsigned char MS_INPUT[] = {66, 9, 149, 187, 161, 142, 100, 80, 0x0a, 0xea, 0x06, 0xe6};
+    ToeplitzHash reference(MS_KEY);
+    if (reference.hash(MS_INPUT, 8) != 0x323e8fc2 || reference.hash(MS_INPUT, 12) != 0x51ccc178) {
+        std::cerr << "Toeplitz check value mismatch" << std::endl;
+        return 1;
+    }
+
+    // Frames of both directions of every flow, and the sequence of flows to route: a power law, a few flows
+    // carry most of the packets like on a real link
+    std::vector<unsigned char> frames(flows * 2 * FRAME_SIZE);
+    std::vector<uint32_t> lengths(flows * 2);
+    std::vector<decoded_packet> decoded(flows * 2);
+    for (uint64_t id = 0; id < flows; ++id) {
+        for (int reply = 0; reply < 2; ++reply) {
+            size_t index = id * 2 + reply;
+            lengths[index] = MakeFrame(id, reply != 0, &frames[index * FRAME_SIZE]);
+            PacketDecoder::decode(LINK_ETHERNET, &frames[index * FRAME_SIZE], lengths[index], decoded[index]);
+        }
+    }
+    std::vector<uint32_t> sequence(packets);
+    for (uint64_t i = 0; i < packets; ++i) {
+        double u = (SplitMix(i ^ 0xA5A5A5A5ULL) >> 11) * (1.0 / 9007199254740992.0);
+        uint64_t flow = static_cast<uint64_t>(std::pow(static_cast<double>(flows), u)) - 1;
+        sequence[i] = static_cast<uint32_t>(flow * 2 + (i & 1));
+    }
+
+    ToeplitzHash toeplitz;
+    uint64_t asymmetric = 0;
+    for (uint64_t id = 0; id < flows; ++id) {
+        const decoded_packet& a = decoded[id * 2];
+        const decoded_packet& b = decoded[id * 2 + 1];
+        asymmetric += toeplitz.hash(a) != toeplitz.hash(b);
+        asymmetric += FlowHash::crc32c(a) != FlowHash::crc32c(b);
+        asymmetric += FlowHash::address(LINK_ETHERNET, &frames[id * 2 * FRAME_SIZE], lengths[id * 2]) !=
+                      FlowHash::address(LINK_ETHERNET, &frames[(id * 2 + 1) * FRAME_SIZE], lengths[id * 2 + 1]);
+    }
+    std::cout << flows << " flows, " << asymmetric << " hashed differently per direction" << std::endl;
+
+    uint64_t misrouted = 0;
+    for (const link_header& link : OTHER_LINKS) {
+        unsigned char packet[FRAME_SIZE + 2];
+        uint64_t differ = 0;
+        FlowSharder sharder(workers, FlowHashType::ADDRESS);
+        for (size_t index = 0; index < flows * 2; ++index) {
+            const unsigned char* frame = &frames[index * FRAME_SIZE];
+            uint32_t length = Relink(link.link_type, frame, lengths[index], packet);
+            differ += FlowHash::address(link.link_type, packet, length) !=
+                      FlowHash::address(LINK_ETHERNET, frame, lengths[index]);
+            sharder.route(link.link_type, packet, length, length);
+        }
+        std::cout << link.name << ": " << differ << " packets hashed unlike their Ethernet frame" << std::endl;
+        PrintReport(sharder.report());
+        misrouted += differ;
+    }
+
+    uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < packets; ++i) {
+        sink += toeplitz.hash(decoded[sequence[i]]);
+    }
+    double toeplitzSeconds = Seconds(start);
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < packets; ++i) {
+        sink += FlowHash::crc32c(decoded[sequence[i]]);
+    }
+    double crcSeconds = Seconds(start);
+    std::cout << "hash only: toeplitz " << toeplitzSeconds * 1e9 / packets << " ns/packet, crc32c "
+              << crcSeconds * 1e9 / packets << " ns/packet" << (sink == 1 ? " " : "") << std::endl;
+
+    for (FlowHashType type : TYPES) {
+        FlowSharder sharder(workers, type);
+        start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < packets; ++i) {
+            uint32_t index = sequence[i];
+            sink += sharder.route(LINK_ETHERNET, &frames[index * FRAME_SIZE], lengths[index], lengths[index]);
+        }
+        double seconds = Seconds(start);
+        std::cout << FlowHash::typeName(type) << ": route " << seconds * 1e9 / packets << " ns/packet" << std::endl;
+        PrintReport(sharder.report());
+    }
+    return asymmetric == 0 && misrouted == 0 ? 0 : 1;
+}
@@ -0,0 +1,288 @@
+/**
+ * @file    match_bench.cpp
+ * @ingroup figkey
+ * @brief   Throughput of PayloadMatcher on the payloads of a replayed trace.
+ *          Loads the transport payloads of a pcap/pcapng file into memory and scans them repeatedly on one core,
+ *          once with the prefilter and once without, reporting Gbit/s and the matches found. Without a pattern
+ *          file it builds N signatures: 1% are substrings taken from the trace so some of them match, the rest
+ *          random binary strings. It runs the full set and the sampled part on its own, which is small enough for
+ *          the prefilter to pay off.
+ *
+ *          Before timing, the matches are checked against a naive search of every pattern and the payloads are
+ *          scanned as one stream, whole and cut at random points, to check that the saved state carries matches
+ *          across the cuts.
+ *
+ *          usage: match_bench <file.pcap|file.pcapng> [--patterns FILE | --signatures N] [--seconds S]
+ *            --patterns    one pattern per line
+ *            --signatures  number of generated signatures (default: 10000)
+ *            --seconds     minimum measuring time per run (default: 1)
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "bench_util.h"
+#include "pcap_file.h"
+#include "packet_decoder.h"
+#include "payload_match.h"
+
+using namespace figkey;
+using namespace figkey::bench;
+
+namespace {
+
+typedef std::vector<std::vector<unsigned char>> pattern_list;
+
+// Payloads held in memory so the benchmark measures the matcher rather than file I/O
+struct payload {
+    size_t offset;
+    size_t length;
+};
+
+// Collects (pattern, end) pairs, for comparing two scans
+class ListCallback : public MatchCallback {
+public:
+    void onMatch(uint32_t pattern, uint64_t end) override {
+        found.emplace_back(pattern, end);
+    }
+
+    std::vector<std::pair<uint32_t, uint64_t>> found;
+};
+
+bool loadPayloads(const std::string& path, std::vector<unsigned char>& bytes, std::vector<payload>& payloads) {
+    PcapFileReader reader;
+    if (!reader.open(path)) {
+        std::cerr << "Couldn't open " << path << ": " << reader.lastError() << std::endl;
+        return false;
+    }
+    file_packet packet;
+    decoded_packet decoded;
+    int rc;
+    while ((rc = reader.next(packet)) == 1) {
+        PacketDecoder::decode(packet.link_type, packet.data, packet.header.caplen, decoded);
+        if (decoded.payload_length == 0) {
+            continue;
+        }
+        payloads.push_back(payload{bytes.size(), decoded.payload_length});
+        bytes.insert(bytes.end(), packet.data + decoded.payload_offset,
+                     packet.data + decoded.payload_offset + decoded.payload_length);
+    }
+    if (rc < 0) {
+        std::cerr << "Error reading " << path << ": " << reader.lastError() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool loadPatterns(const std::string& path, pattern_list& patterns) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Couldn't read patterns from " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            patterns.emplace_back(line.begin(), line.end());
+        }
+    }
+    return true;
+}
+
+// count signatures of 4 to 16 bytes, every hundredth cut from the payloads (sampled), the others random
+void makeSignatures(size_t count, const std::vector<unsigned char>& bytes, pattern_list& sampled,
+                    pattern_list& all) {
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t r = SplitMix(i);
+        size_t length = 4 + r % 13;
+        std::vector<unsigned char> pattern(length);
+        if (i % 100 == 0 && bytes.size() > length) {
+            size_t from = (r >> 8) % (bytes.size() - length);
+            std::memcpy(pattern.data(), bytes.data() + from, length);
+            sampled.push_back(pattern);
+        }
+        else {
+            for (size_t j = 0; j < length; ++j) {
+                pattern[j] = static_cast<unsigned char>(SplitMix(r + j) >> 56);
+            }
+        }
+        all.push_back(pattern);
+    }
+}
+
+void compile(const pattern_list& patterns, PayloadMatcher& matcher, bool use_prefilter) {
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        matcher.add(patterns[i].data(), patterns[i].size(), static_cast<uint32_t>(i));
+    }
+    matcher.compile(use_prefilter);
+}
+
+// Matches of every pattern in every payload found by brute force, against those of the matcher
+bool checkNaive(const PayloadMatcher& matcher, const pattern_list& patterns, const std::vector<unsigned char>& bytes,
+                const std::vector<payload>& payloads) {
+    for (const payload& p : payloads) {
+        const unsigned char* data = bytes.data() + p.offset;
+        std::vector<std::pair<uint32_t, uint64_t>> expected;
+        for (size_t id = 0; id < patterns.size(); ++id) {
+            const auto& pattern = patterns[id];
+            for (size_t end = pattern.size(); end <= p.length; ++end) {
+                if (std::memcmp(data + end - pattern.size(), pattern.data(), pattern.size()) == 0) {
+                    expected.emplace_back(static_cast<uint32_t>(id), end);
+                }
+            }
+        }
+        ListCallback callback;
+        match_state state{0, 0};
+        matcher.scan(state, data, p.length, &callback);
+        std::sort(expected.begin(), expected.end());
+        std::sort(callback.found.begin(), callback.found.end());
+        if (expected != callback.found) {
+            std::cerr << "Matches differ from a naive search: " << callback.found.size() << " found, "
+                      << expected.size() << " expected" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// The first size payload bytes as one stream, scanned in one go and in random pieces
+bool checkStreaming(const PayloadMatcher& matcher, const std::vector<unsigned char>& bytes, size_t size) {
+    ListCallback whole;
+    match_state state{0, 0};
+    matcher.scan(state, bytes.data(), size, &whole);
+
+    ListCallback pieces;
+    state = match_state{0, 0};
+    size_t position = 0;
+    for (uint64_t i = 0; position < size; ++i) {
+        size_t length = std::min<size_t>(1 + SplitMix(i) % 64, size - position);
+        matcher.scan(state, bytes.data() + position, length, &pieces);
+        position += length;
+    }
+    if (whole.found != pieces.found) {
+        std::cerr << "Matches differ when the stream is cut: " << pieces.found.size() << " found, "
+                  << whole.found.size() << " in one piece" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void run(const char* name, const pattern_list& patterns, const std::vector<unsigned char>& bytes,
+         const std::vector<payload>& payloads, double min_seconds) {
+    for (int prefilter = 1; prefilter >= 0; --prefilter) {
+        PayloadMatcher matcher;
+        compile(patterns, matcher, prefilter != 0);
+        uint64_t scanned = 0;
+        uint64_t matches = 0;
+        uint64_t passes = 0;
+        auto start = std::chrono::steady_clock::now();
+        double seconds = 0;
+        do {
+            for (const payload& p : payloads) {
+                match_state state{0, 0};
+                matches += matcher.scan(state, bytes.data() + p.offset, p.length, nullptr);
+            }
+            scanned += bytes.size();
+            ++passes;
+            seconds = Seconds(start);
+        } while (seconds < min_seconds);
+
+        std::cout << name << ", prefilter " << PayloadMatcher::prefilterName(matcher.prefilter());
+        if (prefilter) {
+            std::cout << " (passes " << matcher.prefilterPassRate() * 100 << "% of positions)";
+        }
+        std::cout << ": " << scanned * 8 / seconds / 1e9 << " Gbit/s, " << matches / passes << " matches per pass"
+                  << std::endl;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const char* usage = " <file.pcap|file.pcapng> [--patterns FILE | --signatures N] [--seconds S]";
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << usage << std::endl;
+        return 1;
+    }
+    std::string patternPath;
+    size_t signatures = 10000;
+    double minSeconds = 1.0;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--patterns" && i + 1 < argc) {
+            patternPath = argv[++i];
+        }
+        else if (arg == "--signatures" && i + 1 < argc) {
+            signatures = static_cast<size_t>(std::atoll(argv[++i]));
+        }
+        else if (arg == "--seconds" && i + 1 < argc) {
+            minSeconds = std::atof(argv[++i]);
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << usage << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<unsigned char> bytes;
+    std::vector<payload> payloads;
+    if (!loadPayloads(argv[1], bytes, payloads)) {
+        return 1;
+    }
+    if (payloads.empty()) {
+        std::cerr << "No payloads in " << argv[1] << std::endl;
+        return 1;
+    }
+    std::cout << "Loaded " << payloads.size() << " payloads, " << bytes.size() << " bytes" << std::endl;
+
+    pattern_list sampled;
+    pattern_list all;
+    if (!patternPath.empty()) {
+        if (!loadPatterns(patternPath, all) || all.empty()) {
+            std::cerr << "No patterns in " << patternPath << std::endl;
+            return 1;
+        }
+    }
+    else {
+        makeSignatures(signatures, bytes, sampled, all);
+    }
+
+    // Checks on the small set, a naive search over every payload is too slow for thousands of patterns
+    const pattern_list& checked = patternPath.empty() ? sampled : all;
+    std::vector<payload> checkedPayloads(payloads.begin(), payloads.begin() + std::min<size_t>(payloads.size(), 2000));
+    size_t checkedBytes = checkedPayloads.back().offset + checkedPayloads.back().length;
+    for (int prefilter = 1; prefilter >= 0 && !checked.empty(); --prefilter) {
+        PayloadMatcher matcher;
+        compile(checked, matcher, prefilter != 0);
+        if (!checkNaive(matcher, checked, bytes, checkedPayloads) || !checkStreaming(matcher, bytes, checkedBytes)) {
+            return 1;
+        }
+    }
+
+    PayloadMatcher matcher;
+    compile(all, matcher, true);
+    std::cout << all.size() << " patterns: " << matcher.states() << " states, " << matcher.memory() / 1024
+              << " KiB" << std::endl;
+    if (!patternPath.empty()) {
+        run("patterns", all, bytes, payloads, minSeconds);
+        return 0;
+    }
+    run("all signatures", all, bytes, payloads, minSeconds);
+    if (!sampled.empty()) {
+        run("sampled signatures", sampled, bytes, payloads, minSeconds);
+    }
+    return 0;
+}
@@ -0,0 +1,250 @@
+/**
+ * @file    reassembly_bench.cpp
+ * @ingroup figkey
+ * @brief   Throughput and correctness benchmark for TcpReassembler with synthetic connections.
+ *          First replays fixed overlap cases: a longer retransmission at the offset of a buffered segment, a
+ *          segment straddling a buffered one and an in-order segment running over a buffered one. Then each
+ *          connection sends its stream in segments of random size, reordered within a small window and mixed
+ *          with overlapping retransmissions whose bytes differ from the first copy. Every stream must come out
+ *          as the bytes that arrived first at each offset, without gaps.
+ *
+ *          usage: reassembly_bench [--connections N] [--bytes N] [--retransmit PERCENT]
+ *            --connections   concurrent connections, at most 50000 (default: 1000)
+ *            --bytes         stream bytes per connection (default: 32768)
+ *            --retransmit    percent of the segments followed by an overlapping retransmission (default: 10)
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bench_util.h"
+#include "flow_table.h"
+#include "tcp_reassembly.h"
+
+using namespace figkey;
+using namespace figkey::bench;
+
+namespace {
+
+const uint16_t SERVER_PORT = 80;
+const uint16_t FIRST_CLIENT_PORT = 10000;
+const uint16_t PAYLOAD_OFFSET = 54;     // Ethernet, IPv4 and TCP headers without options
+
+// Collects the stream of every connection, found by its client port
+class StreamCollector : public TcpStreamHandler {
+public:
+    explicit StreamCollector(size_t connections) : streams(connections) {}
+
+    void onData(tcp_stream& stream, const unsigned char* data, size_t length) override {
+        if (!stream.user) {
+            const flow_key& key = stream.flow->key;
+            uint16_t client = key.port_a == SERVER_PORT ? key.port_b : key.port_a;
+            stream.user = &streams[client - FIRST_CLIENT_PORT];
+        }
+        static_cast<std::string*>(stream.user)->append(reinterpret_cast<const char*>(data), length);
+    }
+
+    void onGap(tcp_stream& stream, size_t length) override {
+        (void)stream;
+        gaps += length;
+    }
+
+    std::vector<std::string> streams;
+    uint64_t gaps{0};
+};
+
+// Client segment of a connection: stream bytes [offset, offset + length) or a SYN without payload
+struct segment {
+    uint32_t connection;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t copy;      // 0 for the first transmission, retransmissions carry other bytes
+    bool syn;
+};
+
+unsigned char ByteOf(const segment& seg, uint32_t offset) {
+    return static_cast<unsigned char>(SplitMix((static_cast<uint64_t>(seg.connection) << 40) ^
+                                               (static_cast<uint64_t>(seg.copy) << 32) ^ offset));
+}
+
+class Connections {
+public:
+    explicit Connections(size_t connections)
+            : table(connections * 2), reassembler(table), collector(connections) {
+        reassembler.setHandler(&collector);
+    }
+
+    void send(const segment& seg, const unsigned char* payload) {
+        decoded_packet packet;
+        std::memset(&packet, 0, sizeof(packet));
+        packet.ip_version = 4;
+        packet.protocol = 6;
+        packet.flags = PKT_FLAG_IPV4 | PKT_FLAG_TRANSPORT;
+        packet.l3_offset = 14;
+        packet.l4_offset = 34;
+        packet.payload_offset = seg.syn ? 0 : PAYLOAD_OFFSET;
+        packet.payload_length = static_cast<uint16_t>(seg.length);
+        packet.ip_length = static_cast<uint16_t>(40 + seg.length);
+        packet.src_addr[0] = 10;
+        packet.dst_addr[0] = 192;
+        packet.src_port = static_cast<uint16_t>(FIRST_CLIENT_PORT + seg.connection);
+        packet.dst_port = SERVER_PORT;
+        // Initial sequence numbers near the top of the space, so the streams wrap around
+        uint32_t isn = 0xffff0000u + static_cast<uint32_t>(SplitMix(seg.connection) & 0xffff);
+        packet.tcp_seq = seg.syn ? isn : isn + 1 + seg.offset;
+        packet.tcp_flags = seg.syn ? 0x02 : 0x10;
+        int direction = 0;
+        flow_record* flow = table.update(packet, ++time, PAYLOAD_OFFSET + seg.length, &direction);
+        if (flow) {
+            reassembler.onPacket(flow, direction, packet, seg.syn ? payload : payload - PAYLOAD_OFFSET);
+        }
+    }
+
+    FlowTable table;
+    TcpReassembler reassembler;
+    StreamCollector collector;
+    uint64_t time{0};
+};
+
+// Sends the segments of one connection with the given fill bytes and checks the stream that comes out
+bool OverlapCase(const char* name, const std::vector<std::pair<segment, char>>& segments, const std::string& expected) {
+    Connections connections(1);
+    connections.send(segment{0, 0, 0, 0, true}, nullptr);
+    std::vector<unsigned char> buffer;
+    for (const auto& entry : segments) {
+        buffer.assign(PAYLOAD_OFFSET, 0);
+        buffer.insert(buffer.end(), entry.first.length, static_cast<unsigned char>(entry.second));
+        connections.send(entry.first, buffer.data() + PAYLOAD_OFFSET);
+    }
+    connections.reassembler.flush();
+    const std::string& stream = connections.collector.streams[0];
+    bool ok = stream == expected && connections.collector.gaps == 0;
+    std::cout << name << ": " << (ok ? "ok" : "FAILED, got \"" + stream + "\"") << std::endl;
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    uint32_t connections = 1000;
+    uint32_t bytes = 32768;
+    unsigned retransmit = 10;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--connections" && i + 1 < argc) {
+            connections = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--bytes" && i + 1 < argc) {
+            bytes = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--retransmit" && i + 1 < argc) {
+            retransmit = static_cast<unsigned>(std::atoi(argv[++i]));
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--connections N] [--bytes N] [--retransmit PERCENT]" << std::endl;
+            return 1;
+        }
+    }
+    if (connections == 0 || connections > 50000 || bytes == 0 || retransmit > 100) {
+        std::cerr << "--connections must be 1 to 50000, --bytes positive, --retransmit at most 100" << std::endl;
+        return 1;
+    }
+
+    // Segments are {connection, offset, length, copy, syn} with the byte they are filled with
+    bool ok = OverlapCase("longer retransmission at a buffered offset",
+                          {{{0, 10, 10, 0, false}, 'a'}, {{0, 10, 20, 0, false}, 'b'}, {{0, 0, 10, 0, false}, 'c'}},
+                          std::string(10, 'c') + std::string(10, 'a') + std::string(10, 'b'));
+    ok &= OverlapCase("segment straddling a buffered one",
+                      {{{0, 10, 10, 0, false}, 'a'}, {{0, 5, 20, 0, false}, 'b'}, {{0, 0, 5, 0, false}, 'c'}},
+                      std::string(5, 'c') + std::string(5, 'b') + std::string(10, 'a') + std::string(5, 'b'));
+    ok &= OverlapCase("in-order segment over a buffered one",
+                      {{{0, 10, 10, 0, false}, 'a'}, {{0, 0, 30, 0, false}, 'b'}},
+                      std::string(10, 'b') + std::string(10, 'a') + std::string(10, 'b'));
+
+    // Segments of every connection, reordered within a window of 8 and with overlapping retransmissions
+    std::vector<std::vector<segment>> perConnection(connections);
+    uint64_t r = 0;
+    for (uint32_t c = 0; c < connections; ++c) {
+        std::vector<segment>& list = perConnection[c];
+        uint32_t copies = 0;
+        for (uint32_t offset = 0; offset < bytes;) {
+            uint32_t length = std::min<uint32_t>(1 + static_cast<uint32_t>(SplitMix(++r) % 1460), bytes - offset);
+            list.push_back(segment{c, offset, length, 0, false});
+            if (SplitMix(++r) % 100 < retransmit) {
+                uint32_t start = static_cast<uint32_t>(SplitMix(++r) % (offset + 1));
+                start = std::max(start, offset > 400 ? offset - 400 : 0);
+                uint32_t end = std::min<uint32_t>(offset + length + static_cast<uint32_t>(SplitMix(++r) % 400), bytes);
+                list.push_back(segment{c, start, end - start, ++copies, false});
+            }
+            offset += length;
+        }
+        for (size_t i = 0; i + 1 < list.size(); ++i) {
+            std::swap(list[i], list[i + std::min<size_t>(SplitMix(++r) % 8, list.size() - 1 - i)]);
+        }
+    }
+
+    // Interleave the connections and lay out every packet's payload behind room for its headers
+    std::vector<segment> arrivals;
+    for (uint32_t c = 0; c < connections; ++c) {
+        arrivals.push_back(segment{c, 0, 0, 0, true});
+    }
+    for (size_t i = 0;; ++i) {
+        bool any = false;
+        for (uint32_t c = 0; c < connections; ++c) {
+            if (i < perConnection[c].size()) {
+                arrivals.push_back(perConnection[c][i]);
+                any = true;
+            }
+        }
+        if (!any) {
+            break;
+        }
+    }
+    std::vector<size_t> payloads(arrivals.size());
+    std::vector<unsigned char> arena;
+    std::vector<std::string> expected(connections, std::string(bytes, '\0'));
+    std::vector<std::vector<bool>> filled(connections, std::vector<bool>(bytes, false));
+    for (size_t i = 0; i < arrivals.size(); ++i) {
+        const segment& seg = arrivals[i];
+        arena.insert(arena.end(), PAYLOAD_OFFSET, 0);
+        payloads[i] = arena.size();
+        for (uint32_t k = 0; k < seg.length; ++k) {
+            unsigned char value = ByteOf(seg, seg.offset + k);
+            arena.push_back(value);
+            // The byte that arrives first at an offset is the one the stream has to carry
+            if (!filled[seg.connection][seg.offset + k]) {
+                filled[seg.connection][seg.offset + k] = true;
+                expected[seg.connection][seg.offset + k] = static_cast<char>(value);
+            }
+        }
+    }
+
+    Connections replay(connections);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < arrivals.size(); ++i) {
+        replay.send(arrivals[i], arena.data() + payloads[i]);
+    }
+    double seconds = Seconds(start);
+    replay.reassembler.flush();
+    tcp_reassembly_stats stats = replay.reassembler.getStats();
+    std::cout << "Reassembly: " << arrivals.size() << " packets in " << seconds << " s, "
+              << arrivals.size() / seconds / 1e6 << " Mpps, " << stats.delivered / seconds / 1e6 << " MB/s, "
+              << stats.in_order << " in order, " << stats.out_of_order << " buffered, " << stats.retransmitted
+              << " bytes retransmitted" << std::endl;
+
+    uint32_t wrong = 0;
+    for (uint32_t c = 0; c < connections; ++c) {
+        wrong += replay.collector.streams[c] != expected[c];
+    }
+    std::cout << wrong << " of " << connections << " streams differ from the first bytes sent, "
+              << replay.collector.gaps << " bytes of gaps" << std::endl;
+    return ok && wrong == 0 && replay.collector.gaps == 0 ? 0 : 1;
+}
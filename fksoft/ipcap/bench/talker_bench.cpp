@@ -0,0 +1,243 @@
+/**
+ * @file    talker_bench.cpp
+ * @ingroup figkey
+ * @brief   Throughput and accuracy benchmark for the top talker sketches with synthetic traffic.
+ *          Flows are drawn from a Zipf distribution, and a share of the packets comes from a scan that sends
+ *          one packet from each of many fresh sources, the worst case for SpaceSaving. Measures a single
+ *          TalkerSketch, then the threads of a TopTalkers rotated every few milliseconds, whose reports must
+ *          add up to every packet. The whole trace counted as one interval is compared with exact counts: every
+ *          reported flow must lie within its bounds, and the recall of the true top flows by bytes is shown.
+ *
+ *          usage: talker_bench [--packets N] [--flows N] [--threads N] [--top N] [--scan PERCENT]
+ *            --packets   packets per phase, decoded up front (default: 2000000)
+ *            --flows     Zipf distributed flows (default: 100000)
+ *            --threads   counting threads of the TopTalkers phases (default: 4)
+ *            --top       entries per reported list (default: 10)
+ *            --scan      percent of the packets from one-packet scan sources (default: 20)
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "bench_util.h"
+#include "heavy_hitters.h"
+
+using namespace figkey;
+using namespace figkey::bench;
+
+namespace {
+
+void SetAddress(uint8_t* addr, uint32_t value) {
+    addr[0] = static_cast<uint8_t>(value >> 24);
+    addr[1] = static_cast<uint8_t>(value >> 16);
+    addr[2] = static_cast<uint8_t>(value >> 8);
+    addr[3] = static_cast<uint8_t>(value);
+}
+
+// Client to server packet of flow id; scan ids above the flows get a source of their own
+void MakePacket(uint64_t id, decoded_packet& packet) {
+    uint64_t r = SplitMix(id);
+    std::memset(&packet, 0, sizeof(packet));
+    packet.ip_version = 4;
+    packet.protocol = (r & 1) ? 6 : 17;
+    packet.flags = PKT_FLAG_IPV4 | PKT_FLAG_TRANSPORT;
+    SetAddress(packet.src_addr, 0x0a000000u | static_cast<uint32_t>(id & 0xffffff));
+    SetAddress(packet.dst_addr, 0xc0a80000u | static_cast<uint32_t>((r >> 8) & 0xff));
+    packet.src_port = static_cast<uint16_t>(1024 + ((r >> 24) % 60000));
+    packet.dst_port = static_cast<uint16_t>((r >> 40) & 0x3ff);
+}
+
+uint32_t Length(uint64_t id) {
+    return 64 + static_cast<uint32_t>(SplitMix(id ^ 0x51ed270b) % 1437);
+}
+
+struct exact_count {
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t packets = 2000000;
+    uint64_t flows = 100000;
+    unsigned threads = 4;
+    size_t top = 10;
+    unsigned scan = 20;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--packets" && i + 1 < argc) {
+            packets = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--flows" && i + 1 < argc) {
+            flows = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        }
+        else if (arg == "--top" && i + 1 < argc) {
+            top = static_cast<size_t>(std::atoi(argv[++i]));
+        }
+        else if (arg == "--scan" && i + 1 < argc) {
+            scan = static_cast<unsigned>(std::atoi(argv[++i]));
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--packets N] [--flows N] [--threads N] [--top N] [--scan PERCENT]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    if (packets == 0 || flows == 0 || threads == 0 || top == 0 || scan > 100) {
+        std::cerr << "--packets, --flows, --threads and --top must be positive, --scan at most 100" << std::endl;
+        return 1;
+    }
+
+    // Flow of every packet: Zipf with exponent 1.1 over the flows, or a fresh scan source
+    std::vector<double> cdf(flows);
+    double sum = 0;
+    for (uint64_t k = 0; k < flows; ++k) {
+        sum += 1.0 / std::pow(static_cast<double>(k + 1), 1.1);
+        cdf[k] = sum;
+    }
+    std::vector<uint64_t> ids(packets);
+    for (uint64_t i = 0; i < packets; ++i) {
+        uint64_t r = SplitMix(i ^ 0x2545f491);
+        if (r % 100 < scan) {
+            ids[i] = flows + i;
+        }
+        else {
+            double u = static_cast<double>(r >> 11) / 9007199254740992.0 * sum;
+            ids[i] = static_cast<uint64_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+        }
+    }
+    std::vector<decoded_packet> decoded(packets);
+    std::vector<uint32_t> lengths(packets);
+    for (uint64_t i = 0; i < packets; ++i) {
+        MakePacket(ids[i], decoded[i]);
+        lengths[i] = Length(ids[i]);
+    }
+
+    TopTalkerOptions options(top);
+    TalkerSketch single(options);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < packets; ++i) {
+        single.count(decoded[i], lengths[i]);
+    }
+    Report("single sketch", packets, Seconds(start));
+
+    // Threads count slices of the trace while the main thread rotates the intervals
+    auto countThreads = [&](TopTalkers& talkers, bool rotating, std::vector<talker_report>& reports) {
+        std::vector<ThreadTalkers*> sketches;
+        for (unsigned t = 0; t < threads; ++t) {
+            sketches.push_back(talkers.addThread());
+        }
+        talkers.start(0);
+        std::atomic<unsigned> running{threads};
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                for (uint64_t i = t; i < packets; i += threads) {
+                    sketches[t]->count(decoded[i], lengths[i]);
+                }
+                running.fetch_sub(1);
+            });
+        }
+        uint64_t time = 0;
+        talker_report report;
+        while (rotating && running.load() > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            if (talkers.rotate(++time, report)) {
+                reports.push_back(report);
+            }
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (ThreadTalkers* sketch : sketches) {
+            sketch->flush();
+        }
+        for (const talker_report& last : talkers.finish(++time)) {
+            reports.push_back(last);
+        }
+    };
+
+    std::vector<talker_report> reports;
+    TopTalkers rotated(options);
+    start = std::chrono::steady_clock::now();
+    countThreads(rotated, true, reports);
+    Report("threads, rotated", packets, Seconds(start));
+    uint64_t reported = 0;
+    for (const talker_report& report : reports) {
+        reported += report.packets;
+    }
+    std::cout << reports.size() << " reports with " << reported << " packets" << std::endl;
+    if (reported != packets) {
+        return 1;
+    }
+
+    reports.clear();
+    TopTalkers whole(options);
+    countThreads(whole, false, reports);
+    const talker_report& report = reports.back();
+
+    std::unordered_map<uint64_t, exact_count> exact;
+    for (uint64_t i = 0; i < packets; ++i) {
+        exact_count& count = exact[ids[i]];
+        ++count.packets;
+        count.bytes += lengths[i];
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> heaviest;
+    for (const auto& flow : exact) {
+        heaviest.emplace_back(flow.second.bytes, flow.first);
+    }
+    size_t shown = std::min(top, heaviest.size());
+    std::partial_sort(heaviest.begin(), heaviest.begin() + static_cast<std::ptrdiff_t>(shown), heaviest.end(),
+                      [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
+                          return a.first > b.first;
+                      });
+
+    // Key of every flow id as the report has it
+    std::unordered_map<uint64_t, uint64_t> ofKey;
+    for (const auto& flow : exact) {
+        decoded_packet packet;
+        MakePacket(flow.first, packet);
+        flow_key key;
+        bool reversed;
+        FlowTable::makeKey(packet, key, reversed);
+        ofKey[FlowTable::hashKey(key)] = flow.first;
+    }
+    size_t found = 0;
+    uint64_t outOfBounds = 0;
+    double worstError = 0;
+    for (const talker_entry& entry : report.by_bytes[TALKER_FLOW]) {
+        auto id = ofKey.find(FlowTable::hashKey(entry.key));
+        if (id == ofKey.end()) {
+            ++outOfBounds;
+            continue;
+        }
+        uint64_t truth = exact[id->second].bytes;
+        if (entry.bytes < truth || entry.bytes - entry.error > truth) {
+            ++outOfBounds;
+        }
+        worstError = std::max(worstError, static_cast<double>(entry.bytes - truth) / truth);
+        for (size_t k = 0; k < shown; ++k) {
+            found += heaviest[k].second == id->second;
+        }
+    }
+    std::cout << "Top " << shown << " flows by bytes: " << found << " found, " << outOfBounds
+              << " outside their bounds, worst overestimate " << worstError * 100 << " %, " << exact.size()
+              << " distinct flows" << std::endl;
+    return outOfBounds == 0 ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+// capture_stats.cpp: 抓包统计
+//
+
+#include "capture_stats.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace figkey {
+
+namespace {
+
+const char* const PROTOCOL_NAMES[STAT_PROTOCOLS] = {"tcp", "udp", "icmp", "other_ip", "non_ip"};
+
+uint64_t WallClockNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Counters can only grow, a kernel counter that went back (e.g. a reopened socket) counts as no change
+inline uint64_t Delta(uint64_t current, uint64_t previous) {
+    return current > previous ? current - previous : 0;
+}
+
+void WriteSample(std::ostream& out, const capture_stats_sample& sample) {
+    out << "{\"time_ns\": " << sample.time_ns << ", \"interval_ns\": " << sample.interval_ns
+        << ", \"packets\": " << sample.packets << ", \"bytes\": " << sample.bytes;
+    for (int i = 0; i < STAT_PROTOCOLS; ++i) {
+        out << ", \"" << PROTOCOL_NAMES[i] << "\": " << sample.protocols[i];
+    }
+    out << ", \"decode_errors\": " << sample.decode_errors << ", \"errors\": " << sample.errors
+        << ", \"queue_drops\": " << sample.queue_drops << ", \"checksum_errors\": " << sample.checksum_errors
+        << ", \"kernel_received\": " << sample.kernel_received
+        << ", \"kernel_drops\": " << sample.kernel_drops << "}";
+}
+
+}  // namespace
+
+CaptureStats::~CaptureStats() {
+    stop();
+}
+
+void CaptureStats::reset() {
+    std::lock_guard<std::mutex> guard(lock);
+    threads.clear();
+    samples.clear();
+    talkers.reset();
+    talkerReports.clear();
+    previous = capture_stats_sample{};
+    finalTotals = capture_stats_sample{};
+}
+
+thread_counters* CaptureStats::addThread() {
+    std::lock_guard<std::mutex> guard(lock);
+    threads.push_back(std::make_unique<thread_counters>());
+    if (talkers) {
+        threads.back()->talkers = talkers->addThread();
+    }
+    return threads.back().get();
+}
+
+void CaptureStats::start(const KernelSource& source, const CaptureStatsOptions& stats_options, bool sample) {
+    stop();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        kernel = source;
+        options = stats_options;
+        if (options.intervalMs == 0) {
+            options.intervalMs = 1000;
+        }
+        started = true;
+        previous = collect();
+        if (options.talkers.top > 0 && !talkers) {
+            talkers = std::make_unique<TopTalkers>(options.talkers);
+            for (const auto& counters : threads) {
+                counters->talkers = talkers->addThread();
+            }
+        }
+        if (talkers) {
+            talkers->start(previous.time_ns);
+        }
+    }
+    if (sample) {
+        stopping = false;
+        sampler = std::thread(&CaptureStats::run, this);
+    }
+}
+
+void CaptureStats::stop() {
+    if (sampler.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(wakeLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        sampler.join();
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    if (!started) {
+        return;
+    }
+    finalTotals = collect();
+    started = false;
+    if (talkers) {
+        // The last interval is empty when the sampler rotated just before
+        std::vector<talker_report> reports = talkers->finish(finalTotals.time_ns);
+        for (size_t i = 0; i < reports.size(); ++i) {
+            if (reports[i].packets > 0 || i + 1 < reports.size() || talkerReports.empty()) {
+                addTalkerReport(reports[i]);
+            }
+        }
+    }
+    kernel = KernelSource();
+}
+
+capture_stats_sample CaptureStats::totals() {
+    std::lock_guard<std::mutex> guard(lock);
+    return started ? collect() : finalTotals;
+}
+
+std::vector<capture_stats_sample> CaptureStats::history(size_t count) const {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t first = count > 0 && count < samples.size() ? samples.size() - count : 0;
+    return std::vector<capture_stats_sample>(samples.begin() + static_cast<std::ptrdiff_t>(first), samples.end());
+}
+
+std::vector<talker_report> CaptureStats::topTalkers(size_t count) const {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t first = count > 0 && count < talkerReports.size() ? talkerReports.size() - count : 0;
+    return std::vector<talker_report>(talkerReports.begin() + static_cast<std::ptrdiff_t>(first),
+                                      talkerReports.end());
+}
+
+void CaptureStats::run() {
+    auto interval = std::chrono::milliseconds(options.intervalMs);
+    auto next = std::chrono::steady_clock::now() + interval;
+    bool last = false;
+    while (!last) {
+        {
+            std::unique_lock<std::mutex> guard(wakeLock);
+            last = wake.wait_until(guard, next, [this] { return stopping; });
+        }
+        next += interval;
+
+        capture_stats_sample current;
+        capture_stats_sample sample;
+        talker_report report;
+        bool reported = false;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            current = collect();
+            sample = addSample(current);
+            if (talkers && talkers->rotate(current.time_ns, report)) {
+                addTalkerReport(report);
+                reported = true;
+            }
+        }
+        if (!options.snapshotPath.empty()) {
+            // Reported once until a snapshot succeeds again, not every interval
+            std::string error;
+            if (writeSnapshot(current, sample, reported ? &report : nullptr, error)) {
+                snapshotFailing = false;
+            }
+            else if (!snapshotFailing) {
+                std::cerr << "Couldn't write stats snapshot " << options.snapshotPath << ": " << error << std::endl;
+                snapshotFailing = true;
+            }
+        }
+    }
+}
+
+capture_stats_sample CaptureStats::collect() const {
+    capture_stats_sample current{};
+    current.time_ns = WallClockNs();
+    for (const auto& counters : threads) {
+        current.packets += counters->packets.load(std::memory_order_relaxed);
+        current.bytes += counters->bytes.load(std::memory_order_relaxed);
+        for (int i = 0; i < STAT_PROTOCOLS; ++i) {
+            current.protocols[i] += counters->protocols[i].load(std::memory_order_relaxed);
+        }
+        current.decode_errors += counters->decode_errors.load(std::memory_order_relaxed);
+        current.errors += counters->errors.load(std::memory_order_relaxed);
+        current.queue_drops += counters->queue_drops.load(std::memory_order_relaxed);
+        current.checksum_errors += counters->checksum_errors.load(std::memory_order_relaxed);
+    }
+    if (kernel) {
+        kernel_counters counters = kernel();
+        current.kernel_received = counters.received;
+        current.kernel_drops = counters.drops;
+    }
+    return current;
+}
+
+capture_stats_sample CaptureStats::addSample(const capture_stats_sample& current) {
+    capture_stats_sample sample{};
+    sample.time_ns = current.time_ns;
+    sample.interval_ns = Delta(current.time_ns, previous.time_ns);
+    sample.packets = Delta(current.packets, previous.packets);
+    sample.bytes = Delta(current.bytes, previous.bytes);
+    for (int i = 0; i < STAT_PROTOCOLS; ++i) {
+        sample.protocols[i] = Delta(current.protocols[i], previous.protocols[i]);
+    }
+    sample.decode_errors = Delta(current.decode_errors, previous.decode_errors);
+    sample.errors = Delta(current.errors, previous.errors);
+    sample.queue_drops = Delta(current.queue_drops, previous.queue_drops);
+    sample.checksum_errors = Delta(current.checksum_errors, previous.checksum_errors);
+    sample.kernel_received = Delta(current.kernel_received, previous.kernel_received);
+    sample.kernel_drops = Delta(current.kernel_drops, previous.kernel_drops);
+    previous = current;
+
+    samples.push_back(sample);
+    while (samples.size() > options.history) {
+        samples.pop_front();
+    }
+    return sample;
+}
+
+void CaptureStats::addTalkerReport(const talker_report& report) {
+    talkerReports.push_back(report);
+    while (talkerReports.size() > options.history) {
+        talkerReports.pop_front();
+    }
+}
+
+bool CaptureStats::writeSnapshot(const capture_stats_sample& current, const capture_stats_sample& sample,
+                                 const talker_report* report, std::string& error) const {
+    // Written next to the snapshot and renamed over it, so readers never see a partial file
+    std::string temporary = options.snapshotPath + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        if (!out) {
+            error = "cannot open " + temporary + ": " + std::strerror(errno);
+            return false;
+        }
+        out << "{\"totals\": ";
+        WriteSample(out, current);
+        out << ",\n \"last\": ";
+        WriteSample(out, sample);
+        if (report) {
+            out << ",\n \"top_talkers\": ";
+            TopTalkers::writeJson(out, *report);
+        }
+        out << "}\n";
+        out.close();
+        if (!out) {
+            error = "cannot write " + temporary;
+            return false;
+        }
+    }
+    // std::rename does not replace an existing file on Windows
+#ifdef _WIN32
+    if (!MoveFileExA(temporary.c_str(), options.snapshotPath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        error = "cannot replace it with " + temporary + ", error " + std::to_string(GetLastError());
+        return false;
+    }
+#else
+    if (std::rename(temporary.c_str(), options.snapshotPath.c_str()) != 0) {
+        error = "cannot replace it with " + temporary + ": " + std::strerror(errno);
+        return false;
+    }
+#endif
+    return true;
+}
+
+}  // namespace figkey
@@ -0,0 +1,198 @@
+/**
+ * @file    capture_stats.h
+ * @ingroup figkey
+ * @brief   Capture statistics: per-thread counters merged into a per-second time series.
+ *          Every capture thread and pipeline worker counts into a thread_counters block of its own, aligned to
+ *          cache lines so no two threads ever write the same line, and updated with plain relaxed stores
+ *          instead of locked increments. A sampling thread sums the blocks once per interval, adds the kernel
+ *          receive and drop counters, and keeps the differences as a bounded history that can be read through
+ *          the API and, optionally, from a JSON snapshot file rewritten after every sample.
+ *          With top talkers on, every thread also feeds a TalkerSketch of its own (heavy_hitters.h), and the
+ *          sampling thread rotates them with each sample into a history of per-interval top lists.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_CAPTURE_STATS_HPP
+#define FIGKEY_CAPTURE_STATS_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "heavy_hitters.h"
+#include "packet_decoder.h"
+
+namespace figkey {
+
+// Index into the protocol counters
+enum StatProtocol {
+    STAT_TCP,
+    STAT_UDP,
+    STAT_ICMP,          // ICMP and ICMPv6
+    STAT_OTHER_IP,
+    STAT_NON_IP,
+    STAT_PROTOCOLS
+};
+
+// Counters of one capture thread or worker. Only that thread writes them
+struct alignas(64) thread_counters {
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> bytes{0};             // Wire length
+    std::atomic<uint64_t> protocols[STAT_PROTOCOLS] = {};
+    std::atomic<uint64_t> decode_errors{0};     // Truncated, malformed or of an unsupported link type
+    std::atomic<uint64_t> errors{0};            // Packets the handler could not account, e.g. with the flow table full
+    std::atomic<uint64_t> queue_drops{0};       // Packets dropped by a full pipeline ring
+    std::atomic<uint64_t> checksum_errors{0};   // Packets with a bad IP or transport checksum, when validated
+    ThreadTalkers* talkers{nullptr};            // Top talker sketch of the thread, when enabled
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Counts a decoded packet
+    void count(uint32_t length, const decoded_packet& packet, DecodeStatus status) {
+        add(packets, 1);
+        add(bytes, length);
+        int protocol = STAT_NON_IP;
+        if (packet.ip_version != 0) {
+            switch (packet.protocol) {
+            case 6: protocol = STAT_TCP; break;
+            case 17: protocol = STAT_UDP; break;
+            case 1:
+            case 58: protocol = STAT_ICMP; break;
+            default: protocol = STAT_OTHER_IP; break;
+            }
+        }
+        add(protocols[protocol], 1);
+        if (status != DecodeStatus::OK && status != DecodeStatus::NOT_IP) {
+            add(decode_errors, 1);
+        }
+        if (talkers) {
+            talkers->count(packet, length);
+        }
+    }
+
+    // Counts packets handed on without being decoded, e.g. in batches
+    void count(uint64_t packet_count, uint64_t byte_count) {
+        add(packets, packet_count);
+        add(bytes, byte_count);
+    }
+};
+
+// Kernel side of the capture, as far as the backend reports it
+struct kernel_counters {
+    uint64_t received;      // Packets the kernel (or the replay filter) passed to the capture
+    uint64_t drops;         // Packets dropped before the capture saw them
+};
+
+// Counter values, either totals since the capture started or the increase over one interval
+struct capture_stats_sample {
+    uint64_t time_ns;       // Wall clock at the end of the interval, or when the totals were taken
+    uint64_t interval_ns;   // Length of the interval, 0 for totals
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t protocols[STAT_PROTOCOLS];
+    uint64_t decode_errors;
+    uint64_t errors;
+    uint64_t queue_drops;
+    uint64_t checksum_errors;
+    uint64_t kernel_received;
+    uint64_t kernel_drops;
+};
+
+struct CaptureStatsOptions {
+    uint32_t intervalMs;        // Sampling interval
+    size_t history;             // Samples kept, older ones are dropped
+    std::string snapshotPath;   // Rewritten after every sample, empty for none
+    TopTalkerOptions talkers;   // Top talkers per interval, with talkers.top 0 for none
+
+    CaptureStatsOptions(uint32_t interval_ms = 1000, size_t history_samples = 300,
+                        const std::string& snapshot_path = std::string(),
+                        const TopTalkerOptions& top_talkers = TopTalkerOptions(0))
+            : intervalMs(interval_ms), history(history_samples), snapshotPath(snapshot_path),
+              talkers(top_talkers) {}
+};
+
+class CaptureStats {
+public:
+    using KernelSource = std::function<kernel_counters()>;
+
+    CaptureStats() = default;
+    ~CaptureStats();
+
+    CaptureStats(const CaptureStats&) = delete;
+    CaptureStats& operator=(const CaptureStats&) = delete;
+
+    // Forgets all threads, totals and samples. Not while started
+    void reset();
+
+    // Counters for one more thread, valid until reset. May be called while started
+    thread_counters* addThread();
+
+    // Starts counting a capture whose kernel counters come from source (may be empty). With sample set a thread
+    // takes a sample every interval
+    void start(const KernelSource& source, const CaptureStatsOptions& options, bool sample);
+
+    // Takes the final totals and, when sampling, a last sample of the partial interval. Then source is not
+    // called any more
+    void stop();
+
+    // Totals so far while started, the final ones after stop
+    capture_stats_sample totals();
+
+    // Samples oldest first, the newest count of them (0 for all)
+    std::vector<capture_stats_sample> history(size_t count = 0) const;
+
+    // Top talker reports oldest first, the newest count of them (0 for all). A report is added one interval after
+    // the one it covers; stop adds the rest. Without sampling there is a single report of the whole capture
+    std::vector<talker_report> topTalkers(size_t count = 0) const;
+
+private:
+    mutable std::mutex lock;
+    std::deque<std::unique_ptr<thread_counters>> threads;
+    std::deque<capture_stats_sample> samples;
+    std::unique_ptr<TopTalkers> talkers;
+    std::deque<talker_report> talkerReports;
+    capture_stats_sample previous{};    // Totals at the last sample
+    capture_stats_sample finalTotals{};
+    KernelSource kernel;
+    CaptureStatsOptions options;
+    bool started{false};
+
+    std::thread sampler;
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    bool stopping{false};
+    bool snapshotFailing{false};    // The last snapshot could not be written, sampler thread only
+
+    void run();
+
+    // Sums the thread counters and asks the kernel, lock held
+    capture_stats_sample collect() const;
+
+    // Appends and returns the difference to the previous totals, lock held
+    capture_stats_sample addSample(const capture_stats_sample& current);
+
+    // Appends a top talker report, lock held
+    void addTalkerReport(const talker_report& report);
+
+    // With talker_report the newest top talkers, or nullptr. Returns false with error set if the snapshot could
+    // not be replaced
+    bool writeSnapshot(const capture_stats_sample& current, const capture_stats_sample& sample,
+                       const talker_report* report, std::string& error) const;
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_CAPTURE_STATS_HPP
@@ -0,0 +1,325 @@
+// capture_writer.cpp: pcap/pcapng 写文件线程
+//
+#include "capture_writer.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include "pcap_file.h"
+
+namespace figkey {
+
+namespace {
+
+constexpr size_t BUFFER_ALIGN = 4096;
+constexpr size_t DRAIN_BATCH = 256;
+constexpr unsigned FLUSH_IDLE_MS = 1000;    // Idle time after which a partly filled buffer is written anyway
+constexpr uint64_t NANOS_PER_SECOND = 1000000000ULL;
+constexpr uint16_t PCAPNG_OPT_IF_NAME = 2;
+
+struct pcap_file_header_v24 {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_header {
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+inline size_t Pad4(size_t size) {
+    return (size + 3) & ~static_cast<size_t>(3);
+}
+
+template<typename T>
+inline unsigned char* Put(unsigned char* p, T value) {
+    std::memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+}
+
+// Adds a pcapng option with its value padded to 32 bits
+unsigned char* PutOption(unsigned char* p, uint16_t code, const void* value, size_t length) {
+    p = Put(p, code);
+    p = Put(p, static_cast<uint16_t>(length));
+    std::memcpy(p, value, length);
+    std::memset(p + length, 0, Pad4(length) - length);
+    return p + Pad4(length);
+}
+
+}  // namespace
+
+CaptureWriter::CaptureWriter(const CaptureWriterOptions& writer_options) : options(writer_options) {
+    if (options.snaplen == 0) {
+        options.snaplen = 65535;
+    }
+    // A buffer always has room for the largest record, and is written in whole pages
+    size_t minimum = options.snaplen + 64;
+    if (options.bufferSize < minimum) {
+        options.bufferSize = minimum;
+    }
+    options.bufferSize = (options.bufferSize + BUFFER_ALIGN - 1) / BUFFER_ALIGN * BUFFER_ALIGN;
+    buffer = static_cast<unsigned char*>(::operator new(options.bufferSize, std::align_val_t(BUFFER_ALIGN)));
+}
+
+CaptureWriter::~CaptureWriter() {
+    stop();
+    ::operator delete(buffer, std::align_val_t(BUFFER_ALIGN));
+}
+
+uint32_t CaptureWriter::addInterface(const std::string& name, int link_type, uint32_t ts_unit_ns) {
+    interfaces.push_back(interface_info{name, link_type, ts_unit_ns > 0 ? ts_unit_ns : 1000});
+    return static_cast<uint32_t>(interfaces.size() - 1);
+}
+
+PacketRing* CaptureWriter::addQueue(uint32_t interface_id) {
+    queues.push_back(queue_info{std::make_unique<PacketRing>(options.ringSlots, options.snaplen), interface_id});
+    return queues.back().ring.get();
+}
+
+bool CaptureWriter::start(const std::string& path) {
+    stop();
+    if (interfaces.empty()) {
+        error = "no interface to record";
+        return false;
+    }
+    basePath = path;
+    rotating = options.rotateBytes > 0 || options.rotateSeconds > 0;
+    fileNumber = 0;
+    files.clear();
+    if (!openFile()) {
+        return false;
+    }
+    stopping.store(false);
+    thread = std::thread(&CaptureWriter::run, this);
+    return true;
+}
+
+void CaptureWriter::stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+    stopping.store(true, std::memory_order_release);
+    thread.join();
+}
+
+capture_writer_stats CaptureWriter::getStats() const {
+    capture_writer_stats stats{};
+    stats.packets = packetCount.load(std::memory_order_relaxed);
+    stats.bytes = byteCount.load(std::memory_order_relaxed);
+    stats.dropped = failedCount.load(std::memory_order_relaxed);
+    stats.files = fileCount.load(std::memory_order_relaxed);
+    for (const auto& queue : queues) {
+        stats.dropped += queue.ring->dropped();
+        stats.truncated += queue.ring->truncated();
+    }
+    return stats;
+}
+
+void CaptureWriter::run() {
+    PacketBatch batch(DRAIN_BATCH);
+    unsigned idleMs = 0;
+    while (true) {
+        // Read before draining, so every packet queued before the stop request is written
+        bool stop = stopping.load(std::memory_order_acquire);
+        if (drain(batch) > 0) {
+            idleMs = 0;
+            continue;
+        }
+        if (stop) {
+            break;
+        }
+        if (++idleMs == FLUSH_IDLE_MS) {
+            flush();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    closeFile();
+}
+
+size_t CaptureWriter::drain(PacketBatch& batch) {
+    size_t total = 0;
+    for (const auto& queue : queues) {
+        const interface_info& interface = interfaces[queue.interface_id];
+        size_t count = queue.ring->peek(batch, batch.capacity());
+        for (const packet_view& view : batch) {
+            writePacket(interface, queue.interface_id, view.header, view.data);
+        }
+        batch.clear();
+        queue.ring->release(count);
+        total += count;
+    }
+    return total;
+}
+
+void CaptureWriter::writePacket(const interface_info& interface, uint32_t interface_id,
+                                const struct pcap_pkthdr& header, const unsigned char* data) {
+    uint64_t timestamp = static_cast<uint64_t>(header.ts.tv_sec) * NANOS_PER_SECOND +
+                         static_cast<uint64_t>(header.ts.tv_usec) * interface.ts_unit_ns;
+    const bool pcapng = options.format == CaptureFileFormat::PCAPNG;
+    size_t size = pcapng ? 32 + Pad4(header.caplen) : sizeof(pcap_record_header) + header.caplen;
+
+    if (file && rotating && filePackets > 0) {
+        bool full = options.rotateBytes > 0 && fileBytes + size > options.rotateBytes;
+        bool old = options.rotateSeconds > 0 && timestamp >= fileStartNs + options.rotateSeconds * NANOS_PER_SECOND;
+        if (full || old) {
+            closeFile();
+            openFile();
+        }
+    }
+    if (!file) {
+        failedCount.store(failedCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    if (filePackets++ == 0) {
+        fileStartNs = timestamp;
+    }
+
+    unsigned char* p = reserve(size);
+    if (pcapng) {
+        p = Put(p, PCAPNG_BLOCK_EPB);
+        p = Put(p, static_cast<uint32_t>(size));
+        p = Put(p, interface_id);
+        p = Put(p, static_cast<uint32_t>(timestamp >> 32));
+        p = Put(p, static_cast<uint32_t>(timestamp));
+        p = Put(p, static_cast<uint32_t>(header.caplen));
+        p = Put(p, static_cast<uint32_t>(header.len));
+        std::memcpy(p, data, header.caplen);
+        std::memset(p + header.caplen, 0, Pad4(header.caplen) - header.caplen);
+        p += Pad4(header.caplen);
+        Put(p, static_cast<uint32_t>(size));
+    }
+    else {
+        pcap_record_header record;
+        record.ts_sec = static_cast<uint32_t>(timestamp / NANOS_PER_SECOND);
+        record.ts_nsec = static_cast<uint32_t>(timestamp % NANOS_PER_SECOND);
+        record.caplen = header.caplen;
+        record.len = header.len;
+        p = Put(p, record);
+        std::memcpy(p, data, header.caplen);
+    }
+    packetCount.store(packetCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+bool CaptureWriter::openFile() {
+    std::string path = basePath;
+    if (rotating) {
+        // Number goes before the extension, so rotated files keep it
+        size_t slash = basePath.find_last_of("/\\");
+        size_t dot = basePath.find_last_of('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+            dot = basePath.size();
+        }
+        char number[16];
+        std::snprintf(number, sizeof(number), "_%05llu", static_cast<unsigned long long>(fileNumber));
+        path = basePath.substr(0, dot) + number + basePath.substr(dot);
+    }
+    ++fileNumber;
+
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        error = "couldn't create " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    // The buffer is already large, stdio buffering would only add a copy
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    fileCount.store(fileCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    fileBytes = 0;
+    filePackets = 0;
+    if (rotating) {
+        files.push_back(path);
+        if (options.maxFiles > 0 && files.size() > options.maxFiles) {
+            std::remove(files.front().c_str());
+            files.pop_front();
+        }
+    }
+    writeFileHeader();
+    return true;
+}
+
+void CaptureWriter::closeFile() {
+    if (!file) {
+        return;
+    }
+    flush();
+    if (file) {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+void CaptureWriter::writeFileHeader() {
+    if (options.format == CaptureFileFormat::PCAP) {
+        pcap_file_header_v24 header;
+        header.magic = PCAP_MAGIC_NANO;
+        header.version_major = 2;
+        header.version_minor = 4;
+        header.thiszone = 0;
+        header.sigfigs = 0;
+        header.snaplen = static_cast<uint32_t>(options.snaplen);
+        header.linktype = static_cast<uint32_t>(interfaces.front().link_type);
+        Put(reserve(sizeof(header)), header);
+        return;
+    }
+
+    unsigned char* p = reserve(28);
+    p = Put(p, PCAPNG_BLOCK_SHB);
+    p = Put(p, static_cast<uint32_t>(28));
+    p = Put(p, PCAPNG_BYTE_ORDER_MAGIC);
+    p = Put(p, static_cast<uint16_t>(1));
+    p = Put(p, static_cast<uint16_t>(0));
+    p = Put(p, static_cast<int64_t>(-1));   // Section length unknown
+    Put(p, static_cast<uint32_t>(28));
+
+    const uint8_t resolution = 9;           // 10^-9 s
+    for (const interface_info& interface : interfaces) {
+        size_t nameLength = interface.name.size() < 0xFFFF ? interface.name.size() : 0;
+        size_t size = 20 + (nameLength > 0 ? 4 + Pad4(nameLength) : 0) + 8 + 4;
+        p = reserve(size);
+        p = Put(p, PCAPNG_BLOCK_IDB);
+        p = Put(p, static_cast<uint32_t>(size));
+        p = Put(p, static_cast<uint16_t>(interface.link_type));
+        p = Put(p, static_cast<uint16_t>(0));
+        p = Put(p, static_cast<uint32_t>(options.snaplen));
+        if (nameLength > 0) {
+            p = PutOption(p, PCAPNG_OPT_IF_NAME, interface.name.data(), nameLength);
+        }
+        p = PutOption(p, PCAPNG_OPT_IF_TSRESOL, &resolution, 1);
+        p = Put(p, PCAPNG_OPT_ENDOFOPT);
+        p = Put(p, static_cast<uint16_t>(0));
+        Put(p, static_cast<uint32_t>(size));
+    }
+}
+
+unsigned char* CaptureWriter::reserve(size_t size) {
+    if (used + size > options.bufferSize) {
+        flush();
+    }
+    unsigned char* p = buffer + used;
+    used += size;
+    fileBytes += size;
+    return p;
+}
+
+void CaptureWriter::flush() {
+    size_t pending = used;
+    used = 0;
+    if (!file || pending == 0) {
+        return;
+    }
+    if (std::fwrite(buffer, 1, pending, file) != pending) {
+        error = std::string("write failed: ") + std::strerror(errno);
+        std::fclose(file);
+        file = nullptr;
+        return;
+    }
+    byteCount.store(byteCount.load(std::memory_order_relaxed) + pending, std::memory_order_relaxed);
+}
+
+}  // namespace figkey
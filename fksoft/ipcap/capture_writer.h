@@ -0,0 +1,153 @@
+/**
+ * @file    capture_writer.h
+ * @ingroup figkey
+ * @brief   pcap/pcapng writer that records traffic to disk on its own thread.
+ *          Capture threads only copy packets into an SPSC PacketRing per producer and never wait for the disk;
+ *          when a ring is full the packet is dropped and counted. The writer thread drains the rings into a
+ *          page-aligned buffer and writes it in large chunks. Files are rotated by size and/or capture time,
+ *          with a bounded number of files the oldest one is deleted (ring-buffer mode).
+ *
+ *          Both formats carry nanosecond timestamps: pcap files use the nanosecond magic, pcapng files have one
+ *          interface description block per interface with if_tsresol 9. Every rotated file starts with its own
+ *          headers, so each one can be read on its own.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_CAPTURE_WRITER_HPP
+#define FIGKEY_CAPTURE_WRITER_HPP
+
+#include <pcap.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "packet_batch.h"
+#include "packet_ring.h"
+
+namespace figkey {
+
+enum class CaptureFileFormat {
+    PCAP,
+    PCAPNG
+};
+
+struct CaptureWriterOptions {
+    CaptureFileFormat format;
+    uint64_t rotateBytes;   // Start a new file once this many bytes are written, 0 never
+    uint32_t rotateSeconds; // Start a new file after this much capture time, 0 never
+    unsigned maxFiles;      // Keep only the newest maxFiles files of a rotating capture, 0 keeps all
+    size_t ringSlots;       // Packets queued per producer, rounded up to a power of two
+    size_t snaplen;         // Bytes written per packet, longer packets are truncated
+    size_t bufferSize;      // Bytes per write
+
+    CaptureWriterOptions(CaptureFileFormat file_format = CaptureFileFormat::PCAPNG, uint64_t rotate_bytes = 0,
+                         uint32_t rotate_seconds = 0, unsigned max_files = 0, size_t slots = 16384,
+                         size_t snap_len = 2048, size_t buffer_size = 4 << 20)
+            : format(file_format), rotateBytes(rotate_bytes), rotateSeconds(rotate_seconds), maxFiles(max_files),
+              ringSlots(slots), snaplen(snap_len), bufferSize(buffer_size) {}
+};
+
+struct capture_writer_stats {
+    uint64_t packets;   // Packets written
+    uint64_t bytes;     // Bytes written, file headers included
+    uint64_t dropped;   // Packets dropped because a ring was full or the disk failed
+    uint64_t truncated; // Packets cut to snaplen
+    uint64_t files;     // Files started
+};
+
+class CaptureWriter {
+public:
+    explicit CaptureWriter(const CaptureWriterOptions& options = CaptureWriterOptions());
+    ~CaptureWriter();
+
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    // Describes an interface, returns its pcapng interface id. ts_unit_ns is the unit of pkthdr ts.tv_usec:
+    // 1000 for microsecond captures, 1 for nanosecond ones. pcap files hold a single link type, the one of the
+    // first interface. Call before start
+    uint32_t addInterface(const std::string& name, int link_type, uint32_t ts_unit_ns = 1000);
+
+    // Adds the ring of one producer thread, whose packets belong to interface_id. Call before start
+    PacketRing* addQueue(uint32_t interface_id);
+
+    // Opens the first file and starts the writer thread. With rotation the files are named
+    // <path stem>_<number><extension>, otherwise path is used as is
+    bool start(const std::string& path);
+
+    // Writes everything still queued, closes the file and joins the writer thread. Producers must have stopped
+    void stop();
+
+    bool isRunning() const { return thread.joinable(); }
+
+    capture_writer_stats getStats() const;
+
+    const std::string& lastError() const { return error; }
+
+private:
+    struct interface_info {
+        std::string name;
+        int link_type;
+        uint32_t ts_unit_ns;
+    };
+
+    struct queue_info {
+        std::unique_ptr<PacketRing> ring;
+        uint32_t interface_id;
+    };
+
+    CaptureWriterOptions options;
+    std::vector<interface_info> interfaces;
+    std::vector<queue_info> queues;
+    std::string basePath;
+    bool rotating{false};
+
+    FILE* file{nullptr};
+    unsigned char* buffer{nullptr};     // Page aligned, written out whenever it is full
+    size_t used{0};
+    uint64_t fileBytes{0};
+    uint64_t filePackets{0};
+    uint64_t fileStartNs{0};            // Timestamp of the first packet in the current file
+    uint64_t fileNumber{0};
+    std::deque<std::string> files;      // Files of a rotating capture, oldest first
+
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> packetCount{0};
+    std::atomic<uint64_t> byteCount{0};
+    std::atomic<uint64_t> failedCount{0};
+    std::atomic<uint64_t> fileCount{0};
+    std::string error;
+
+    void run();
+
+    // Writes up to one batch from every queue, returns how many packets
+    size_t drain(PacketBatch& batch);
+
+    void writePacket(const interface_info& interface, uint32_t interface_id, const struct pcap_pkthdr& header,
+                     const unsigned char* data);
+
+    bool openFile();
+
+    void closeFile();
+
+    void writeFileHeader();
+
+    // Room for size bytes in the buffer, writing it out first if needed
+    unsigned char* reserve(size_t size);
+
+    void flush();
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_CAPTURE_WRITER_HPP
@@ -0,0 +1,313 @@
+// checksum.cpp: IP/TCP/UDP 校验和
+//
+
+#include "checksum.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FIGKEY_CHECKSUM_SSE2
+#if defined(__GNUC__) || defined(_MSC_VER)
+#include <immintrin.h>
+#define FIGKEY_CHECKSUM_AVX2
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FIGKEY_TARGET_AVX2
+#else
+#define FIGKEY_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace figkey {
+
+namespace {
+
+const uint8_t PROTO_ICMP = 1;
+const uint8_t PROTO_TCP = 6;
+const uint8_t PROTO_UDP = 17;
+const uint8_t PROTO_ICMPV6 = 58;
+const size_t VECTOR_MIN = 64;       // Shorter data is summed by the scalar kernel, the setup would not pay off
+
+inline uint32_t Fold(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFFULL) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFFULL) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return static_cast<uint32_t>(sum);
+}
+
+// 32-bit words added into 64 bits can't overflow for any packet size, and 2^16 = 1 in ones' complement
+// arithmetic, so the sum of 32-bit words folds to the sum of 16-bit words
+uint64_t SumScalar(const unsigned char* data, size_t length, uint64_t sum) {
+    while (length >= 16) {
+        uint32_t w[4];
+        std::memcpy(w, data, sizeof(w));
+        sum += static_cast<uint64_t>(w[0]) + w[1] + w[2] + w[3];
+        data += 16;
+        length -= 16;
+    }
+    while (length >= 4) {
+        uint32_t w;
+        std::memcpy(&w, data, sizeof(w));
+        sum += w;
+        data += 4;
+        length -= 4;
+    }
+    if (length >= 2) {
+        uint16_t w;
+        std::memcpy(&w, data, sizeof(w));
+        sum += w;
+        data += 2;
+        length -= 2;
+    }
+    if (length > 0) {
+        // The odd byte is the first byte of a word padded with zero, whatever the host byte order
+        uint16_t w = 0;
+        std::memcpy(&w, data, 1);
+        sum += w;
+    }
+    return sum;
+}
+
+#ifdef FIGKEY_CHECKSUM_SSE2
+// 16-bit words are widened to 32-bit lanes, which are moved into 64-bit lanes before they could overflow
+uint64_t SumSse2(const unsigned char* data, size_t length, uint64_t sum) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = _mm_setzero_si128();
+    while (length >= 16) {
+        size_t blocks = length / 16;
+        if (blocks > 16384) {
+            blocks = 16384;     // Each 32-bit lane takes at most 2 * 0xFFFF per block
+        }
+        __m128i lanes = _mm_setzero_si128();
+        for (size_t i = 0; i < blocks; ++i) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            lanes = _mm_add_epi32(lanes, _mm_unpacklo_epi16(v, zero));
+            lanes = _mm_add_epi32(lanes, _mm_unpackhi_epi16(v, zero));
+            data += 16;
+        }
+        length -= blocks * 16;
+        total = _mm_add_epi64(total, _mm_unpacklo_epi32(lanes, zero));
+        total = _mm_add_epi64(total, _mm_unpackhi_epi32(lanes, zero));
+    }
+    uint64_t parts[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(parts), total);
+    return SumScalar(data, length, sum + parts[0] + parts[1]);
+}
+#endif
+
+#ifdef FIGKEY_CHECKSUM_AVX2
+FIGKEY_TARGET_AVX2
+uint64_t SumAvx2(const unsigned char* data, size_t length, uint64_t sum) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = _mm256_setzero_si256();
+    while (length >= 64) {
+        size_t blocks = length / 64;
+        if (blocks > 8192) {
+            blocks = 8192;      // Each 32-bit lane takes at most 4 * 0xFFFF per block
+        }
+        // Two independent chains, so the adds of consecutive loads can overlap
+        __m256i a = _mm256_setzero_si256();
+        __m256i b = _mm256_setzero_si256();
+        for (size_t i = 0; i < blocks; ++i) {
+            __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+            a = _mm256_add_epi32(a, _mm256_unpacklo_epi16(v0, zero));
+            b = _mm256_add_epi32(b, _mm256_unpackhi_epi16(v0, zero));
+            a = _mm256_add_epi32(a, _mm256_unpacklo_epi16(v1, zero));
+            b = _mm256_add_epi32(b, _mm256_unpackhi_epi16(v1, zero));
+            data += 64;
+        }
+        length -= blocks * 64;
+        total = _mm256_add_epi64(total, _mm256_unpacklo_epi32(a, zero));
+        total = _mm256_add_epi64(total, _mm256_unpackhi_epi32(a, zero));
+        total = _mm256_add_epi64(total, _mm256_unpacklo_epi32(b, zero));
+        total = _mm256_add_epi64(total, _mm256_unpackhi_epi32(b, zero));
+    }
+    uint64_t parts[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(parts), total);
+    return SumScalar(data, length, sum + parts[0] + parts[1] + parts[2] + parts[3]);
+}
+#endif
+
+bool CpuHasAvx2() {
+#if defined(FIGKEY_CHECKSUM_AVX2) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osSaves = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;    // OSXSAVE, XMM and YMM state
+    __cpuidex(info, 7, 0);
+    return osSaves && (info[1] & (1 << 5)) != 0;
+#elif defined(FIGKEY_CHECKSUM_AVX2)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
+
+ChecksumKernel DetectKernel() {
+    if (CpuHasAvx2()) {
+        return ChecksumKernel::AVX2;
+    }
+#ifdef FIGKEY_CHECKSUM_SSE2
+    return ChecksumKernel::SSE2;
+#else
+    return ChecksumKernel::SCALAR;
+#endif
+}
+
+const ChecksumKernel BEST_KERNEL = DetectKernel();
+
+inline uint16_t Load16(const unsigned char* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+// Sum of the pseudo-header in the same host order as the payload sum
+uint32_t PseudoHeader(const decoded_packet& packet, uint8_t protocol, uint32_t length) {
+    unsigned char header[40];
+    size_t size;
+    if (packet.ip_version == 4) {
+        std::memcpy(header, packet.src_addr, 4);
+        std::memcpy(header + 4, packet.dst_addr, 4);
+        header[8] = 0;
+        header[9] = protocol;
+        header[10] = static_cast<unsigned char>(length >> 8);
+        header[11] = static_cast<unsigned char>(length);
+        size = 12;
+    }
+    else {
+        std::memcpy(header, packet.src_addr, 16);
+        std::memcpy(header + 16, packet.dst_addr, 16);
+        header[32] = static_cast<unsigned char>(length >> 24);
+        header[33] = static_cast<unsigned char>(length >> 16);
+        header[34] = static_cast<unsigned char>(length >> 8);
+        header[35] = static_cast<unsigned char>(length);
+        header[36] = 0;
+        header[37] = 0;
+        header[38] = 0;
+        header[39] = protocol;
+        size = 40;
+    }
+    return Fold(SumScalar(header, size, 0));
+}
+
+}  // namespace
+
+uint32_t Checksum::partial(const unsigned char* data, size_t length, uint32_t sum) {
+    if (length < VECTOR_MIN) {
+        return Fold(SumScalar(data, length, sum));
+    }
+    return partial(BEST_KERNEL, data, length, sum);
+}
+
+uint32_t Checksum::partial(ChecksumKernel kernel, const unsigned char* data, size_t length, uint32_t sum) {
+    switch (kernel) {
+#ifdef FIGKEY_CHECKSUM_AVX2
+    case ChecksumKernel::AVX2:
+        return Fold(SumAvx2(data, length, sum));
+#endif
+#ifdef FIGKEY_CHECKSUM_SSE2
+    case ChecksumKernel::SSE2:
+        return Fold(SumSse2(data, length, sum));
+#endif
+    default:
+        return Fold(SumScalar(data, length, sum));
+    }
+}
+
+ChecksumKernel Checksum::kernel() {
+    return BEST_KERNEL;
+}
+
+bool Checksum::supported(ChecksumKernel kernel) {
+    switch (kernel) {
+    case ChecksumKernel::AVX2:
+        return BEST_KERNEL == ChecksumKernel::AVX2;
+    case ChecksumKernel::SSE2:
+#ifdef FIGKEY_CHECKSUM_SSE2
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
+
+const char* Checksum::kernelName(ChecksumKernel kernel) {
+    switch (kernel) {
+    case ChecksumKernel::SCALAR: return "scalar";
+    case ChecksumKernel::SSE2: return "SSE2";
+    case ChecksumKernel::AVX2: return "AVX2";
+    }
+    return "unknown";
+}
+
+checksum_result Checksum::verify(const unsigned char* data, decoded_packet& packet) {
+    checksum_result result{ChecksumStatus::UNVERIFIED, ChecksumStatus::UNVERIFIED};
+    if (packet.ip_version == 0) {
+        return result;
+    }
+    const unsigned char* ip = data + packet.l3_offset;
+    if (packet.ip_version == 4) {
+        // The decoder only sets the IP fields once the whole header was captured
+        uint32_t headerLength = (ip[0] & 0x0F) * 4u;
+        result.ip = partial(ip, headerLength) == 0xFFFF ? ChecksumStatus::GOOD : ChecksumStatus::BAD;
+        if (result.ip == ChecksumStatus::BAD) {
+            packet.flags |= PKT_FLAG_BAD_IP_CHECKSUM;
+        }
+    }
+
+    // The whole segment is needed, which a fragment or a snaplen cut does not have
+    if (!(packet.flags & PKT_FLAG_TRANSPORT) || (packet.flags & (PKT_FLAG_FRAGMENT | PKT_FLAG_TRUNCATED))) {
+        return result;
+    }
+    uint32_t end = packet.l3_offset + packet.ip_length;
+    if (end <= packet.l4_offset) {
+        return result;
+    }
+    const unsigned char* l4 = data + packet.l4_offset;
+    uint32_t length = end - packet.l4_offset;
+    uint32_t sum = 0;
+    switch (packet.protocol) {
+    case PROTO_TCP:
+        sum = PseudoHeader(packet, PROTO_TCP, length);
+        break;
+    case PROTO_UDP: {
+        uint32_t udpLength = Load16(l4 + 4);
+        if (Load16(l4 + 6) == 0 || udpLength < 8 || udpLength > length) {
+            return result;      // No checksum sent, or a length the checksum can't be checked against
+        }
+        length = udpLength;
+        sum = PseudoHeader(packet, PROTO_UDP, length);
+        break;
+    }
+    case PROTO_ICMP:
+        if (packet.ip_version != 4) {
+            return result;
+        }
+        break;
+    case PROTO_ICMPV6:
+        if (packet.ip_version != 6) {
+            return result;
+        }
+        sum = PseudoHeader(packet, PROTO_ICMPV6, length);
+        break;
+    default:
+        return result;
+    }
+    result.transport = partial(l4, length, sum) == 0xFFFF ? ChecksumStatus::GOOD : ChecksumStatus::BAD;
+    if (result.transport == ChecksumStatus::BAD) {
+        packet.flags |= PKT_FLAG_BAD_L4_CHECKSUM;
+    }
+    return result;
+}
+
+}  // namespace figkey
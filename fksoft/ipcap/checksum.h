@@ -0,0 +1,74 @@
+/**
+ * @file    checksum.h
+ * @ingroup figkey
+ * @brief   Internet checksum (RFC 1071) verification for IPv4 headers and TCP/UDP/ICMP/ICMPv6 payloads.
+ *          The ones' complement sum does not depend on byte order, so words are added in host order, 16 or 32
+ *          bytes at a time with SSE2 or AVX2 and 4 bytes at a time otherwise. The widest kernel the CPU
+ *          supports is picked once at startup; AVX2 is compiled with a target attribute, so the binary still
+ *          runs on CPUs without it.
+ *
+ *          Transport checksums include the IPv4 or IPv6 pseudo-header and are only verified when the whole
+ *          segment was captured and is not a fragment. Captures taken on the sending host often show bad
+ *          transport checksums because the NIC fills them in later (checksum offload).
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_CHECKSUM_HPP
+#define FIGKEY_CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "packet_decoder.h"
+
+namespace figkey {
+
+enum class ChecksumKernel : uint8_t {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+// Outcome of Checksum::verify for one header
+enum class ChecksumStatus : uint8_t {
+    GOOD,
+    BAD,
+    UNVERIFIED      // Not captured whole, a fragment, no checksum (UDP over IPv4 with 0) or no such header
+};
+
+struct checksum_result {
+    ChecksumStatus ip;          // IPv4 header, UNVERIFIED for IPv6 which has none
+    ChecksumStatus transport;   // TCP, UDP, ICMP or ICMPv6
+};
+
+class Checksum {
+public:
+    // Ones' complement sum of length bytes folded to 16 bits, added to sum. data must start at an even offset
+    // of the checksummed bytes, an odd length is only allowed for the last part
+    static uint32_t partial(const unsigned char* data, size_t length, uint32_t sum = 0);
+
+    // The same with a given kernel, for benchmarks. The kernel must be supported
+    static uint32_t partial(ChecksumKernel kernel, const unsigned char* data, size_t length, uint32_t sum = 0);
+
+    // Checksum field value for a finished sum, in the byte order the sum was taken in
+    static uint16_t finish(uint32_t sum) { return static_cast<uint16_t>(~sum); }
+
+    // Kernel picked for this CPU
+    static ChecksumKernel kernel();
+
+    static bool supported(ChecksumKernel kernel);
+
+    static const char* kernelName(ChecksumKernel kernel);
+
+    // Verifies the IPv4 header and transport checksums of a decoded packet, data being what it was decoded
+    // from. Bad checksums are also marked in packet.flags with PKT_FLAG_BAD_IP_CHECKSUM and
+    // PKT_FLAG_BAD_L4_CHECKSUM
+    static checksum_result verify(const unsigned char* data, decoded_packet& packet);
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_CHECKSUM_HPP
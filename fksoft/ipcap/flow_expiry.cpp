@@ -0,0 +1,164 @@
+// flow_expiry.cpp: 会话超时老化
+//
+
+#include "flow_expiry.h"
+
+namespace figkey {
+
+FlowExpiry::FlowExpiry(FlowTable& flow_table, FlowExpiryHandler* expiry_handler, const FlowExpiryOptions& options)
+        : table(flow_table), handler(expiry_handler) {
+    const uint64_t ms = 1000000ULL;
+    tickNs = (options.tickMs > 0 ? options.tickMs : 1) * ms;
+    idleNs = options.idleTimeoutMs * ms;
+    activeNs = options.activeTimeoutMs * ms;
+    closeNs = options.closeTimeoutMs * ms;
+
+    // Enough slots for one idle timeout, longer deadlines wait for their turn a few revolutions later
+    size_t slots = 64;
+    while (slots < idleNs / tickNs + 2 && slots < (1u << 20)) {
+        slots <<= 1;
+    }
+    wheel.assign(slots, NO_RECORD);
+    mask = slots - 1;
+
+    size_t batchSize = options.batchSize > 0 ? options.batchSize : 1;
+    batch.reserve(batchSize);
+    pending.reserve(batchSize);
+}
+
+uint64_t FlowExpiry::deadline(const flow_record& record) const {
+    uint64_t due = record.last_seen_ns + (record.closed ? closeNs : idleNs);
+    if (activeNs > 0 && record.first_seen_ns + activeNs < due) {
+        due = record.first_seen_ns + activeNs;
+    }
+    return due;
+}
+
+ExpiryReason FlowExpiry::reason(const flow_record& record, uint64_t now) const {
+    if (record.closed && record.last_seen_ns + closeNs <= now) {
+        return ExpiryReason::TCP_CLOSED;
+    }
+    if (activeNs > 0 && record.first_seen_ns + activeNs <= now) {
+        return ExpiryReason::ACTIVE;
+    }
+    return ExpiryReason::IDLE;
+}
+
+void FlowExpiry::reschedule(flow_record* record) {
+    if (record->timer_slot != 0) {
+        unlink(record);
+    }
+    if (record->closed) {
+        record->closed = CLOSE_SCHEDULED;
+    }
+    schedule(record, deadline(*record));
+}
+
+void FlowExpiry::schedule(flow_record* record, uint64_t deadline_ns) {
+    // Never behind the wheel, a slot already examined would only come round again a revolution later
+    uint64_t tick = deadline_ns / tickNs;
+    if (tick <= currentTick) {
+        tick = currentTick + 1;
+    }
+    size_t slot = static_cast<size_t>(tick & mask);
+    uint32_t index = table.indexOf(record);
+    uint32_t head = wheel[slot];
+    record->timer_prev = NO_RECORD;
+    record->timer_next = head;
+    if (head != NO_RECORD) {
+        table.recordAt(head).timer_prev = index;
+    }
+    wheel[slot] = index;
+    record->timer_slot = static_cast<uint32_t>(slot + 1);
+}
+
+void FlowExpiry::unlink(flow_record* record) {
+    size_t slot = record->timer_slot - 1;
+    if (record->timer_prev != NO_RECORD) {
+        table.recordAt(record->timer_prev).timer_next = record->timer_next;
+    }
+    else {
+        wheel[slot] = record->timer_next;
+    }
+    if (record->timer_next != NO_RECORD) {
+        table.recordAt(record->timer_next).timer_prev = record->timer_prev;
+    }
+    record->timer_slot = 0;
+}
+
+void FlowExpiry::runTicks(uint64_t timestamp_ns) {
+    uint64_t target = timestamp_ns / tickNs;
+    if (nextTickNs == 0) {
+        currentTick = target;       // First packet starts the wheel
+        nextTickNs = (target + 1) * tickNs;
+        return;
+    }
+    // After a gap longer than a revolution every slot is examined once, flows check their own deadline
+    uint64_t from = currentTick;
+    uint64_t steps = target - from;
+    if (steps > wheel.size()) {
+        steps = wheel.size();
+    }
+    currentTick = target;
+    nextTickNs = (target + 1) * tickNs;
+    for (uint64_t i = 1; i <= steps; ++i) {
+        expireSlot((from + i) & mask, timestamp_ns);
+    }
+    deliver();
+}
+
+void FlowExpiry::expireSlot(uint64_t slot, uint64_t now) {
+    uint32_t index = wheel[slot];
+    wheel[slot] = NO_RECORD;
+    while (index != NO_RECORD) {
+        flow_record* record = &table.recordAt(index);
+        index = record->timer_next;
+        record->timer_slot = 0;
+        uint64_t due = deadline(*record);
+        if (due <= now) {
+            expire(record, reason(*record, now));
+        }
+        else {
+            schedule(record, due);
+        }
+    }
+}
+
+void FlowExpiry::expire(flow_record* record, ExpiryReason why) {
+    batch.push_back(expired_flow{record, why});
+    pending.push_back(table.indexOf(record));
+    if (batch.size() == batch.capacity()) {
+        deliver();
+    }
+}
+
+void FlowExpiry::deliver() {
+    if (batch.empty()) {
+        return;
+    }
+    if (handler) {
+        handler->onExpired(batch.data(), batch.size());
+    }
+    for (uint32_t index : pending) {
+        table.erase(&table.recordAt(index));
+    }
+    expiredCount += batch.size();
+    batch.clear();
+    pending.clear();
+}
+
+void FlowExpiry::flush() {
+    for (size_t slot = 0; slot < wheel.size(); ++slot) {
+        uint32_t index = wheel[slot];
+        wheel[slot] = NO_RECORD;
+        while (index != NO_RECORD) {
+            flow_record* record = &table.recordAt(index);
+            index = record->timer_next;
+            record->timer_slot = 0;
+            expire(record, ExpiryReason::END);
+        }
+    }
+    deliver();
+}
+
+}  // namespace figkey
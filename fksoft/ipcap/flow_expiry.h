@@ -0,0 +1,129 @@
+/**
+ * @file    flow_expiry.h
+ * @ingroup figkey
+ * @brief   Flow expiry for FlowTable with a hashed timing wheel.
+ *          Every flow sits in the wheel slot of its next possible deadline, linked through the record itself.
+ *          Packets only move last_seen forward; a slot is examined when its tick passes and each flow in it is
+ *          either expired or moved to the slot of its real deadline, so expiry never scans the table and the
+ *          per-packet cost does not depend on the number of flows. Time comes from packet timestamps, so live
+ *          capture and replay expire the same flows at the same points.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_FLOW_EXPIRY_HPP
+#define FIGKEY_FLOW_EXPIRY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "flow_table.h"
+
+namespace figkey {
+
+enum class ExpiryReason : uint8_t {
+    IDLE,           // No packet for the idle timeout
+    ACTIVE,         // Open longer than the active timeout, the next packet starts a new record
+    TCP_CLOSED,     // RST or FIN in both directions, after the close timeout
+    END             // Still open when the capture stopped
+};
+
+struct expired_flow {
+    const flow_record* record;  // Valid during the callback only, the table reuses it afterwards
+    ExpiryReason reason;
+};
+
+// Receives expired flows, one batch per wheel advance. Called on the thread that tracks the flows, so a handler
+// shared by several capture threads must be thread safe
+class FlowExpiryHandler {
+public:
+    virtual ~FlowExpiryHandler() = default;
+
+    virtual void onExpired(const expired_flow* flows, size_t count) = 0;
+};
+
+struct FlowExpiryOptions {
+    uint32_t idleTimeoutMs;     // Expire a flow this long after its last packet
+    uint32_t activeTimeoutMs;   // Expire a flow this long after its first packet, 0 never
+    uint32_t closeTimeoutMs;    // Idle timeout of a closed TCP flow, leaves room for the last ACK
+    uint32_t tickMs;            // Wheel resolution, flows expire up to one tick late
+    size_t batchSize;           // Expired flows handed over per callback at most
+
+    FlowExpiryOptions(uint32_t idle_ms = 60000, uint32_t active_ms = 1800000, uint32_t close_ms = 1000,
+                      uint32_t tick_ms = 100, size_t batch_size = 256)
+            : idleTimeoutMs(idle_ms), activeTimeoutMs(active_ms), closeTimeoutMs(close_ms), tickMs(tick_ms),
+              batchSize(batch_size) {}
+};
+
+class FlowExpiry {
+public:
+    FlowExpiry(FlowTable& flow_table, FlowExpiryHandler* handler, const FlowExpiryOptions& options = FlowExpiryOptions());
+
+    FlowExpiry(const FlowExpiry&) = delete;
+    FlowExpiry& operator=(const FlowExpiry&) = delete;
+
+    // Expires every flow due at timestamp_ns. Call before FlowTable::update with the packet's timestamp, time
+    // never moves backwards, so slightly reordered timestamps are harmless
+    void advance(uint64_t timestamp_ns) {
+        if (timestamp_ns >= nextTickNs) {
+            runTicks(timestamp_ns);
+        }
+    }
+
+    // Call after FlowTable::update for the packet's flow: schedules new flows and brings closed ones forward
+    void onPacket(flow_record* record) {
+        if (record->timer_slot == 0 || record->closed == CLOSE_SEEN) {
+            reschedule(record);
+        }
+    }
+
+    // Expires all remaining flows with ExpiryReason::END
+    void flush();
+
+    uint64_t expired() const { return expiredCount; }
+
+private:
+    static constexpr uint32_t NO_RECORD = 0xFFFFFFFFu;
+    static constexpr uint8_t CLOSE_SEEN = 1;        // flow_record::closed as set by FlowTable
+    static constexpr uint8_t CLOSE_SCHEDULED = 2;   // Moved to the close deadline
+
+    FlowTable& table;
+    FlowExpiryHandler* handler;
+    uint64_t idleNs;
+    uint64_t activeNs;
+    uint64_t closeNs;
+    uint64_t tickNs;
+    std::vector<uint32_t> wheel;    // Head record of every slot
+    uint64_t mask;
+    uint64_t currentTick{0};        // Every slot up to this tick has been examined
+    uint64_t nextTickNs{0};         // 0 until the first timestamp starts the wheel
+    std::vector<expired_flow> batch;
+    std::vector<uint32_t> pending;  // Record indexes of batch, erased once the handler returned
+    uint64_t expiredCount{0};
+
+    uint64_t deadline(const flow_record& record) const;
+
+    ExpiryReason reason(const flow_record& record, uint64_t now) const;
+
+    // New flows and flows that just closed, whose deadline moved earlier than their current slot
+    void reschedule(flow_record* record);
+
+    void schedule(flow_record* record, uint64_t deadline_ns);
+
+    void unlink(flow_record* record);
+
+    void runTicks(uint64_t timestamp_ns);
+
+    void expireSlot(uint64_t slot, uint64_t now);
+
+    void expire(flow_record* record, ExpiryReason why);
+
+    void deliver();
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_FLOW_EXPIRY_HPP
@@ -0,0 +1,363 @@
+﻿// flow_hash.cpp: 对称会话哈希与按会话分流
+//
+
+#include "flow_hash.h"
+#include <pcap.h>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#define FIGKEY_CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define FIGKEY_CRC32C_ARM
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FIGKEY_TARGET_SSE42
+#else
+#define FIGKEY_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+
+namespace figkey {
+
+namespace {
+
+const uint8_t PROTO_TCP = 6;
+const uint8_t PROTO_UDP = 17;
+const uint8_t PROTO_SCTP = 132;
+const uint32_t CRC32C_POLY = 0x82F63B78;    // Reflected Castagnoli polynomial
+
+struct crc32c_table {
+    uint32_t entries[256];
+
+    crc32c_table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+const crc32c_table CRC32C_TABLE;
+
+uint32_t Crc32cBytes(const unsigned char* data, size_t length, uint32_t crc) {
+    for (size_t i = 0; i < length; ++i) {
+        crc = CRC32C_TABLE.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef FIGKEY_CRC32C_SSE42
+FIGKEY_TARGET_SSE42
+uint32_t Crc32cSse42(const unsigned char* data, size_t length, uint32_t crc) {
+    uint64_t wide = crc;
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        wide = _mm_crc32_u64(wide, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(wide);
+    while (length > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --length;
+    }
+    return crc;
+}
+
+bool CpuHasSse42() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+const bool HARDWARE_CRC = CpuHasSse42();
+#elif defined(FIGKEY_CRC32C_ARM)
+uint32_t Crc32cArm(const unsigned char* data, size_t length, uint32_t crc) {
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = __crc32cb(crc, *data++);
+        --length;
+    }
+    return crc;
+}
+
+const bool HARDWARE_CRC = true;
+#else
+const bool HARDWARE_CRC = false;
+#endif
+
+// The CRC instructions leave out the pre- and post-inversion
+uint32_t Crc32cRaw(const unsigned char* data, size_t length, uint32_t crc) {
+#if defined(FIGKEY_CRC32C_SSE42)
+    if (HARDWARE_CRC) {
+        return Crc32cSse42(data, length, crc);
+    }
+#elif defined(FIGKEY_CRC32C_ARM)
+    return Crc32cArm(data, length, crc);
+#endif
+    return Crc32cBytes(data, length, crc);
+}
+
+// 0x6d5a repeated: swapping two 16-bit aligned fields keeps the hash, see the file comment
+const uint8_t SYMMETRIC_KEY[ToeplitzHash::KEY_SIZE] = {
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a
+};
+
+inline bool HasPorts(const decoded_packet& packet) {
+    return (packet.flags & PKT_FLAG_TRANSPORT) && !(packet.flags & PKT_FLAG_FRAGMENT) &&
+           (packet.protocol == PROTO_TCP || packet.protocol == PROTO_UDP || packet.protocol == PROTO_SCTP);
+}
+
+inline void Store16(unsigned char* p, uint16_t value) {
+    p[0] = static_cast<unsigned char>(value >> 8);
+    p[1] = static_cast<unsigned char>(value);
+}
+
+// Finalizer so that nearby addresses spread over all workers
+inline uint32_t Mix32(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6B;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// XOR of the address words, the same whether read from the packet or from decoded_packet
+uint32_t AddressWords(const unsigned char* src, const unsigned char* dst, size_t size) {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < size; i += 4) {
+        uint32_t a, b;
+        std::memcpy(&a, src + i, 4);
+        std::memcpy(&b, dst + i, 4);
+        hash ^= a ^ b;
+    }
+    return Mix32(hash);
+}
+
+}  // namespace
+
+ToeplitzHash::ToeplitzHash(const uint8_t* key) {
+    if (!key) {
+        key = SYMMETRIC_KEY;
+    }
+    for (size_t position = 0; position < MAX_INPUT; ++position) {
+        // Key windows of the 8 bits of this byte: the 32 key bits starting at each bit
+        uint32_t windows[8];
+        for (int bit = 0; bit < 8; ++bit) {
+            size_t start = position * 8 + bit;
+            uint32_t window = 0;
+            for (int i = 0; i < 32; ++i) {
+                size_t k = start + i;
+                window = (window << 1) | ((key[k / 8] >> (7 - k % 8)) & 1);
+            }
+            windows[bit] = window;
+        }
+        for (uint32_t value = 0; value < 256; ++value) {
+            uint32_t result = 0;
+            for (int bit = 0; bit < 8; ++bit) {
+                if (value & (0x80u >> bit)) {
+                    result ^= windows[bit];
+                }
+            }
+            table[position][value] = result;
+        }
+    }
+}
+
+uint32_t ToeplitzHash::hash(const unsigned char* data, size_t length) const {
+    if (length > MAX_INPUT) {
+        length = MAX_INPUT;
+    }
+    uint32_t result = 0;
+    for (size_t i = 0; i < length; ++i) {
+        result ^= table[i][data[i]];
+    }
+    return result;
+}
+
+uint32_t ToeplitzHash::hash(const decoded_packet& packet) const {
+    if (packet.ip_version == 0) {
+        return 0;
+    }
+    unsigned char input[MAX_INPUT];
+    size_t size = packet.ip_version == 6 ? 16 : 4;
+    std::memcpy(input, packet.src_addr, size);
+    std::memcpy(input + size, packet.dst_addr, size);
+    size_t length = size * 2;
+    if (HasPorts(packet)) {
+        Store16(input + length, packet.src_port);
+        Store16(input + length + 2, packet.dst_port);
+        length += 4;
+    }
+    return hash(input, length);
+}
+
+uint32_t FlowHash::crc32c(const unsigned char* data, size_t length, uint32_t crc) {
+    return ~Crc32cRaw(data, length, ~crc);
+}
+
+uint32_t FlowHash::crc32cPortable(const unsigned char* data, size_t length, uint32_t crc) {
+    return ~Crc32cBytes(data, length, ~crc);
+}
+
+bool FlowHash::hardwareCrc32c() {
+    return HARDWARE_CRC;
+}
+
+uint32_t FlowHash::crc32c(const decoded_packet& packet) {
+    if (packet.ip_version == 0) {
+        return 0;
+    }
+    // Lower (address, port) endpoint first, as in flow_key, padded to whole 8-byte words
+    unsigned char input[40] = {0};
+    size_t size = packet.ip_version == 6 ? 16 : 4;
+    uint16_t srcPort = 0;
+    uint16_t dstPort = 0;
+    if (HasPorts(packet)) {
+        srcPort = packet.src_port;
+        dstPort = packet.dst_port;
+    }
+    int order = std::memcmp(packet.src_addr, packet.dst_addr, size);
+    bool swap = order > 0 || (order == 0 && srcPort > dstPort);
+    std::memcpy(input, swap ? packet.dst_addr : packet.src_addr, size);
+    std::memcpy(input + size, swap ? packet.src_addr : packet.dst_addr, size);
+    Store16(input + size * 2, swap ? dstPort : srcPort);
+    Store16(input + size * 2 + 2, swap ? srcPort : dstPort);
+    input[size * 2 + 4] = packet.protocol;
+    return crc32c(input, size == 16 ? 40 : 16);
+}
+
+uint32_t FlowHash::address(int link_type, const unsigned char* data, uint32_t caplen) {
+    // Same link layers as the decoder, e.g. the cooked header of the "any" device or a raw IP file
+    uint32_t offset = 0;
+    uint16_t etherType = 0;
+    if (PacketDecoder::linkLayer(link_type, data, caplen, offset, etherType) != DecodeStatus::OK) {
+        return Mix32(0);
+    }
+    if (etherType == 0x0800 && caplen >= offset + 20) {
+        return AddressWords(data + offset + 12, data + offset + 16, 4);
+    }
+    else if (etherType == 0x86DD && caplen >= offset + 40) {
+        return AddressWords(data + offset + 8, data + offset + 24, 16);
+    }
+    return Mix32(0);
+}
+
+const char* FlowHash::typeName(FlowHashType type) {
+    switch (type) {
+    case FlowHashType::ADDRESS: return "address";
+    case FlowHashType::TOEPLITZ: return "toeplitz";
+    case FlowHashType::CRC32C: return "crc32c";
+    }
+    return "unknown";
+}
+
+FlowSharder::FlowSharder(unsigned worker_count, FlowHashType type)
+        : hashType(type), workerCount(worker_count > 0 ? worker_count : 1),
+          packetCounts(new std::atomic<uint64_t>[workerCount]), byteCounts(new std::atomic<uint64_t>[workerCount]) {
+    for (size_t i = 0; i < TABLE_SIZE; ++i) {
+        indirection[i] = static_cast<uint16_t>(i % workerCount);
+    }
+    if (hashType == FlowHashType::TOEPLITZ) {
+        toeplitz = std::make_unique<ToeplitzHash>();
+    }
+    for (unsigned i = 0; i < workerCount; ++i) {
+        packetCounts[i].store(0, std::memory_order_relaxed);
+        byteCounts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint32_t FlowSharder::hash(const decoded_packet& packet) const {
+    switch (hashType) {
+    case FlowHashType::TOEPLITZ:
+        return toeplitz->hash(packet);
+    case FlowHashType::CRC32C:
+        return FlowHash::crc32c(packet);
+    default:
+        if (packet.ip_version == 0) {
+            return Mix32(0);
+        }
+        return AddressWords(packet.src_addr, packet.dst_addr, packet.ip_version == 6 ? 16 : 4);
+    }
+}
+
+unsigned FlowSharder::count(uint32_t hash, uint32_t length) {
+    unsigned worker = indirection[hash % TABLE_SIZE];
+    // Only the routing thread writes, a plain load and store avoids a locked instruction per packet
+    packetCounts[worker].store(packetCounts[worker].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    byteCounts[worker].store(byteCounts[worker].load(std::memory_order_relaxed) + length, std::memory_order_relaxed);
+    return worker;
+}
+
+unsigned FlowSharder::route(int link_type, const unsigned char* data, uint32_t caplen, uint32_t length) {
+    if (workerCount == 1) {
+        return count(0, length);
+    }
+    if (hashType == FlowHashType::ADDRESS) {
+        return count(FlowHash::address(link_type, data, caplen), length);
+    }
+    decoded_packet packet;
+    PacketDecoder::decode(link_type, data, caplen, packet);
+    return count(hash(packet), length);
+}
+
+unsigned FlowSharder::route(const decoded_packet& packet, uint32_t length) {
+    return count(workerCount == 1 ? 0 : hash(packet), length);
+}
+
+void FlowSharder::route(const PacketBatch& batch, unsigned* targets) {
+    for (size_t i = 0; i < batch.size(); ++i) {
+        targets[i] = route(batch.linkType(), batch[i].data, batch[i].header.caplen, batch[i].header.len);
+    }
+}
+
+shard_report FlowSharder::report() const {
+    shard_report report{hashType, 0, 0, {}, 0, 0};
+    for (unsigned i = 0; i < workerCount; ++i) {
+        shard_load load{i, packetCounts[i].load(std::memory_order_relaxed),
+                        byteCounts[i].load(std::memory_order_relaxed), 0};
+        report.packets += load.packets;
+        report.bytes += load.bytes;
+        if (report.workers.empty() || load.packets > report.workers[report.busiest].packets) {
+            report.busiest = i;
+        }
+        report.workers.push_back(load);
+    }
+    if (report.packets > 0) {
+        for (auto& load : report.workers) {
+            load.share = static_cast<double>(load.packets) / report.packets;
+        }
+        report.skew = report.workers[report.busiest].share * workerCount;
+    }
+    return report;
+}
+
+void FlowSharder::resetCounters() {
+    for (unsigned i = 0; i < workerCount; ++i) {
+        packetCounts[i].store(0, std::memory_order_relaxed);
+        byteCounts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace figkey
@@ -0,0 +1,144 @@
+/**
+ * @file    flow_hash.h
+ * @ingroup figkey
+ * @brief   Symmetric flow hashes and an RSS-style sharder that spreads packets over workers.
+ *          All hashes give both directions of a flow the same value, so one worker sees the whole flow:
+ *            ADDRESS   the IP addresses straight from the packet bytes, nothing is decoded. Every flow between
+ *                      two hosts lands on the same worker
+ *            TOEPLITZ  the Toeplitz hash NICs use for receive side scaling, over addresses and ports, with a key
+ *                      repeating every 16 bits which makes it symmetric (Woo and Park, "Scalable TCP Session
+ *                      Monitoring with Symmetric Receive-side Scaling"). Table driven, one lookup per input byte
+ *            CRC32C    CRC32C of the 5-tuple with its endpoints in a fixed order, using the SSE4.2 or ARMv8
+ *                      CRC instructions when the CPU has them
+ *          Fragments hash by address only, like RSS does, so all fragments of a datagram meet on one worker.
+ *
+ *          FlowSharder maps a hash to a worker through a 512-entry indirection table, as a NIC does, and counts
+ *          packets and bytes per worker for a skew report.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_FLOW_HASH_HPP
+#define FIGKEY_FLOW_HASH_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "packet_batch.h"
+#include "packet_decoder.h"
+
+namespace figkey {
+
+enum class FlowHashType : uint8_t {
+    ADDRESS,
+    TOEPLITZ,
+    CRC32C
+};
+
+class ToeplitzHash {
+public:
+    static constexpr size_t KEY_SIZE = 40;      // Standard RSS key length, enough for an IPv6 4-tuple
+    static constexpr size_t MAX_INPUT = KEY_SIZE - 4;
+
+    // Precomputes lookup tables for key, nullptr for the symmetric key 0x6d5a repeated. Other keys are only
+    // symmetric if they repeat every 16 bits as well
+    explicit ToeplitzHash(const uint8_t* key = nullptr);
+
+    // Hash of up to MAX_INPUT bytes
+    uint32_t hash(const unsigned char* data, size_t length) const;
+
+    // Hash of the RSS input of a decoded packet: source and destination address, then source and destination
+    // port for unfragmented TCP, UDP and SCTP. 0 for packets that are not IP
+    uint32_t hash(const decoded_packet& packet) const;
+
+private:
+    uint32_t table[MAX_INPUT][256];     // XOR of the key windows of the set bits of each byte value at each position
+};
+
+class FlowHash {
+public:
+    // CRC32C (Castagnoli) of length bytes continuing from crc, 0 to start
+    static uint32_t crc32c(const unsigned char* data, size_t length, uint32_t crc = 0);
+
+    // The same without the CRC instructions, for checking them
+    static uint32_t crc32cPortable(const unsigned char* data, size_t length, uint32_t crc = 0);
+
+    // Whether crc32c uses CPU instructions
+    static bool hardwareCrc32c();
+
+    // Symmetric CRC32C of a decoded packet's addresses, ports (as for ToeplitzHash) and protocol
+    static uint32_t crc32c(const decoded_packet& packet);
+
+    // Symmetric hash of the IP addresses of a captured packet, read without decoding it. Knows Ethernet with
+    // VLAN tags and raw IP, other link types and non-IP packets hash to the same value
+    static uint32_t address(int link_type, const unsigned char* data, uint32_t caplen);
+
+    static const char* typeName(FlowHashType type);
+};
+
+// Load of one worker as counted by FlowSharder
+struct shard_load {
+    unsigned worker;
+    uint64_t packets;
+    uint64_t bytes;         // Wire length
+    double share;           // Fraction of all packets
+};
+
+struct shard_report {
+    FlowHashType hash;
+    uint64_t packets;
+    uint64_t bytes;
+    std::vector<shard_load> workers;
+    unsigned busiest;       // Worker with the most packets
+    double skew;            // Packets of the busiest worker over the mean, 1 is an even spread. 0 without packets
+};
+
+class FlowSharder {
+public:
+    static constexpr size_t TABLE_SIZE = 512;
+
+    // Spreads packets over worker_count workers with the given hash
+    explicit FlowSharder(unsigned worker_count, FlowHashType type = FlowHashType::TOEPLITZ);
+
+    FlowSharder(const FlowSharder&) = delete;
+    FlowSharder& operator=(const FlowSharder&) = delete;
+
+    unsigned workers() const { return workerCount; }
+    FlowHashType type() const { return hashType; }
+
+    // Worker for a captured packet, decoded first unless the hash is ADDRESS, and counts it
+    unsigned route(int link_type, const unsigned char* data, uint32_t caplen, uint32_t length);
+
+    // Worker for an already decoded packet, and counts it. With ADDRESS the decoded addresses are hashed
+    unsigned route(const decoded_packet& packet, uint32_t length);
+
+    // Worker of every packet of batch, written to targets[0 .. batch.size())
+    void route(const PacketBatch& batch, unsigned* targets);
+
+    // Packets and bytes routed to each worker so far. Counters are written by the routing thread only, the
+    // report may be taken from any thread
+    shard_report report() const;
+
+    // Starts counting from zero, routing thread only
+    void resetCounters();
+
+private:
+    FlowHashType hashType;
+    unsigned workerCount;
+    uint16_t indirection[TABLE_SIZE];
+    std::unique_ptr<ToeplitzHash> toeplitz;     // nullptr unless the hash is TOEPLITZ
+    std::unique_ptr<std::atomic<uint64_t>[]> packetCounts;
+    std::unique_ptr<std::atomic<uint64_t>[]> byteCounts;
+
+    uint32_t hash(const decoded_packet& packet) const;
+    unsigned count(uint32_t hash, uint32_t length);
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_FLOW_HASH_HPP
@@ -0,0 +1,335 @@
+﻿// flow_table.cpp: 会话跟踪表
+//
+
+#include "flow_table.h"
+#include <cstring>
+#include <new>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FIGKEY_FLOW_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define FIGKEY_FLOW_NEON
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace figkey {
+
+namespace {
+
+const uint8_t PROTO_TCP = 6;
+const uint8_t PROTO_UDP = 17;
+const uint8_t PROTO_SCTP = 132;
+
+inline unsigned LowestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// Bit i of the result is set when control byte i of the 16-byte group matches
+inline uint32_t MatchByte(const int8_t* group, int8_t value) {
+#if defined(FIGKEY_FLOW_SSE2)
+    __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value))));
+#elif defined(FIGKEY_FLOW_NEON)
+    static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t eq = vceqq_s8(vld1q_s8(group), vdupq_n_s8(value));
+    uint8x16_t masked = vandq_u8(eq, vld1q_u8(bits));
+    return vaddv_u8(vget_low_u8(masked)) | (static_cast<uint32_t>(vaddv_u8(vget_high_u8(masked))) << 8);
+#else
+    uint32_t mask = 0;
+    for (unsigned i = 0; i < 16; ++i) {
+        mask |= static_cast<uint32_t>(group[i] == value) << i;
+    }
+    return mask;
+#endif
+}
+
+// EMPTY (-128) and DELETED (-2) are the only negative values below -1, full slots hold 0..127
+inline uint32_t MatchEmptyOrDeleted(const int8_t* group) {
+#if defined(FIGKEY_FLOW_SSE2)
+    __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl)));
+#elif defined(FIGKEY_FLOW_NEON)
+    static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t lt = vcltq_s8(vld1q_s8(group), vdupq_n_s8(-1));
+    uint8x16_t masked = vandq_u8(lt, vld1q_u8(bits));
+    return vaddv_u8(vget_low_u8(masked)) | (static_cast<uint32_t>(vaddv_u8(vget_high_u8(masked))) << 8);
+#else
+    uint32_t mask = 0;
+    for (unsigned i = 0; i < 16; ++i) {
+        mask |= static_cast<uint32_t>(group[i] < -1) << i;
+    }
+    return mask;
+#endif
+}
+
+inline uint64_t Load64(const unsigned char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t Mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+}  // namespace
+
+static_assert(sizeof(flow_key) == 40, "flow_key must not contain padding");
+
+FlowTable::FlowTable(size_t max_flows)
+        : records(max_flows > 0 ? max_flows : 1) {
+    // Live flows fill at most 3/4 of the slots, so at least 1/8 of them can turn into tombstones before
+    // dropDeletes runs at the 7/8 growth limit and its O(capacity) pass stays amortized under churn
+    size_t wanted = records.size() + records.size() / 3 + 1;
+    capacity = GROUP_WIDTH;
+    while (capacity < wanted) {
+        capacity <<= 1;
+    }
+    groupMask = capacity / GROUP_WIDTH - 1;
+    growthLimit = capacity - capacity / 8;
+
+    control = static_cast<int8_t*>(::operator new(capacity, std::align_val_t(GROUP_WIDTH)));
+    std::memset(control, CTRL_EMPTY, capacity);
+    slots = static_cast<uint32_t*>(::operator new(capacity * sizeof(uint32_t), std::align_val_t(CACHE_LINE)));
+
+    freeRecords.resize(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        freeRecords[i] = static_cast<uint32_t>(records.size() - 1 - i);
+    }
+}
+
+FlowTable::~FlowTable() {
+    ::operator delete(control, std::align_val_t(GROUP_WIDTH));
+    ::operator delete(slots, std::align_val_t(CACHE_LINE));
+}
+
+bool FlowTable::makeKey(const decoded_packet& packet, flow_key& key, bool& reversed) {
+    if (packet.ip_version != 4 && packet.ip_version != 6) {
+        return false;
+    }
+    uint16_t srcPort = 0, dstPort = 0;
+    if ((packet.flags & PKT_FLAG_TRANSPORT) &&
+        (packet.protocol == PROTO_TCP || packet.protocol == PROTO_UDP || packet.protocol == PROTO_SCTP)) {
+        srcPort = packet.src_port;
+        dstPort = packet.dst_port;
+    }
+
+    int order = std::memcmp(packet.src_addr, packet.dst_addr, sizeof(packet.src_addr));
+    reversed = order > 0 || (order == 0 && srcPort > dstPort);
+    if (!reversed) {
+        std::memcpy(key.addr_a, packet.src_addr, sizeof(key.addr_a));
+        std::memcpy(key.addr_b, packet.dst_addr, sizeof(key.addr_b));
+        key.port_a = srcPort;
+        key.port_b = dstPort;
+    }
+    else {
+        std::memcpy(key.addr_a, packet.dst_addr, sizeof(key.addr_a));
+        std::memcpy(key.addr_b, packet.src_addr, sizeof(key.addr_b));
+        key.port_a = dstPort;
+        key.port_b = srcPort;
+    }
+    key.protocol = packet.protocol;
+    key.ip_version = packet.ip_version;
+    key.vlan_id = packet.vlan_count > 0 ? packet.vlan_id[0] : 0;
+    return true;
+}
+
+uint64_t FlowTable::hashKey(const flow_key& key) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(&key);
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < sizeof(flow_key); i += 8) {
+        h = (h ^ Load64(p + i)) * 0x87c37b91114253d5ULL;
+        h ^= h >> 29;
+    }
+    return Mix(h);
+}
+
+size_t FlowTable::lookup(const flow_key& key, uint64_t hash, size_t* firstFree) const {
+    const int8_t tag = static_cast<int8_t>(hash & 0x7f);
+    size_t group = (hash >> 7) & groupMask;
+    size_t free = capacity;
+    // The slot indexes of the first group only depend on the hash, fetch them while the tags are compared
+#if defined(__GNUC__)
+    __builtin_prefetch(slots + group * GROUP_WIDTH);
+#elif defined(FIGKEY_FLOW_SSE2)
+    _mm_prefetch(reinterpret_cast<const char*>(slots + group * GROUP_WIDTH), _MM_HINT_T0);
+#endif
+    for (size_t step = 1;; ++step) {
+        const int8_t* ctrl = control + group * GROUP_WIDTH;
+        for (uint32_t mask = MatchByte(ctrl, tag); mask != 0; mask &= mask - 1) {
+            size_t slot = group * GROUP_WIDTH + LowestBit(mask);
+            const flow_record& record = records[slots[slot]];
+            if (record.hash == hash && std::memcmp(&record.key, &key, sizeof(flow_key)) == 0) {
+                return slot;
+            }
+        }
+        uint32_t open = MatchEmptyOrDeleted(ctrl);
+        if (free == capacity && open != 0) {
+            free = group * GROUP_WIDTH + LowestBit(open);
+        }
+        // A group with an empty slot ends the probe sequence, no key was ever pushed past it
+        if (MatchByte(ctrl, CTRL_EMPTY) != 0) {
+            break;
+        }
+        group = (group + step) & groupMask;
+    }
+    if (firstFree) {
+        *firstFree = free;
+    }
+    return capacity;
+}
+
+size_t FlowTable::findFirstNonFull(uint64_t hash) const {
+    size_t group = (hash >> 7) & groupMask;
+    for (size_t step = 1;; ++step) {
+        uint32_t open = MatchEmptyOrDeleted(control + group * GROUP_WIDTH);
+        if (open != 0) {
+            return group * GROUP_WIDTH + LowestBit(open);
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+flow_record* FlowTable::find(const flow_key& key) {
+    size_t slot = lookup(key, hashKey(key), nullptr);
+    return slot == capacity ? nullptr : &records[slots[slot]];
+}
+
+flow_record* FlowTable::update(const decoded_packet& packet, uint64_t timestamp_ns, uint32_t length, int* direction) {
+    flow_key key;
+    bool reversed;
+    if (!makeKey(packet, key, reversed)) {
+        return nullptr;
+    }
+    uint64_t hash = hashKey(key);
+    size_t free;
+    size_t slot = lookup(key, hash, &free);
+
+    flow_record* record;
+    if (slot != capacity) {
+        record = &records[slots[slot]];
+    }
+    else {
+        if (freeRecords.empty()) {
+            ++droppedCount;
+            return nullptr;
+        }
+        if (count + tombstones >= growthLimit) {
+            dropDeletes();
+            free = findFirstNonFull(hash);
+        }
+        uint32_t index = freeRecords.back();
+        freeRecords.pop_back();
+        if (control[free] == CTRL_DELETED) {
+            --tombstones;
+        }
+        control[free] = static_cast<int8_t>(hash & 0x7f);
+        slots[free] = index;
+        ++count;
+        ++createdCount;
+
+        record = &records[index];
+        std::memset(record, 0, sizeof(flow_record));
+        record->key = key;
+        record->hash = hash;
+        record->first_seen_ns = timestamp_ns;
+        record->first_direction = reversed ? 1 : 0;
+    }
+
+    int dir = reversed ? 1 : 0;
+    record->last_seen_ns = timestamp_ns;
+    ++record->packets[dir];
+    record->bytes[dir] += length;
+    if (packet.protocol == PROTO_TCP && (packet.flags & PKT_FLAG_TRANSPORT)) {
+        record->tcp_flags[dir] |= packet.tcp_flags;
+        const uint8_t fin = 0x01, rst = 0x04;
+        if (!record->closed &&
+            ((packet.tcp_flags & rst) || ((record->tcp_flags[0] & fin) && (record->tcp_flags[1] & fin)))) {
+            record->closed = 1;
+        }
+    }
+    if (direction) {
+        *direction = dir;
+    }
+    return record;
+}
+
+void FlowTable::erase(flow_record* record) {
+    uint32_t index = static_cast<uint32_t>(record - records.data());
+    const int8_t tag = static_cast<int8_t>(record->hash & 0x7f);
+    size_t group = (record->hash >> 7) & groupMask;
+    for (size_t step = 1;; ++step) {
+        const int8_t* ctrl = control + group * GROUP_WIDTH;
+        for (uint32_t mask = MatchByte(ctrl, tag); mask != 0; mask &= mask - 1) {
+            size_t slot = group * GROUP_WIDTH + LowestBit(mask);
+            if (slots[slot] != index) {
+                continue;
+            }
+            // Probes stop at a group that still has an empty slot, so only a full group needs a tombstone
+            if (MatchByte(ctrl, CTRL_EMPTY) != 0) {
+                control[slot] = CTRL_EMPTY;
+            }
+            else {
+                control[slot] = CTRL_DELETED;
+                ++tombstones;
+            }
+            freeRecords.push_back(index);
+            --count;
+            return;
+        }
+        if (MatchByte(ctrl, CTRL_EMPTY) != 0) {
+            return;     // Not in the table
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+void FlowTable::dropDeletes() {
+    // Full slots become DELETED (still to be placed), everything else becomes EMPTY
+    for (size_t i = 0; i < capacity; ++i) {
+        control[i] = control[i] >= 0 ? CTRL_DELETED : CTRL_EMPTY;
+    }
+    for (size_t i = 0; i < capacity; ++i) {
+        if (control[i] != CTRL_DELETED) {
+            continue;
+        }
+        uint64_t hash = records[slots[i]].hash;
+        int8_t tag = static_cast<int8_t>(hash & 0x7f);
+        size_t target = findFirstNonFull(hash);
+        if (target / GROUP_WIDTH == i / GROUP_WIDTH) {
+            control[i] = tag;           // Already in the first group with room
+        }
+        else if (control[target] == CTRL_EMPTY) {
+            control[target] = tag;
+            slots[target] = slots[i];
+            control[i] = CTRL_EMPTY;
+        }
+        else {
+            // Target holds another entry still to be placed: swap and place that one from slot i next
+            control[target] = tag;
+            uint32_t other = slots[target];
+            slots[target] = slots[i];
+            slots[i] = other;
+            --i;
+        }
+    }
+    tombstones = 0;
+}
+
+}  // namespace figkey
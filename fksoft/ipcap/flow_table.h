@@ -0,0 +1,140 @@
+﻿/**
+ * @file    flow_table.h
+ * @ingroup figkey
+ * @brief   Connection tracking table keyed by normalized bidirectional 5-tuple.
+ *          Open addressing in the style of a Swiss table: one control byte per slot holds 7 bits of the hash,
+ *          and a group of 16 control bytes is compared against the wanted tag with a single SSE2 (or NEON)
+ *          instruction, so a lookup usually touches one control line and the matching record only.
+ *          All records are preallocated for a fixed number of flows and never move, pointers to a record stay
+ *          valid until it is erased; nothing is allocated per flow or per packet.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_FLOW_TABLE_HPP
+#define FIGKEY_FLOW_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "packet_decoder.h"
+
+namespace figkey {
+
+// Bidirectional 5-tuple, endpoint a is the lower (address, port) pair so both directions map to one key.
+// No padding, so keys can be compared and hashed as raw bytes
+struct flow_key {
+    uint8_t addr_a[16];     // Network byte order, IPv4 uses the first 4 bytes and zeroes the rest
+    uint8_t addr_b[16];
+    uint16_t port_a;        // 0 for protocols without ports and for non-first fragments
+    uint16_t port_b;
+    uint8_t protocol;
+    uint8_t ip_version;
+    uint16_t vlan_id;       // Outer VLAN, separate VLANs may reuse the same addresses
+};
+
+// Application layer fields of a flow, filled by DissectorRegistry (app_dissector.h) from the first payload bytes
+struct flow_app {
+    uint8_t protocol;           // AppProtocol, 0 while unknown
+    uint8_t flags;              // APP_FLAG_* of app_dissector.h
+    uint16_t status;            // HTTP response status, DNS response code plus one; 0 until a response is seen
+    uint16_t version;           // HTTP major << 8 | minor, highest TLS version offered by the client
+    uint16_t type;              // DNS query type
+    uint16_t scanned[2];        // Payload bytes handed to the dissectors per direction
+    char method[8];             // HTTP request method
+    char name[64];              // DNS query name, HTTP Host or TLS server name; NUL-terminated, cut to fit
+};
+
+// State of one flow
+struct flow_record {
+    flow_key key;
+    uint64_t hash;              // Hash of key, symmetric because the key is normalized
+    uint64_t first_seen_ns;     // Packet timestamps, so live capture and replay behave the same
+    uint64_t last_seen_ns;
+    uint64_t packets[2];        // [0] sent by endpoint a, [1] sent by endpoint b
+    uint64_t bytes[2];          // Wire length
+    uint8_t tcp_flags[2];       // All TCP flags seen per direction
+    uint8_t first_direction;    // Direction of the first packet, 0 if endpoint a spoke first
+    uint8_t closed;             // Nonzero once TCP RST, or FIN in both directions, was seen
+    uint32_t timer_next;        // Expiry wheel list links (record indexes) and slot + 1, 0 while not
+    uint32_t timer_prev;        // scheduled. Maintained by FlowExpiry
+    uint32_t timer_slot;
+    flow_app app;               // Zero unless application dissection is on
+};
+
+class FlowTable {
+public:
+    // Preallocates room for max_flows records; the slot array is sized to stay below 3/4 load with every record
+    // in use, leaving room for tombstones up to the 7/8 growth limit
+    explicit FlowTable(size_t max_flows);
+    ~FlowTable();
+
+    FlowTable(const FlowTable&) = delete;
+    FlowTable& operator=(const FlowTable&) = delete;
+
+    // Finds or creates the flow of a decoded IP packet and accounts the packet to it. Returns nullptr if the
+    // packet is not IP or the table is full. direction (optional) receives 0 if endpoint a sent the packet
+    flow_record* update(const decoded_packet& packet, uint64_t timestamp_ns, uint32_t length, int* direction = nullptr);
+
+    flow_record* find(const flow_key& key);
+
+    // Removes a flow, the record must come from this table
+    void erase(flow_record* record);
+
+    // Builds the normalized key of a decoded IP packet, reversed tells whether the sender is endpoint b
+    static bool makeKey(const decoded_packet& packet, flow_key& key, bool& reversed);
+
+    static uint64_t hashKey(const flow_key& key);
+
+    // Calls f(flow_record&) for every flow, the table must not be modified meanwhile
+    template<typename F>
+    void forEach(F&& f) {
+        for (size_t i = 0; i < capacity; ++i) {
+            if (control[i] >= 0) {
+                f(records[slots[i]]);
+            }
+        }
+    }
+
+    // Stable index of a record, for structures that link records without pointers
+    uint32_t indexOf(const flow_record* record) const { return static_cast<uint32_t>(record - records.data()); }
+    flow_record& recordAt(uint32_t index) { return records[index]; }
+
+    size_t size() const { return count; }
+    uint64_t created() const { return createdCount; }   // Flows created since construction
+    size_t maxFlows() const { return records.size(); }
+    uint64_t dropped() const { return droppedCount; }   // Packets whose new flow did not fit
+
+private:
+    static constexpr int8_t CTRL_EMPTY = -128;
+    static constexpr int8_t CTRL_DELETED = -2;
+    static constexpr size_t GROUP_WIDTH = 16;
+    static constexpr size_t CACHE_LINE = 64;     // One group of slot indexes
+
+    int8_t* control;                // capacity control bytes: EMPTY, DELETED or the 7-bit hash tag of a full slot
+    uint32_t* slots;                // Record index of every full slot, a group's indexes share a cache line
+    size_t capacity;                // Power of two, multiple of GROUP_WIDTH
+    size_t groupMask;
+    size_t growthLimit;             // Full plus deleted slots allowed before tombstones are cleared
+    std::vector<flow_record> records;
+    std::vector<uint32_t> freeRecords;
+    size_t count{0};
+    size_t tombstones{0};
+    uint64_t droppedCount{0};
+    uint64_t createdCount{0};
+
+    // Slot holding a record with this key, or capacity if absent; firstFree receives the insert position
+    size_t lookup(const flow_key& key, uint64_t hash, size_t* firstFree) const;
+
+    size_t findFirstNonFull(uint64_t hash) const;
+
+    // Clears all tombstones in place by moving entries to their best position, no memory is allocated
+    void dropDeletes();
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_FLOW_TABLE_HPP
@@ -0,0 +1,464 @@
+// heavy_hitters.cpp: 固定内存的流量大户统计 (Space-Saving 与 Count-Min)
+//
+
+#include "heavy_hitters.h"
+#include <algorithm>
+#include <cstring>
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace figkey {
+
+namespace {
+
+const char* const DIMENSION_NAMES[TALKER_DIMENSIONS] = {"sources", "ports", "flows"};
+
+std::string TransportName(uint8_t protocol) {
+    switch (protocol) {
+    case 6:
+        return "tcp";
+    case 17:
+        return "udp";
+    case 132:
+        return "sctp";
+    default:
+        return std::to_string(protocol);
+    }
+}
+
+size_t PowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Entries of a SpaceSaving list as talker entries, with the other weight estimated by the sketch
+std::vector<talker_entry> Ranked(const std::vector<SpaceSaving::entry>& entries, const CountMinSketch& sketch,
+                                 bool by_bytes) {
+    std::vector<talker_entry> ranked;
+    ranked.reserve(entries.size());
+    for (const auto& e : entries) {
+        talker_entry t;
+        t.key = e.key;
+        sketch.estimate(e.hash, t.packets, t.bytes);
+        // Both are upper bounds, the smaller is closer
+        uint64_t& ranked_weight = by_bytes ? t.bytes : t.packets;
+        ranked_weight = std::min(ranked_weight, e.count);
+        t.error = e.error < ranked_weight ? e.error : ranked_weight;
+        ranked.push_back(t);
+    }
+    return ranked;
+}
+
+}  // namespace
+
+CountMinSketch::CountMinSketch(size_t sketch_width, size_t sketch_depth)
+        : width(PowerOfTwo(sketch_width > 0 ? sketch_width : 1)), depth(sketch_depth > 0 ? sketch_depth : 1) {
+    cells.assign(width * depth, cell{0, 0});
+}
+
+void CountMinSketch::update(uint64_t hash, uint64_t packets, uint64_t bytes, uint64_t& packet_estimate,
+                            uint64_t& byte_estimate) {
+    // Conservative update: raise every row only as far as the new estimate
+    uint64_t minPackets = UINT64_MAX;
+    uint64_t minBytes = UINT64_MAX;
+    for (size_t row = 0; row < depth; ++row) {
+        const cell& c = cells[slot(hash, row)];
+        minPackets = std::min(minPackets, c.packets);
+        minBytes = std::min(minBytes, c.bytes);
+    }
+    minPackets += packets;
+    minBytes += bytes;
+    for (size_t row = 0; row < depth; ++row) {
+        cell& c = cells[slot(hash, row)];
+        c.packets = std::max(c.packets, minPackets);
+        c.bytes = std::max(c.bytes, minBytes);
+    }
+    packet_estimate = minPackets;
+    byte_estimate = minBytes;
+}
+
+void CountMinSketch::estimate(uint64_t hash, uint64_t& packets, uint64_t& bytes) const {
+    packets = UINT64_MAX;
+    bytes = UINT64_MAX;
+    for (size_t row = 0; row < depth; ++row) {
+        const cell& c = cells[slot(hash, row)];
+        packets = std::min(packets, c.packets);
+        bytes = std::min(bytes, c.bytes);
+    }
+}
+
+void CountMinSketch::merge(const CountMinSketch& other) {
+    if (other.width != width || other.depth != depth) {
+        return;
+    }
+    for (size_t i = 0; i < cells.size(); ++i) {
+        cells[i].packets += other.cells[i].packets;
+        cells[i].bytes += other.cells[i].bytes;
+    }
+}
+
+void CountMinSketch::clear() {
+    std::fill(cells.begin(), cells.end(), cell{0, 0});
+}
+
+SpaceSaving::SpaceSaving(size_t capacity)
+        : limit(capacity > 0 ? capacity : 1) {
+    entries.reserve(limit);
+    heap.reserve(limit);
+    position.reserve(limit);
+    index.assign(PowerOfTwo(limit * 2), 0);
+    mask = index.size() - 1;
+}
+
+uint32_t SpaceSaving::find(const flow_key& key, uint64_t hash) const {
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t slot = index[i];
+        if (slot == 0) {
+            return NONE;
+        }
+        const entry& e = entries[slot - 1];
+        if (e.hash == hash && std::memcmp(&e.key, &key, sizeof(flow_key)) == 0) {
+            return slot - 1;
+        }
+    }
+}
+
+void SpaceSaving::insertIndex(uint32_t entry_index) {
+    size_t i = entries[entry_index].hash & mask;
+    while (index[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    index[i] = entry_index + 1;
+}
+
+void SpaceSaving::eraseIndex(uint32_t entry_index) {
+    size_t hole = entries[entry_index].hash & mask;
+    while (index[hole] != entry_index + 1) {
+        hole = (hole + 1) & mask;
+    }
+    // Backward shift: pull up later entries of the probe run whose home slot is not between the hole and them
+    for (size_t j = (hole + 1) & mask; index[j] != 0; j = (j + 1) & mask) {
+        size_t home = entries[index[j] - 1].hash & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            index[hole] = index[j];
+            hole = j;
+        }
+    }
+    index[hole] = 0;
+}
+
+void SpaceSaving::siftUp(size_t at) {
+    uint32_t moving = heap[at];
+    while (at > 0) {
+        size_t parent = (at - 1) / 2;
+        if (entries[heap[parent]].count <= entries[moving].count) {
+            break;
+        }
+        heap[at] = heap[parent];
+        position[heap[at]] = static_cast<uint32_t>(at);
+        at = parent;
+    }
+    heap[at] = moving;
+    position[moving] = static_cast<uint32_t>(at);
+}
+
+void SpaceSaving::siftDown(size_t at) {
+    uint32_t moving = heap[at];
+    size_t size = heap.size();
+    while (true) {
+        size_t child = at * 2 + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && entries[heap[child + 1]].count < entries[heap[child]].count) {
+            ++child;
+        }
+        if (entries[heap[child]].count >= entries[moving].count) {
+            break;
+        }
+        heap[at] = heap[child];
+        position[heap[at]] = static_cast<uint32_t>(at);
+        at = child;
+    }
+    heap[at] = moving;
+    position[moving] = static_cast<uint32_t>(at);
+}
+
+void SpaceSaving::update(const flow_key& key, uint64_t hash, uint64_t weight, uint64_t estimate) {
+    uint32_t found = find(key, hash);
+    if (found != NONE) {
+        entries[found].count += weight;
+        siftDown(position[found]);
+        return;
+    }
+    if (entries.size() < limit) {
+        uint32_t added = static_cast<uint32_t>(entries.size());
+        entries.push_back(entry{key, hash, weight, 0});
+        insertIndex(added);
+        heap.push_back(added);
+        position.push_back(static_cast<uint32_t>(heap.size() - 1));
+        siftUp(heap.size() - 1);
+        return;
+    }
+    // A missing key weighed at most the lightest count before, as it was either evicted as the lightest or kept
+    // out with an estimate below it. The newcomer replaces the lightest key if it may be heavier
+    uint32_t victim = heap[0];
+    uint64_t lightest = entries[victim].count;
+    if (estimate <= lightest) {
+        return;
+    }
+    uint64_t count = std::min(lightest + weight, estimate);
+    eraseIndex(victim);
+    entries[victim] = entry{key, hash, count, count - weight};
+    insertIndex(victim);
+    siftDown(0);
+}
+
+void SpaceSaving::merge(const SpaceSaving& other) {
+    // A key missing from a full summary may have weighed up to its minimum there
+    uint64_t ownMinimum = minimum();
+    uint64_t otherMinimum = other.minimum();
+    std::vector<entry> combined;
+    combined.reserve(entries.size() + other.entries.size());
+    for (const entry& e : entries) {
+        uint32_t match = other.find(e.key, e.hash);
+        entry c = e;
+        if (match != NONE) {
+            c.count += other.entries[match].count;
+            c.error += other.entries[match].error;
+        }
+        else {
+            c.count += otherMinimum;
+            c.error += otherMinimum;
+        }
+        combined.push_back(c);
+    }
+    for (const entry& e : other.entries) {
+        if (find(e.key, e.hash) == NONE) {
+            combined.push_back(entry{e.key, e.hash, e.count + ownMinimum, e.error + ownMinimum});
+        }
+    }
+    if (combined.size() > limit) {
+        std::nth_element(combined.begin(), combined.begin() + static_cast<std::ptrdiff_t>(limit), combined.end(),
+                         [](const entry& a, const entry& b) { return a.count > b.count; });
+        combined.resize(limit);
+    }
+    entries.swap(combined);
+    rebuild();
+}
+
+void SpaceSaving::rebuild() {
+    std::fill(index.begin(), index.end(), 0);
+    heap.clear();
+    position.clear();
+    for (uint32_t i = 0; i < entries.size(); ++i) {
+        insertIndex(i);
+        heap.push_back(i);
+        position.push_back(i);
+    }
+    for (size_t i = heap.size() / 2; i-- > 0;) {
+        siftDown(i);
+    }
+}
+
+void SpaceSaving::clear() {
+    entries.clear();
+    heap.clear();
+    position.clear();
+    std::fill(index.begin(), index.end(), 0);
+}
+
+std::vector<SpaceSaving::entry> SpaceSaving::top(size_t count) const {
+    std::vector<entry> sorted(entries);
+    size_t shown = std::min(count, sorted.size());
+    std::partial_sort(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(shown), sorted.end(),
+                      [](const entry& a, const entry& b) { return a.count > b.count; });
+    sorted.resize(shown);
+    return sorted;
+}
+
+TalkerSketch::TalkerSketch(const TopTalkerOptions& options) {
+    for (int i = 0; i < TALKER_DIMENSIONS; ++i) {
+        dimensions.push_back(dimension{CountMinSketch(options.sketchWidth, options.sketchDepth),
+                                       SpaceSaving(options.capacity), SpaceSaving(options.capacity)});
+    }
+}
+
+void TalkerSketch::add(TalkerDimension which, const flow_key& key, uint32_t length) {
+    uint64_t hash = FlowTable::hashKey(key);
+    dimension& d = dimensions[which];
+    uint64_t packetEstimate;
+    uint64_t byteEstimate;
+    d.sketch.update(hash, 1, length, packetEstimate, byteEstimate);
+    d.byBytes.update(key, hash, length, byteEstimate);
+    d.byPackets.update(key, hash, 1, packetEstimate);
+}
+
+void TalkerSketch::count(const decoded_packet& packet, uint32_t length) {
+    flow_key key;
+    bool reversed;
+    if (!FlowTable::makeKey(packet, key, reversed)) {
+        return;
+    }
+    ++packets;
+    bytes += length;
+    add(TALKER_FLOW, key, length);
+
+    flow_key source;
+    std::memset(&source, 0, sizeof(source));
+    std::memcpy(source.addr_a, packet.src_addr, sizeof(source.addr_a));
+    source.ip_version = packet.ip_version;
+    add(TALKER_SOURCE, source, length);
+
+    // makeKey leaves the ports 0 where there are none
+    uint16_t port = reversed ? key.port_a : key.port_b;
+    if (port != 0) {
+        flow_key destination;
+        std::memset(&destination, 0, sizeof(destination));
+        destination.port_b = port;
+        destination.protocol = packet.protocol;
+        add(TALKER_PORT, destination, length);
+    }
+}
+
+void TalkerSketch::merge(const TalkerSketch& other) {
+    for (size_t i = 0; i < dimensions.size() && i < other.dimensions.size(); ++i) {
+        dimensions[i].sketch.merge(other.dimensions[i].sketch);
+        dimensions[i].byBytes.merge(other.dimensions[i].byBytes);
+        dimensions[i].byPackets.merge(other.dimensions[i].byPackets);
+    }
+    packets += other.packets;
+    bytes += other.bytes;
+}
+
+void TalkerSketch::clear() {
+    for (dimension& d : dimensions) {
+        d.sketch.clear();
+        d.byBytes.clear();
+        d.byPackets.clear();
+    }
+    packets = 0;
+    bytes = 0;
+}
+
+void TalkerSketch::report(size_t top, talker_report& report) const {
+    report.packets = packets;
+    report.bytes = bytes;
+    for (int i = 0; i < TALKER_DIMENSIONS; ++i) {
+        const dimension& d = dimensions[i];
+        report.by_bytes[i] = Ranked(d.byBytes.top(top), d.sketch, true);
+        report.by_packets[i] = Ranked(d.byPackets.top(top), d.sketch, false);
+    }
+}
+
+ThreadTalkers::ThreadTalkers(TopTalkers& top_talkers, const TopTalkerOptions& options, uint32_t current_epoch)
+        : owner(top_talkers), sketch(options), epoch(current_epoch) {}
+
+void ThreadTalkers::flush() {
+    if (!empty) {
+        owner.handIn(sketch, epoch);
+        sketch.clear();
+        empty = true;
+    }
+}
+
+TopTalkers::TopTalkers(const TopTalkerOptions& talker_options)
+        : options(talker_options), merged{TalkerSketch(talker_options), TalkerSketch(talker_options)} {}
+
+ThreadTalkers* TopTalkers::addThread() {
+    std::lock_guard<std::mutex> guard(lock);
+    threads.push_back(std::make_unique<ThreadTalkers>(*this, options, epoch.load(std::memory_order_relaxed)));
+    return threads.back().get();
+}
+
+void TopTalkers::start(uint64_t time_ns) {
+    std::lock_guard<std::mutex> guard(lock);
+    starts[epoch.load(std::memory_order_relaxed) & 1] = time_ns;
+}
+
+void TopTalkers::handIn(const TalkerSketch& sketch, uint32_t counted) {
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t current = epoch.load(std::memory_order_relaxed);
+    // Counts of an interval already reported (the thread was idle across boundaries) go to the next report
+    merged[counted == current ? current & 1 : (current - 1) & 1].merge(sketch);
+}
+
+talker_report TopTalkers::take(uint32_t interval, uint64_t end_ns) {
+    talker_report report;
+    report.time_ns = end_ns;
+    report.interval_ns = end_ns > starts[interval & 1] ? end_ns - starts[interval & 1] : 0;
+    merged[interval & 1].report(options.top, report);
+    merged[interval & 1].clear();
+    return report;
+}
+
+bool TopTalkers::rotate(uint64_t time_ns, talker_report& report) {
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t current = epoch.load(std::memory_order_relaxed);
+    bool ready = current > 0;
+    if (ready) {
+        report = take(current - 1, starts[current & 1]);
+    }
+    starts[(current + 1) & 1] = time_ns;
+    epoch.store(current + 1, std::memory_order_relaxed);
+    return ready;
+}
+
+std::vector<talker_report> TopTalkers::finish(uint64_t time_ns) {
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t current = epoch.load(std::memory_order_relaxed);
+    std::vector<talker_report> reports;
+    if (current > 0) {
+        reports.push_back(take(current - 1, starts[current & 1]));
+    }
+    reports.push_back(take(current, time_ns));
+    return reports;
+}
+
+std::string TopTalkers::keyName(TalkerDimension dimension, const flow_key& key) {
+    char a[INET6_ADDRSTRLEN];
+    char b[INET6_ADDRSTRLEN];
+    int family = key.ip_version == 6 ? AF_INET6 : AF_INET;
+    switch (dimension) {
+    case TALKER_SOURCE:
+        inet_ntop(family, key.addr_a, a, sizeof(a));
+        return a;
+    case TALKER_PORT:
+        return TransportName(key.protocol) + "/" + std::to_string(key.port_b);
+    default:
+        break;
+    }
+    // IPv6 addresses in brackets, so the port stands apart
+    const char* open = family == AF_INET6 ? "[" : "";
+    const char* close = family == AF_INET6 ? "]:" : ":";
+    inet_ntop(family, key.addr_a, a, sizeof(a));
+    inet_ntop(family, key.addr_b, b, sizeof(b));
+    return open + std::string(a) + close + std::to_string(key.port_a) + " <-> " + open + b + close +
+           std::to_string(key.port_b) + " proto " + std::to_string(key.protocol);
+}
+
+void TopTalkers::writeJson(std::ostream& out, const talker_report& report) {
+    out << "{\"time_ns\": " << report.time_ns << ", \"interval_ns\": " << report.interval_ns
+        << ", \"packets\": " << report.packets << ", \"bytes\": " << report.bytes;
+    for (int i = 0; i < TALKER_DIMENSIONS; ++i) {
+        for (int weight = 0; weight < 2; ++weight) {
+            const std::vector<talker_entry>& list = weight == 0 ? report.by_bytes[i] : report.by_packets[i];
+            out << ",\n  \"" << DIMENSION_NAMES[i] << (weight == 0 ? "_by_bytes" : "_by_packets") << "\": [";
+            for (size_t k = 0; k < list.size(); ++k) {
+                out << (k > 0 ? ", " : "") << "{\"key\": \""
+                    << keyName(static_cast<TalkerDimension>(i), list[k].key) << "\", \"packets\": "
+                    << list[k].packets << ", \"bytes\": " << list[k].bytes << ", \"error\": " << list[k].error << "}";
+            }
+            out << "]";
+        }
+    }
+    out << "}";
+}
+
+}  // namespace figkey
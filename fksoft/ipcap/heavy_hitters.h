@@ -0,0 +1,270 @@
+/**
+ * @file    heavy_hitters.h
+ * @ingroup figkey
+ * @brief   Top talkers per interval in fixed memory: source addresses, destination ports and flows with the most
+ *          bytes and packets.
+ *          Exact per-key maps grow with every scanned address or port. These sketches stay the same size
+ *          whatever the traffic:
+ *            SpaceSaving    keeps the k heaviest keys seen so far. A new key takes the place of the lightest one
+ *                           and inherits its count as error, so a count overestimates its key by at most
+ *                           total / k. Lookups go through a small open addressing index, and the lightest entry
+ *                           sits at the top of a min-heap
+ *            CountMinSketch estimates the weight of any key from depth rows of counters, with conservative
+ *                           update: only the counters that carry the smallest estimate are raised. It gives the
+ *                           packet count of a top key by bytes and vice versa, and caps SpaceSaving counts.
+ *                           A key enters a full SpaceSaving summary only once its estimate passes the lightest
+ *                           count, so the long tail and scans of one packet per key leave the heap alone
+ *          Both merge: summaries of several threads combine as in Agarwal et al., "Mergeable Summaries", and
+ *          sketches add counter by counter.
+ *
+ *          Every capture thread counts into a TalkerSketch of its own, without locks. TopTalkers starts a new
+ *          interval by bumping an epoch. Each thread notices the change with its next packet, merges the sketch of
+ *          the interval it closed into a shared one and starts over. So a report is ready one interval after the
+ *          interval it covers, and a thread idle across a boundary hands its counts in with its next packet.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_HEAVY_HITTERS_HPP
+#define FIGKEY_HEAVY_HITTERS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "flow_table.h"
+#include "packet_decoder.h"
+
+namespace figkey {
+
+// What a top talker list ranks. Keys are flow_keys with only some fields set: the source address in addr_a for
+// TALKER_SOURCE, protocol and destination port in port_b for TALKER_PORT, the whole key for TALKER_FLOW
+enum TalkerDimension {
+    TALKER_SOURCE,
+    TALKER_PORT,
+    TALKER_FLOW,
+    TALKER_DIMENSIONS
+};
+
+struct TopTalkerOptions {
+    size_t top;             // Entries per reported list
+    size_t capacity;        // Keys kept per SpaceSaving summary
+    size_t sketchWidth;     // Counters per CountMinSketch row, rounded up to a power of two
+    size_t sketchDepth;     // CountMinSketch rows
+
+    TopTalkerOptions(size_t top_count = 10, size_t summary_capacity = 256, size_t sketch_width = 2048,
+                     size_t sketch_depth = 4)
+            : top(top_count), capacity(summary_capacity), sketchWidth(sketch_width), sketchDepth(sketch_depth) {}
+};
+
+class CountMinSketch {
+public:
+    CountMinSketch(size_t width, size_t depth);
+
+    // Adds packets and bytes to the key with this hash, and sets the estimates to the key's new upper bounds
+    void update(uint64_t hash, uint64_t packets, uint64_t bytes, uint64_t& packet_estimate, uint64_t& byte_estimate);
+
+    // Upper bounds of the packets and bytes of the key with this hash
+    void estimate(uint64_t hash, uint64_t& packets, uint64_t& bytes) const;
+
+    // Adds other, which must have the same dimensions
+    void merge(const CountMinSketch& other);
+
+    void clear();
+
+private:
+    struct cell {
+        uint64_t packets;
+        uint64_t bytes;
+    };
+
+    std::vector<cell> cells;    // depth rows of width cells
+    size_t width;
+    size_t depth;
+
+    // Cell of the key in row, from two halves of its hash (Kirsch and Mitzenmacher)
+    size_t slot(uint64_t hash, size_t row) const {
+        uint32_t h1 = static_cast<uint32_t>(hash);
+        uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+        return row * width + ((h1 + static_cast<uint32_t>(row) * h2) & (width - 1));
+    }
+};
+
+class SpaceSaving {
+public:
+    struct entry {
+        flow_key key;
+        uint64_t hash;
+        uint64_t count;     // Upper bound of the key's weight
+        uint64_t error;     // count - error is a lower bound
+    };
+
+    explicit SpaceSaving(size_t capacity);
+
+    // Adds weight to key, whose total weight is at most estimate (e.g. from a CountMinSketch). Once full, a
+    // missing key replaces the lightest one only when its estimate is higher
+    void update(const flow_key& key, uint64_t hash, uint64_t weight, uint64_t estimate);
+
+    // Combines other into this summary, keeping the heaviest keys of both
+    void merge(const SpaceSaving& other);
+
+    void clear();
+
+    // Smallest count once full, the most any key left out can weigh; 0 until then
+    uint64_t minimum() const { return entries.size() < limit ? 0 : entries[heap[0]].count; }
+
+    // The count heaviest entries, heaviest first
+    std::vector<entry> top(size_t count) const;
+
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+
+    size_t limit;
+    std::vector<entry> entries;
+    std::vector<uint32_t> heap;         // Entry indexes, min-heap by count
+    std::vector<uint32_t> position;     // Heap position of each entry
+    std::vector<uint32_t> index;        // Open addressing, entry index plus one, 0 for an empty slot
+    size_t mask;
+
+    uint32_t find(const flow_key& key, uint64_t hash) const;
+    void insertIndex(uint32_t entry_index);
+    void eraseIndex(uint32_t entry_index);
+    void siftUp(size_t at);
+    void siftDown(size_t at);
+    void rebuild();
+};
+
+// One ranked key of a report
+struct talker_entry {
+    flow_key key;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t error;     // Of the ranked weight, which is at least its value minus error
+};
+
+struct talker_report {
+    uint64_t time_ns;       // Wall clock at the end of the interval
+    uint64_t interval_ns;
+    uint64_t packets;       // IP packets and bytes counted in the interval
+    uint64_t bytes;
+    std::vector<talker_entry> by_bytes[TALKER_DIMENSIONS];
+    std::vector<talker_entry> by_packets[TALKER_DIMENSIONS];
+};
+
+// Summaries and sketches of all dimensions
+class TalkerSketch {
+public:
+    explicit TalkerSketch(const TopTalkerOptions& options);
+
+    // Counts an IP packet, others are ignored
+    void count(const decoded_packet& packet, uint32_t length);
+
+    void merge(const TalkerSketch& other);
+    void clear();
+
+    // Fills the totals and lists of report with up to top entries each
+    void report(size_t top, talker_report& report) const;
+
+private:
+    struct dimension {
+        CountMinSketch sketch;
+        SpaceSaving byBytes;
+        SpaceSaving byPackets;
+    };
+
+    std::vector<dimension> dimensions;
+    uint64_t packets{0};
+    uint64_t bytes{0};
+
+    void add(TalkerDimension which, const flow_key& key, uint32_t length);
+};
+
+class TopTalkers;
+
+// Sketch of one capture thread. Only that thread calls count and flush
+class ThreadTalkers {
+public:
+    ThreadTalkers(TopTalkers& top_talkers, const TopTalkerOptions& options, uint32_t epoch);
+
+    void count(const decoded_packet& packet, uint32_t length);
+
+    // Hands in the counts of the current interval, when the thread stops
+    void flush();
+
+private:
+    TopTalkers& owner;
+    TalkerSketch sketch;
+    uint32_t epoch;     // Interval being counted
+    bool empty{true};
+};
+
+class TopTalkers {
+public:
+    explicit TopTalkers(const TopTalkerOptions& options);
+
+    TopTalkers(const TopTalkers&) = delete;
+    TopTalkers& operator=(const TopTalkers&) = delete;
+
+    // Sketch for one more thread, valid as long as this object
+    ThreadTalkers* addThread();
+
+    // Marks the start of the first interval
+    void start(uint64_t time_ns);
+
+    // Ends the current interval and starts the next. Returns false, or true with the report of the interval
+    // ended by the call before, which the threads have handed in by now
+    bool rotate(uint64_t time_ns, talker_report& report);
+
+    // After the threads flushed: the reports of the last interval ended by rotate (if any) and of the one
+    // ending at time_ns
+    std::vector<talker_report> finish(uint64_t time_ns);
+
+    // JSON object of a report, keys as text
+    static void writeJson(std::ostream& out, const talker_report& report);
+
+    // Key of a report entry as text: an address, protocol/port, or both endpoints of a flow
+    static std::string keyName(TalkerDimension dimension, const flow_key& key);
+
+private:
+    friend class ThreadTalkers;
+
+    TopTalkerOptions options;
+    std::atomic<uint32_t> epoch{0};
+    mutable std::mutex lock;
+    std::deque<std::unique_ptr<ThreadTalkers>> threads;
+    TalkerSketch merged[2];     // Hand-ins per epoch parity
+    uint64_t starts[2] = {};    // Start time of the interval of each parity
+
+    // Merges a thread's counts of interval counted
+    void handIn(const TalkerSketch& sketch, uint32_t counted);
+
+    talker_report take(uint32_t interval, uint64_t end_ns);
+};
+
+inline void ThreadTalkers::count(const decoded_packet& packet, uint32_t length) {
+    uint32_t current = owner.epoch.load(std::memory_order_relaxed);
+    if (current != epoch) {
+        if (!empty) {
+            owner.handIn(sketch, epoch);
+            sketch.clear();
+            empty = true;
+        }
+        epoch = current;
+    }
+    if (packet.ip_version != 0) {
+        sketch.count(packet, length);
+        empty = false;
+    }
+}
+
+}  // namespace figkey
+
+#endif // !FIGKEY_HEAVY_HITTERS_HPP
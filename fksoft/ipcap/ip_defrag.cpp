@@ -0,0 +1,399 @@
+// ip_defrag.cpp: IP 分片重组
+//
+
+#include "ip_defrag.h"
+#include <algorithm>
+#include <cstring>
+
+namespace figkey {
+
+namespace {
+
+const uint8_t IPPROTO_HOPOPTS_ = 0;
+const uint8_t IPPROTO_ROUTING_ = 43;
+const uint8_t IPPROTO_FRAGMENT_ = 44;
+const uint8_t IPPROTO_DSTOPTS_ = 60;
+const int MAX_IPV6_EXTENSIONS = 8;
+const uint32_t MAX_IPV4_LENGTH = 65535;
+const uint32_t MAX_IPV6_LENGTH = 65535 + 40;     // The payload length excludes the fixed header
+const size_t KEEP_CAPACITY = 16384;              // Larger buffers are freed with their datagram
+
+inline uint64_t Load64(const unsigned char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t Mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint16_t Load16(const unsigned char* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline void Store16(unsigned char* p, uint16_t value) {
+    p[0] = static_cast<unsigned char>(value >> 8);
+    p[1] = static_cast<unsigned char>(value);
+}
+
+uint16_t HeaderChecksum(const unsigned char* header, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        sum += Load16(header + i);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+// Walks the unfragmentable IPv6 extension headers to the fragment header. position receives its offset from the
+// IP header, next_at the offset of the next header field pointing to it
+bool FindFragmentHeader(const unsigned char* ip, uint32_t end, uint32_t& position, uint32_t& next_at) {
+    uint8_t next = ip[6];
+    next_at = 6;
+    position = 40;
+    for (int i = 0; i <= MAX_IPV6_EXTENSIONS; ++i) {
+        if (next == IPPROTO_FRAGMENT_) {
+            return position + 8 <= end;
+        }
+        if ((next != IPPROTO_HOPOPTS_ && next != IPPROTO_ROUTING_ && next != IPPROTO_DSTOPTS_) || position + 8 > end) {
+            return false;
+        }
+        next_at = position;
+        next = ip[position];
+        position += (ip[position + 1] + 1u) * 8u;
+    }
+    return false;
+}
+
+}  // namespace
+
+IpDefragmenter::IpDefragmenter(const IpDefragOptions& defrag_options)
+        : options(defrag_options), datagrams(defrag_options.maxDatagrams > 0 ? defrag_options.maxDatagrams : 1),
+          sourceMemory(SOURCE_BUCKETS, 0) {
+    static_assert(sizeof(fragment_key) == 40, "fragment_key must not contain padding");
+    size_t bucketCount = 16;
+    while (bucketCount < datagrams.size() * 2) {
+        bucketCount <<= 1;
+    }
+    buckets.assign(bucketCount, NONE);
+    bucketMask = bucketCount - 1;
+    freeDatagrams.reserve(datagrams.size());
+    for (size_t i = datagrams.size(); i > 0; --i) {
+        freeDatagrams.push_back(static_cast<uint32_t>(i - 1));
+    }
+}
+
+bool IpDefragmenter::add(const decoded_packet& packet, const unsigned char* data, uint32_t wire_length,
+                         uint64_t timestamp_ns, ip_datagram& datagram) {
+    expire(timestamp_ns);
+    if (!(packet.flags & PKT_FLAG_FRAGMENT) || packet.ip_version == 0) {
+        return false;
+    }
+    ++stats.fragments;
+    if (packet.flags & PKT_FLAG_TRUNCATED) {
+        ++stats.truncated;
+        return false;
+    }
+
+    // Fragment data and the header that goes in front of the reassembled payload, both relative to the IP header
+    const unsigned char* ip = data + packet.l3_offset;
+    uint32_t end = packet.ip_length;
+    uint32_t headerLength;
+    uint32_t dataStart;
+    uint32_t nextAt = 0;
+    if (packet.ip_version == 4) {
+        headerLength = (ip[0] & 0x0F) * 4u;
+        dataStart = headerLength;
+    }
+    else {
+        if (!FindFragmentHeader(ip, end, headerLength, nextAt)) {
+            ++stats.malformed;
+            return false;
+        }
+        dataStart = headerLength + 8;
+    }
+
+    fragment_key key;
+    std::memset(&key, 0, sizeof(key));
+    size_t addressLength = packet.ip_version == 4 ? 4 : 16;
+    std::memcpy(key.src_addr, packet.src_addr, addressLength);
+    std::memcpy(key.dst_addr, packet.dst_addr, addressLength);
+    key.id = packet.fragment_id;
+    key.vlan_id = packet.vlan_count > 0 ? packet.vlan_id[0] : 0;
+    key.protocol = packet.ip_version == 4 ? packet.protocol : 0;
+    key.ip_version = packet.ip_version;
+    const unsigned char* k = reinterpret_cast<const unsigned char*>(&key);
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < sizeof(key); i += 8) {
+        h = (h ^ Load64(k + i)) * 0x87c37b91114253d5ULL;
+        h ^= h >> 29;
+    }
+    uint64_t hash = Mix(h);
+    uint32_t index = find(key, hash);
+
+    // Every fragment but the last carries a multiple of 8 bytes, and none may reach past the largest datagram
+    uint32_t offset = packet.fragment_offset;
+    uint32_t length = dataStart <= end ? end - dataStart : 0;
+    bool more = (packet.flags & PKT_FLAG_MORE_FRAGMENTS) != 0;
+    uint32_t maxLength = packet.ip_version == 4 ? MAX_IPV4_LENGTH : MAX_IPV6_LENGTH;
+    if (dataStart > end || (more && (length == 0 || length % 8 != 0)) || headerLength + offset + length > maxLength) {
+        if (index != NONE) {
+            release(index);
+        }
+        ++stats.malformed;
+        return false;
+    }
+    if (index == NONE) {
+        index = create(key, hash, timestamp_ns);
+    }
+    datagram_state& state = datagrams[index];
+
+    uint32_t fragmentEnd = offset + length;
+    bool consistent = ++state.fragments <= options.maxFragments;
+    if (!more) {
+        // The last fragment fixes the length, data already received must not go past it
+        if ((state.lastSeen && state.total != fragmentEnd) ||
+            (!state.ranges.empty() && state.ranges.back().second > fragmentEnd)) {
+            consistent = false;
+        }
+        state.total = fragmentEnd;
+        state.lastSeen = true;
+    }
+    else if (state.lastSeen && fragmentEnd > state.total) {
+        consistent = false;
+    }
+    if (!consistent) {
+        release(index);
+        ++stats.malformed;
+        return false;
+    }
+    state.wireLength += wire_length;
+
+    // Bytes the buffers grow by, checked against the limits before anything is copied
+    size_t headerSize = offset == 0 && state.header.empty() ? headerLength : state.header.size();
+    size_t needed = std::max<size_t>(state.payload.size(), fragmentEnd) + headerSize;
+    if (needed > state.charged) {
+        size_t extra = needed - state.charged;
+        if (sourceMemory[state.source] + extra > options.maxPerSource) {
+            release(index);
+            ++stats.limited;
+            return false;
+        }
+        while (memory + extra > options.maxMemory && oldest != index) {
+            release(oldest);
+            ++stats.evicted;
+        }
+        if (memory + extra > options.maxMemory) {
+            release(index);
+            ++stats.evicted;
+            return false;
+        }
+    }
+
+    bool duplicate = false;
+    if (!merge(state, offset, ip + dataStart, length, duplicate)) {
+        release(index);
+        ++stats.overlaps;
+        return false;
+    }
+    if (duplicate) {
+        ++stats.duplicates;
+    }
+    if (offset == 0 && state.header.empty()) {
+        state.header.assign(ip, ip + headerLength);
+        if (packet.ip_version == 6) {
+            state.header[nextAt] = ip[headerLength];    // Skip the fragment header
+        }
+    }
+    charge(state, state.payload.size() + state.header.size());
+
+    if (!state.lastSeen || state.header.empty() || state.ranges.size() != 1 || state.ranges[0].first != 0 ||
+        state.ranges[0].second != state.total) {
+        return false;
+    }
+    if (state.header.size() + state.total > maxLength) {
+        release(index);
+        ++stats.malformed;
+        return false;
+    }
+    complete(state, datagram);
+    release(index);
+    ++stats.reassembled;
+    return true;
+}
+
+void IpDefragmenter::expire(uint64_t timestamp_ns) {
+    uint64_t timeout = static_cast<uint64_t>(options.timeoutMs) * 1000000ULL;
+    while (oldest != NONE && timestamp_ns >= datagrams[oldest].firstSeenNs + timeout) {
+        release(oldest);
+        ++stats.timeouts;
+    }
+}
+
+ip_defrag_stats IpDefragmenter::getStats() const {
+    ip_defrag_stats current = stats;
+    current.pending = count;
+    current.buffered = memory;
+    return current;
+}
+
+uint32_t IpDefragmenter::find(const fragment_key& key, uint64_t hash) const {
+    for (uint32_t index = buckets[hash & bucketMask]; index != NONE; index = datagrams[index].bucketNext) {
+        const datagram_state& state = datagrams[index];
+        if (state.hash == hash && std::memcmp(&state.key, &key, sizeof(key)) == 0) {
+            return index;
+        }
+    }
+    return NONE;
+}
+
+uint32_t IpDefragmenter::create(const fragment_key& key, uint64_t hash, uint64_t timestamp_ns) {
+    if (freeDatagrams.empty()) {
+        release(oldest);
+        ++stats.evicted;
+    }
+    uint32_t index = freeDatagrams.back();
+    freeDatagrams.pop_back();
+
+    datagram_state& state = datagrams[index];
+    state.key = key;
+    state.hash = hash;
+    state.firstSeenNs = timestamp_ns;
+    state.source = static_cast<uint32_t>(Mix(Load64(key.src_addr) ^ Load64(key.src_addr + 8)) & (SOURCE_BUCKETS - 1));
+    state.total = 0;
+    state.lastSeen = false;
+    state.fragments = 0;
+    state.wireLength = 0;
+    state.charged = 0;
+
+    size_t bucket = hash & bucketMask;
+    state.bucketNext = buckets[bucket];
+    buckets[bucket] = index;
+    state.older = newest;
+    state.newer = NONE;
+    if (newest != NONE) {
+        datagrams[newest].newer = index;
+    }
+    else {
+        oldest = index;
+    }
+    newest = index;
+    ++count;
+    return index;
+}
+
+void IpDefragmenter::release(uint32_t index) {
+    datagram_state& state = datagrams[index];
+    uint32_t* link = &buckets[state.hash & bucketMask];
+    while (*link != index) {
+        link = &datagrams[*link].bucketNext;
+    }
+    *link = state.bucketNext;
+    if (state.older != NONE) {
+        datagrams[state.older].newer = state.newer;
+    }
+    else {
+        oldest = state.newer;
+    }
+    if (state.newer != NONE) {
+        datagrams[state.newer].older = state.older;
+    }
+    else {
+        newest = state.older;
+    }
+
+    charge(state, 0);
+    state.header.clear();
+    state.ranges.clear();
+    if (state.payload.capacity() > KEEP_CAPACITY) {
+        std::vector<unsigned char>().swap(state.payload);
+    }
+    else {
+        state.payload.clear();
+    }
+    freeDatagrams.push_back(index);
+    --count;
+}
+
+void IpDefragmenter::charge(datagram_state& state, size_t bytes) {
+    memory = memory - state.charged + bytes;
+    sourceMemory[state.source] = sourceMemory[state.source] - state.charged + bytes;
+    state.charged = bytes;
+}
+
+bool IpDefragmenter::merge(datagram_state& state, uint32_t start, const unsigned char* data, uint32_t length,
+                           bool& duplicate) {
+    uint32_t end = start + length;
+    if (length == 0) {
+        return true;
+    }
+    for (const auto& range : state.ranges) {
+        if (range.first >= end) {
+            break;
+        }
+        if (range.second <= start) {
+            continue;
+        }
+        uint32_t from = std::max(range.first, start);
+        uint32_t to = std::min(range.second, end);
+        if (std::memcmp(state.payload.data() + from, data + (from - start), to - from) != 0) {
+            return false;
+        }
+        if (from == start && to == end) {
+            duplicate = true;
+            return true;
+        }
+        if (state.key.ip_version == 6) {
+            return false;
+        }
+    }
+
+    if (state.payload.size() < end) {
+        state.payload.resize(end);
+    }
+    std::memcpy(state.payload.data() + start, data, length);
+    auto position = std::upper_bound(state.ranges.begin(), state.ranges.end(), std::make_pair(start, end));
+    state.ranges.insert(position, std::make_pair(start, end));
+    size_t kept = 0;
+    for (size_t i = 1; i < state.ranges.size(); ++i) {
+        if (state.ranges[i].first <= state.ranges[kept].second) {
+            state.ranges[kept].second = std::max(state.ranges[kept].second, state.ranges[i].second);
+        }
+        else {
+            state.ranges[++kept] = state.ranges[i];
+        }
+    }
+    state.ranges.resize(kept + 1);
+    return true;
+}
+
+void IpDefragmenter::complete(datagram_state& state, ip_datagram& datagram) {
+    size_t headerLength = state.header.size();
+    size_t length = headerLength + state.total;
+    output.resize(length);
+    std::memcpy(output.data(), state.header.data(), headerLength);
+    std::memcpy(output.data() + headerLength, state.payload.data(), state.total);
+    if (state.key.ip_version == 4) {
+        Store16(output.data() + 2, static_cast<uint16_t>(length));
+        Store16(output.data() + 6, Load16(output.data() + 6) & 0x4000);    // Keep DF only
+        Store16(output.data() + 10, 0);
+        Store16(output.data() + 10, HeaderChecksum(output.data(), headerLength));
+    }
+    else {
+        Store16(output.data() + 4, static_cast<uint16_t>(length - 40));
+    }
+    datagram.data = output.data();
+    datagram.length = static_cast<uint32_t>(length);
+    datagram.wire_length = state.wireLength;
+    datagram.fragments = state.fragments;
+}
+
+}  // namespace figkey
@@ -0,0 +1,150 @@
+/**
+ * @file    ip_defrag.h
+ * @ingroup figkey
+ * @brief   IPv4/IPv6 fragment reassembly with bounded memory.
+ *          Fragments are grouped by (source, destination, identification, protocol, VLAN) in a fixed pool of
+ *          datagrams reached through hashed buckets; nothing is allocated per fragment once the pool buffers
+ *          have grown. A datagram that is not complete within the timeout is discarded, and so are the oldest
+ *          ones when the number of datagrams or the bytes held over all of them would exceed their limit.
+ *          Every source address is charged for the bytes its datagrams hold, a source over its limit only
+ *          loses its own datagrams.
+ *
+ *          Overlapping fragments are how IDS evasion and teardrop style attacks work, so the first fragment
+ *          that changes bytes already received discards the whole datagram; for IPv6 any overlap does
+ *          (RFC 5722). Exact duplicates are dropped as retransmissions. Offsets or lengths that cannot occur in
+ *          a valid datagram, e.g. past 64 KB, discard it too.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_IP_DEFRAG_HPP
+#define FIGKEY_IP_DEFRAG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "packet_decoder.h"
+
+namespace figkey {
+
+struct IpDefragOptions {
+    uint32_t timeoutMs;         // Time from the first fragment after which an incomplete datagram is discarded
+    size_t maxDatagrams;        // Datagrams reassembled at the same time
+    size_t maxMemory;           // Bytes held over all datagrams
+    size_t maxPerSource;        // Bytes held for the datagrams of one source address
+    uint16_t maxFragments;      // Fragments per datagram, guards against floods of tiny fragments
+
+    IpDefragOptions(uint32_t timeout_ms = 30000, size_t max_datagrams = 4096, size_t max_memory = 32 << 20,
+                    size_t max_per_source = 4 << 20, uint16_t max_fragments = 64)
+            : timeoutMs(timeout_ms), maxDatagrams(max_datagrams), maxMemory(max_memory),
+              maxPerSource(max_per_source), maxFragments(max_fragments) {}
+};
+
+struct ip_defrag_stats {
+    uint64_t fragments;         // Fragments taken
+    uint64_t reassembled;       // Datagrams completed
+    uint64_t duplicates;        // Fragments whose bytes were all held already
+    uint64_t overlaps;          // Datagrams discarded because a fragment changed bytes already received
+    uint64_t malformed;         // Datagrams discarded for an impossible offset, length or fragment count
+    uint64_t timeouts;          // Datagrams discarded incomplete after the timeout
+    uint64_t evicted;           // Datagrams discarded to stay within maxDatagrams or maxMemory
+    uint64_t limited;           // Datagrams discarded because their source went over maxPerSource
+    uint64_t truncated;         // Fragments cut by the snaplen, which cannot be reassembled
+    size_t pending;             // Datagrams currently incomplete
+    size_t buffered;            // Bytes currently held
+};
+
+// A reassembled datagram: an IP header without fragmentation followed by the whole payload
+struct ip_datagram {
+    const unsigned char* data;  // Valid until the next call to add
+    uint32_t length;
+    uint32_t wire_length;       // Sum of the wire lengths of all fragments
+    uint16_t fragments;
+};
+
+class IpDefragmenter {
+public:
+    explicit IpDefragmenter(const IpDefragOptions& options = IpDefragOptions());
+
+    IpDefragmenter(const IpDefragmenter&) = delete;
+    IpDefragmenter& operator=(const IpDefragmenter&) = delete;
+
+    // Takes a packet the decoder flagged PKT_FLAG_FRAGMENT, data being the captured data it was decoded from.
+    // Returns true with datagram filled in when the fragment completed its datagram; decode it with
+    // PacketDecoder::decodeIp. Also discards the datagrams that timed out by timestamp_ns
+    bool add(const decoded_packet& packet, const unsigned char* data, uint32_t wire_length, uint64_t timestamp_ns,
+             ip_datagram& datagram);
+
+    // Discards the datagrams whose first fragment is older than the timeout at timestamp_ns
+    void expire(uint64_t timestamp_ns);
+
+    ip_defrag_stats getStats() const;
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr size_t SOURCE_BUCKETS = 4096;      // Sources sharing a bucket share maxPerSource
+
+    // No padding, compared and hashed as raw bytes
+    struct fragment_key {
+        uint8_t src_addr[16];
+        uint8_t dst_addr[16];
+        uint32_t id;
+        uint16_t vlan_id;
+        uint8_t protocol;       // IPv4 only, IPv6 fragments are identified without it
+        uint8_t ip_version;
+    };
+
+    struct datagram_state {
+        fragment_key key;
+        uint64_t hash;
+        uint64_t firstSeenNs;
+        uint32_t source;        // sourceMemory bucket of the source address
+        uint32_t bucketNext;    // Next datagram in the same bucket
+        uint32_t older;         // Age list, oldest first
+        uint32_t newer;
+        uint32_t total;         // Payload length, known once the last fragment arrived
+        bool lastSeen;
+        uint16_t fragments;
+        uint32_t wireLength;
+        size_t charged;         // Bytes counted against the memory limits
+        std::vector<unsigned char> header;      // IP header of the first fragment, without the fragment header
+        std::vector<unsigned char> payload;     // Fragment data at its offset
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;     // Received [start, end), sorted and coalesced
+    };
+
+    IpDefragOptions options;
+    std::vector<datagram_state> datagrams;
+    std::vector<uint32_t> freeDatagrams;
+    std::vector<uint32_t> buckets;      // First datagram of every bucket, power of two
+    size_t bucketMask;
+    uint32_t oldest{NONE};
+    uint32_t newest{NONE};
+    size_t count{0};
+    size_t memory{0};
+    std::vector<size_t> sourceMemory;
+    std::vector<unsigned char> output;  // Holds the last reassembled datagram
+    ip_defrag_stats stats{};
+
+    uint32_t find(const fragment_key& key, uint64_t hash) const;
+
+    uint32_t create(const fragment_key& key, uint64_t hash, uint64_t timestamp_ns);
+
+    // Frees a datagram, its bytes and buffers
+    void release(uint32_t index);
+
+    // Updates the bytes charged for a datagram after its buffers changed
+    void charge(datagram_state& state, size_t bytes);
+
+    // Merges [start, end) into the received ranges, false if it changes bytes already received
+    bool merge(datagram_state& state, uint32_t start, const unsigned char* data, uint32_t length, bool& duplicate);
+
+    void complete(datagram_state& state, ip_datagram& datagram);
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_IP_DEFRAG_HPP
@@ -1,44 +1,27 @@
 ﻿// ipcap.cpp: 定义应用程序的入口点。
 //
+#ifdef _WIN32
 #include <WinSock2.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <sstream>
+#include <thread>
 #include "ipcap.h"
+#include "checksum.h"
 #include "common/thread_pool.hpp"
 #include "common/logger.hpp"
 
-#define ETHERNET_HEADER_LEN 14
-
-struct ip_header {
-    unsigned char  iph_ihl : 4, iph_ver : 4;
-    unsigned char  iph_tos;
-    unsigned short iph_len;
-    unsigned short iph_ident;
-    unsigned short iph_offset;
-    unsigned char  iph_ttl;
-    unsigned char  iph_protocol;
-    unsigned short iph_chksum;
-    unsigned int   iph_sourceip;
-    unsigned int   iph_destip;
-};
-
-struct tcp_header {
-    unsigned short th_sport;
-    unsigned short th_dport;
-    unsigned int   th_seq;
-    unsigned int   th_ack;
-    unsigned char  th_off : 4, th_x2 : 4;
-    unsigned char  th_flags;
-    unsigned short th_win;
-    unsigned short th_sum;
-    unsigned short th_urp;
-};
-
-struct udp_header {
-    unsigned short uh_sport;
-    unsigned short uh_dport;
-    unsigned short uh_len;
-    unsigned short uh_sum;
-};
 namespace figkey{
 
 // 获取线程池的实例
@@ -62,35 +45,130 @@ static void InitLogger()
     logger.enableFileWrite(config);
 }
 
+static void CountChecksum(const checksum_result& result, thread_counters* counters)
+{
+    if (counters && (result.ip == ChecksumStatus::BAD || result.transport == ChecksumStatus::BAD)) {
+        thread_counters::add(counters->checksum_errors, 1);
+    }
+}
+
 void PcapCom::packetHandler(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet) {
-    struct ip_header* iph = (struct ip_header*)(packet + ETHERNET_HEADER_LEN);
-    unsigned int IPHeaderLength = iph->iph_ihl * 4;
+    auto* handlerContext = reinterpret_cast<HandlerContext*>(userData);
+    if (handlerContext && handlerContext->captureQueue) {
+        handlerContext->captureQueue->push(*pkthdr, packet);
+    }
+    int linkType = handlerContext ? handlerContext->linkType : DLT_EN10MB;
+    decoded_packet decoded;
+    DecodeStatus status = PacketDecoder::decode(linkType, packet, pkthdr->caplen, decoded);
+    thread_counters* counters = handlerContext ? handlerContext->counters : nullptr;
+    if (counters) {
+        counters->count(pkthdr->len, decoded, status);
+    }
+    if (handlerContext && handlerContext->checksums) {
+        CountChecksum(Checksum::verify(packet, decoded), counters);
+    }
+    uint64_t timestamp = static_cast<uint64_t>(pkthdr->ts.tv_sec) * 1000000000ULL +
+                         static_cast<uint64_t>(pkthdr->ts.tv_usec) * (handlerContext ? handlerContext->tsUnitNs : 1000);
+
+    // A fragment is tracked, logged and recorded as the datagram it completes; the fragments before it are only
+    // counted
+    const decoded_packet* datagram = &decoded;
+    const unsigned char* datagramData = packet;
+    uint32_t datagramLength = pkthdr->len;
+    DecodeStatus datagramStatus = status;
+    decoded_packet reassembled;
+    if (handlerContext && handlerContext->defrag && (decoded.flags & PKT_FLAG_FRAGMENT)) {
+        ip_datagram whole;
+        if (handlerContext->defrag->add(decoded, packet, pkthdr->len, timestamp, whole)) {
+            datagramStatus = PacketDecoder::decodeIp(whole.data, whole.length, reassembled);
+            reassembled.vlan_count = decoded.vlan_count;
+            reassembled.vlan_id[0] = decoded.vlan_id[0];
+            reassembled.vlan_id[1] = decoded.vlan_id[1];
+            if (handlerContext->checksums) {
+                CountChecksum(Checksum::verify(whole.data, reassembled), counters);
+            }
+            datagram = &reassembled;
+            datagramData = whole.data;
+            datagramLength = whole.wire_length;
+        }
+        else {
+            return;
+        }
+    }
 
-    char sourceIp[INET_ADDRSTRLEN];
-    char destIp[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(iph->iph_sourceip), sourceIp, INET_ADDRSTRLEN);
-    inet_ntop(AF_INET, &(iph->iph_destip), destIp, INET_ADDRSTRLEN);
+    if (handlerContext && handlerContext->flows && datagram->ip_version != 0) {
+        FlowExpiry* expiry = handlerContext->expiry.get();
+        if (expiry) {
+            expiry->advance(timestamp);
+        }
+        int direction = 0;
+        flow_record* flow = handlerContext->flows->update(*datagram, timestamp, datagramLength, &direction);
+        if (!flow && counters) {
+            thread_counters::add(counters->errors, 1);
+        }
+        if (flow && expiry) {
+            expiry->onPacket(flow);
+        }
+        if (flow && handlerContext->reassembly) {
+            handlerContext->reassembly->onPacket(flow, direction, *datagram, datagramData);
+        }
+        if (flow && handlerContext->dissectors) {
+            handlerContext->dissectors->inspect(*flow, direction, *datagram, datagramData);
+        }
+        if (flow && handlerContext->udpScanner && datagram->protocol == IPPROTO_UDP && datagram->payload_length) {
+            handlerContext->udpScanner->scanPacket(*flow, direction, datagramData + datagram->payload_offset,
+                                                   datagram->payload_length);
+        }
+    }
+    if (datagram != &decoded) {
+        decoded = *datagram;
+        status = datagramStatus;
+    }
+    if (handlerContext && handlerContext->records) {
+        struct pcap_pkthdr header = *pkthdr;
+        header.len = datagramLength;
+        handlerContext->records->writePacket(header, timestamp, decoded, status);
+        return;
+    }
+    if (decoded.ip_version == 0) {
+        logger.debug(std::string("###") + PacketDecoder::statusName(status) + " Packet");
+        return;
+    }
+
+    int family = decoded.ip_version == 6 ? AF_INET6 : AF_INET;
+    char sourceIp[INET6_ADDRSTRLEN];
+    char destIp[INET6_ADDRSTRLEN];
+    inet_ntop(family, decoded.src_addr, sourceIp, INET6_ADDRSTRLEN);
+    inet_ntop(family, decoded.dst_addr, destIp, INET6_ADDRSTRLEN);
 
     std::ostringstream ss_log;
     ss_log << "Source IP: " << sourceIp << ", Destination IP: " << destIp;
 
-    switch (iph->iph_protocol) {
-    case IPPROTO_TCP: {
-        struct tcp_header* tcph = (struct tcp_header*)(packet + ETHERNET_HEADER_LEN + IPHeaderLength);
-        ss_log << "###TCP Packet: Src Port: " << ntohs(tcph->th_sport) << ", Dst Port: " << ntohs(tcph->th_dport);
-        break;
+    if (status != DecodeStatus::OK) {
+        ss_log << "###" << PacketDecoder::statusName(status) << " Packet";
+    }
+    else if ((decoded.flags & PKT_FLAG_FRAGMENT) && decoded.fragment_offset != 0) {
+        ss_log << "###Fragment: Offset: " << decoded.fragment_offset;
     }
-    case IPPROTO_UDP: {
-        struct udp_header* udph = (struct udp_header*)(packet + ETHERNET_HEADER_LEN + IPHeaderLength);
-        ss_log << "###UDP Packet: Src Port: " << ntohs(udph->uh_sport) << ", Dst Port: " << ntohs(udph->uh_dport);
-        break;
+    else {
+        switch (decoded.protocol) {
+        case IPPROTO_TCP:
+            ss_log << "###TCP Packet: Src Port: " << decoded.src_port << ", Dst Port: " << decoded.dst_port;
+            break;
+        case IPPROTO_UDP:
+            ss_log << "###UDP Packet: Src Port: " << decoded.src_port << ", Dst Port: " << decoded.dst_port;
+            break;
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            ss_log << "###ICMP Packet";
+            break;
+        default:
+            ss_log << "###Other Protocol";
+            break;
+        }
     }
-    case IPPROTO_ICMP:
-        ss_log << "###ICMP Packet";
-        break;
-    default:
-        ss_log << "###Other Protocol";
-        break;
+    if (decoded.flags & (PKT_FLAG_BAD_IP_CHECKSUM | PKT_FLAG_BAD_L4_CHECKSUM)) {
+        ss_log << "###Bad Checksum";
     }
     logger.info(ss_log.str());
 }
@@ -117,51 +195,1088 @@ std::vector<network_info> PcapCom::getNetworkList() {
     return devices;
 }
 
-bool PcapCom::setNetwork(const std::string& network_name) {
+bool PcapCom::setNetwork(const std::string& network_name, const CaptureOptions& options) {
     char errbuf[PCAP_ERRBUF_SIZE];
-    handle = pcap_open_live(network_name.c_str(), 65536, 1, 1000, errbuf);
+    closeCapture();
+    handle = pcap_create(network_name.c_str(), errbuf);
     if (handle == NULL) {
         std::cerr << "Couldn't open device " << network_name << ": " << errbuf << std::endl;
         return false;
     }
+    // Settings only fail on an activated handle, the device's verdict comes from pcap_activate
+    pcap_set_snaplen(handle, options.snaplen);
+    pcap_set_promisc(handle, options.promisc ? 1 : 0);
+    pcap_set_timeout(handle, options.timeoutMs);
+    pcap_set_immediate_mode(handle, options.immediate ? 1 : 0);
+    if (options.bufferSize > 0) {
+        pcap_set_buffer_size(handle, options.bufferSize);
+    }
+    if (options.nanoTimestamps && pcap_set_tstamp_precision(handle, PCAP_TSTAMP_PRECISION_NANO) != 0) {
+        std::cerr << "Nanosecond timestamps not supported on " << network_name << ", using microseconds" << std::endl;
+    }
+    int rc = pcap_activate(handle);
+    if (rc < 0) {
+        std::cerr << "Couldn't open device " << network_name << ": " << pcap_statustostr(rc) << " "
+                  << pcap_geterr(handle) << std::endl;
+        pcap_close(handle);
+        handle = nullptr;
+        return false;
+    }
+    if (rc > 0) {
+        std::cerr << "Warning on " << network_name << ": " << pcap_statustostr(rc) << " " << pcap_geterr(handle)
+                  << std::endl;
+    }
+    tsUnitNs = pcap_get_tstamp_precision(handle) == PCAP_TSTAMP_PRECISION_NANO ? 1 : 1000;
+    networkName = network_name;
+    resetFilterStats();
+    return true;
+}
+
+bool PcapCom::setOffline(const std::string& file_path, const ReplayOptions& options) {
+    closeCapture();
+
+    if (options.useLibpcap) {
+        char errbuf[PCAP_ERRBUF_SIZE];
+        handle = pcap_open_offline(file_path.c_str(), errbuf);
+        if (handle == NULL) {
+            std::cerr << "Couldn't open file " << file_path << ": " << errbuf << std::endl;
+            return false;
+        }
+    } else {
+        fileReader = std::make_unique<PcapFileReader>();
+        if (!fileReader->open(file_path)) {
+            std::cerr << "Couldn't open file " << file_path << ": " << fileReader->lastError() << std::endl;
+            fileReader.reset();
+            return false;
+        }
+    }
+    offline = true;
+    networkName = file_path;
+    replayOptions = options;
     return true;
+}
 
-#if 0
-    // 设置过滤器（例如只捕获TCP数据包）
-    struct bpf_program filter;
-    char filter_exp[] = "tcp";
-    if (pcap_compile(handle, &filter, filter_exp, 0, PCAP_NETMASK_UNKNOWN) == -1) {
-        std::cerr << "Bad filter - " << pcap_geterr(handle) << std::endl;
-        pcap_freealldevs(alldevs);
-        pcap_close(handle);
-        return -1;
+bool PcapCom::setAfPacket(const std::string& network_name, const AfPacketOptions& options) {
+    closeCapture();
+    afPacket = std::make_unique<AfPacketCapture>();
+    if (!afPacket->open(network_name, options)) {
+        std::cerr << "Couldn't open device " << network_name << ": " << afPacket->lastError() << std::endl;
+        afPacket.reset();
+        return false;
+    }
+    networkName = network_name;
+    resetFilterStats();
+    return true;
+}
+
+bool PcapCom::setFanout(const std::string& network_name, unsigned thread_count, const AfPacketOptions& options,
+                        bool pin_threads) {
+    closeCapture();
+    if (thread_count == 0) {
+        std::cerr << "Fanout capture needs at least one thread" << std::endl;
+        return false;
+    }
+
+    // Group ids are global to the host, derive one from the pid unless the caller picked one
+    AfPacketOptions groupOptions = options;
+    if (groupOptions.fanoutGroup == 0) {
+#if defined(__linux__)
+        groupOptions.fanoutGroup = static_cast<uint16_t>(getpid() & 0xFFFF);
+#endif
+        if (groupOptions.fanoutGroup == 0) {
+            groupOptions.fanoutGroup = 1;
+        }
+    }
+    unsigned cpuCount = std::thread::hardware_concurrency();
+
+    for (unsigned i = 0; i < thread_count; ++i) {
+        auto worker = std::make_unique<FanoutWorker>();
+        worker->index = i;
+        worker->cpu = pin_threads && cpuCount > 0 ? static_cast<int>(i % cpuCount) : -1;
+        if (!worker->capture.open(network_name, groupOptions)) {
+            std::cerr << "Couldn't open fanout socket " << i << " on " << network_name << ": "
+                      << worker->capture.lastError() << std::endl;
+            fanoutWorkers.clear();
+            return false;
+        }
+        worker->context.linkType = worker->capture.linkType();
+        fanoutWorkers.push_back(std::move(worker));
+    }
+    networkName = network_name;
+    resetFilterStats();
+    return true;
+}
+
+// Packets the interface received and sent, everything a packet socket sees before its filter (Linux only)
+static bool InterfaceCounters(const std::string& network_name, uint64_t& packets)
+{
+#if defined(__linux__)
+    uint64_t total = 0;
+    for (const char* counter : {"rx_packets", "tx_packets"}) {
+        std::ifstream file("/sys/class/net/" + network_name + "/statistics/" + counter);
+        uint64_t value;
+        if (!(file >> value)) {
+            return false;
+        }
+        total += value;
+    }
+    packets = total;
+    return true;
+#else
+    (void)network_name;
+    (void)packets;
+    return false;
+#endif
+}
+
+void PcapCom::resetFilterStats() {
+    interfaceCounters = InterfaceCounters(networkName, interfaceBaseline);
+}
+
+bool PcapCom::setFilter(const std::string& expression) {
+    if (!handle && !fileReader && !afPacket && fanoutWorkers.empty()) {
+        std::cerr << "Open a capture before setting a filter" << std::endl;
+        return false;
+    }
+
+    // Live libpcap handles compile for their own link layer, the other backends through a dead handle
+    auto filter = std::make_unique<FilterProgram>();
+    pcap_t* compiler = handle ? handle : pcap_open_dead(captureLinkType(), 262144);
+    if (!compiler) {
+        std::cerr << "Couldn't compile filter \"" << expression << "\"" << std::endl;
+        return false;
+    }
+    bool compiled = pcap_compile(compiler, &filter->program, expression.c_str(), 1, PCAP_NETMASK_UNKNOWN) == 0;
+    if (!compiled) {
+        std::cerr << "Bad filter \"" << expression << "\": " << pcap_geterr(compiler) << std::endl;
+    }
+    if (compiler != handle) {
+        pcap_close(compiler);
+    }
+    if (!compiled) {
+        return false;
+    }
+
+    // The kernel copies socket filters, only replay filters have to outlive this call
+    std::string error;
+    if (offline) {
+        replayFilter.store(filter.get(), std::memory_order_release);
+        replayFilters.push_back(std::move(filter));
+    }
+    else if (!fanoutWorkers.empty()) {
+        size_t attached = 0;
+        for (; attached < fanoutWorkers.size(); ++attached) {
+            if (!fanoutWorkers[attached]->capture.setFilter(filter->program)) {
+                error = fanoutWorkers[attached]->capture.lastError();
+                break;
+            }
+        }
+        if (error.empty()) {
+            fanoutFilter = std::move(filter);
+        }
+        else {
+            // Every socket of the group has to filter alike, the ones already switched get the previous program
+            // back; without one they accept everything, as the empty expression compiles to
+            struct bpf_insn acceptAll = BPF_STMT(BPF_RET | BPF_K, 262144);
+            struct bpf_program acceptProgram = {1, &acceptAll};
+            const struct bpf_program& previous = fanoutFilter ? fanoutFilter->program : acceptProgram;
+            for (size_t i = 0; i < attached; ++i) {
+                if (!fanoutWorkers[i]->capture.setFilter(previous)) {
+                    std::cerr << "Couldn't restore the filter of fanout thread " << i << " on " << networkName
+                              << ": " << fanoutWorkers[i]->capture.lastError() << std::endl;
+                }
+            }
+        }
+    }
+    else if (afPacket) {
+        if (!afPacket->setFilter(filter->program)) {
+            error = afPacket->lastError();
+        }
+    }
+    else {
+        // pcap_setfilter fixes the program up for the link layer (e.g. the cooked "any" device) and drains the
+        // socket, so it must not race pcap_loop: a running loop is stopped, swaps and resumes on its own thread
+        std::unique_lock<std::mutex> lock(filterSwapMutex);
+        if (pcapLooping) {
+            pendingFilter = filter.get();
+            pcap_breakloop(handle);
+            filterSwapped.wait(lock, [this]() { return pendingFilter == nullptr; });
+            error = filterSwapError;
+        }
+        else if (pcap_setfilter(handle, &filter->program) != 0) {
+            error = pcap_geterr(handle);
+        }
     }
-    if (pcap_setfilter(handle, &filter) == -1) {
-        std::cerr << "Error setting filter - " << pcap_geterr(handle) << std::endl;
-        pcap_freealldevs(alldevs);
+    if (!error.empty()) {
+        std::cerr << "Couldn't set filter \"" << expression << "\" on " << networkName << ": " << error << std::endl;
+        return false;
+    }
+    filterExpression = expression;
+    return true;
+}
+
+filter_stats PcapCom::getFilterStats() {
+    filter_stats stats{};
+    if (offline) {
+        stats.accepted = replayAccepted.load(std::memory_order_relaxed);
+        stats.filtered = replayFiltered.load(std::memory_order_relaxed);
+        return stats;
+    }
+    if (!fanoutWorkers.empty()) {
+        for (auto& worker : fanoutWorkers) {
+            af_packet_stats kernel = worker->capture.getStats();
+            stats.accepted += kernel.packets;
+            stats.kernel_drops += kernel.drops;
+        }
+    }
+    else if (afPacket) {
+        af_packet_stats kernel = afPacket->getStats();
+        stats.accepted = kernel.packets;
+        stats.kernel_drops = kernel.drops;
+    }
+    else if (handle) {
+        struct pcap_stat ps;
+        if (pcap_stats(handle, &ps) == 0) {
+            stats.accepted = ps.ps_recv;
+            stats.kernel_drops = static_cast<uint64_t>(ps.ps_drop) + ps.ps_ifdrop;
+        }
+    }
+    // The interface counts every packet, the socket only those its filter passed
+    uint64_t seen;
+    if (interfaceCounters && InterfaceCounters(networkName, seen) && seen - interfaceBaseline > stats.accepted) {
+        stats.filtered = seen - interfaceBaseline - stats.accepted;
+    }
+    return stats;
+}
+
+void PcapCom::setStatistics(const CaptureStatsOptions& options) {
+    statisticsOptions = options;
+    statisticsSampling = true;
+}
+
+capture_stats_sample PcapCom::getStatistics() {
+    return statistics.totals();
+}
+
+std::vector<capture_stats_sample> PcapCom::getStatisticsHistory(size_t count) const {
+    return statistics.history(count);
+}
+
+std::vector<talker_report> PcapCom::getTopTalkers(size_t count) const {
+    return statistics.topTalkers(count);
+}
+
+std::vector<fanout_stats> PcapCom::getFanoutStats() const {
+    std::vector<fanout_stats> stats;
+    for (const auto& worker : fanoutWorkers) {
+        stats.push_back(fanout_stats{worker->index, worker->cpu, worker->packets.load(std::memory_order_relaxed),
+                                     worker->bytes.load(std::memory_order_relaxed)});
+    }
+    return stats;
+}
+
+void PcapCom::fanoutHandler(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet) {
+    auto* worker = reinterpret_cast<FanoutWorker*>(userData);
+    // Single writer, a plain load and store is enough and avoids a locked instruction per packet
+    worker->packets.store(worker->packets.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    worker->bytes.store(worker->bytes.load(std::memory_order_relaxed) + pkthdr->caplen, std::memory_order_relaxed);
+    packetHandler(reinterpret_cast<unsigned char*>(&worker->context), pkthdr, packet);
+}
+
+void PcapCom::setBatchHandler(BatchHandler* handler, size_t batch_size) {
+    batchHandler = handler;
+    batchSize = batch_size > 0 ? batch_size : PacketBatch::DEFAULT_CAPACITY;
+}
+
+void PcapCom::batchCollect(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet) {
+    auto* state = reinterpret_cast<BatchState*>(userData);
+    if (PacketRing* queue = (state->worker ? state->worker->context : state->owner->context).captureQueue) {
+        queue->push(*pkthdr, packet);
+    }
+    state->batch.add(*pkthdr, packet);
+    if (state->batch.full()) {
+        flushBatch(*state);
+    }
+}
+
+void PcapCom::batchCollectCopy(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet) {
+    auto* state = reinterpret_cast<BatchState*>(userData);
+    if (PacketRing* queue = (state->worker ? state->worker->context : state->owner->context).captureQueue) {
+        queue->push(*pkthdr, packet);
+    }
+    if (!state->batch.addCopy(*pkthdr, packet)) {
+        flushBatch(*state);
+        state->batch.addCopy(*pkthdr, packet);
+    }
+    if (state->batch.full()) {
+        flushBatch(*state);
+    }
+}
+
+void PcapCom::batchBlockDone(unsigned char* userData) {
+    flushBatch(*reinterpret_cast<BatchState*>(userData));
+}
+
+void PcapCom::beginPcapLoop() {
+    std::lock_guard<std::mutex> lock(filterSwapMutex);
+    pcapLooping = true;
+}
+
+void PcapCom::endPcapLoop() {
+    std::lock_guard<std::mutex> lock(filterSwapMutex);
+    pcapLooping = false;
+    installPendingFilter();
+}
+
+bool PcapCom::swapPendingFilter() {
+    std::lock_guard<std::mutex> lock(filterSwapMutex);
+    // Without a pending filter the break came from stopCapture
+    return installPendingFilter() && !pcapStopping;
+}
+
+bool PcapCom::installPendingFilter() {
+    if (!pendingFilter) {
+        return false;
+    }
+    filterSwapError.clear();
+    if (pcap_setfilter(handle, &pendingFilter->program) != 0) {
+        filterSwapError = pcap_geterr(handle);
+    }
+    pendingFilter = nullptr;
+    filterSwapped.notify_all();
+    return true;
+}
+
+void PcapCom::flushBatch(BatchState& state) {
+    PacketBatch& batch = state.batch;
+    if (batch.empty()) {
+        return;
+    }
+    if (FanoutWorker* worker = state.worker) {
+        uint64_t bytes = 0;
+        for (const packet_view& view : batch) {
+            bytes += view.header.caplen;
+        }
+        worker->packets.store(worker->packets.load(std::memory_order_relaxed) + batch.size(), std::memory_order_relaxed);
+        worker->bytes.store(worker->bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    }
+    if (thread_counters* counters = (state.worker ? state.worker->context : state.owner->context).counters) {
+        uint64_t length = 0;
+        for (const packet_view& view : batch) {
+            length += view.header.len;
+        }
+        counters->count(batch.size(), length);
+    }
+    state.owner->batchHandler->onBatch(batch);
+    batch.clear();
+}
+
+void PcapCom::setPipeline(const PipelineOptions& options) {
+    pipelineOptions = options;
+}
+
+void PcapCom::setFlowTracking(size_t max_flows) {
+    maxFlows = max_flows;
+}
+
+void PcapCom::setFlowExpiry(FlowExpiryHandler* handler, const FlowExpiryOptions& options) {
+    flowExpiry = true;
+    expiryHandler = handler;
+    expiryOptions = options;
+}
+
+void PcapCom::setRecordOutput(const std::string& path) {
+    recordPath = path;
+}
+
+void PcapCom::setIpDefrag(bool enable, const IpDefragOptions& options) {
+    ipDefrag = enable;
+    defragOptions = options;
+}
+
+void PcapCom::setChecksumValidation(bool enable) {
+    checksumValidation = enable;
+}
+
+ip_defrag_stats PcapCom::getIpDefragStats() const {
+    ip_defrag_stats total{};
+    auto add = [&total](const HandlerContext& handler_context) {
+        if (!handler_context.defrag) {
+            return;
+        }
+        ip_defrag_stats stats = handler_context.defrag->getStats();
+        total.fragments += stats.fragments;
+        total.reassembled += stats.reassembled;
+        total.duplicates += stats.duplicates;
+        total.overlaps += stats.overlaps;
+        total.malformed += stats.malformed;
+        total.timeouts += stats.timeouts;
+        total.evicted += stats.evicted;
+        total.limited += stats.limited;
+        total.truncated += stats.truncated;
+        total.pending += stats.pending;
+        total.buffered += stats.buffered;
+    };
+    add(context);
+    for (const auto& worker : fanoutWorkers) {
+        add(worker->context);
+    }
+    for (const auto& worker : pipelineWorkers) {
+        add(worker->context);
+    }
+    return total;
+}
+
+void PcapCom::setStreamHandler(TcpStreamHandler* handler, uint16_t port) {
+    for (auto& entry : streamHandlers) {
+        if (entry.first == port) {
+            entry.second = handler;
+            return;
+        }
+    }
+    streamHandlers.emplace_back(port, handler);
+}
+
+void PcapCom::setTcpReassembly(const TcpReassemblyOptions& options) {
+    reassemblyOptions = options;
+}
+
+void PcapCom::setPayloadMatching(const PayloadMatcher* matcher, PayloadMatchHandler* handler) {
+    payloadMatcher = matcher;
+    payloadMatchHandler = handler;
+}
+
+void PcapCom::setAppDissection(const DissectorRegistry* registry) {
+    dissectorRegistry = registry;
+}
+
+payload_match_stats PcapCom::getPayloadMatchStats() const {
+    payload_match_stats total{};
+    auto add = [&total](const HandlerContext& handler_context) {
+        for (const auto& scanner : handler_context.scanners) {
+            payload_match_stats stats = scanner->getStats();
+            total.tcp_bytes += stats.tcp_bytes;
+            total.udp_bytes += stats.udp_bytes;
+            total.matches += stats.matches;
+            total.flows += stats.flows;
+        }
+    };
+    add(context);
+    for (const auto& worker : fanoutWorkers) {
+        add(worker->context);
+    }
+    for (const auto& worker : pipelineWorkers) {
+        add(worker->context);
+    }
+    return total;
+}
+
+void PcapCom::setCaptureOutput(const std::string& path, const CaptureWriterOptions& options) {
+    captureOutputPath = path;
+    captureOutputOptions = options;
+}
+
+capture_writer_stats PcapCom::getCaptureOutputStats() const {
+    return captureWriter ? captureWriter->getStats() : capture_writer_stats{};
+}
+
+void PcapCom::startCaptureOutput() {
+    captureWriter.reset();
+    if (captureOutputPath.empty()) {
+        return;
+    }
+    auto writer = std::make_unique<CaptureWriter>(captureOutputOptions);
+    uint32_t interface = writer->addInterface(networkName, captureLinkType(), tsUnitNs);
+    std::vector<PacketRing*> queues;
+    size_t producers = fanoutWorkers.empty() ? 1 : fanoutWorkers.size();
+    for (size_t i = 0; i < producers; ++i) {
+        queues.push_back(writer->addQueue(interface));
+    }
+    if (!writer->start(captureOutputPath)) {
+        std::cerr << "Couldn't write capture file: " << writer->lastError() << std::endl;
+        return;
+    }
+    if (fanoutWorkers.empty()) {
+        context.captureQueue = queues.front();
+    }
+    else {
+        for (size_t i = 0; i < fanoutWorkers.size(); ++i) {
+            fanoutWorkers[i]->context.captureQueue = queues[i];
+        }
+    }
+    captureWriter = std::move(writer);
+}
+
+void PcapCom::stopCaptureOutput() {
+    if (!captureWriter || !captureWriter->isRunning()) {
+        return;
+    }
+    captureWriter->stop();
+    context.captureQueue = nullptr;
+    for (auto& worker : fanoutWorkers) {
+        worker->context.captureQueue = nullptr;
+    }
+    capture_writer_stats stats = captureWriter->getStats();
+    std::cout << "Capture file " << captureOutputPath << ": " << stats.packets << " packets, " << stats.bytes
+              << " bytes in " << stats.files << " files, " << stats.dropped << " dropped, " << stats.truncated
+              << " truncated" << std::endl;
+    if (!captureWriter->lastError().empty()) {
+        std::cerr << "Capture file " << captureOutputPath << ": " << captureWriter->lastError() << std::endl;
+    }
+}
+
+void PcapCom::startStatistics() {
+    statistics.stop();
+    statistics.reset();
+    statistics.start([this]() {
+        filter_stats stats = getFilterStats();
+        return kernel_counters{stats.accepted, stats.kernel_drops};
+    }, statisticsOptions, statisticsSampling);
+}
+
+void PcapCom::stopStatistics() {
+    statistics.stop();
+}
+
+void PcapCom::prepareContext(HandlerContext& handler_context, int link_type, int worker) {
+    handler_context.linkType = link_type;
+    handler_context.tsUnitNs = tsUnitNs;
+    handler_context.expiry.reset();
+    handler_context.reassemblyExpiry.reset();
+    handler_context.recordExpiry.reset();
+    handler_context.reassembly.reset();
+    handler_context.udpScanner = nullptr;
+    handler_context.scanners.clear();
+    handler_context.records.reset();
+    handler_context.flows.reset();
+    handler_context.counters = statistics.addThread();
+    handler_context.checksums = checksumValidation;
+    handler_context.dissectors = dissectorRegistry;
+    handler_context.defrag.reset();
+    if (ipDefrag) {
+        handler_context.defrag = std::make_unique<IpDefragmenter>(defragOptions);
+    }
+
+    if (!recordPath.empty()) {
+        std::string path = worker < 0 ? recordPath : recordPath + "." + std::to_string(worker);
+        auto writer = std::make_unique<RecordWriter>();
+        if (writer->open(path, link_type)) {
+            handler_context.records = std::move(writer);
+        }
+        else {
+            std::cerr << "Couldn't write records: " << writer->lastError() << std::endl;
+        }
+    }
+    if (maxFlows > 0) {
+        handler_context.flows = std::make_unique<FlowTable>(maxFlows);
+        if (!streamHandlers.empty() || payloadMatcher) {
+            handler_context.reassembly = std::make_unique<TcpReassembler>(*handler_context.flows, reassemblyOptions);
+            for (const auto& entry : streamHandlers) {
+                handler_context.reassembly->setHandler(entry.second, entry.first);
+            }
+        }
+        if (payloadMatcher) {
+            // Every stream handler gets a scanner in front, the default one (if any) that of the other streams
+            TcpStreamHandler* fallback = nullptr;
+            for (const auto& entry : streamHandlers) {
+                if (entry.first == 0) {
+                    fallback = entry.second;
+                    continue;
+                }
+                handler_context.scanners.push_back(
+                        std::make_unique<PayloadScanner>(*payloadMatcher, payloadMatchHandler, entry.second));
+                handler_context.reassembly->setHandler(handler_context.scanners.back().get(), entry.first);
+            }
+            handler_context.scanners.push_back(
+                    std::make_unique<PayloadScanner>(*payloadMatcher, payloadMatchHandler, fallback));
+            handler_context.udpScanner = handler_context.scanners.back().get();
+            handler_context.reassembly->setHandler(handler_context.udpScanner, 0);
+        }
+        if (flowExpiry) {
+            FlowExpiryHandler* handler = expiryHandler;
+            if (handler_context.records) {
+                handler_context.recordExpiry = std::make_unique<RecordExpiryHandler>(*handler_context.records, expiryHandler);
+                handler = handler_context.recordExpiry.get();
+            }
+            if (handler_context.reassembly) {
+                handler_context.reassemblyExpiry = std::make_unique<ReassemblyExpiryHandler>(*handler_context.reassembly, handler);
+                handler = handler_context.reassemblyExpiry.get();
+            }
+            handler_context.expiry = std::make_unique<FlowExpiry>(*handler_context.flows, handler, expiryOptions);
+        }
+    }
+}
+
+void PcapCom::finishContext(HandlerContext& handler_context) {
+    if (handler_context.expiry) {
+        handler_context.expiry->flush();
+    }
+    if (handler_context.reassembly) {
+        handler_context.reassembly->flush();
+    }
+    if (handler_context.records) {
+        handler_context.records->close();
+    }
+    if (handler_context.counters && handler_context.counters->talkers) {
+        handler_context.counters->talkers->flush();
+    }
+}
+
+void PcapCom::forEachFlow(const std::function<void(const flow_record&)>& f) const {
+    auto visit = [&f](const HandlerContext& handler_context) {
+        if (handler_context.flows) {
+            handler_context.flows->forEach(f);
+        }
+    };
+    visit(context);
+    for (const auto& worker : fanoutWorkers) {
+        visit(worker->context);
+    }
+    for (const auto& worker : pipelineWorkers) {
+        visit(worker->context);
+    }
+}
+
+// Appended to the stop messages when flow tracking is on
+static std::string FlowSummary(const std::unique_ptr<FlowTable>& flows)
+{
+    if (!flows) {
+        return std::string();
+    }
+    std::ostringstream ss;
+    ss << ", " << flows->created() << " flows";
+    if (flows->dropped() > 0) {
+        ss << " (" << flows->dropped() << " packets not tracked, flow table full)";
+    }
+    return ss.str();
+}
+
+int PcapCom::captureLinkType() {
+    if (!fanoutWorkers.empty()) {
+        return fanoutWorkers.front()->capture.linkType();
+    }
+    if (afPacket) {
+        return afPacket->linkType();
+    }
+    if (fileReader) {
+        return fileReader->linkType();
+    }
+    return handle ? pcap_datalink(handle) : DLT_EN10MB;
+}
+
+void PcapCom::startPipeline() {
+    pipelineWorkers.clear();
+    pipelineKernelDrops = 0;
+    pipelineSharder = std::make_unique<FlowSharder>(pipelineOptions.workers, pipelineOptions.hash);
+    for (unsigned i = 0; i < pipelineOptions.workers; ++i) {
+        auto worker = std::make_unique<PipelineWorker>(pipelineOptions.ringSlots, pipelineOptions.slotSize);
+        worker->index = i;
+        prepareContext(worker->context, context.linkType, static_cast<int>(i));
+        pipelineWorkers.push_back(std::move(worker));
+    }
+    for (auto& worker : pipelineWorkers) {
+        worker->thread = std::thread(&PcapCom::pipelineWork, this, worker.get());
+    }
+}
+
+void PcapCom::stopPipeline() {
+    // Workers drain their rings before returning
+    for (auto& worker : pipelineWorkers) {
+        worker->stopping.store(true, std::memory_order_release);
+    }
+    for (auto& worker : pipelineWorkers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    if (afPacket) {
+        pipelineKernelDrops = afPacket->getStats().drops;
+    }
+    else if (handle && !offline) {
+        struct pcap_stat ps;
+        if (pcap_stats(handle, &ps) == 0) {
+            pipelineKernelDrops = static_cast<uint64_t>(ps.ps_drop) + ps.ps_ifdrop;
+        }
+    }
+
+    pipeline_stats stats = getPipelineStats();
+    uint64_t processed = 0;
+    for (const auto& worker : stats.workers) {
+        processed += worker.processed;
+    }
+    std::cout << "Pipeline on " << networkName << " stopped: " << stats.kernel_drops << " dropped by kernel, "
+              << FlowHash::typeName(stats.sharding.hash) << " hash skew " << stats.sharding.skew << std::endl;
+    for (const auto& worker : stats.workers) {
+        std::cout << "  worker " << worker.worker << ": " << worker.queued << " queued, " << worker.ring_drops
+                  << " dropped by ring, " << worker.truncated << " truncated, " << worker.processed << " processed ("
+                  << (processed > 0 ? 100.0 * worker.processed / processed : 0.0) << "% of processed packets, "
+                  << stats.sharding.workers[worker.worker].bytes << " bytes routed)"
+                  << FlowSummary(pipelineWorkers[worker.worker]->context.flows) << std::endl;
+    }
+}
+
+pipeline_stats PcapCom::getPipelineStats() const {
+    pipeline_stats stats{pipelineKernelDrops, {}, {}};
+    if (pipelineSharder) {
+        stats.sharding = pipelineSharder->report();
+    }
+    for (const auto& worker : pipelineWorkers) {
+        stats.workers.push_back(pipeline_worker_stats{worker->index, worker->ring.pushed(), worker->ring.dropped(),
+                                                      worker->ring.truncated(),
+                                                      worker->processed.load(std::memory_order_relaxed)});
+    }
+    return stats;
+}
+
+void PcapCom::pipelineCollect(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet) {
+    auto* self = reinterpret_cast<PcapCom*>(userData);
+    if (self->context.captureQueue) {
+        self->context.captureQueue->push(*pkthdr, packet);
+    }
+    unsigned index = self->pipelineSharder->route(self->context.linkType, packet, pkthdr->caplen, pkthdr->len);
+    PacketRing& ring = self->pipelineWorkers[index]->ring;
+    // A file can wait for its worker, only live traffic that outruns a worker is dropped
+    while (self->offline && !ring.writable()) {
+        std::this_thread::yield();
+    }
+    if (!ring.push(*pkthdr, packet) && self->context.counters) {
+        thread_counters::add(self->context.counters->queue_drops, 1);
+    }
+}
+
+void PcapCom::pipelineWork(PipelineWorker* worker)
+{
+    opensource::ctrlfrmb::LogContextScope ifaceScope("iface", networkName);
+    opensource::ctrlfrmb::LogContextScope workerScope("worker", worker->index);
+    PacketBatch batch(batchSize);
+    batch.setLinkType(worker->context.linkType);
+    batch.setWorker(worker->index);
+    unsigned idle = 0;
+
+    while (true) {
+        // Read before peeking, so every packet pushed before the stop request is seen
+        bool stopping = worker->stopping.load(std::memory_order_acquire);
+        size_t count = worker->ring.peek(batch, batch.capacity());
+        if (count == 0) {
+            if (stopping) {
+                break;
+            }
+            // Spin briefly for low latency, then back off so an idle link costs no CPU
+            if (++idle < 64) {
+                std::this_thread::yield();
+            }
+            else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+            continue;
+        }
+        idle = 0;
+        if (batchHandler) {
+            if (thread_counters* counters = worker->context.counters) {
+                uint64_t length = 0;
+                for (const packet_view& view : batch) {
+                    length += view.header.len;
+                }
+                counters->count(batch.size(), length);
+            }
+            batchHandler->onBatch(batch);
+        }
+        else {
+            for (const packet_view& view : batch) {
+                packetHandler(reinterpret_cast<unsigned char*>(&worker->context), &view.header, view.data);
+            }
+        }
+        worker->ring.release(count);
+        worker->processed.store(worker->processed.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        batch.clear();
+    }
+    finishContext(worker->context);
+}
+
+void PcapCom::fanoutCapture(FanoutWorker* worker)
+{
+#if defined(__linux__)
+    if (worker->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            std::cerr << "Couldn't pin fanout thread " << worker->index << " to cpu " << worker->cpu << std::endl;
+        }
+    }
+#endif
+    opensource::ctrlfrmb::LogContextScope ifaceScope("iface", networkName);
+    opensource::ctrlfrmb::LogContextScope workerScope("worker", worker->index);
+    int64_t rc;
+    if (batchHandler) {
+        BatchState state(this, batchSize, worker);
+        state.batch.setLinkType(worker->capture.linkType());
+        state.batch.setWorker(worker->index);
+        rc = worker->capture.loop(batchCollect, reinterpret_cast<unsigned char*>(&state), batchBlockDone);
+    }
+    else {
+        rc = worker->capture.loop(fanoutHandler, reinterpret_cast<unsigned char*>(worker));
+    }
+    if (rc < 0) {
+        std::cerr << "Fanout capture " << worker->index << " on " << networkName << " failed: "
+                  << worker->capture.lastError() << std::endl;
+    }
+    finishContext(worker->context);
+}
+
+void PcapCom::closeCapture() {
+    statistics.stop();
+    if (!fanoutWorkers.empty()) {
+        for (auto& worker : fanoutWorkers) {
+            worker->capture.breakLoop();
+        }
+        for (auto& worker : fanoutWorkers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+        fanoutWorkers.clear();
+    }
+    if (handle) {
         pcap_close(handle);
-        return -1;
+        handle = nullptr;
     }
-#endif 
+    fileReader.reset();
+    afPacket.reset();
+    offline = false;
+    tsUnitNs = 1000;
+    filterExpression.clear();
+    replayFilter.store(nullptr);
+    replayFilters.clear();
+    replayAccepted.store(0);
+    replayFiltered.store(0);
+    interfaceCounters = false;
+}
+
+void PcapCom::replayCapture()
+{
+    using Clock = std::chrono::steady_clock;
+    const double speed = replayOptions.speed;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t firstTimestamp = 0;
+    auto start = Clock::now();
+
+    const bool pipelined = !pipelineWorkers.empty();
+    std::unique_ptr<BatchState> state;
+    if (batchHandler && !pipelined) {
+        state = std::make_unique<BatchState>(this, batchSize, nullptr);
+        state->batch.setLinkType(captureLinkType());
+    }
+    // Only this thread writes the filter counters, a plain load and store avoids a locked instruction per packet
+    auto deliver = [&](const struct pcap_pkthdr* header, const unsigned char* data) {
+        const FilterProgram* filter = replayFilter.load(std::memory_order_acquire);
+        if (filter && pcap_offline_filter(&filter->program, header, data) == 0) {
+            replayFiltered.store(replayFiltered.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        replayAccepted.store(replayAccepted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (pipelined) {
+            pipelineCollect(reinterpret_cast<unsigned char*>(this), header, data);
+        }
+        else if (state) {
+            batchCollectCopy(reinterpret_cast<unsigned char*>(state.get()), header, data);
+        }
+        else {
+            packetHandler(reinterpret_cast<unsigned char*>(&context), header, data);
+        }
+        ++packets;
+        bytes += header->caplen;
+    };
+
+    // Holds a packet back until its original offset from the first packet, scaled by speed, has passed
+    auto pace = [&](uint64_t timestamp_ns) {
+        if (speed <= 0.0) {
+            return;
+        }
+        if (packets == 0) {
+            firstTimestamp = timestamp_ns;
+            return;
+        }
+        if (timestamp_ns <= firstTimestamp) {
+            return;
+        }
+        auto due = start + std::chrono::nanoseconds(static_cast<int64_t>((timestamp_ns - firstTimestamp) / speed));
+        auto now = Clock::now();
+        if (due > now && state) {
+            flushBatch(*state);  // Packets collected so far are due already
+        }
+        if (due - now > std::chrono::microseconds(200)) {
+            std::this_thread::sleep_until(due - std::chrono::microseconds(100));
+        }
+        while (Clock::now() < due) {
+            std::this_thread::yield();
+        }
+    };
+
+    if (fileReader) {
+        file_packet packet;
+        int rc;
+        while ((rc = fileReader->next(packet)) == 1) {
+            pace(packet.timestamp_ns);
+            deliver(&packet.header, packet.data);
+        }
+        if (rc < 0) {
+            std::cerr << "Error reading " << networkName << ": " << fileReader->lastError() << std::endl;
+        }
+    } else {
+        struct pcap_pkthdr* header;
+        const unsigned char* data;
+        int rc;
+        while ((rc = pcap_next_ex(handle, &header, &data)) == 1) {
+            pace(static_cast<uint64_t>(header->ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(header->ts.tv_usec) * 1000);
+            deliver(header, data);
+        }
+        if (rc == PCAP_ERROR) {
+            std::cerr << "Error reading " << networkName << ": " << pcap_geterr(handle) << std::endl;
+        }
+    }
+
+    if (state) {
+        flushBatch(*state);
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    replayStats = replay_stats{packets, bytes, seconds};
+    double rate = seconds > 0 ? 1.0 / seconds : 0.0;
+    std::cout << "Replay of " << networkName << " finished: " << packets << " packets, " << bytes << " bytes in "
+              << seconds << " s, " << static_cast<uint64_t>(packets * rate) << " packets/s, "
+              << static_cast<uint64_t>(bytes * rate) << " bytes/s" << FlowSummary(context.flows) << std::endl;
 }
 
 void PcapCom::asynStartCapture()
 {
-    pcap_loop(handle, 0, packetHandler, NULL);
+    opensource::ctrlfrmb::LogContextScope ifaceScope("iface", networkName);
+    prepareContext(context, captureLinkType());
+    const bool pipelined = pipelineOptions.workers > 0;
+    if (pipelined) {
+        startPipeline();
+    }
+    unsigned char* pipelineUser = reinterpret_cast<unsigned char*>(this);
+
+    if (offline) {
+        replayCapture();
+    }
+    else if (afPacket) {
+        int64_t rc;
+        if (pipelined) {
+            rc = afPacket->loop(pipelineCollect, pipelineUser);
+        }
+        else if (batchHandler) {
+            BatchState state(this, batchSize, nullptr);
+            state.batch.setLinkType(afPacket->linkType());
+            rc = afPacket->loop(batchCollect, reinterpret_cast<unsigned char*>(&state), batchBlockDone);
+        }
+        else {
+            rc = afPacket->loop(packetHandler, reinterpret_cast<unsigned char*>(&context));
+        }
+        if (rc < 0) {
+            std::cerr << "Capture on " << networkName << " failed: " << afPacket->lastError() << std::endl;
+        }
+        af_packet_stats stats = afPacket->getStats();
+        std::cout << "Capture on " << networkName << " stopped: " << stats.packets << " packets, "
+                  << stats.drops << " dropped by kernel" << FlowSummary(context.flows) << std::endl;
+    }
+    else if (pipelined) {
+        beginPcapLoop();
+        while (pcap_loop(handle, 0, pipelineCollect, pipelineUser) == PCAP_ERROR_BREAK && swapPendingFilter()) {
+        }
+        endPcapLoop();
+    }
+    else if (batchHandler) {
+        // libpcap may reuse its buffer once a callback returns, so batches are copied and handed over after
+        // every pcap_dispatch call
+        BatchState state(this, batchSize, nullptr);
+        state.batch.setLinkType(pcap_datalink(handle));
+        int rc;
+        beginPcapLoop();
+        while ((rc = pcap_dispatch(handle, -1, batchCollectCopy, reinterpret_cast<unsigned char*>(&state))) >= 0 ||
+               (rc == PCAP_ERROR_BREAK && swapPendingFilter())) {
+            flushBatch(state);
+        }
+        endPcapLoop();
+        flushBatch(state);
+        if (rc == PCAP_ERROR) {
+            std::cerr << "Capture on " << networkName << " failed: " << pcap_geterr(handle) << std::endl;
+        }
+    }
+    else {
+        beginPcapLoop();
+        while (pcap_loop(handle, 0, packetHandler, reinterpret_cast<unsigned char*>(&context)) == PCAP_ERROR_BREAK &&
+               swapPendingFilter()) {
+        }
+        endPcapLoop();
+    }
+
+    finishContext(context);
+    if (pipelined) {
+        stopPipeline();
+    }
+    stopCaptureOutput();
+    stopStatistics();
 }
 
 void PcapCom::startCapture(bool use_thread_pool) {
-    if (handle) {
+    if (!fanoutWorkers.empty()) {
+        InitLogger();
+        startStatistics();
+        startCaptureOutput();
+        for (auto& worker : fanoutWorkers) {
+            prepareContext(worker->context, worker->capture.linkType(), static_cast<int>(worker->index));
+            worker->thread = std::thread(&PcapCom::fanoutCapture, this, worker.get());
+        }
+        return;
+    }
+    if (handle || fileReader || afPacket) {
+        pcapStopping = false;
         InitLogger();
+        startStatistics();
+        startCaptureOutput();
 
         if (use_thread_pool)
         {
             //using std::placeholders::_1;
             std::function<void()> fun_asyn = std::bind(&PcapCom::asynStartCapture, this);
-            pool.submit(fun_asyn);
+            captureTask = pool.submit(fun_asyn);
         }
         else
-            pcap_loop(handle, 0, packetHandler, NULL);
+            asynStartCapture();
+    }
+}
+
+void PcapCom::stopCapture() {
+    if (!fanoutWorkers.empty()) {
+        for (auto& worker : fanoutWorkers) {
+            worker->capture.breakLoop();
+        }
+        for (auto& worker : fanoutWorkers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+                af_packet_stats kernel = worker->capture.getStats();
+                std::cout << "Fanout thread " << worker->index << " on " << networkName << " stopped: "
+                          << worker->packets.load() << " packets, " << worker->bytes.load() << " bytes, "
+                          << kernel.drops << " dropped by kernel" << FlowSummary(worker->context.flows) << std::endl;
+            }
+        }
+        stopCaptureOutput();
+        stopStatistics();
+    }
+    if (afPacket) {
+        afPacket->breakLoop();
+    }
+    else if (handle && !offline) {
+        std::lock_guard<std::mutex> lock(filterSwapMutex);
+        pcapStopping = true;
+        pcap_breakloop(handle);
+    }
+    if (captureTask.valid()) {
+        captureTask.wait();
     }
 }
 
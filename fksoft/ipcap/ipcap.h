@@ -13,9 +13,32 @@
 #define FIGKEY_PCAP_COM_HPP
 
 #include <pcap.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
+#include <thread>
+#include "pcap_file.h"
+#include "af_packet.h"
+#include "app_dissector.h"
+#include "capture_stats.h"
+#include "capture_writer.h"
+#include "flow_expiry.h"
+#include "flow_hash.h"
+#include "flow_table.h"
+#include "ip_defrag.h"
+#include "packet_batch.h"
+#include "packet_decoder.h"
+#include "packet_ring.h"
+#include "payload_match.h"
+#include "record_file.h"
+#include "tcp_reassembly.h"
 
 namespace figkey {
 
@@ -25,6 +48,91 @@ struct network_info {
     std::string description;
 };
 
+// Options for replaying a capture file through the packet handler
+struct ReplayOptions {
+    double speed;       // 0 replays as fast as possible, 1 with the original timing, N at N times the original rate
+    bool useLibpcap;    // Read with pcap_open_offline instead of the native pcap/pcapng reader
+
+    ReplayOptions(double replaySpeed = 0.0, bool libpcap = false) : speed(replaySpeed), useLibpcap(libpcap) {}
+};
+
+// Tuning of a libpcap live capture. The defaults match the former pcap_open_live call; at high packet rates the
+// kernel buffer is what runs out first, so the presets mostly differ in buffer size and how much of a packet they keep
+struct CaptureOptions {
+    int snaplen;            // Bytes kept per packet
+    int bufferSize;         // Kernel buffer in bytes, 0 keeps the libpcap default (2 MB on Linux)
+    int timeoutMs;          // Packet buffer timeout: how long the kernel may hold packets back to fill a buffer
+    bool immediate;         // Hand every packet over as soon as it arrives, timeoutMs no longer applies
+    bool nanoTimestamps;    // Nanosecond precision if the device supports it, pkthdr ts.tv_usec then holds
+                            // nanoseconds for batch handlers
+    bool promisc;
+
+    CaptureOptions(int snap_len = 65536, int buffer_size = 0, int timeout_ms = 1000, bool immediate_mode = false,
+                   bool nano_timestamps = false, bool promiscuous = true)
+            : snaplen(snap_len), bufferSize(buffer_size), timeoutMs(timeout_ms), immediate(immediate_mode),
+              nanoTimestamps(nano_timestamps), promisc(promiscuous) {}
+
+    // Decoding and flow tracking at high rates: headers through TCP options behind QinQ and IPv6, 64 MB buffer
+    static CaptureOptions headerOnly() { return CaptureOptions(128, 64 << 20, 100); }
+
+    // Whole packets with nanosecond timestamps for evidence files, 256 MB buffer to ride out bursts
+    static CaptureOptions forensic() { return CaptureOptions(262144, 256 << 20, 1000, false, true); }
+
+    // Interactive tools that react to single packets, nothing is held back
+    static CaptureOptions lowLatency() { return CaptureOptions(65536, 4 << 20, 1, true); }
+};
+
+// Result of the last replay
+struct replay_stats {
+    uint64_t packets;
+    uint64_t bytes;
+    double seconds;
+};
+
+// Per-thread counters of a fanout capture
+struct fanout_stats {
+    unsigned thread;    // Worker index
+    int cpu;            // CPU the worker is pinned to, -1 if not pinned
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+// Decoupled processing: the capture thread only copies packets into one SPSC ring per worker and a dedicated
+// thread per worker runs the packet or batch handler
+struct PipelineOptions {
+    unsigned workers;   // Worker threads, 0 processes packets on the capture thread
+    size_t ringSlots;   // Packets each worker ring holds, rounded up to a power of two
+    size_t slotSize;    // Bytes kept per packet, longer packets are truncated
+    FlowHashType hash;  // Spreads packets over the workers, all but ADDRESS decode them on the capture thread
+
+    PipelineOptions(unsigned worker_count = 0, size_t slots = 8192, size_t size = 2048,
+                    FlowHashType hash_type = FlowHashType::ADDRESS)
+            : workers(worker_count), ringSlots(slots), slotSize(size), hash(hash_type) {}
+};
+
+// Counters of one pipeline worker, from capture thread to handler
+struct pipeline_worker_stats {
+    unsigned worker;
+    uint64_t queued;      // Packets copied into the worker's ring
+    uint64_t ring_drops;  // Packets dropped because the ring was full
+    uint64_t truncated;   // Packets cut to slotSize
+    uint64_t processed;   // Packets handed to the handler
+};
+
+struct pipeline_stats {
+    uint64_t kernel_drops;  // Dropped before reaching the capture thread, known once the capture stopped
+    std::vector<pipeline_worker_stats> workers;
+    shard_report sharding;  // Packets and bytes the capture thread routed to each worker, ring drops included
+};
+
+// Packet counts of the capture filter since the capture was opened
+struct filter_stats {
+    uint64_t accepted;      // Passed the filter
+    uint64_t kernel_drops;  // Passed the filter, then dropped because the kernel buffer or ring was full
+    uint64_t filtered;      // Rejected by the filter. Exact for replays, live captures derive it from the interface
+                            // counters on Linux and report 0 elsewhere
+};
+
 class PcapCom {
 public:
     PcapCom() : handle(nullptr) {
@@ -32,22 +140,331 @@ public:
     }
 
     ~PcapCom() {
-        if (handle) {
-            pcap_close(handle);
-        }
+        stopCapture();
+        closeCapture();
     }
 
     std::vector<network_info> getNetworkList();
 
-    bool setNetwork(const std::string& network_name);
+    // Open a live libpcap capture on network_name with pcap_create/pcap_activate
+    bool setNetwork(const std::string& network_name, const CaptureOptions& options = CaptureOptions());
+
+    // Use a pcap/pcapng file instead of a live interface, startCapture then replays it once
+    bool setOffline(const std::string& file_path, const ReplayOptions& options = ReplayOptions());
+
+    // Capture from network_name with the Linux AF_PACKET TPACKET_V3 backend instead of libpcap
+    bool setAfPacket(const std::string& network_name, const AfPacketOptions& options = AfPacketOptions());
+
+    // Capture from network_name with thread_count AF_PACKET sockets in one PACKET_FANOUT group, each serviced by
+    // its own thread. The group mode decides which thread sees a packet, HASH keeps every flow on one thread
+    bool setFanout(const std::string& network_name, unsigned thread_count, const AfPacketOptions& options = AfPacketOptions(),
+                   bool pin_threads = true);
+
+    // Compiles a tcpdump filter expression and installs it on the open capture, also while it is running. Live
+    // captures filter in the kernel, a running libpcap loop is paused for pcap_setfilter and resumed, replays
+    // filter in userland. An empty expression
+    // accepts every packet. Returns false and keeps the current filter if the expression does not compile.
+    // Opening another capture removes the filter
+    bool setFilter(const std::string& expression);
+
+    const std::string& getFilter() const { return filterExpression; }
+
+    // Accepted, dropped and filtered packets of the open capture, callable while it runs
+    filter_stats getFilterStats();
+
+    // Sample the capture counters every options.intervalMs into a history of options.history samples, and rewrite
+    // options.snapshotPath as JSON after every sample when it is set. Call before startCapture
+    void setStatistics(const CaptureStatsOptions& options);
+
+    // Packets, bytes, protocols and errors handled by all threads of the current or last capture, with the kernel
+    // receive and drop counts. Counted whether or not setStatistics was called, callable while the capture runs
+    capture_stats_sample getStatistics();
+
+    // Samples of the current or last capture, oldest first, the newest count of them (0 for all)
+    std::vector<capture_stats_sample> getStatisticsHistory(size_t count = 0) const;
+
+    // Top sources, destination ports and flows by bytes and packets per statistics interval, oldest first, the
+    // newest count of them (0 for all). Needs options.talkers.top set in setStatistics; IP packets seen by the
+    // built-in packet handler are counted. A report is ready one interval after the one it covers, the rest
+    // when the capture stops. Without sampling a single report covers the whole capture
+    std::vector<talker_report> getTopTalkers(size_t count = 0) const;
+
+    // Deliver packets in batches of up to batch_size to handler instead of the built-in per-packet handler.
+    // Call before startCapture, nullptr restores per-packet handling. handler must outlive the capture
+    void setBatchHandler(BatchHandler* handler, size_t batch_size = PacketBatch::DEFAULT_CAPACITY);
+
+    // Hand packets from the capture thread to worker threads through SPSC rings, call before startCapture.
+    // Packets are spread over the workers by a symmetric flow hash so both directions of a flow reach the same
+    // worker, the skew of the spread is in getPipelineStats. A live capture drops packets a full ring cannot
+    // take, a replay waits for the worker instead.
+    // Not used by fanout captures, whose threads already process their own packets
+    void setPipeline(const PipelineOptions& options);
+
+    // Track flows by bidirectional 5-tuple in the built-in packet handler, call before startCapture. Every capture
+    // thread and pipeline worker keeps its own table of up to max_flows flows, 0 turns tracking off
+    void setFlowTracking(size_t max_flows);
+
+    // Expire tracked flows on idle and active timeouts and TCP close, driven by packet timestamps. Expired flows
+    // are handed to handler (may be nullptr) in batches from the thread tracking them; flows still open when the
+    // capture stops are flushed with ExpiryReason::END. Every thread's clock only moves with the packets it
+    // handles. Needs setFlowTracking, call before startCapture
+    void setFlowExpiry(FlowExpiryHandler* handler, const FlowExpiryOptions& options = FlowExpiryOptions());
+
+    // Write a 64-byte binary record per packet to path instead of logging it as text, plus a flow record per
+    // expired flow when flow expiry is on; render them with record_dump. Fanout threads and pipeline workers
+    // write path.<index> each. An empty path restores text logging, call before startCapture
+    void setRecordOutput(const std::string& path);
+
+    // Put fragmented IPv4/IPv6 datagrams back together before flow tracking, TCP reassembly, logging and the
+    // record file, so their transport header and payload are seen whole. Fragments are held until their datagram
+    // completes, which then counts as one packet with the wire length of all its fragments. Every capture thread
+    // and pipeline worker reassembles the fragments it receives; fanout HASH groups already have the kernel
+    // defragment. Call before startCapture
+    void setIpDefrag(bool enable, const IpDefragOptions& options = IpDefragOptions());
+
+    // Fragment counters summed over all threads of the last capture, only once it has stopped
+    ip_defrag_stats getIpDefragStats() const;
+
+    // Verify IPv4 header and TCP/UDP/ICMP checksums of every packet (and of reassembled datagrams). Bad ones are
+    // flagged in the packet records, logged and counted in the statistics, but still tracked: captures on the
+    // sending host see checksums the NIC has yet to fill in. Call before startCapture
+    void setChecksumValidation(bool enable);
+
+    // Reassemble the TCP connections of tracked flows and hand their in-order data to handler: connections with
+    // port on either endpoint, or with port 0 every connection without a handler of its own. Every capture thread
+    // and pipeline worker reassembles its own flows, handlers are called from those threads. Streams end on FIN,
+    // RST, flow expiry or when the capture stops. Needs setFlowTracking, call before startCapture
+    void setStreamHandler(TcpStreamHandler* handler, uint16_t port = 0);
+
+    // Buffer limits of TCP reassembly, call before startCapture
+    void setTcpReassembly(const TcpReassemblyOptions& options);
 
+    // Scan the reassembled TCP streams and UDP payloads of tracked flows for the patterns of matcher (compiled,
+    // kept alive by the caller) and report every match to handler, which may be nullptr to only count them.
+    // Turns TCP reassembly on; stream handlers still get the data after it is scanned. Needs setFlowTracking,
+    // nullptr turns it off, call before startCapture
+    void setPayloadMatching(const PayloadMatcher* matcher, PayloadMatchHandler* handler = nullptr);
+
+    // Scan counters summed over all threads of the last capture, only once it has stopped
+    payload_match_stats getPayloadMatchStats() const;
+
+    // Run the dissectors of registry (kept alive by the caller) on the first payload bytes of each tracked flow,
+    // filling flow_record::app with DNS names, HTTP methods and hosts or TLS server names. Needs setFlowTracking,
+    // nullptr turns it off, call before startCapture
+    void setAppDissection(const DissectorRegistry* registry);
+
+    // Record every captured packet to a pcap or pcapng file on a writer thread, alongside the analysis. Packets
+    // reach the writer as the capture thread sees them (after the filter, before batching or pipelining), so a
+    // slow disk drops packets from the file but never holds up the capture. An empty path turns it off, call
+    // before startCapture
+    void setCaptureOutput(const std::string& path, const CaptureWriterOptions& options = CaptureWriterOptions());
+
+    // Counters of the current or last capture file
+    capture_writer_stats getCaptureOutputStats() const;
+
+    // Calls f for every flow tracked by the last capture, only once it has stopped
+    void forEachFlow(const std::function<void(const flow_record&)>& f) const;
+
+    // Fanout captures always run on their own threads, use_thread_pool only applies to single-threaded captures
     void startCapture(bool use_thread_pool=false);
 
+    // Makes a running live capture return and waits for a thread pool capture to finish
+    void stopCapture();
+
+    // Packet and byte counts of the last completed replay
+    replay_stats getReplayStats() const { return replayStats; }
+
+    // Packets handled by each fanout thread so far
+    std::vector<fanout_stats> getFanoutStats() const;
+
+    // Per-stage counters of the current or last pipelined capture
+    pipeline_stats getPipelineStats() const;
+
 private:
+    // Per-thread state of the built-in packet handler, passed to it as userData
+    struct HandlerContext {
+        int linkType{DLT_EN10MB};
+        uint32_t tsUnitNs{1000};            // Nanoseconds per pkthdr ts.tv_usec unit, 1 for nanosecond captures
+        std::unique_ptr<FlowTable> flows;   // nullptr unless flow tracking is enabled
+        std::unique_ptr<FlowExpiry> expiry; // nullptr unless flow expiry is enabled
+        std::unique_ptr<RecordWriter> records;              // nullptr unless record output is set
+        std::unique_ptr<IpDefragmenter> defrag;             // nullptr unless IP defragmentation is on
+        std::unique_ptr<RecordExpiryHandler> recordExpiry;  // Writes expired flows, then calls expiryHandler
+        std::unique_ptr<TcpReassembler> reassembly;         // nullptr unless a stream handler is set
+        std::unique_ptr<ReassemblyExpiryHandler> reassemblyExpiry;  // Ends streams of expired flows first
+        std::vector<std::unique_ptr<PayloadScanner>> scanners;      // One per stream handler with payload matching
+        PayloadScanner* udpScanner{nullptr};                // Scanner of the default handler, also scans UDP
+        const DissectorRegistry* dissectors{nullptr};       // Application dissection, nullptr if off
+        PacketRing* captureQueue{nullptr};                  // Queue to the capture file writer, capture thread only
+        thread_counters* counters{nullptr};                 // This thread's counters in statistics
+        bool checksums{false};                              // Verify checksums
+    };
+
+    // One socket of a fanout group and the thread servicing it, counters are only written by that thread and sit
+    // on their own cache line
+    struct FanoutWorker {
+        AfPacketCapture capture;
+        std::thread thread;
+        unsigned index{0};
+        int cpu{-1};
+        HandlerContext context;
+        alignas(64) std::atomic<uint64_t> packets{0};
+        std::atomic<uint64_t> bytes{0};
+    };
+
+    // Compiled filter program, freed with pcap_freecode
+    struct FilterProgram {
+        struct bpf_program program{};
+
+        FilterProgram() = default;
+        ~FilterProgram() { pcap_freecode(&program); }
+
+        FilterProgram(const FilterProgram&) = delete;
+        FilterProgram& operator=(const FilterProgram&) = delete;
+    };
+
+    // Batch being collected by one capture thread
+    struct BatchState {
+        PcapCom* owner;
+        PacketBatch batch;
+        FanoutWorker* worker;   // Counts the delivered packets of a fanout thread, nullptr otherwise
+
+        BatchState(PcapCom* pcap, size_t capacity, FanoutWorker* fanout) : owner(pcap), batch(capacity), worker(fanout) {}
+    };
+
+    // Ring and thread of one pipeline worker, the workers never wait for a ThreadPool thread to come free
+    struct PipelineWorker {
+        PacketRing ring;
+        unsigned index{0};
+        std::thread thread;
+        std::atomic<bool> stopping{false};
+        std::atomic<uint64_t> processed{0};
+        HandlerContext context;
+
+        PipelineWorker(size_t slots, size_t size) : ring(slots, size) {}
+    };
+
     pcap_t* handle;
+    std::string networkName;  // Interface opened by setNetwork, tagged on every log line of the capture thread
+    HandlerContext context;   // Handler state of the single-threaded capture, context.linkType is its DLT
+    bool offline{false};      // handle or fileReader refers to a capture file
+    uint32_t tsUnitNs{1000};  // Timestamp unit of handle, see HandlerContext::tsUnitNs
+    std::unique_ptr<PcapFileReader> fileReader;  // Native reader, used instead of handle when set
+    std::unique_ptr<AfPacketCapture> afPacket;   // AF_PACKET socket, used instead of handle when set
+    ReplayOptions replayOptions;
+    replay_stats replayStats{};
+    std::future<void> captureTask;  // Capture running on the thread pool
+    // Filter swaps on a running libpcap loop: setFilter leaves the program here and breaks the loop, the capture
+    // thread installs it with pcap_setfilter and goes on looping
+    std::mutex filterSwapMutex;
+    std::condition_variable filterSwapped;
+    FilterProgram* pendingFilter{nullptr};
+    std::string filterSwapError;
+    bool pcapLooping{false};        // The capture thread runs pcap_loop or pcap_dispatch on handle
+    bool pcapStopping{false};       // stopCapture broke the loop, a swap must not resume it
+    std::vector<std::unique_ptr<FanoutWorker>> fanoutWorkers;
+    PipelineOptions pipelineOptions;
+    std::vector<std::unique_ptr<PipelineWorker>> pipelineWorkers;
+    uint64_t pipelineKernelDrops{0};
+    std::unique_ptr<FlowSharder> pipelineSharder;   // Picks the worker of each packet, capture thread only
+    BatchHandler* batchHandler{nullptr};
+    size_t batchSize{PacketBatch::DEFAULT_CAPACITY};
+    size_t maxFlows{0};
+    bool flowExpiry{false};
+    FlowExpiryHandler* expiryHandler{nullptr};
+    FlowExpiryOptions expiryOptions;
+    std::string recordPath;
+    bool ipDefrag{false};
+    IpDefragOptions defragOptions;
+    bool checksumValidation{false};
+    std::vector<std::pair<uint16_t, TcpStreamHandler*>> streamHandlers;
+    TcpReassemblyOptions reassemblyOptions;
+    const PayloadMatcher* payloadMatcher{nullptr};
+    PayloadMatchHandler* payloadMatchHandler{nullptr};
+    const DissectorRegistry* dissectorRegistry{nullptr};
+    std::string captureOutputPath;
+    CaptureWriterOptions captureOutputOptions;
+    std::unique_ptr<CaptureWriter> captureWriter;
+    std::string filterExpression;
+    std::unique_ptr<FilterProgram> fanoutFilter;    // Program on every fanout socket, restored when a swap fails
+    // Replay filters: the replay thread reads the current one, replaced ones stay alive until the capture closes
+    std::atomic<const FilterProgram*> replayFilter{nullptr};
+    std::vector<std::unique_ptr<FilterProgram>> replayFilters;
+    std::atomic<uint64_t> replayAccepted{0};
+    std::atomic<uint64_t> replayFiltered{0};
+    bool interfaceCounters{false};  // interfaceBaseline holds the interface's packet count at open
+    uint64_t interfaceBaseline{0};
+    CaptureStatsOptions statisticsOptions;
+    bool statisticsSampling{false};
+    CaptureStats statistics;        // Last, so it stops before anything its kernel source reads is destroyed
+
+    void closeCapture();
+
+    // Remembers the interface's packet count, getFilterStats reports what the filter rejected since then
+    void resetFilterStats();
 
     void asynStartCapture();
 
+    void replayCapture();
+
+    void fanoutCapture(FanoutWorker* worker);
+
+    static void fanoutHandler(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet);
+
+    // Adds a packet to the BatchState in userData by reference, the AF_PACKET ring keeps it valid
+    static void batchCollect(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet);
+
+    // Adds a copy of the packet, for buffers that may be reused once the callback returns
+    static void batchCollectCopy(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet);
+
+    // Hands the collected batch over before the AF_PACKET block goes back to the kernel
+    static void batchBlockDone(unsigned char* userData);
+
+    static void flushBatch(BatchState& state);
+
+    // Capture thread, around its libpcap loop: marks it running, or stopped with any pending filter installed
+    void beginPcapLoop();
+    void endPcapLoop();
+
+    // Capture thread, after the libpcap loop returned PCAP_ERROR_BREAK: installs the pending filter and tells
+    // whether the loop has to go on
+    bool swapPendingFilter();
+
+    // Installs pendingFilter if there is one and wakes setFilter, filterSwapMutex held
+    bool installPendingFilter();
+
+    int captureLinkType();
+
+    // Sets the DLT and gives the context fresh flow state and record file as configured, worker selects the
+    // record file of a fanout thread or pipeline worker
+    void prepareContext(HandlerContext& handler_context, int link_type, int worker = -1);
+
+    // Flushes the flows still open and the record file, on the thread that used them
+    static void finishContext(HandlerContext& handler_context);
+
+    // Starts the capture file writer with one queue per capture thread
+    void startCaptureOutput();
+
+    // Writes the rest of the capture file once every capture thread stopped
+    void stopCaptureOutput();
+
+    // Clears the counters of the last capture and starts sampling if configured, before any context is prepared
+    void startStatistics();
+
+    // Takes the final counters while the capture is still open
+    void stopStatistics();
+
+    void startPipeline();
+
+    void stopPipeline();
+
+    void pipelineWork(PipelineWorker* worker);
+
+    // Copies a packet into the ring of the worker its addresses map to, userData is the PcapCom
+    static void pipelineCollect(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet);
+
+    // Decodes, tracks and logs or records one packet, userData points to a HandlerContext (DLT_EN10MB, no
+    // tracking if NULL)
     static void packetHandler(unsigned char* userData, const struct pcap_pkthdr* pkthdr, const unsigned char* packet);
 };
 
@@ -1,7 +1,18 @@
 ﻿#include "ipcap.h"
+#include "checksum.h"
 #include <iostream>
+#include <fstream>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
 #include "common/thread_pool.hpp"
 
 void InitThreadPool()
@@ -12,8 +23,719 @@ void InitThreadPool()
     pool.set(4, 2, 5); // 设置最大线程数为4，最小线程数为2，线程超时时间为600秒
 }
 
-int main() {
+// 批量处理示例: 统计包数和字节数, 处理当前包时预取下一个包
+class CountingBatchHandler : public figkey::BatchHandler {
+public:
+    void onBatch(const figkey::PacketBatch& batch) override {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (i + 1 < batch.size()) {
+                batch.prefetch(i + 1);
+            }
+            bytes.fetch_add(batch[i].header.caplen, std::memory_order_relaxed);
+        }
+        packets.fetch_add(batch.size(), std::memory_order_relaxed);
+        batches.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t packetCount() const {
+        return packets.load();
+    }
+
+    void print() const {
+        std::cout << "Batch handler: " << packets.load() << " packets, " << bytes.load() << " bytes in "
+                  << batches.load() << " batches" << std::endl;
+    }
+
+private:
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> batches{0};
+};
+
+// 会话老化示例: 按老化原因统计会话数, 可能被多个抓包线程同时调用
+class CountingExpiryHandler : public figkey::FlowExpiryHandler {
+public:
+    void onExpired(const figkey::expired_flow* flows, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            const figkey::flow_record& flow = *flows[i].record;
+            reasons[static_cast<int>(flows[i].reason)].fetch_add(1, std::memory_order_relaxed);
+            packets.fetch_add(flow.packets[0] + flow.packets[1], std::memory_order_relaxed);
+        }
+    }
+
+    void print() const {
+        std::cout << "Expired flows: " << reasons[0].load() << " idle, " << reasons[1].load() << " active timeout, "
+                  << reasons[2].load() << " tcp closed, " << reasons[3].load() << " at end of capture, "
+                  << packets.load() << " packets" << std::endl;
+    }
+
+private:
+    std::atomic<uint64_t> reasons[4] = {};
+    std::atomic<uint64_t> packets{0};
+};
+
+// TCP 流重组示例: 按结束原因统计流数, 每条流计算 FNV-1a 摘要, 所有流的摘要异或后输出, 可以比较两次重组的结果
+class CountingStreamHandler : public figkey::TcpStreamHandler {
+public:
+    void onData(figkey::tcp_stream& stream, const unsigned char* data, size_t length) override {
+        uint64_t hash = stream.user ? *static_cast<uint64_t*>(stream.user) : 14695981039346656037ULL;
+        for (size_t i = 0; i < length; ++i) {
+            hash = (hash ^ data[i]) * 1099511628211ULL;
+        }
+        if (!stream.user) {
+            stream.user = new uint64_t(hash);
+        }
+        else {
+            *static_cast<uint64_t*>(stream.user) = hash;
+        }
+        bytes.fetch_add(length, std::memory_order_relaxed);
+    }
+
+    void onGap(figkey::tcp_stream& stream, size_t length) override {
+        (void)stream;
+        gaps.fetch_add(length, std::memory_order_relaxed);
+    }
+
+    void onClose(figkey::tcp_stream& stream, figkey::StreamEnd reason) override {
+        if (stream.user) {
+            uint64_t* hash = static_cast<uint64_t*>(stream.user);
+            digest.fetch_xor(*hash, std::memory_order_relaxed);
+            delete hash;
+            stream.user = nullptr;
+        }
+        reasons[static_cast<int>(reason)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void print() const {
+        std::cout << "TCP streams: " << reasons[0].load() << " fin, " << reasons[1].load() << " reset, "
+                  << reasons[2].load() << " expired, " << reasons[3].load() << " cut off by a reused record, "
+                  << bytes.load() << " bytes, " << gaps.load()
+                  << " bytes lost, digest " << std::hex << digest.load() << std::dec << std::endl;
+    }
+
+private:
+    std::atomic<uint64_t> reasons[4] = {};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> gaps{0};
+    std::atomic<uint64_t> digest{0};
+};
+
+// 载荷匹配示例: 按模式统计命中次数, 输出命中最多的模式
+class CountingMatchHandler : public figkey::PayloadMatchHandler {
+public:
+    // 每行一个模式, 忽略空行, 模式编号为其序号
+    bool load(const std::string& path, figkey::PayloadMatcher& matcher) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Couldn't read patterns from " << path << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                matcher.add(line, static_cast<uint32_t>(patterns.size()));
+                patterns.push_back(line);
+            }
+        }
+        hits.reset(new std::atomic<uint64_t>[patterns.size()]());
+        return matcher.compile();
+    }
+
+    void onMatch(const figkey::flow_record& flow, int direction, uint32_t pattern, uint64_t end) override {
+        (void)flow;
+        (void)direction;
+        (void)end;
+        hits[pattern].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void print(const figkey::payload_match_stats& stats, size_t count) const {
+        std::cout << "Payload matches: " << stats.matches << " in " << stats.flows
+                  << " stream directions and datagrams, " << stats.tcp_bytes << " TCP and " << stats.udp_bytes
+                  << " UDP bytes scanned" << std::endl;
+        std::vector<std::pair<uint64_t, size_t>> ranked;
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            if (hits[i].load() > 0) {
+                ranked.emplace_back(hits[i].load(), i);
+            }
+        }
+        size_t shown = std::min(count, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(),
+                          [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+                              return a.first > b.first;
+                          });
+        for (size_t i = 0; i < shown; ++i) {
+            std::cout << "  \"" << patterns[ranked[i].second] << "\": " << ranked[i].first << std::endl;
+        }
+    }
+
+private:
+    std::vector<std::string> patterns;
+    std::unique_ptr<std::atomic<uint64_t>[]> hits;
+};
+
+// 流水线模式: 每个工作线程独占一个线程, 不占用线程池
+static void SetPipeline(figkey::PcapCom& pcap, unsigned workers, figkey::FlowHashType hash)
+{
+    if (workers == 0) {
+        return;
+    }
+    pcap.setPipeline(figkey::PipelineOptions(workers, 8192, 2048, hash));
+}
+
+// 解析 --hash address|toeplitz|crc32c, 流水线分流用的会话哈希
+static bool ParseHashOption(const std::string& arg, int argc, char* argv[], int& i, figkey::FlowHashType& hash)
+{
+    using figkey::FlowHashType;
+    if (arg != "--hash" || i + 1 >= argc) {
+        return false;
+    }
+    std::string name = argv[++i];
+    for (FlowHashType type : {FlowHashType::ADDRESS, FlowHashType::TOEPLITZ, FlowHashType::CRC32C}) {
+        if (name == figkey::FlowHash::typeName(type)) {
+            hash = type;
+            return true;
+        }
+    }
+    std::cerr << "Unknown hash " << name << ", using " << figkey::FlowHash::typeName(hash) << std::endl;
+    return true;
+}
+
+// 应用层解析结果: 协议名, 再按协议输出 HTTP 方法与状态码, DNS 查询类型与响应码, TLS 版本, 最后是名字
+static void PrintApp(const figkey::flow_app& app)
+{
+    using figkey::AppProtocol;
+    std::cout << " " << figkey::DissectorRegistry::protocolName(app.protocol);
+    switch (static_cast<AppProtocol>(app.protocol)) {
+    case AppProtocol::HTTP:
+        std::cout << " " << (app.method[0] ? app.method : "-") << " "
+                  << (app.status ? std::to_string(app.status) : "-");
+        break;
+    case AppProtocol::DNS:
+        std::cout << " type " << app.type << " rcode " << (app.status ? std::to_string(app.status - 1) : "-");
+        break;
+    case AppProtocol::TLS:
+        std::cout << " version " << std::hex << app.version << std::dec;
+        break;
+    default:
+        break;
+    }
+    if (app.name[0]) {
+        std::cout << " " << app.name << ((app.flags & figkey::APP_FLAG_TRUNCATED) ? "..." : "");
+    }
+}
+
+// 会话跟踪结果: 打印字节数最多的 count 条会话
+static void PrintTopFlows(const figkey::PcapCom& pcap, size_t count)
+{
+    std::vector<figkey::flow_record> flows;
+    pcap.forEachFlow([&flows](const figkey::flow_record& flow) { flows.push_back(flow); });
+    auto total = [](const figkey::flow_record& flow) { return flow.bytes[0] + flow.bytes[1]; };
+    size_t shown = std::min(count, flows.size());
+    std::partial_sort(flows.begin(), flows.begin() + shown, flows.end(),
+                      [&total](const figkey::flow_record& a, const figkey::flow_record& b) { return total(a) > total(b); });
+
+    std::cout << flows.size() << " flows tracked, top " << shown << " by bytes:" << std::endl;
+    for (size_t i = 0; i < shown; ++i) {
+        const figkey::flow_record& flow = flows[i];
+        int family = flow.key.ip_version == 6 ? AF_INET6 : AF_INET;
+        char a[INET6_ADDRSTRLEN];
+        char b[INET6_ADDRSTRLEN];
+        inet_ntop(family, flow.key.addr_a, a, sizeof(a));
+        inet_ntop(family, flow.key.addr_b, b, sizeof(b));
+        std::cout << "  " << a << ":" << flow.key.port_a << " <-> " << b << ":" << flow.key.port_b << " proto "
+                  << static_cast<int>(flow.key.protocol) << ": " << flow.packets[0] << "/" << flow.packets[1]
+                  << " packets, " << flow.bytes[0] << "/" << flow.bytes[1] << " bytes, "
+                  << (flow.last_seen_ns - flow.first_seen_ns) / 1000000 << " ms";
+        if (flow.app.protocol) {
+            std::cout << ",";
+            PrintApp(flow.app);
+        }
+        std::cout << std::endl;
+    }
+}
+
+// 按应用层协议统计会话数, 并打印每种协议的前 count 条会话
+static void PrintAppFlows(const figkey::PcapCom& pcap, size_t count)
+{
+    uint64_t flows[4] = {};
+    uint64_t shown[4] = {};
+    pcap.forEachFlow([&](const figkey::flow_record& flow) {
+        uint8_t protocol = flow.app.protocol < 4 ? flow.app.protocol : 0;
+        ++flows[protocol];
+        if (protocol != 0 && shown[protocol]++ < count) {
+            std::cout << " ";
+            PrintApp(flow.app);
+            std::cout << std::endl;
+        }
+    });
+    std::cout << "Application protocols: " << flows[1] << " dns, " << flows[2] << " http, " << flows[3] << " tls, "
+              << flows[0] << " unknown" << std::endl;
+}
+
+// 流量大户: 打印最近一个统计区间里字节数最多的源地址, 目的端口和会话, 误差为计数可能多算的上限
+static void PrintTopTalkers(const figkey::PcapCom& pcap)
+{
+    std::vector<figkey::talker_report> last = pcap.getTopTalkers(1);
+    if (last.empty()) {
+        return;
+    }
+    const figkey::talker_report& report = last.back();
+    const char* const names[figkey::TALKER_DIMENSIONS] = {"sources", "destination ports", "flows"};
+    std::cout << "Top talkers of the last " << report.interval_ns / 1000000 << " ms (" << report.packets
+              << " packets, " << report.bytes << " bytes):" << std::endl;
+    for (int i = 0; i < figkey::TALKER_DIMENSIONS; ++i) {
+        std::cout << " " << names[i] << " by bytes:" << std::endl;
+        for (const figkey::talker_entry& entry : report.by_bytes[i]) {
+            std::cout << "  " << figkey::TopTalkers::keyName(static_cast<figkey::TalkerDimension>(i), entry.key)
+                      << ": " << entry.bytes << " bytes (error " << entry.error << "), " << entry.packets
+                      << " packets" << std::endl;
+        }
+    }
+}
+
+// 写抓包文件参数: --write FILE [--rotate-mb N] [--rotate-s S] [--max-files N], 扩展名为 .pcap 时写 pcap,
+// 否则写 pcapng; 设置了轮转时文件名带序号, --max-files 只保留最新的 N 个文件
+static bool ParseWriteOption(const std::string& arg, int argc, char* argv[], int& i, std::string& path,
+                             figkey::CaptureWriterOptions& options)
+{
+    if (i + 1 >= argc) {
+        return false;
+    }
+    if (arg == "--write") {
+        path = argv[++i];
+        bool pcap = path.size() >= 5 && path.compare(path.size() - 5, 5, ".pcap") == 0;
+        options.format = pcap ? figkey::CaptureFileFormat::PCAP : figkey::CaptureFileFormat::PCAPNG;
+    }
+    else if (arg == "--rotate-mb") {
+        options.rotateBytes = static_cast<uint64_t>(std::atoll(argv[++i])) << 20;
+    }
+    else if (arg == "--rotate-s") {
+        options.rotateSeconds = static_cast<uint32_t>(std::atoi(argv[++i]));
+    }
+    else if (arg == "--max-files") {
+        options.maxFiles = static_cast<unsigned>(std::atoi(argv[++i]));
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// 离线回放: ipcap <file.pcap|file.pcapng> [speed] [--libpcap] [--batch N] [--workers N [--hash H]]
+//           [--flows N [--idle S]] [--streams] [--patterns FILE] [--dissect] [--defrag] [--checksums]
+//           [--records FILE] [--filter EXPR] [--write FILE ...] [--top N]
+// speed 为 0 时全速回放, 1 为原始速率, N 为 N 倍速, --hash 为流水线分流的会话哈希 address, toeplitz 或 crc32c,
+// --flows 开启会话跟踪, 每个线程最多 N 条会话,
+// --idle 按包时间戳老化会话, 空闲超时 S 秒, --streams 重组会话中的 TCP 流并输出统计,
+// --patterns 在 TCP 流和 UDP 载荷中查找文件里的模式 (每行一个) 并输出命中统计,
+// --dissect 解析每条会话开头的 DNS, HTTP 和 TLS ClientHello, 输出 DNS 域名, HTTP 主机和 TLS SNI,
+// --defrag 先重组 IP 分片再跟踪会话, --checksums 校验 IP/TCP/UDP/ICMP 校验和, --records 以二进制记录代替文本日志, 用 record_dump 查看,
+// --filter 只回放匹配 tcpdump 过滤表达式的包, --write 把回放的包写入新文件,
+// --top 按秒统计流量大户, 回放结束后输出最后一秒的前 N 名
+static int ReplayFile(int argc, char* argv[])
+{
+    using namespace figkey;
+    ReplayOptions options;
+    size_t batchSize = 0;
+    unsigned workers = 0;
+    FlowHashType hash = FlowHashType::ADDRESS;
+    size_t maxFlows = 0;
+    double idleSeconds = 0;
+    bool streams = false;
+    bool defrag = false;
+    bool checksums = false;
+    bool dissect = false;
+    size_t top = 0;
+    std::string patternPath;
+    std::string recordPath;
+    std::string filter;
+    std::string writePath;
+    CaptureWriterOptions writeOptions;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--libpcap") {
+            options.useLibpcap = true;
+        }
+        else if (arg == "--streams") {
+            streams = true;
+        }
+        else if (arg == "--defrag") {
+            defrag = true;
+        }
+        else if (arg == "--checksums") {
+            checksums = true;
+        }
+        else if (arg == "--dissect") {
+            dissect = true;
+        }
+        else if (arg == "--batch" && i + 1 < argc) {
+            batchSize = static_cast<size_t>(std::atoi(argv[++i]));
+        }
+        else if (arg == "--workers" && i + 1 < argc) {
+            workers = static_cast<unsigned>(std::atoi(argv[++i]));
+        }
+        else if (arg == "--flows" && i + 1 < argc) {
+            maxFlows = static_cast<size_t>(std::atoll(argv[++i]));
+        }
+        else if (arg == "--idle" && i + 1 < argc) {
+            idleSeconds = std::atof(argv[++i]);
+        }
+        else if (arg == "--records" && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--patterns" && i + 1 < argc) {
+            patternPath = argv[++i];
+        }
+        else if (arg == "--top" && i + 1 < argc) {
+            top = static_cast<size_t>(std::atoi(argv[++i]));
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if (ParseWriteOption(arg, argc, argv, i, writePath, writeOptions)) {
+        }
+        else if (ParseHashOption(arg, argc, argv, i, hash)) {
+        }
+        else {
+            options.speed = std::atof(argv[i]);
+        }
+    }
+    PayloadMatcher matcher;
+    CountingMatchHandler matchCounter;
+    if (!patternPath.empty() && !matchCounter.load(patternPath, matcher)) {
+        return 1;
+    }
+
+    PcapCom pcap;
+    if (!pcap.setOffline(argv[1], options)) {
+        std::cerr << "Failed to open capture file." << std::endl;
+        return 1;
+    }
+    if (!filter.empty() && !pcap.setFilter(filter)) {
+        return 1;
+    }
+    CountingBatchHandler counter;
+    if (batchSize > 0) {
+        pcap.setBatchHandler(&counter, batchSize);
+    }
+    SetPipeline(pcap, workers, hash);
+    pcap.setFlowTracking(maxFlows);
+    pcap.setRecordOutput(recordPath);
+    pcap.setCaptureOutput(writePath, writeOptions);
+    CountingExpiryHandler expired;
+    if (idleSeconds > 0) {
+        pcap.setFlowExpiry(&expired, FlowExpiryOptions(static_cast<uint32_t>(idleSeconds * 1000)));
+    }
+    CountingStreamHandler streamCounter;
+    if (streams) {
+        pcap.setStreamHandler(&streamCounter);
+    }
+    if (!patternPath.empty()) {
+        pcap.setPayloadMatching(&matcher, &matchCounter);
+    }
+    DissectorRegistry dissectors;
+    if (dissect) {
+        pcap.setAppDissection(&dissectors);
+    }
+    pcap.setIpDefrag(defrag);
+    pcap.setChecksumValidation(checksums);
+    if (top > 0) {
+        pcap.setStatistics(CaptureStatsOptions(1000, 300, std::string(), TopTalkerOptions(top)));
+    }
+    pcap.startCapture(false);
+    if (!filter.empty()) {
+        filter_stats stats = pcap.getFilterStats();
+        std::cout << "Filter \"" << filter << "\": " << stats.accepted << " accepted, " << stats.filtered
+                  << " filtered" << std::endl;
+    }
+    if (batchSize > 0) {
+        counter.print();
+        // Batches bypass the packet handler, the capture statistics still have to count every packet
+        uint64_t counted = pcap.getStatistics().packets;
+        if (counted != counter.packetCount()) {
+            std::cerr << "Capture statistics counted " << counted << " packets, the batch handler got "
+                      << counter.packetCount() << std::endl;
+            return 1;
+        }
+    }
+    if (defrag) {
+        ip_defrag_stats stats = pcap.getIpDefragStats();
+        std::cout << "IP fragments: " << stats.fragments << " taken, " << stats.reassembled << " datagrams reassembled, "
+                  << stats.duplicates << " duplicates, " << stats.overlaps + stats.malformed << " datagrams invalid, "
+                  << stats.timeouts + stats.evicted + stats.limited << " discarded, " << stats.pending
+                  << " incomplete" << std::endl;
+    }
+    if (checksums) {
+        std::cout << "Checksums (" << Checksum::kernelName(Checksum::kernel()) << "): "
+                  << pcap.getStatistics().checksum_errors << " packets bad" << std::endl;
+    }
+    if (streams) {
+        streamCounter.print();
+    }
+    if (!patternPath.empty()) {
+        matchCounter.print(pcap.getPayloadMatchStats(), 10);
+    }
+    if (dissect) {
+        PrintAppFlows(pcap, 5);
+    }
+    if (top > 0) {
+        PrintTopTalkers(pcap);
+    }
+    if (idleSeconds > 0) {
+        expired.print();
+    }
+    else if (maxFlows > 0) {
+        PrintTopFlows(pcap, 10);
+    }
+    return 0;
+}
+
+// 等待输入 exit, 抓包期间 filter <表达式> 替换过滤器 (空表达式接收全部), stats 打印过滤器计数
+// 输出抓包统计总数, 有采样时再输出最近一秒的速率和流量大户
+static void PrintStatistics(figkey::PcapCom& pcap)
+{
+    figkey::capture_stats_sample totals = pcap.getStatistics();
+    std::cout << "Handled " << totals.packets << " packets, " << totals.bytes << " bytes (tcp "
+              << totals.protocols[figkey::STAT_TCP] << ", udp " << totals.protocols[figkey::STAT_UDP] << ", icmp "
+              << totals.protocols[figkey::STAT_ICMP] << ", other " << totals.protocols[figkey::STAT_OTHER_IP]
+              << ", non-ip " << totals.protocols[figkey::STAT_NON_IP] << "), " << totals.decode_errors
+              << " decode errors, " << totals.errors << " errors, " << totals.checksum_errors << " bad checksums, "
+              << totals.queue_drops << " queue drops, "
+              << totals.kernel_received << " received and " << totals.kernel_drops << " dropped by kernel"
+              << std::endl;
+    std::vector<figkey::capture_stats_sample> last = pcap.getStatisticsHistory(1);
+    if (!last.empty() && last.back().interval_ns > 0) {
+        double seconds = last.back().interval_ns / 1e9;
+        std::cout << "Last interval: " << last.back().packets / seconds << " packets/s, "
+                  << last.back().bytes * 8 / seconds / 1e6 << " Mbit/s, " << last.back().kernel_drops / seconds
+                  << " kernel drops/s" << std::endl;
+    }
+    PrintTopTalkers(pcap);
+}
+
+static void WaitForExit(figkey::PcapCom& pcap)
+{
+    while (true)
+    {
+        std::string s;
+        std::getline(std::cin, s);
+        if (s == "exit" || !std::cin)
+        {
+            break;
+        }
+        if (s == "filter" || s.compare(0, 7, "filter ") == 0)
+        {
+            std::string expression = s.size() > 7 ? s.substr(7) : std::string();
+            if (pcap.setFilter(expression))
+            {
+                std::cout << "Filter set to \"" << expression << "\"" << std::endl;
+            }
+        }
+        else if (s == "stats")
+        {
+            figkey::filter_stats stats = pcap.getFilterStats();
+            std::cout << "Filter \"" << pcap.getFilter() << "\": " << stats.accepted << " accepted, "
+                      << stats.kernel_drops << " dropped by kernel, " << stats.filtered << " filtered" << std::endl;
+            PrintStatistics(pcap);
+        }
+    }
+}
+
+// Linux AF_PACKET 抓包: ipcap --af-packet <interface> [block_size_kb] [block_count] [--batch N]
+//                       [--workers N [--hash H]] [--flows N [--idle S]] [--records FILE] [--filter EXPR] [--write FILE ...] [--stats FILE] [--top N]
+// --stats 每秒采样统计并写入 JSON 快照文件, --top 同时统计每秒的前 N 名流量大户
+static int CaptureAfPacket(int argc, char* argv[])
+{
+    using namespace figkey;
+    if (argc < 3) {
+        std::cerr << "Usage: ipcap --af-packet <interface> [block_size_kb] [block_count] [--batch N] [--workers N [--hash H]] [--flows N [--idle S]] [--records FILE] [--filter EXPR] [--write FILE ...] [--stats FILE] [--top N]" << std::endl;
+        return 1;
+    }
+    AfPacketOptions options;
+    size_t batchSize = 0;
+    unsigned workers = 0;
+    FlowHashType hash = FlowHashType::ADDRESS;
+    size_t maxFlows = 0;
+    double idleSeconds = 0;
+    std::string recordPath;
+    std::string filter;
+    std::string writePath;
+    CaptureWriterOptions writeOptions;
+    std::string statsPath;
+    size_t top = 0;
+    int position = 0;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc) {
+            batchSize = static_cast<size_t>(std::atoi(argv[++i]));
+        }
+        else if (arg == "--workers" && i + 1 < argc) {
+            workers = static_cast<unsigned>(std::atoi(argv[++i]));
+        }
+        else if (arg == "--flows" && i + 1 < argc) {
+            maxFlows = static_cast<size_t>(std::atoll(argv[++i]));
+        }
+        else if (arg == "--idle" && i + 1 < argc) {
+            idleSeconds = std::atof(argv[++i]);
+        }
+        else if (arg == "--records" && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if (arg == "--stats" && i + 1 < argc) {
+            statsPath = argv[++i];
+        }
+        else if (arg == "--top" && i + 1 < argc) {
+            top = static_cast<size_t>(std::atoi(argv[++i]));
+        }
+        else if (ParseWriteOption(arg, argc, argv, i, writePath, writeOptions)) {
+        }
+        else if (ParseHashOption(arg, argc, argv, i, hash)) {
+        }
+        else if (position++ == 0) {
+            options.blockSize = static_cast<uint32_t>(std::atoi(argv[i])) * 1024;
+        }
+        else {
+            options.blockCount = static_cast<uint32_t>(std::atoi(argv[i]));
+        }
+    }
+
+    PcapCom pcap;
+    if (!pcap.setAfPacket(argv[2], options)) {
+        std::cerr << "Failed to set network." << std::endl;
+        return 1;
+    }
+    if (!filter.empty() && !pcap.setFilter(filter)) {
+        return 1;
+    }
+    CountingBatchHandler counter;
+    if (batchSize > 0) {
+        pcap.setBatchHandler(&counter, batchSize);
+    }
+    SetPipeline(pcap, workers, hash);
+    pcap.setFlowTracking(maxFlows);
+    pcap.setRecordOutput(recordPath);
+    pcap.setCaptureOutput(writePath, writeOptions);
+    CountingExpiryHandler expired;
+    if (idleSeconds > 0) {
+        pcap.setFlowExpiry(&expired, FlowExpiryOptions(static_cast<uint32_t>(idleSeconds * 1000)));
+    }
+    if (!statsPath.empty() || top > 0) {
+        pcap.setStatistics(CaptureStatsOptions(1000, 300, statsPath, TopTalkerOptions(top)));
+    }
+    std::cout << "Starting capture on " << argv[2] << ", type filter <expr>, stats or exit" << std::endl;
+    pcap.startCapture(true);
+    WaitForExit(pcap);
+    pcap.stopCapture();
+    PrintStatistics(pcap);
+    if (batchSize > 0) {
+        counter.print();
+    }
+    if (idleSeconds > 0) {
+        expired.print();
+    }
+    else if (maxFlows > 0) {
+        PrintTopFlows(pcap, 10);
+    }
+    return 0;
+}
+
+// libpcap 抓包: ipcap --live <interface> [header|forensic|latency] [--filter EXPR]
+// header 只保留包头, 大缓冲区, 适合高包速; forensic 保留整包和纳秒时间戳; latency 立即交付每个包
+static int CaptureLive(int argc, char* argv[])
+{
+    using namespace figkey;
+    if (argc < 3) {
+        std::cerr << "Usage: ipcap --live <interface> [header|forensic|latency] [--filter EXPR]" << std::endl;
+        return 1;
+    }
+    CaptureOptions options;
+    std::string filter;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if (arg == "header") {
+            options = CaptureOptions::headerOnly();
+        }
+        else if (arg == "forensic") {
+            options = CaptureOptions::forensic();
+        }
+        else if (arg == "latency") {
+            options = CaptureOptions::lowLatency();
+        }
+    }
+
+    PcapCom pcap;
+    if (!pcap.setNetwork(argv[2], options)) {
+        std::cerr << "Failed to set network." << std::endl;
+        return 1;
+    }
+    if (!filter.empty() && !pcap.setFilter(filter)) {
+        return 1;
+    }
+    std::cout << "Starting capture on " << argv[2] << " (snaplen " << options.snaplen << ", buffer "
+              << options.bufferSize << "), type filter <expr>, stats or exit" << std::endl;
+    pcap.startCapture(true);
+    WaitForExit(pcap);
+    pcap.stopCapture();
+    return 0;
+}
+
+// 多线程抓包: ipcap --fanout <interface> <threads> [hash|lb|cpu|qm]
+static int CaptureFanout(int argc, char* argv[])
+{
+    using namespace figkey;
+    if (argc < 4) {
+        std::cerr << "Usage: ipcap --fanout <interface> <threads> [hash|lb|cpu|qm]" << std::endl;
+        return 1;
+    }
+    AfPacketOptions options;
+    if (argc > 4) {
+        std::string mode = argv[4];
+        if (mode == "lb") {
+            options.fanoutMode = FanoutMode::LB;
+        }
+        else if (mode == "cpu") {
+            options.fanoutMode = FanoutMode::CPU;
+        }
+        else if (mode == "qm") {
+            options.fanoutMode = FanoutMode::QM;
+        }
+    }
+
+    PcapCom pcap;
+    if (!pcap.setFanout(argv[2], static_cast<unsigned>(std::atoi(argv[3])), options)) {
+        std::cerr << "Failed to set network." << std::endl;
+        return 1;
+    }
+    std::cout << "Starting capture on " << argv[2] << " with " << argv[3] << " threads, type filter <expr>, stats or exit" << std::endl;
+    pcap.startCapture();
+    WaitForExit(pcap);
+    pcap.stopCapture();
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     InitThreadPool();
+    if (argc > 1) {
+        if (std::string(argv[1]) == "--af-packet") {
+            return CaptureAfPacket(argc, argv);
+        }
+        if (std::string(argv[1]) == "--live") {
+            return CaptureLive(argc, argv);
+        }
+        if (std::string(argv[1]) == "--fanout") {
+            return CaptureFanout(argc, argv);
+        }
+        return ReplayFile(argc, argv);
+    }
 
     using namespace figkey;
     PcapCom pcap;
@@ -40,15 +762,7 @@ int main() {
 
     std::cout << "Starting capture on " << networkList[choice - 1].name << std::endl;
     pcap.startCapture(true);
-    while (true)
-    {
-        std::string s;
-        std::getline(std::cin, s);
-        if (s == "exit")
-        {
-            break;
-        }
-    }
+    WaitForExit(pcap);
 
     return 0;
 }
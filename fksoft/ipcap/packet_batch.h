@@ -0,0 +1,122 @@
+/**
+ * @file    packet_batch.h
+ * @ingroup figkey
+ * @brief   Batched packet delivery for PcapCom.
+ *          Instead of one callback per packet, the capture loop collects up to N packets (header plus data
+ *          span) and hands the whole batch to a BatchHandler, so per-call overhead is paid once per batch and
+ *          the handler can prefetch and parse several packets at a time. On the AF_PACKET backend the spans
+ *          point straight into the receive ring, other backends copy the data into the batch's own arena.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_PACKET_BATCH_HPP
+#define FIGKEY_PACKET_BATCH_HPP
+
+#include <pcap.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+namespace figkey {
+
+// One packet of a batch
+struct packet_view {
+    struct pcap_pkthdr header;
+    const unsigned char* data;   // header.caplen bytes, valid until BatchHandler::onBatch returns
+};
+
+class PacketBatch {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 64;
+    static constexpr size_t ARENA_BYTES_PER_PACKET = 2048;  // Arena size per slot, larger packets grow it
+
+    explicit PacketBatch(size_t capacity = DEFAULT_CAPACITY)
+            : packets(capacity > 0 ? capacity : 1), count(0), arenaUsed(0), dlt(DLT_EN10MB), workerIndex(0) {}
+
+    size_t size() const { return count; }
+    size_t capacity() const { return packets.size(); }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == packets.size(); }
+
+    const packet_view& operator[](size_t i) const { return packets[i]; }
+
+    // Starts loading the data of packet i, e.g. the next one while the current one is parsed
+    void prefetch(size_t i) const {
+#if defined(__GNUC__)
+        __builtin_prefetch(packets[i].data);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_prefetch(reinterpret_cast<const char*>(packets[i].data), _MM_HINT_T0);
+#else
+        (void)i;
+#endif
+    }
+    const packet_view* begin() const { return packets.data(); }
+    const packet_view* end() const { return packets.data() + count; }
+
+    // DLT_* of every packet in the batch
+    int linkType() const { return dlt; }
+
+    // Index of the fanout thread that collected the batch, 0 for single-threaded captures
+    unsigned worker() const { return workerIndex; }
+
+    // Adds a packet by reference, the data must stay valid until the batch is handed over
+    void add(const struct pcap_pkthdr& header, const unsigned char* data) {
+        packet_view& view = packets[count++];
+        view.header = header;
+        view.data = data;
+    }
+
+    // Adds a copy of the packet, returns false if the arena is full and the batch has to be handed over first
+    bool addCopy(const struct pcap_pkthdr& header, const unsigned char* data) {
+        if (arena.empty()) {
+            arena.resize(packets.size() * ARENA_BYTES_PER_PACKET);
+        }
+        if (arenaUsed + header.caplen > arena.size()) {
+            if (count > 0) {
+                return false;
+            }
+            arena.resize(header.caplen);  // Nothing refers to the arena yet, growing it is safe
+        }
+        unsigned char* copy = arena.data() + arenaUsed;
+        std::memcpy(copy, data, header.caplen);
+        arenaUsed += header.caplen;
+        add(header, copy);
+        return true;
+    }
+
+    void clear() {
+        count = 0;
+        arenaUsed = 0;
+    }
+
+    void setLinkType(int link_type) { dlt = link_type; }
+    void setWorker(unsigned index) { workerIndex = index; }
+
+private:
+    std::vector<packet_view> packets;
+    size_t count;
+    std::vector<unsigned char> arena;   // Copies of packets whose capture buffer does not outlive the callback
+    size_t arenaUsed;
+    int dlt;
+    unsigned workerIndex;
+};
+
+// Receives whole batches of packets. With a fanout capture onBatch is called concurrently from every worker
+// thread, use PacketBatch::worker() to keep per-thread state
+class BatchHandler {
+public:
+    virtual ~BatchHandler() = default;
+
+    virtual void onBatch(const PacketBatch& batch) = 0;
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_PACKET_BATCH_HPP
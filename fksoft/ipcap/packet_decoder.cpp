@@ -0,0 +1,358 @@
+﻿// packet_decoder.cpp: 数据包协议解析
+//
+#include "packet_decoder.h"
+#include <pcap.h>
+#include <cstring>
+
+namespace figkey {
+
+namespace {
+
+// Link types that are written to files with a different value than the DLT_* of the running platform
+constexpr int LINKTYPE_RAW = 101;
+constexpr int LINKTYPE_LOOP = 108;
+constexpr int LINKTYPE_LINUX_SLL = 113;
+constexpr int LINKTYPE_IPV4 = 228;
+constexpr int LINKTYPE_IPV6 = 229;
+constexpr int LINKTYPE_LINUX_SLL2 = 276;
+
+constexpr uint16_t ETHERTYPE_IPV4 = 0x0800;
+constexpr uint16_t ETHERTYPE_IPV6 = 0x86DD;
+constexpr uint16_t ETHERTYPE_VLAN = 0x8100;
+constexpr uint16_t ETHERTYPE_QINQ = 0x88A8;
+constexpr uint16_t ETHERTYPE_QINQ_OLD = 0x9100;
+constexpr uint8_t MAX_VLAN_TAGS = 8;
+constexpr int MAX_IPV6_EXTENSIONS = 8;
+
+constexpr uint8_t IPPROTO_HOPOPTS_ = 0;
+constexpr uint8_t IPPROTO_ICMP_ = 1;
+constexpr uint8_t IPPROTO_TCP_ = 6;
+constexpr uint8_t IPPROTO_UDP_ = 17;
+constexpr uint8_t IPPROTO_ROUTING_ = 43;
+constexpr uint8_t IPPROTO_FRAGMENT_ = 44;
+constexpr uint8_t IPPROTO_AH_ = 51;
+constexpr uint8_t IPPROTO_ICMPV6_ = 58;
+constexpr uint8_t IPPROTO_DSTOPTS_ = 60;
+constexpr uint8_t IPPROTO_SCTP_ = 132;
+
+inline uint16_t load16(const unsigned char* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline uint32_t load32(const unsigned char* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+inline uint16_t clamp16(uint32_t v) {
+    return static_cast<uint16_t>(v > 0xFFFF ? 0xFFFF : v);
+}
+
+}  // namespace
+
+DecodeStatus PacketDecoder::linkLayer(int link_type, const unsigned char* data, uint32_t caplen, uint32_t& offset,
+                                     uint16_t& ether_type, decoded_packet* packet) {
+    offset = 0;
+    ether_type = 0;
+    if (link_type == DLT_EN10MB) {
+        if (caplen < 14) {
+            return DecodeStatus::TRUNCATED;
+        }
+        ether_type = load16(data + 12);
+        offset = 14;
+        uint8_t tags = 0;
+        while (ether_type == ETHERTYPE_VLAN || ether_type == ETHERTYPE_QINQ || ether_type == ETHERTYPE_QINQ_OLD) {
+            if (caplen < offset + 4) {
+                return DecodeStatus::TRUNCATED;
+            }
+            if (tags >= MAX_VLAN_TAGS) {
+                return DecodeStatus::MALFORMED;
+            }
+            if (packet) {
+                if (tags < 2) {
+                    packet->vlan_id[tags] = load16(data + offset) & 0x0FFF;
+                }
+                packet->vlan_count = static_cast<uint8_t>(tags + 1);
+                packet->flags |= PKT_FLAG_VLAN;
+            }
+            ++tags;
+            ether_type = load16(data + offset + 2);
+            offset += 4;
+        }
+    }
+    else if (link_type == LINKTYPE_LINUX_SLL) {
+        if (caplen < 16) {
+            return DecodeStatus::TRUNCATED;
+        }
+        ether_type = load16(data + 14);
+        offset = 16;
+    }
+    else if (link_type == LINKTYPE_LINUX_SLL2) {
+        if (caplen < 20) {
+            return DecodeStatus::TRUNCATED;
+        }
+        ether_type = load16(data);
+        offset = 20;
+    }
+    else if (link_type == DLT_NULL || link_type == DLT_LOOP || link_type == LINKTYPE_LOOP) {
+        // Address family in host byte order for DLT_NULL and network byte order for DLT_LOOP; families fit in
+        // 16 bits, so whichever interpretation is small is the right one
+        if (caplen < 4) {
+            return DecodeStatus::TRUNCATED;
+        }
+        uint32_t family = load32(data);
+        if (family > 0xFFFF) {
+            family = (family >> 24) | ((family >> 8) & 0xFF00);
+        }
+        if (family == 2) {
+            ether_type = ETHERTYPE_IPV4;
+        }
+        else if (family == 10 || family == 24 || family == 28 || family == 30) {
+            ether_type = ETHERTYPE_IPV6;  // AF_INET6 on Linux, NetBSD/OpenBSD, FreeBSD and macOS
+        }
+        offset = 4;
+    }
+    else if (link_type == DLT_RAW || link_type == LINKTYPE_RAW || link_type == LINKTYPE_IPV4 ||
+             link_type == LINKTYPE_IPV6) {
+        if (caplen < 1) {
+            return DecodeStatus::TRUNCATED;
+        }
+        ether_type = (data[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IPV4;
+    }
+    else {
+        return DecodeStatus::UNSUPPORTED_LINK;
+    }
+    return DecodeStatus::OK;
+}
+
+DecodeStatus PacketDecoder::decode(int link_type, const unsigned char* data, uint32_t caplen, decoded_packet& packet) {
+    std::memset(&packet, 0, sizeof(packet));
+    uint32_t offset = 0;
+    uint16_t etherType = 0;
+    DecodeStatus status = linkLayer(link_type, data, caplen, offset, etherType, &packet);
+    if (status != DecodeStatus::OK) {
+        return status;
+    }
+
+    packet.ether_type = etherType;
+    if (etherType == ETHERTYPE_IPV4) {
+        return decodeIpv4(data, caplen, offset, packet);
+    }
+    if (etherType == ETHERTYPE_IPV6) {
+        return decodeIpv6(data, caplen, offset, packet);
+    }
+    return DecodeStatus::NOT_IP;
+}
+
+DecodeStatus PacketDecoder::decodeIp(const unsigned char* data, uint32_t caplen, decoded_packet& packet) {
+    return decode(LINKTYPE_RAW, data, caplen, packet);
+}
+
+const char* PacketDecoder::statusName(DecodeStatus status) {
+    switch (status) {
+    case DecodeStatus::OK: return "OK";
+    case DecodeStatus::NOT_IP: return "Non-IP";
+    case DecodeStatus::UNSUPPORTED_LINK: return "Unsupported link type";
+    case DecodeStatus::TRUNCATED: return "Truncated";
+    case DecodeStatus::MALFORMED: return "Malformed";
+    }
+    return "Unknown";
+}
+
+DecodeStatus PacketDecoder::decodeIpv4(const unsigned char* data, uint32_t caplen, uint32_t offset, decoded_packet& packet) {
+    if (caplen < offset + 20) {
+        return DecodeStatus::TRUNCATED;
+    }
+    const unsigned char* ip = data + offset;
+    uint32_t headerLength = (ip[0] & 0x0F) * 4u;
+    uint16_t totalLength = load16(ip + 2);
+    if ((ip[0] >> 4) != 4 || headerLength < 20 || totalLength < headerLength) {
+        return DecodeStatus::MALFORMED;
+    }
+
+    packet.l3_offset = static_cast<uint16_t>(offset);
+    packet.ether_type = ETHERTYPE_IPV4;
+    packet.ip_version = 4;
+    packet.flags |= PKT_FLAG_IPV4;
+    packet.ip_length = totalLength;
+    packet.ttl = ip[8];
+    packet.protocol = ip[9];
+    packet.fragment_id = load16(ip + 4);
+    std::memcpy(packet.src_addr, ip + 12, 4);
+    std::memcpy(packet.dst_addr, ip + 16, 4);
+
+    uint16_t fragment = load16(ip + 6);
+    packet.fragment_offset = static_cast<uint16_t>((fragment & 0x1FFF) * 8);
+    if (fragment & 0x4000) {
+        packet.flags |= PKT_FLAG_DONT_FRAGMENT;
+    }
+    if (fragment & 0x2000) {
+        packet.flags |= PKT_FLAG_MORE_FRAGMENTS | PKT_FLAG_FRAGMENT;
+    }
+    if (packet.fragment_offset != 0) {
+        packet.flags |= PKT_FLAG_FRAGMENT;
+    }
+    if (headerLength > 20) {
+        packet.flags |= PKT_FLAG_IP_OPTIONS;
+    }
+    if (caplen < offset + headerLength) {
+        return DecodeStatus::TRUNCATED;
+    }
+
+    // Everything past the IP length is link layer padding
+    uint32_t end = offset + totalLength;
+    if (end > caplen) {
+        end = caplen;
+        packet.flags |= PKT_FLAG_TRUNCATED;
+    }
+    if (packet.fragment_offset != 0) {
+        packet.payload_offset = static_cast<uint16_t>(offset + headerLength);
+        packet.payload_length = clamp16(end - packet.payload_offset);
+        return DecodeStatus::OK;  // Only the first fragment carries the transport header
+    }
+    return decodeTransport(data, end, offset + headerLength, packet);
+}
+
+DecodeStatus PacketDecoder::decodeIpv6(const unsigned char* data, uint32_t caplen, uint32_t offset, decoded_packet& packet) {
+    if (caplen < offset + 40) {
+        return DecodeStatus::TRUNCATED;
+    }
+    const unsigned char* ip = data + offset;
+    if ((ip[0] >> 4) != 6) {
+        return DecodeStatus::MALFORMED;
+    }
+
+    packet.l3_offset = static_cast<uint16_t>(offset);
+    packet.ether_type = ETHERTYPE_IPV6;
+    packet.ip_version = 6;
+    packet.flags |= PKT_FLAG_IPV6;
+    packet.ttl = ip[7];
+    uint32_t payloadLength = load16(ip + 4);
+    packet.ip_length = clamp16(40 + payloadLength);
+    std::memcpy(packet.src_addr, ip + 8, 16);
+    std::memcpy(packet.dst_addr, ip + 24, 16);
+
+    uint32_t end = offset + 40 + payloadLength;
+    if (end > caplen) {
+        end = caplen;
+        packet.flags |= PKT_FLAG_TRUNCATED;
+    }
+
+    // Walk the extension header chain up to the transport header
+    uint8_t next = ip[6];
+    uint32_t position = offset + 40;
+    for (int i = 0; i <= MAX_IPV6_EXTENSIONS; ++i) {
+        switch (next) {
+        case IPPROTO_HOPOPTS_:
+        case IPPROTO_ROUTING_:
+        case IPPROTO_DSTOPTS_:
+        case IPPROTO_AH_: {
+            if (end < position + 8) {
+                return DecodeStatus::TRUNCATED;
+            }
+            uint32_t length = next == IPPROTO_AH_ ? (data[position + 1] + 2u) * 4u : (data[position + 1] + 1u) * 8u;
+            packet.flags |= PKT_FLAG_IP_OPTIONS;
+            next = data[position];
+            position += length;
+            if (position > end) {
+                return DecodeStatus::TRUNCATED;
+            }
+            continue;
+        }
+        case IPPROTO_FRAGMENT_: {
+            if (end < position + 8) {
+                return DecodeStatus::TRUNCATED;
+            }
+            uint16_t fragment = load16(data + position + 2);
+            packet.flags |= PKT_FLAG_IP_OPTIONS | PKT_FLAG_FRAGMENT;
+            packet.fragment_offset = fragment & 0xFFF8;
+            if (fragment & 0x0001) {
+                packet.flags |= PKT_FLAG_MORE_FRAGMENTS;
+            }
+            packet.fragment_id = load32(data + position + 4);
+            next = data[position];
+            position += 8;
+            if (packet.fragment_offset != 0) {
+                packet.protocol = next;
+                packet.payload_offset = static_cast<uint16_t>(position);
+                packet.payload_length = clamp16(end - position);
+                return DecodeStatus::OK;
+            }
+            continue;
+        }
+        default:
+            packet.protocol = next;
+            return decodeTransport(data, end, position, packet);
+        }
+    }
+    return DecodeStatus::MALFORMED;  // Longer chains than any real stack sends
+}
+
+DecodeStatus PacketDecoder::decodeTransport(const unsigned char* data, uint32_t end, uint32_t offset, decoded_packet& packet) {
+    const unsigned char* l4 = data + offset;
+    uint32_t headerLength;
+
+    switch (packet.protocol) {
+    case IPPROTO_TCP_:
+        if (end < offset + 20) {
+            return DecodeStatus::TRUNCATED;
+        }
+        headerLength = (l4[12] >> 4) * 4u;
+        if (headerLength < 20) {
+            return DecodeStatus::MALFORMED;
+        }
+        if (end < offset + headerLength) {
+            return DecodeStatus::TRUNCATED;
+        }
+        packet.src_port = load16(l4);
+        packet.dst_port = load16(l4 + 2);
+        packet.tcp_seq = load32(l4 + 4);
+        packet.tcp_ack = load32(l4 + 8);
+        packet.tcp_flags = l4[13];
+        packet.tcp_window = load16(l4 + 14);
+        break;
+    case IPPROTO_UDP_: {
+        if (end < offset + 8) {
+            return DecodeStatus::TRUNCATED;
+        }
+        headerLength = 8;
+        packet.src_port = load16(l4);
+        packet.dst_port = load16(l4 + 2);
+        uint32_t length = load16(l4 + 4);
+        if (length >= 8 && offset + length < end) {
+            end = offset + length;
+        }
+        break;
+    }
+    case IPPROTO_SCTP_:
+        if (end < offset + 12) {
+            return DecodeStatus::TRUNCATED;
+        }
+        headerLength = 12;
+        packet.src_port = load16(l4);
+        packet.dst_port = load16(l4 + 2);
+        break;
+    case IPPROTO_ICMP_:
+    case IPPROTO_ICMPV6_:
+        if (end < offset + 8) {
+            return DecodeStatus::TRUNCATED;
+        }
+        headerLength = 8;
+        packet.icmp_type = l4[0];
+        packet.icmp_code = l4[1];
+        break;
+    default:
+        // Unknown transport, the whole IP payload is the payload
+        packet.payload_offset = static_cast<uint16_t>(offset);
+        packet.payload_length = clamp16(end > offset ? end - offset : 0);
+        return DecodeStatus::OK;
+    }
+
+    packet.l4_offset = static_cast<uint16_t>(offset);
+    packet.payload_offset = static_cast<uint16_t>(offset + headerLength);
+    packet.payload_length = clamp16(end - packet.payload_offset);
+    packet.flags |= PKT_FLAG_TRANSPORT;
+    return DecodeStatus::OK;
+}
+
+}  // namespace figkey
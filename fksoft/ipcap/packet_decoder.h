@@ -0,0 +1,97 @@
+﻿/**
+ * @file    packet_decoder.h
+ * @ingroup figkey
+ * @brief   Bounds-checked, allocation-free protocol decoder for captured packets.
+ *          Walks the link layer (Ethernet with 802.1Q/QinQ tags, Linux cooked SLL/SLL2, BSD loopback, raw IP),
+ *          IPv4 or IPv6 including extension headers and fragments, and TCP/UDP/SCTP/ICMP/ICMPv6. Every read is
+ *          checked against caplen and the IP length; the result is a compact struct of offsets and fields that
+ *          points back into the original packet, nothing is copied or allocated.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_PACKET_DECODER_HPP
+#define FIGKEY_PACKET_DECODER_HPP
+
+#include <cstdint>
+
+namespace figkey {
+
+// decoded_packet::flags
+constexpr uint32_t PKT_FLAG_VLAN = 1u << 0;             // At least one 802.1Q/802.1ad tag
+constexpr uint32_t PKT_FLAG_IPV4 = 1u << 1;
+constexpr uint32_t PKT_FLAG_IPV6 = 1u << 2;
+constexpr uint32_t PKT_FLAG_IP_OPTIONS = 1u << 3;       // IPv4 options or IPv6 extension headers present
+constexpr uint32_t PKT_FLAG_FRAGMENT = 1u << 4;         // Part of a fragmented datagram
+constexpr uint32_t PKT_FLAG_MORE_FRAGMENTS = 1u << 5;
+constexpr uint32_t PKT_FLAG_TRANSPORT = 1u << 6;        // Transport header decoded (first fragment or unfragmented)
+constexpr uint32_t PKT_FLAG_TRUNCATED = 1u << 7;        // caplen ends before the end of the IP datagram
+constexpr uint32_t PKT_FLAG_DONT_FRAGMENT = 1u << 8;
+constexpr uint32_t PKT_FLAG_BAD_IP_CHECKSUM = 1u << 9;   // Set by Checksum::verify, never by the decoder
+constexpr uint32_t PKT_FLAG_BAD_L4_CHECKSUM = 1u << 10;
+
+// Outcome of a decode, the packet struct holds whatever was decoded before the problem
+enum class DecodeStatus : uint8_t {
+    OK,                 // Decoded as far as the protocols are known
+    NOT_IP,             // Valid link layer carrying something other than IPv4/IPv6
+    UNSUPPORTED_LINK,   // Link type the decoder does not know
+    TRUNCATED,          // A header is cut off by caplen
+    MALFORMED           // A header contradicts itself, e.g. IPv4 total length below the header length
+};
+
+// Decoded fields of one packet. Offsets are from the start of the captured data, multi-byte fields are in
+// host byte order except the addresses, which stay in network byte order
+struct decoded_packet {
+    uint16_t l3_offset;         // IP header
+    uint16_t l4_offset;         // Transport header, 0 if not decoded
+    uint16_t payload_offset;    // Transport payload, 0 if not decoded
+    uint16_t payload_length;    // Transport payload bytes present in the capture, Ethernet padding excluded
+    uint16_t ether_type;        // Type of the L3 header after any VLAN tags
+    uint16_t vlan_id[2];        // Outer and inner VLAN id
+    uint8_t vlan_count;         // Number of tags seen, only the first two ids are kept
+    uint8_t ip_version;         // 4 or 6, 0 when not IP
+    uint8_t protocol;           // Transport protocol, after IPv6 extension headers
+    uint8_t ttl;                // TTL or hop limit
+    uint16_t ip_length;         // Datagram length from the IP header
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t fragment_offset;   // In bytes
+    uint32_t fragment_id;       // IPv4 identification or IPv6 fragment header id
+    uint8_t tcp_flags;
+    uint8_t icmp_type;
+    uint8_t icmp_code;
+    uint16_t tcp_window;
+    uint32_t tcp_seq;
+    uint32_t tcp_ack;
+    uint32_t flags;             // PKT_FLAG_*
+    uint8_t src_addr[16];       // IPv4 uses the first 4 bytes
+    uint8_t dst_addr[16];
+};
+
+class PacketDecoder {
+public:
+    // Decodes caplen bytes of a packet captured with link type link_type (DLT_* or LINKTYPE_* value)
+    static DecodeStatus decode(int link_type, const unsigned char* data, uint32_t caplen, decoded_packet& packet);
+
+    // Decodes a bare IPv4 or IPv6 datagram, e.g. one put back together from fragments
+    static DecodeStatus decodeIp(const unsigned char* data, uint32_t caplen, decoded_packet& packet);
+
+    static const char* statusName(DecodeStatus status);
+
+    // Finds the network layer behind the link header of every link type decode supports: its offset and the
+    // EtherType it carries (0 for an unknown address family). VLAN tags are skipped and, with packet, recorded
+    static DecodeStatus linkLayer(int link_type, const unsigned char* data, uint32_t caplen, uint32_t& offset,
+                                  uint16_t& ether_type, decoded_packet* packet = nullptr);
+
+private:
+    static DecodeStatus decodeIpv4(const unsigned char* data, uint32_t caplen, uint32_t offset, decoded_packet& packet);
+    static DecodeStatus decodeIpv6(const unsigned char* data, uint32_t caplen, uint32_t offset, decoded_packet& packet);
+    static DecodeStatus decodeTransport(const unsigned char* data, uint32_t end, uint32_t offset, decoded_packet& packet);
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_PACKET_DECODER_HPP
@@ -0,0 +1,134 @@
+﻿/**
+ * @file    packet_ring.h
+ * @ingroup figkey
+ * @brief   Single-producer single-consumer packet ring between the capture thread and one worker.
+ *          All slots are preallocated in one slab; the producer copies a packet into the next slot with a
+ *          single memcpy, the consumer reads the slots in place and releases them once processed. When the
+ *          ring is full the packet is dropped and counted instead of stalling the capture thread.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_PACKET_RING_HPP
+#define FIGKEY_PACKET_RING_HPP
+
+#include <pcap.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include "packet_batch.h"
+
+namespace figkey {
+
+class PacketRing {
+public:
+    // slot_count is rounded up to a power of two, packets longer than slot_size are truncated
+    PacketRing(size_t slot_count, size_t slot_size)
+            : slotSize(static_cast<uint32_t>(slot_size)) {
+        slotCount = 1;
+        while (slotCount < slot_count) {
+            slotCount <<= 1;
+        }
+        mask = slotCount - 1;
+        stride = (DATA_OFFSET + slot_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+        slab = static_cast<unsigned char*>(::operator new(slotCount * stride, std::align_val_t(CACHE_LINE)));
+    }
+
+    ~PacketRing() {
+        ::operator delete(slab, std::align_val_t(CACHE_LINE));
+    }
+
+    PacketRing(const PacketRing&) = delete;
+    PacketRing& operator=(const PacketRing&) = delete;
+
+    // Producer: copies the packet into the next free slot, returns false and counts a drop if the ring is full
+    bool push(const struct pcap_pkthdr& header, const unsigned char* data) {
+        uint64_t head = headPos.load(std::memory_order_relaxed);
+        if (head - cachedTail >= slotCount) {
+            cachedTail = tailPos.load(std::memory_order_acquire);
+            if (head - cachedTail >= slotCount) {
+                droppedCount.store(droppedCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        unsigned char* slot = slab + (head & mask) * stride;
+        auto* slotHeader = reinterpret_cast<struct pcap_pkthdr*>(slot);
+        *slotHeader = header;
+        if (header.caplen > slotSize) {
+            slotHeader->caplen = slotSize;
+            truncatedCount.store(truncatedCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        std::memcpy(slot + DATA_OFFSET, data, slotHeader->caplen);
+        headPos.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer: true if the next push finds a free slot
+    bool writable() {
+        uint64_t head = headPos.load(std::memory_order_relaxed);
+        if (head - cachedTail >= slotCount) {
+            cachedTail = tailPos.load(std::memory_order_acquire);
+        }
+        return head - cachedTail < slotCount;
+    }
+
+    // Consumer: adds up to max ready packets to batch by reference. The slots stay owned by the consumer until
+    // release() is called, peek again only after releasing
+    size_t peek(PacketBatch& batch, size_t max) {
+        uint64_t tail = tailPos.load(std::memory_order_relaxed);
+        if (cachedHead - tail < max) {
+            cachedHead = headPos.load(std::memory_order_acquire);
+        }
+        size_t available = static_cast<size_t>(cachedHead - tail);
+        size_t room = batch.capacity() - batch.size();
+        size_t count = available < max ? available : max;
+        count = count < room ? count : room;
+        for (size_t i = 0; i < count; ++i) {
+            const unsigned char* slot = slab + ((tail + i) & mask) * stride;
+            batch.add(*reinterpret_cast<const struct pcap_pkthdr*>(slot), slot + DATA_OFFSET);
+        }
+        return count;
+    }
+
+    // Consumer: gives the oldest count slots back to the producer
+    void release(size_t count) {
+        tailPos.store(tailPos.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    bool empty() const {
+        return headPos.load(std::memory_order_acquire) == tailPos.load(std::memory_order_acquire);
+    }
+
+    uint64_t pushed() const { return headPos.load(std::memory_order_relaxed); }
+    uint64_t consumed() const { return tailPos.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return droppedCount.load(std::memory_order_relaxed); }
+    uint64_t truncated() const { return truncatedCount.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+    static constexpr size_t DATA_OFFSET = (sizeof(struct pcap_pkthdr) + 15) / 16 * 16;
+
+    unsigned char* slab;
+    size_t slotCount;
+    size_t mask;
+    size_t stride;
+    uint32_t slotSize;
+
+    // Producer side, cachedTail saves reading the consumer's cache line for every packet
+    alignas(CACHE_LINE) std::atomic<uint64_t> headPos{0};
+    uint64_t cachedTail{0};
+    std::atomic<uint64_t> droppedCount{0};
+    std::atomic<uint64_t> truncatedCount{0};
+
+    // Consumer side
+    alignas(CACHE_LINE) std::atomic<uint64_t> tailPos{0};
+    uint64_t cachedHead{0};
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_PACKET_RING_HPP
@@ -0,0 +1,492 @@
+// payload_match.cpp: 多模式载荷匹配
+//
+
+#include "payload_match.h"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define FIGKEY_MATCH_X86
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FIGKEY_TARGET_SSSE3
+#define FIGKEY_TARGET_AVX2
+#else
+#define FIGKEY_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define FIGKEY_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace figkey {
+
+namespace {
+
+const size_t SAMPLE_POSITIONS = 65536;     // Random byte triples tried to estimate the prefilter pass rate
+const double MAX_PASS_RATE = 0.3;           // Above this the prefilter costs more than it skips
+const size_t DENSE_RUN = 16;                // A prefilter call that skips less than this finds candidates dense
+const size_t DENSE_PAUSE = 64;              // Bytes scanned without the prefilter after that
+
+inline unsigned LowestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+uint64_t SplitMix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+#ifdef FIGKEY_MATCH_X86
+bool CpuHas(int feature) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int leaves = info[0];
+    __cpuid(info, 1);
+    if (feature == 1) {
+        return (info[2] & (1 << 9)) != 0;       // SSSE3
+    }
+    bool osSaves = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    if (leaves < 7 || !osSaves) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;           // AVX2
+#else
+    __builtin_cpu_init();
+    return feature == 1 ? __builtin_cpu_supports("ssse3") != 0 : __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+// Bit i set when position i of the 16 bytes at data passes, all 3 bytes checked with nibble shuffles
+FIGKEY_TARGET_SSSE3
+uint32_t CandidatesSsse3(const unsigned char* data, const uint8_t (*low)[32], const uint8_t (*high)[32]) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i result = _mm_set1_epi8(-1);
+    for (int j = 0; j < 3; ++j) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + j));
+        __m128i lo = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(low[j])),
+                                      _mm_and_si128(v, nibble));
+        __m128i hi = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(high[j])),
+                                      _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        result = _mm_and_si128(result, _mm_and_si128(lo, hi));
+    }
+    return ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(result, _mm_setzero_si128()))) & 0xFFFF;
+}
+
+// The same for 32 positions; shuffles stay within 128-bit lanes, hence the tables repeated in both halves
+FIGKEY_TARGET_AVX2
+uint32_t CandidatesAvx2(const unsigned char* data, const uint8_t (*low)[32], const uint8_t (*high)[32]) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i result = _mm256_set1_epi8(-1);
+    for (int j = 0; j < 3; ++j) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + j));
+        __m256i lo = _mm256_shuffle_epi8(_mm256_load_si256(reinterpret_cast<const __m256i*>(low[j])),
+                                         _mm256_and_si256(v, nibble));
+        __m256i hi = _mm256_shuffle_epi8(_mm256_load_si256(reinterpret_cast<const __m256i*>(high[j])),
+                                         _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        result = _mm256_and_si256(result, _mm256_and_si256(lo, hi));
+    }
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(result, _mm256_setzero_si256())));
+}
+#endif
+
+PrefilterKind BestPrefilter() {
+#ifdef FIGKEY_MATCH_X86
+    if (CpuHas(2)) {
+        return PrefilterKind::AVX2;
+    }
+    if (CpuHas(1)) {
+        return PrefilterKind::SSSE3;
+    }
+#endif
+    return PrefilterKind::SCALAR;
+}
+
+// Passes matches of one scan on with the flow they were found in
+class FlowMatchCallback : public MatchCallback {
+public:
+    FlowMatchCallback(PayloadMatchHandler* match_handler, const flow_record& flow_record, int flow_direction)
+            : handler(match_handler), flow(flow_record), direction(flow_direction) {}
+
+    void onMatch(uint32_t pattern, uint64_t end) override {
+        handler->onMatch(flow, direction, pattern, end);
+    }
+
+private:
+    PayloadMatchHandler* handler;
+    const flow_record& flow;
+    int direction;
+};
+
+}  // namespace
+
+void PayloadMatcher::add(const unsigned char* pattern, size_t length, uint32_t id) {
+    if (length == 0) {
+        return;
+    }
+    pending.emplace_back(pattern, pattern + length);
+    pendingIds.push_back(id);
+}
+
+void PayloadMatcher::add(const std::string& pattern, uint32_t id) {
+    add(reinterpret_cast<const unsigned char*>(pattern.data()), pattern.size(), id);
+}
+
+bool PayloadMatcher::compile(bool use_prefilter) {
+    if (pending.empty()) {
+        return false;
+    }
+
+    // Trie with sorted child lists, node 0 the root
+    struct trie_node {
+        std::vector<std::pair<uint8_t, uint32_t>> children;
+        std::vector<uint32_t> ids;
+    };
+    std::vector<trie_node> trie(1);
+    typedef std::pair<uint8_t, uint32_t> edge;
+    for (size_t p = 0; p < pending.size(); ++p) {
+        uint32_t current = 0;
+        for (uint8_t byte : pending[p]) {
+            auto& children = trie[current].children;
+            auto it = std::lower_bound(children.begin(), children.end(), edge(byte, 0),
+                                       [](const edge& a, const edge& b) { return a.first < b.first; });
+            if (it != children.end() && it->first == byte) {
+                current = it->second;
+                continue;
+            }
+            uint32_t created = static_cast<uint32_t>(trie.size());
+            children.insert(it, std::make_pair(byte, created));
+            trie.push_back(trie_node());
+            current = created;
+        }
+        trie[current].ids.push_back(pendingIds[p]);
+    }
+
+    // Breadth-first numbering, so the shallow states that almost every byte visits are adjacent
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> renumber(trie.size());
+    order.reserve(trie.size());
+    order.push_back(0);
+    for (size_t i = 0; i < order.size(); ++i) {
+        renumber[order[i]] = static_cast<uint32_t>(i);
+        for (const auto& child : trie[order[i]].children) {
+            order.push_back(child.second);
+        }
+    }
+
+    nodes.assign(trie.size(), node());
+    edgeBytes.clear();
+    edgeTargets.clear();
+    denseRows.clear();
+    outputIds.clear();
+    for (size_t i = 0; i < order.size(); ++i) {
+        const trie_node& source = trie[order[i]];
+        node& target = nodes[i];
+        target.edges = static_cast<uint32_t>(edgeBytes.size());
+        target.edgeCount = static_cast<uint32_t>(source.children.size());
+        target.dense = 0;
+        target.fail = 0;
+        for (const auto& child : source.children) {
+            edgeBytes.push_back(child.first);
+            edgeTargets.push_back(renumber[child.second]);
+        }
+    }
+
+    // Failure links and outputs in breadth-first order: a state's failure target is shallower, so it is
+    // complete when the state is reached
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        node& current = nodes[i];
+        if (i != 0) {
+            // Own patterns, then those of the failure target, which are suffixes ending here as well
+            std::vector<uint32_t> ids = trie[order[i]].ids;
+            const node& fail = nodes[current.fail];
+            auto inherited = outputIds.begin() + fail.outputs;
+            ids.insert(ids.end(), inherited, inherited + fail.outputCount);
+            current.outputs = static_cast<uint32_t>(outputIds.size());
+            outputIds.insert(outputIds.end(), ids.begin(), ids.end());
+            current.outputCount = static_cast<uint32_t>(outputIds.size() - current.outputs);
+        }
+        else {
+            current.outputs = 0;
+            current.outputCount = 0;
+        }
+        for (uint32_t k = 0; k < current.edgeCount; ++k) {
+            uint8_t byte = edgeBytes[current.edges + k];
+            uint32_t childIndex = edgeTargets[current.edges + k];
+            uint32_t fail = 0;
+            if (i != 0) {
+                uint32_t f = current.fail;
+                while (true) {
+                    uint32_t next = child(f, byte);
+                    if (next != NONE) {
+                        fail = next;
+                        break;
+                    }
+                    if (f == 0) {
+                        break;
+                    }
+                    f = nodes[f].fail;
+                }
+            }
+            nodes[childIndex].fail = fail;
+        }
+    }
+
+    // Dense rows hold the complete transition, failure links already followed, so a dense state never falls
+    // back. Built in breadth-first order, shallower rows are ready when deeper ones look into them
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (i != 0 && nodes[i].edgeCount <= DENSE_EDGES) {
+            continue;
+        }
+        size_t row = denseRows.size();
+        denseRows.resize(row + 256);
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            uint32_t next = child(static_cast<uint32_t>(i), static_cast<uint8_t>(byte));
+            if (next == NONE) {
+                next = i == 0 ? 0 : step(nodes[i].fail, static_cast<uint8_t>(byte));
+            }
+            denseRows[row + byte] = next;
+        }
+        nodes[i].dense = static_cast<uint32_t>(row / 256 + 1);
+    }
+
+    patternCount = pending.size();
+    prefilterKind = PrefilterKind::NONE;
+    passRate = 1.0;
+    if (use_prefilter) {
+        buildPrefilter(pending);
+    }
+    pending.clear();
+    pending.shrink_to_fit();
+    pendingIds.clear();
+    pendingIds.shrink_to_fit();
+    return true;
+}
+
+void PayloadMatcher::buildPrefilter(const std::vector<std::vector<unsigned char>>& patterns) {
+    std::memset(nibbleLow, 0, sizeof(nibbleLow));
+    std::memset(nibbleHigh, 0, sizeof(nibbleHigh));
+    for (const auto& pattern : patterns) {
+        // Bucket by the low bits of the first byte, so a bucket's first-byte low nibbles stay few
+        uint8_t bit = static_cast<uint8_t>(1u << (pattern[0] & 7));
+        for (size_t j = 0; j < 3; ++j) {
+            if (j < pattern.size()) {
+                nibbleLow[j][pattern[j] & 0x0F] |= bit;
+                nibbleHigh[j][pattern[j] >> 4] |= bit;
+            }
+            else {
+                // Shorter patterns match whatever follows them
+                for (int n = 0; n < 16; ++n) {
+                    nibbleLow[j][n] |= bit;
+                    nibbleHigh[j][n] |= bit;
+                }
+            }
+        }
+    }
+    for (size_t j = 0; j < 3; ++j) {
+        std::memcpy(nibbleLow[j] + 16, nibbleLow[j], 16);
+        std::memcpy(nibbleHigh[j] + 16, nibbleHigh[j], 16);
+        for (int byte = 0; byte < 256; ++byte) {
+            byteMasks[j][byte] = nibbleLow[j][byte & 0x0F] & nibbleHigh[j][byte >> 4];
+        }
+    }
+
+    size_t passed = 0;
+    for (size_t i = 0; i < SAMPLE_POSITIONS; ++i) {
+        uint64_t r = SplitMix(i);
+        passed += (byteMasks[0][r & 0xFF] & byteMasks[1][(r >> 8) & 0xFF] & byteMasks[2][(r >> 16) & 0xFF]) != 0;
+    }
+    passRate = static_cast<double>(passed) / SAMPLE_POSITIONS;
+    prefilterKind = passRate <= MAX_PASS_RATE ? BestPrefilter() : PrefilterKind::NONE;
+}
+
+uint32_t PayloadMatcher::child(uint32_t state, uint8_t byte) const {
+    const node& n = nodes[state];
+    const uint8_t* bytes = edgeBytes.data() + n.edges;
+    for (uint32_t k = 0; k < n.edgeCount; ++k) {
+        if (bytes[k] == byte) {
+            return edgeTargets[n.edges + k];
+        }
+    }
+    return NONE;
+}
+
+uint32_t PayloadMatcher::step(uint32_t state, uint8_t byte) const {
+    while (true) {
+        const node& n = nodes[state];
+        if (n.dense != 0) {
+            return denseRows[(static_cast<size_t>(n.dense) - 1) * 256 + byte];
+        }
+        const uint8_t* bytes = edgeBytes.data() + n.edges;
+        for (uint32_t k = 0; k < n.edgeCount; ++k) {
+            if (bytes[k] == byte) {
+                return edgeTargets[n.edges + k];
+            }
+        }
+        state = n.fail;     // The root is dense, so this ends
+    }
+}
+
+size_t PayloadMatcher::nextCandidate(const unsigned char* data, size_t position, size_t length) const {
+    if (length < position + 3) {
+        return position;
+    }
+    size_t p = position;
+#ifdef FIGKEY_MATCH_X86
+    if (prefilterKind == PrefilterKind::AVX2) {
+        for (; p + 34 <= length; p += 32) {
+            uint32_t candidates = CandidatesAvx2(data + p, nibbleLow, nibbleHigh);
+            if (candidates != 0) {
+                return p + LowestBit(candidates);
+            }
+        }
+    }
+    else if (prefilterKind == PrefilterKind::SSSE3) {
+        for (; p + 18 <= length; p += 16) {
+            uint32_t candidates = CandidatesSsse3(data + p, nibbleLow, nibbleHigh);
+            if (candidates != 0) {
+                return p + LowestBit(candidates);
+            }
+        }
+    }
+#endif
+    for (; p + 2 < length; ++p) {
+        if (byteMasks[0][data[p]] & byteMasks[1][data[p + 1]] & byteMasks[2][data[p + 2]]) {
+            return p;
+        }
+    }
+    return p;
+}
+
+size_t PayloadMatcher::scan(match_state& state, const unsigned char* data, size_t length,
+                            MatchCallback* callback) const {
+    if (nodes.empty()) {
+        return 0;
+    }
+    size_t matches = 0;
+    uint32_t current = state.node;
+    const uint32_t* root = denseRows.data();     // The root's row comes first
+    size_t skipFrom = prefilterKind != PrefilterKind::NONE ? 0 : length;    // Ask the prefilter only from here
+    size_t i = 0;
+    while (i < length) {
+        if (current == 0) {
+            // At the root no pattern is under way, nothing can match before the next candidate position
+            if (i >= skipFrom) {
+                size_t next = nextCandidate(data, i, length);
+                if (next - i < DENSE_RUN) {
+                    skipFrom = next + DENSE_PAUSE;
+                }
+                i = next;
+            }
+            current = root[data[i]];
+        }
+        else {
+            current = step(current, data[i]);
+        }
+        const node& n = nodes[current];
+        if (n.outputCount != 0) {
+            matches += n.outputCount;
+            if (callback) {
+                for (uint32_t k = 0; k < n.outputCount; ++k) {
+                    callback->onMatch(outputIds[n.outputs + k], state.offset + i + 1);
+                }
+            }
+        }
+        ++i;
+    }
+    state.node = current;
+    state.offset += length;
+    return matches;
+}
+
+size_t PayloadMatcher::memory() const {
+    return sizeof(*this) + nodes.size() * sizeof(node) + edgeBytes.size() + edgeTargets.size() * sizeof(uint32_t) +
+           denseRows.size() * sizeof(uint32_t) + outputIds.size() * sizeof(uint32_t);
+}
+
+const char* PayloadMatcher::prefilterName(PrefilterKind kind) {
+    switch (kind) {
+    case PrefilterKind::NONE: return "none";
+    case PrefilterKind::SCALAR: return "scalar";
+    case PrefilterKind::SSSE3: return "SSSE3";
+    case PrefilterKind::AVX2: return "AVX2";
+    }
+    return "unknown";
+}
+
+PayloadScanner::stream_state* PayloadScanner::stateOf(tcp_stream& stream) {
+    auto* state = static_cast<stream_state*>(stream.user);
+    if (!state) {
+        state = new stream_state{match_state{0, stream.offset}, false, nullptr};
+        stream.user = state;
+    }
+    return state;
+}
+
+void PayloadScanner::onData(tcp_stream& stream, const unsigned char* data, size_t length) {
+    stream_state* state = stateOf(stream);
+    state->match.offset = stream.offset;
+    FlowMatchCallback callback(handler, *stream.flow, stream.direction);
+    size_t found = matcher.scan(state->match, data, length, handler ? &callback : nullptr);
+    stats.tcp_bytes += length;
+    if (found > 0) {
+        stats.matches += found;
+        if (!state->matched) {
+            state->matched = true;
+            ++stats.flows;
+        }
+    }
+    if (next) {
+        stream.user = state->nextUser;
+        next->onData(stream, data, length);
+        state->nextUser = stream.user;
+        stream.user = state;
+    }
+}
+
+void PayloadScanner::onGap(tcp_stream& stream, size_t length) {
+    // Whatever was under way across the lost bytes can't match any more
+    stream_state* state = stateOf(stream);
+    state->match.node = 0;
+    if (next) {
+        stream.user = state->nextUser;
+        next->onGap(stream, length);
+        state->nextUser = stream.user;
+        stream.user = state;
+    }
+}
+
+void PayloadScanner::onClose(tcp_stream& stream, StreamEnd reason) {
+    auto* state = static_cast<stream_state*>(stream.user);
+    if (next) {
+        stream.user = state ? state->nextUser : nullptr;
+        next->onClose(stream, reason);
+    }
+    delete state;
+    stream.user = nullptr;
+}
+
+void PayloadScanner::scanPacket(const flow_record& flow, int direction, const unsigned char* data, size_t length) {
+    match_state state{0, 0};
+    FlowMatchCallback callback(handler, flow, direction);
+    size_t found = matcher.scan(state, data, length, handler ? &callback : nullptr);
+    stats.udp_bytes += length;
+    if (found > 0) {
+        stats.matches += found;
+        ++stats.flows;
+    }
+}
+
+}  // namespace figkey
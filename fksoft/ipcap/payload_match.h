@@ -0,0 +1,181 @@
+/**
+ * @file    payload_match.h
+ * @ingroup figkey
+ * @brief   Multi-pattern payload matching: an Aho-Corasick automaton over a literal signature set, with a
+ *          Teddy-style SIMD prefilter.
+ *          The automaton is laid out for cache use. States are numbered breadth first, so the hot shallow states
+ *          sit together. Each state keeps its transitions as a short sorted byte list; the root and states with
+ *          many transitions get a dense 256-entry row instead. Failure links cover the rest, and every state
+ *          holds the flattened list of patterns ending there.
+ *
+ *          Most payload bytes leave the automaton at the root. From the root the scanner asks the prefilter for
+ *          the next position where a pattern could start and jumps there. Like Teddy (from Hyperscan), the
+ *          prefilter puts patterns into 8 buckets and keeps a nibble mask per bucket for the first 3 pattern
+ *          bytes. It tests 16 or 32 positions at once with SSSE3 or AVX2 byte shuffles, and falls back to scalar
+ *          lookups. A position passes only if some bucket matches all 3 bytes, and no pattern can start at the
+ *          positions skipped. Sets whose first bytes pass almost everything, e.g. thousands of random binary
+ *          signatures, turn the prefilter off at compile time.
+ *
+ *          A match_state carries the automaton state and stream offset between calls, so a pattern split over
+ *          TCP segments still matches. PayloadScanner plugs the matcher into TCP reassembly and UDP payloads and
+ *          reports matches per flow.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_PAYLOAD_MATCH_HPP
+#define FIGKEY_PAYLOAD_MATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "flow_table.h"
+#include "tcp_reassembly.h"
+
+namespace figkey {
+
+// Position of a scan, zero-initialized to start a stream
+struct match_state {
+    uint32_t node;      // Automaton state, 0 is the root
+    uint64_t offset;    // Stream bytes scanned before
+};
+
+// Receives the matches of PayloadMatcher::scan
+class MatchCallback {
+public:
+    virtual ~MatchCallback() = default;
+
+    // pattern ended just before stream offset end
+    virtual void onMatch(uint32_t pattern, uint64_t end) = 0;
+};
+
+enum class PrefilterKind : uint8_t {
+    NONE,       // Not compiled, or switched off because it would pass nearly every position
+    SCALAR,
+    SSSE3,
+    AVX2
+};
+
+class PayloadMatcher {
+public:
+    PayloadMatcher() = default;
+
+    PayloadMatcher(const PayloadMatcher&) = delete;
+    PayloadMatcher& operator=(const PayloadMatcher&) = delete;
+
+    // Adds a literal to find, reported as id. Empty patterns are ignored. Call before compile
+    void add(const unsigned char* pattern, size_t length, uint32_t id);
+    void add(const std::string& pattern, uint32_t id);
+
+    // Builds the automaton, and the prefilter unless use_prefilter is off. Returns false without patterns.
+    // A compiled matcher is read only, one instance can serve any number of threads
+    bool compile(bool use_prefilter = true);
+
+    // Scans length bytes continuing from state and calls callback (may be nullptr) for every match, returns
+    // the number of matches
+    size_t scan(match_state& state, const unsigned char* data, size_t length, MatchCallback* callback) const;
+
+    size_t patterns() const { return patternCount; }
+    size_t states() const { return nodes.size(); }
+    size_t memory() const;                  // Bytes used by the compiled automaton and prefilter
+    PrefilterKind prefilter() const { return prefilterKind; }
+    double prefilterPassRate() const { return passRate; }  // Share of random positions the prefilter lets through
+
+    static const char* prefilterName(PrefilterKind kind);
+
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+    static constexpr uint32_t DENSE_EDGES = 12;    // States with more transitions get a dense row
+
+    struct node {
+        uint32_t edges;         // First transition in edgeBytes/edgeTargets
+        uint32_t edgeCount;
+        uint32_t dense;         // Row in denseRows plus one, 0 for none
+        uint32_t fail;
+        uint32_t outputs;       // First pattern id in outputIds
+        uint32_t outputCount;
+    };
+
+    // Patterns as added, dropped by compile
+    std::vector<std::vector<unsigned char>> pending;
+    std::vector<uint32_t> pendingIds;
+    size_t patternCount{0};
+
+    std::vector<node> nodes;
+    std::vector<uint8_t> edgeBytes;
+    std::vector<uint32_t> edgeTargets;
+    std::vector<uint32_t> denseRows;
+    std::vector<uint32_t> outputIds;
+
+    PrefilterKind prefilterKind{PrefilterKind::NONE};
+    double passRate{1.0};
+    alignas(32) uint8_t nibbleLow[3][32] = {};     // Bucket masks by low and high nibble per pattern byte, the
+    alignas(32) uint8_t nibbleHigh[3][32] = {};    // 16 entries repeated for 256-bit shuffles
+    uint8_t byteMasks[3][256] = {};                // The same per whole byte, for the scalar prefilter
+
+    uint32_t step(uint32_t state, uint8_t byte) const;
+    uint32_t child(uint32_t state, uint8_t byte) const;   // Transition without failure links, NONE if absent
+
+    // First position in [position, length - 2) where a pattern could start, length - 2 (or position) if none
+    size_t nextCandidate(const unsigned char* data, size_t position, size_t length) const;
+
+    void buildPrefilter(const std::vector<std::vector<unsigned char>>& patterns);
+};
+
+// Receives the matches found by PayloadScanner. Called on the thread that tracks the flow
+class PayloadMatchHandler {
+public:
+    virtual ~PayloadMatchHandler() = default;
+
+    // pattern ended before stream offset end of the direction of flow (0 for data sent by endpoint a). For UDP
+    // the offset counts from the start of the datagram's payload
+    virtual void onMatch(const flow_record& flow, int direction, uint32_t pattern, uint64_t end) = 0;
+};
+
+struct payload_match_stats {
+    uint64_t tcp_bytes;     // Reassembled stream bytes scanned
+    uint64_t udp_bytes;     // UDP payload bytes scanned
+    uint64_t matches;
+    uint64_t flows;         // Stream directions and datagrams with at least one match
+};
+
+// Scans the TCP streams it is the stream handler of and the UDP payloads passed to scanPacket, then hands
+// stream data on to next (may be nullptr). Saves the match state in tcp_stream::user, the next handler still
+// sees its own user pointer there
+class PayloadScanner : public TcpStreamHandler {
+public:
+    PayloadScanner(const PayloadMatcher& payload_matcher, PayloadMatchHandler* match_handler,
+                   TcpStreamHandler* next_handler = nullptr)
+            : matcher(payload_matcher), handler(match_handler), next(next_handler) {}
+
+    void onData(tcp_stream& stream, const unsigned char* data, size_t length) override;
+    void onGap(tcp_stream& stream, size_t length) override;
+    void onClose(tcp_stream& stream, StreamEnd reason) override;
+
+    // Scans one UDP payload on its own
+    void scanPacket(const flow_record& flow, int direction, const unsigned char* data, size_t length);
+
+    payload_match_stats getStats() const { return stats; }
+
+private:
+    struct stream_state {
+        match_state match;
+        bool matched;
+        void* nextUser;
+    };
+
+    const PayloadMatcher& matcher;
+    PayloadMatchHandler* handler;
+    TcpStreamHandler* next;
+    payload_match_stats stats{};
+
+    stream_state* stateOf(tcp_stream& stream);
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_PAYLOAD_MATCH_HPP
@@ -0,0 +1,353 @@
+// pcap_file.cpp: pcap/pcapng 文件读取
+//
+#include "pcap_file.h"
+#include <cstring>
+
+namespace figkey {
+
+namespace {
+
+constexpr size_t READ_CHUNK_SIZE = 4 * 1024 * 1024;
+constexpr uint32_t MAX_BLOCK_SIZE = 256 * 1024 * 1024;
+constexpr uint64_t NANOS_PER_SECOND = 1000000000ULL;
+
+inline uint16_t swap16(uint16_t v) {
+    return static_cast<uint16_t>((v >> 8) | (v << 8));
+}
+
+inline uint32_t swap32(uint32_t v) {
+    return ((v >> 24) & 0xFF) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+}
+
+template<typename T>
+inline T load(const unsigned char* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Converts a timestamp in units_per_second to nanoseconds without overflowing for large values
+inline uint64_t toNanoseconds(uint64_t ts, uint64_t units_per_second) {
+    if (units_per_second == NANOS_PER_SECOND) {
+        return ts;
+    }
+    return (ts / units_per_second) * NANOS_PER_SECOND + (ts % units_per_second) * NANOS_PER_SECOND / units_per_second;
+}
+
+}  // namespace
+
+PcapFileReader::~PcapFileReader() {
+    close();
+}
+
+bool PcapFileReader::open(const std::string& path) {
+    close();
+    file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+    buffer.resize(READ_CHUNK_SIZE);
+    bufferBegin = bufferEnd = 0;
+
+    if (!fill(4)) {
+        error = "empty file " + path;
+        close();
+        return false;
+    }
+    uint32_t magic = load<uint32_t>(&buffer[bufferBegin]);
+    bool ok;
+    if (magic == PCAPNG_BLOCK_SHB) {
+        pcapng = true;
+        ok = readSectionHeader();
+    }
+    else {
+        pcapng = false;
+        ok = readPcapHeader();
+    }
+    if (!ok) {
+        close();
+    }
+    return ok;
+}
+
+void PcapFileReader::close() {
+    if (file) {
+        std::fclose(file);
+        file = nullptr;
+    }
+    interfaces.clear();
+    bufferBegin = bufferEnd = 0;
+}
+
+int PcapFileReader::next(file_packet& packet) {
+    if (!file) {
+        return -1;
+    }
+    return pcapng ? nextPcapng(packet) : nextPcap(packet);
+}
+
+int PcapFileReader::linkType() const {
+    if (pcapng) {
+        return interfaces.empty() ? DLT_EN10MB : interfaces.front().link_type;
+    }
+    return pcapLinkType;
+}
+
+uint16_t PcapFileReader::fix16(uint16_t v) const {
+    return swapped ? swap16(v) : v;
+}
+
+uint32_t PcapFileReader::fix32(uint32_t v) const {
+    return swapped ? swap32(v) : v;
+}
+
+bool PcapFileReader::fill(size_t size) {
+    if (bufferEnd - bufferBegin >= size) {
+        return true;
+    }
+    // Move the unread tail to the front and read a whole chunk behind it
+    size_t remaining = bufferEnd - bufferBegin;
+    if (bufferBegin > 0) {
+        std::memmove(buffer.data(), buffer.data() + bufferBegin, remaining);
+    }
+    bufferBegin = 0;
+    bufferEnd = remaining;
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
+    while (bufferEnd < size) {
+        size_t n = std::fread(buffer.data() + bufferEnd, 1, buffer.size() - bufferEnd, file);
+        if (n == 0) {
+            return false;
+        }
+        bufferEnd += n;
+    }
+    return true;
+}
+
+bool PcapFileReader::readPcapHeader() {
+    if (!fill(24)) {
+        error = "truncated pcap file header";
+        return false;
+    }
+    const unsigned char* p = &buffer[bufferBegin];
+    uint32_t magic = load<uint32_t>(p);
+    if (magic == PCAP_MAGIC_MICRO || magic == PCAP_MAGIC_NANO) {
+        swapped = false;
+    }
+    else if (swap32(magic) == PCAP_MAGIC_MICRO || swap32(magic) == PCAP_MAGIC_NANO) {
+        swapped = true;
+        magic = swap32(magic);
+    }
+    else {
+        error = "not a pcap or pcapng file";
+        return false;
+    }
+    pcapUnitsPerSecond = magic == PCAP_MAGIC_NANO ? NANOS_PER_SECOND : 1000000;
+    // The upper 16 bits of the link type field carry FCS information
+    pcapLinkType = static_cast<int>(fix32(load<uint32_t>(p + 20)) & 0xFFFF);
+    bufferBegin += 24;
+    return true;
+}
+
+bool PcapFileReader::readSectionHeader() {
+    if (!fill(12)) {
+        error = "truncated pcapng section header";
+        return false;
+    }
+    const unsigned char* p = &buffer[bufferBegin];
+    uint32_t order = load<uint32_t>(p + 8);
+    if (order == PCAPNG_BYTE_ORDER_MAGIC) {
+        swapped = false;
+    }
+    else if (swap32(order) == PCAPNG_BYTE_ORDER_MAGIC) {
+        swapped = true;
+    }
+    else {
+        error = "bad pcapng byte order magic";
+        return false;
+    }
+    uint32_t length = fix32(load<uint32_t>(p + 4));
+    if (length < 28 || length > MAX_BLOCK_SIZE || !fill(length)) {
+        error = "truncated pcapng section header";
+        return false;
+    }
+    // Interface ids are per section
+    interfaces.clear();
+    bufferBegin += length;
+    return true;
+}
+
+int PcapFileReader::nextPcap(file_packet& packet) {
+    if (!fill(16)) {
+        return 0;
+    }
+    const unsigned char* p = &buffer[bufferBegin];
+    uint32_t sec = fix32(load<uint32_t>(p));
+    uint32_t frac = fix32(load<uint32_t>(p + 4));
+    uint32_t caplen = fix32(load<uint32_t>(p + 8));
+    uint32_t len = fix32(load<uint32_t>(p + 12));
+    if (caplen > MAX_BLOCK_SIZE) {
+        return fail("bad pcap record length");
+    }
+    if (!fill(16 + static_cast<size_t>(caplen))) {
+        return 0;  // A truncated last record is treated as end of file, like libpcap does for short reads
+    }
+    p = &buffer[bufferBegin];
+    uint64_t ts = static_cast<uint64_t>(sec) * pcapUnitsPerSecond + frac;
+    bufferBegin += 16 + static_cast<size_t>(caplen);
+    setPacket(packet, 0, toNanoseconds(ts, pcapUnitsPerSecond), caplen, len, p + 16);
+    return 1;
+}
+
+int PcapFileReader::nextPcapng(file_packet& packet) {
+    while (true) {
+        if (!fill(12)) {
+            return 0;
+        }
+        const unsigned char* p = &buffer[bufferBegin];
+        uint32_t type = load<uint32_t>(p);
+        if (type == PCAPNG_BLOCK_SHB) {
+            // A new section may switch byte order
+            if (!readSectionHeader()) {
+                return fail(error);
+            }
+            continue;
+        }
+        type = fix32(type);
+        uint32_t length = fix32(load<uint32_t>(p + 4));
+        if (length < 12 || (length & 3) != 0 || length > MAX_BLOCK_SIZE) {
+            return fail("bad pcapng block length");
+        }
+        if (!fill(length)) {
+            return 0;
+        }
+        p = &buffer[bufferBegin];
+        const unsigned char* body = p + 8;
+        size_t bodyLength = length - 12;
+        bufferBegin += length;
+
+        switch (type) {
+        case PCAPNG_BLOCK_IDB:
+            parseInterface(body, bodyLength);
+            break;
+        case PCAPNG_BLOCK_EPB: {
+            if (bodyLength < 20) {
+                return fail("truncated enhanced packet block");
+            }
+            uint32_t id = fix32(load<uint32_t>(body));
+            uint64_t ts = (static_cast<uint64_t>(fix32(load<uint32_t>(body + 4))) << 32) | fix32(load<uint32_t>(body + 8));
+            uint32_t caplen = fix32(load<uint32_t>(body + 12));
+            uint32_t len = fix32(load<uint32_t>(body + 16));
+            if (caplen > bodyLength - 20) {
+                return fail("enhanced packet block data exceeds block");
+            }
+            if (!setPacket(packet, id, ts, caplen, len, body + 20)) {
+                return fail("packet references unknown interface");
+            }
+            return 1;
+        }
+        case PCAPNG_BLOCK_SPB: {
+            if (bodyLength < 4 || interfaces.empty()) {
+                return fail("bad simple packet block");
+            }
+            uint32_t len = fix32(load<uint32_t>(body));
+            uint32_t caplen = len;
+            if (interfaces[0].snaplen != 0 && caplen > interfaces[0].snaplen) {
+                caplen = interfaces[0].snaplen;
+            }
+            if (caplen > bodyLength - 4) {
+                caplen = static_cast<uint32_t>(bodyLength - 4);
+            }
+            // Simple packet blocks carry no timestamp
+            setPacket(packet, 0, 0, caplen, len, body + 4);
+            return 1;
+        }
+        case PCAPNG_BLOCK_PB: {
+            if (bodyLength < 20) {
+                return fail("truncated packet block");
+            }
+            uint32_t id = fix16(load<uint16_t>(body));
+            uint64_t ts = (static_cast<uint64_t>(fix32(load<uint32_t>(body + 4))) << 32) | fix32(load<uint32_t>(body + 8));
+            uint32_t caplen = fix32(load<uint32_t>(body + 12));
+            uint32_t len = fix32(load<uint32_t>(body + 16));
+            if (caplen > bodyLength - 20) {
+                return fail("packet block data exceeds block");
+            }
+            if (!setPacket(packet, id, ts, caplen, len, body + 20)) {
+                return fail("packet references unknown interface");
+            }
+            return 1;
+        }
+        default:
+            // Statistics, name resolution and custom blocks are not needed for replay
+            break;
+        }
+    }
+}
+
+void PcapFileReader::parseInterface(const unsigned char* body, size_t length) {
+    interface_info info{DLT_EN10MB, 0, 1000000};
+    if (length >= 8) {
+        info.link_type = fix16(load<uint16_t>(body));
+        info.snaplen = fix32(load<uint32_t>(body + 4));
+    }
+    // Walk the options for if_tsresol
+    size_t offset = 8;
+    while (offset + 4 <= length) {
+        uint16_t code = fix16(load<uint16_t>(body + offset));
+        uint16_t optionLength = fix16(load<uint16_t>(body + offset + 2));
+        if (code == PCAPNG_OPT_ENDOFOPT || offset + 4 + optionLength > length) {
+            break;
+        }
+        if (code == PCAPNG_OPT_IF_TSRESOL && optionLength >= 1) {
+            uint8_t resolution = body[offset + 4];
+            uint8_t exponent = resolution & 0x7F;
+            uint64_t units = 1;
+            if (resolution & 0x80) {
+                units = exponent < 64 ? (1ULL << exponent) : 0;
+            }
+            else {
+                for (uint8_t i = 0; i < exponent && units <= UINT64_MAX / 10; ++i) {
+                    units *= 10;
+                }
+            }
+            if (units > 0) {
+                info.units_per_second = units;
+            }
+        }
+        offset += 4 + ((optionLength + 3u) & ~3u);
+    }
+    interfaces.push_back(info);
+}
+
+bool PcapFileReader::setPacket(file_packet& packet, uint32_t interface_id, uint64_t timestamp, uint32_t caplen,
+                               uint32_t len, const unsigned char* data) {
+    if (pcapng) {
+        if (interface_id >= interfaces.size()) {
+            return false;
+        }
+        const interface_info& info = interfaces[interface_id];
+        packet.link_type = info.link_type;
+        packet.timestamp_ns = toNanoseconds(timestamp, info.units_per_second);
+    }
+    else {
+        packet.link_type = pcapLinkType;
+        packet.timestamp_ns = timestamp;
+    }
+    packet.interface_id = interface_id;
+    packet.header.ts.tv_sec = static_cast<decltype(packet.header.ts.tv_sec)>(packet.timestamp_ns / NANOS_PER_SECOND);
+    packet.header.ts.tv_usec = static_cast<decltype(packet.header.ts.tv_usec)>((packet.timestamp_ns % NANOS_PER_SECOND) / 1000);
+    packet.header.caplen = caplen;
+    packet.header.len = len;
+    packet.data = data;
+    return true;
+}
+
+int PcapFileReader::fail(const std::string& message) {
+    error = message;
+    return -1;
+}
+
+}  // namespace figkey
@@ -0,0 +1,108 @@
+/**
+ * @file    pcap_file.h
+ * @ingroup figkey
+ * @brief   Native reader for pcap and pcapng capture files, independent of libpcap.
+ *          Supports both byte orders, microsecond and nanosecond pcap files and pcapng
+ *          interface-specific link types and timestamp resolutions. Packets are returned
+ *          as pointers into a large read buffer, valid until the next call.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_PCAP_FILE_HPP
+#define FIGKEY_PCAP_FILE_HPP
+
+#include <pcap.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace figkey {
+
+// pcap file format constants
+constexpr uint32_t PCAP_MAGIC_MICRO = 0xA1B2C3D4;
+constexpr uint32_t PCAP_MAGIC_NANO = 0xA1B23C4D;
+constexpr uint32_t PCAPNG_BLOCK_SHB = 0x0A0D0D0A;
+constexpr uint32_t PCAPNG_BLOCK_IDB = 0x00000001;
+constexpr uint32_t PCAPNG_BLOCK_PB = 0x00000002;   // Obsolete packet block
+constexpr uint32_t PCAPNG_BLOCK_SPB = 0x00000003;
+constexpr uint32_t PCAPNG_BLOCK_ISB = 0x00000005;
+constexpr uint32_t PCAPNG_BLOCK_EPB = 0x00000006;
+constexpr uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+constexpr uint16_t PCAPNG_OPT_ENDOFOPT = 0;
+constexpr uint16_t PCAPNG_OPT_IF_TSRESOL = 9;
+
+// Packet as returned by PcapFileReader
+struct file_packet {
+    struct pcap_pkthdr header;   // Microsecond header, as libpcap hands it to callbacks
+    uint64_t timestamp_ns;       // Full resolution timestamp in nanoseconds since the epoch
+    uint32_t interface_id;       // pcapng interface index, 0 for pcap files
+    int link_type;               // DLT_* of the interface the packet was captured on
+    const unsigned char* data;   // caplen bytes, valid until the next call to next()
+};
+
+class PcapFileReader {
+public:
+    PcapFileReader() = default;
+    ~PcapFileReader();
+
+    PcapFileReader(const PcapFileReader&) = delete;
+    PcapFileReader& operator=(const PcapFileReader&) = delete;
+
+    // Opens a pcap or pcapng file, detected by its magic number
+    bool open(const std::string& path);
+
+    void close();
+
+    // Reads the next packet: returns 1 on success, 0 at end of file, -1 on a malformed file
+    int next(file_packet& packet);
+
+    // Link type of the first interface, DLT_EN10MB until an interface is known
+    int linkType() const;
+
+    bool isPcapng() const { return pcapng; }
+
+    const std::string& lastError() const { return error; }
+
+private:
+    // pcapng interface description
+    struct interface_info {
+        int link_type;
+        uint32_t snaplen;
+        uint64_t units_per_second;   // Timestamp resolution
+    };
+
+    FILE* file{nullptr};
+    bool pcapng{false};
+    bool swapped{false};                // File byte order differs from host byte order
+    uint64_t pcapUnitsPerSecond{1000000};
+    int pcapLinkType{1};
+    std::vector<interface_info> interfaces;
+    std::vector<unsigned char> buffer;  // Read buffer, refilled in large chunks
+    size_t bufferBegin{0};
+    size_t bufferEnd{0};
+    std::string error;
+
+    uint16_t fix16(uint16_t v) const;
+    uint32_t fix32(uint32_t v) const;
+
+    // Makes at least size bytes available at bufferBegin, returns false at end of file
+    bool fill(size_t size);
+
+    bool readPcapHeader();
+    bool readSectionHeader();
+    int nextPcap(file_packet& packet);
+    int nextPcapng(file_packet& packet);
+    void parseInterface(const unsigned char* body, size_t length);
+    bool setPacket(file_packet& packet, uint32_t interface_id, uint64_t timestamp, uint32_t caplen, uint32_t len,
+                   const unsigned char* data);
+    int fail(const std::string& message);
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_PCAP_FILE_HPP
@@ -0,0 +1,241 @@
+// record_file.cpp: 二进制包记录和会话记录
+//
+
+#include "record_file.h"
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+namespace figkey {
+
+namespace {
+
+const size_t SEGMENT_ALIGN = 64;
+
+static_assert(sizeof(record_file_header) == 16, "record_file_header must be 16 bytes");
+static_assert(sizeof(binary_packet_record) == 64, "binary_packet_record must be 64 bytes");
+static_assert(sizeof(binary_flow_record) == 96, "binary_flow_record must be 96 bytes");
+
+// Records are little-endian, on little-endian hosts these compile to nothing
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+inline uint16_t Little(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t Little(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t Little(uint64_t v) { return __builtin_bswap64(v); }
+inline int32_t Little(int32_t v) { return static_cast<int32_t>(__builtin_bswap32(static_cast<uint32_t>(v))); }
+#else
+inline uint16_t Little(uint16_t v) { return v; }
+inline uint32_t Little(uint32_t v) { return v; }
+inline uint64_t Little(uint64_t v) { return v; }
+inline int32_t Little(int32_t v) { return v; }
+#endif
+
+void ToHost(binary_packet_record& r) {
+    r.vlan_id = Little(r.vlan_id);
+    r.timestamp_ns = Little(r.timestamp_ns);
+    r.src_port = Little(r.src_port);
+    r.dst_port = Little(r.dst_port);
+    r.length = Little(r.length);
+    r.flags = Little(r.flags);
+    r.payload_length = Little(r.payload_length);
+    r.fragment_offset = Little(r.fragment_offset);
+}
+
+void ToHost(binary_flow_record& r) {
+    r.vlan_id = Little(r.vlan_id);
+    r.first_seen_ns = Little(r.first_seen_ns);
+    r.last_seen_ns = Little(r.last_seen_ns);
+    r.port_a = Little(r.port_a);
+    r.port_b = Little(r.port_b);
+    for (int i = 0; i < 2; ++i) {
+        r.packets[i] = Little(r.packets[i]);
+        r.bytes[i] = Little(r.bytes[i]);
+    }
+}
+
+}  // namespace
+
+RecordWriter::RecordWriter(size_t segment_size)
+        : segmentSize(segment_size >= sizeof(binary_flow_record) ? segment_size : DEFAULT_SEGMENT_SIZE) {
+    segment = static_cast<unsigned char*>(::operator new(segmentSize, std::align_val_t(SEGMENT_ALIGN)));
+}
+
+RecordWriter::~RecordWriter() {
+    close();
+    ::operator delete(segment, std::align_val_t(SEGMENT_ALIGN));
+}
+
+bool RecordWriter::open(const std::string& path, int link_type) {
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        error = "couldn't create " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    // Segments are already large, stdio buffering would only add a copy
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    record_file_header header;
+    std::memcpy(header.magic, RECORD_FILE_MAGIC, sizeof(header.magic));
+    header.version = Little(RECORD_FILE_VERSION);
+    header.header_size = Little(static_cast<uint16_t>(sizeof(record_file_header)));
+    header.link_type = Little(static_cast<int32_t>(link_type));
+    header.reserved = 0;
+    std::memcpy(segment, &header, sizeof(header));
+    used = sizeof(header);
+    recordCount = 0;
+    return true;
+}
+
+void RecordWriter::close() {
+    if (!file) {
+        return;
+    }
+    flush();
+    std::fclose(file);
+    file = nullptr;
+}
+
+bool RecordWriter::flush() {
+    if (!file || used == 0) {
+        used = 0;
+        return file != nullptr;
+    }
+    size_t pending = used;
+    used = 0;
+    if (std::fwrite(segment, 1, pending, file) != pending) {
+        error = std::string("write failed: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void RecordWriter::writePacket(const struct pcap_pkthdr& header, uint64_t timestamp_ns, const decoded_packet& packet,
+                               DecodeStatus status) {
+    auto* r = static_cast<binary_packet_record*>(reserve(sizeof(binary_packet_record)));
+    r->type = RECORD_PACKET;
+    r->ip_version = packet.ip_version;
+    r->protocol = packet.protocol;
+    r->tcp_flags = packet.tcp_flags;
+    r->status = static_cast<uint8_t>(status);
+    r->ttl = packet.ttl;
+    r->vlan_id = Little(static_cast<uint16_t>(packet.vlan_count > 0 ? packet.vlan_id[0] : 0));
+    r->timestamp_ns = Little(timestamp_ns);
+    std::memcpy(r->src_addr, packet.src_addr, sizeof(r->src_addr));
+    std::memcpy(r->dst_addr, packet.dst_addr, sizeof(r->dst_addr));
+    r->src_port = Little(packet.src_port);
+    r->dst_port = Little(packet.dst_port);
+    r->length = Little(static_cast<uint32_t>(header.len));
+    r->flags = Little(packet.flags);
+    r->payload_length = Little(packet.payload_length);
+    r->fragment_offset = Little(packet.fragment_offset);
+}
+
+void RecordWriter::writeFlow(const flow_record& flow, ExpiryReason reason) {
+    auto* r = static_cast<binary_flow_record*>(reserve(sizeof(binary_flow_record)));
+    r->type = RECORD_FLOW;
+    r->ip_version = flow.key.ip_version;
+    r->protocol = flow.key.protocol;
+    r->reason = static_cast<uint8_t>(reason);
+    r->tcp_flags[0] = flow.tcp_flags[0];
+    r->tcp_flags[1] = flow.tcp_flags[1];
+    r->vlan_id = Little(flow.key.vlan_id);
+    r->first_seen_ns = Little(flow.first_seen_ns);
+    r->last_seen_ns = Little(flow.last_seen_ns);
+    std::memcpy(r->addr_a, flow.key.addr_a, sizeof(r->addr_a));
+    std::memcpy(r->addr_b, flow.key.addr_b, sizeof(r->addr_b));
+    r->port_a = Little(flow.key.port_a);
+    r->port_b = Little(flow.key.port_b);
+    r->first_direction = flow.first_direction;
+    std::memset(r->reserved, 0, sizeof(r->reserved));
+    for (int i = 0; i < 2; ++i) {
+        r->packets[i] = Little(flow.packets[i]);
+        r->bytes[i] = Little(flow.bytes[i]);
+    }
+}
+
+RecordReader::~RecordReader() {
+    close();
+}
+
+bool RecordReader::open(const std::string& path) {
+    close();
+    file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        error = "couldn't open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    record_file_header header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+        std::memcmp(header.magic, RECORD_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        error = path + " is not a record file";
+        close();
+        return false;
+    }
+    if (Little(header.version) != RECORD_FILE_VERSION) {
+        error = "unsupported record file version " + std::to_string(Little(header.version));
+        close();
+        return false;
+    }
+    uint16_t headerSize = Little(header.header_size);
+    if (headerSize > sizeof(header) && std::fseek(file, headerSize, SEEK_SET) != 0) {
+        error = "truncated record file header";
+        close();
+        return false;
+    }
+    link = Little(header.link_type);
+    return true;
+}
+
+void RecordReader::close() {
+    if (file) {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+int RecordReader::next(binary_packet_record& packet, binary_flow_record& flow) {
+    if (!file) {
+        return 0;
+    }
+    int type = std::fgetc(file);
+    if (type == EOF) {
+        return 0;
+    }
+    unsigned char* target;
+    size_t size;
+    if (type == RECORD_PACKET) {
+        target = reinterpret_cast<unsigned char*>(&packet);
+        size = sizeof(packet);
+    }
+    else if (type == RECORD_FLOW) {
+        target = reinterpret_cast<unsigned char*>(&flow);
+        size = sizeof(flow);
+    }
+    else {
+        error = "unknown record type " + std::to_string(type);
+        return -1;
+    }
+    target[0] = static_cast<unsigned char>(type);
+    if (std::fread(target + 1, 1, size - 1, file) != size - 1) {
+        error = "truncated record";
+        return -1;
+    }
+    if (type == RECORD_PACKET) {
+        ToHost(packet);
+    }
+    else {
+        ToHost(flow);
+    }
+    return type;
+}
+
+void RecordExpiryHandler::onExpired(const expired_flow* flows, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        writer.writeFlow(*flows[i].record, flows[i].reason);
+    }
+    if (next) {
+        next->onExpired(flows, count);
+    }
+}
+
+}  // namespace figkey
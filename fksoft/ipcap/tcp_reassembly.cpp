@@ -0,0 +1,356 @@
+﻿// tcp_reassembly.cpp: TCP 流重组
+//
+#include "tcp_reassembly.h"
+#include <algorithm>
+#include <iterator>
+
+namespace figkey {
+
+namespace {
+
+const uint8_t PROTOCOL_TCP = 6;
+const uint8_t TCP_FIN = 0x01;
+const uint8_t TCP_SYN = 0x02;
+const uint8_t TCP_RST = 0x04;
+
+}  // namespace
+
+TcpReassembler::TcpReassembler(FlowTable& flow_table, const TcpReassemblyOptions& reassembly_options)
+        : table(flow_table), options(reassembly_options) {
+}
+
+void TcpReassembler::setHandler(TcpStreamHandler* handler, uint16_t port) {
+    if (port == 0) {
+        defaultHandler = handler;
+        return;
+    }
+    for (auto& entry : portHandlers) {
+        if (entry.first == port) {
+            entry.second = handler;
+            return;
+        }
+    }
+    portHandlers.emplace_back(port, handler);
+}
+
+TcpStreamHandler* TcpReassembler::handlerFor(const flow_record& flow) const {
+    for (const auto& entry : portHandlers) {
+        if (entry.second && (flow.key.port_a == entry.first || flow.key.port_b == entry.first)) {
+            return entry.second;
+        }
+    }
+    return defaultHandler;
+}
+
+void TcpReassembler::onPacket(flow_record* flow, int direction, const decoded_packet& packet, const unsigned char* data) {
+    if (packet.protocol != PROTOCOL_TCP || !(packet.flags & PKT_FLAG_TRANSPORT)) {
+        return;
+    }
+    uint32_t index = table.indexOf(flow);
+    auto it = connections.find(index);
+    if (it != connections.end() && (it->second.hash != flow->hash || it->second.firstSeenNs != flow->first_seen_ns)) {
+        // The record was reused without onFlowEnd, the old flow is gone but its handler still owns stream state
+        for (direction_state& dir : it->second.directions) {
+            dir.stream.flow = flow;
+            close(it->second, dir, StreamEnd::REUSED);
+        }
+        connections.erase(it);
+        it = connections.end();
+    }
+    if (it == connections.end()) {
+        TcpStreamHandler* handler = handlerFor(*flow);
+        if (!handler) {
+            return;
+        }
+        it = connections.emplace(index, connection()).first;
+        connection& created = it->second;
+        created.hash = flow->hash;
+        created.firstSeenNs = flow->first_seen_ns;
+        created.handler = handler;
+        for (uint8_t d = 0; d < 2; ++d) {
+            direction_state& dir = created.directions[d];
+            dir.stream = tcp_stream{flow, d, false, 0, nullptr};
+            dir.state = STREAM_NONE;
+            dir.finSeen = false;
+            dir.baseSeq = 0;
+            dir.finOffset = 0;
+            dir.pendingBytes = 0;
+        }
+    }
+    connection& conn = it->second;
+    conn.directions[0].stream.flow = flow;
+    conn.directions[1].stream.flow = flow;
+    direction_state& dir = conn.directions[direction != 0 ? 1 : 0];
+
+    uint8_t flags = packet.tcp_flags;
+    if (flags & TCP_RST) {
+        close(conn, conn.directions[0], StreamEnd::RESET);
+        close(conn, conn.directions[1], StreamEnd::RESET);
+        return;
+    }
+    if (dir.state == STREAM_CLOSED) {
+        return;
+    }
+
+    // Payload present in the capture and the length it had on the wire, the difference was cut by the snaplen
+    uint32_t seq = packet.tcp_seq;
+    size_t captured = packet.payload_offset != 0 ? packet.payload_length : 0;
+    size_t wire = captured;
+    if (packet.payload_offset != 0 && packet.l3_offset + packet.ip_length > packet.payload_offset + captured) {
+        wire = packet.l3_offset + packet.ip_length - packet.payload_offset;
+    }
+    if (flags & TCP_SYN) {
+        if (dir.state == STREAM_NONE) {
+            dir.baseSeq = seq + 1;
+            dir.state = STREAM_OPEN;
+        }
+        ++seq;                      // Data of a SYN, e.g. TCP Fast Open, starts after it
+    }
+    if (dir.state == STREAM_NONE) {
+        if (wire == 0 && !(flags & TCP_FIN)) {
+            return;                 // Picked up midstream, the first segment with data fixes offset 0
+        }
+        dir.baseSeq = seq;
+        dir.state = STREAM_OPEN;
+        dir.stream.midstream = true;
+    }
+
+    // Sequence numbers wrap, the distance to the next expected byte is taken modulo 2^32
+    uint64_t current = dir.stream.offset;
+    int32_t distance = static_cast<int32_t>(seq - (dir.baseSeq + static_cast<uint32_t>(current)));
+    int64_t start = static_cast<int64_t>(current) + distance;
+    const unsigned char* payload = data + packet.payload_offset;
+    if (start < 0) {
+        // Begins before offset 0, only a retransmission overlapping the stream start can do that
+        uint64_t before = static_cast<uint64_t>(-start);
+        if (before >= wire) {
+            stats.retransmitted += captured;
+            return;
+        }
+        size_t trim = before < captured ? static_cast<size_t>(before) : captured;
+        stats.retransmitted += trim;
+        payload += trim;
+        captured -= trim;
+        wire -= static_cast<size_t>(before);
+        start = 0;
+    }
+    uint64_t offset = static_cast<uint64_t>(start);
+    if (wire > 0) {
+        ++stats.segments;
+        addSegment(conn, dir, offset, payload, captured);
+        if (wire > captured && dir.stream.offset == offset + captured) {
+            gap(conn, dir, wire - captured);
+            drainPending(conn, dir);
+        }
+    }
+    if (flags & TCP_FIN) {
+        dir.finSeen = true;
+        dir.finOffset = offset + wire;
+    }
+    if (dir.finSeen && dir.stream.offset >= dir.finOffset) {
+        close(conn, dir, StreamEnd::FIN);
+    }
+}
+
+void TcpReassembler::addSegment(connection& conn, direction_state& dir, uint64_t offset, const unsigned char* data,
+                                size_t length) {
+    bool delivered = false;
+    while (length > 0) {
+        uint64_t current = dir.stream.offset;
+        if (offset + length <= current) {
+            stats.retransmitted += length;
+            return;
+        }
+        if (offset < current) {
+            // Overlap with delivered data, the bytes that arrived first win
+            size_t trim = static_cast<size_t>(current - offset);
+            stats.retransmitted += trim;
+            data += trim;
+            length -= trim;
+            offset = current;
+        }
+        if (offset == current) {
+            if (!delivered) {
+                ++stats.in_order;
+                delivered = true;
+            }
+            // Stop at the first buffered segment, its bytes arrived first; the rest is trimmed against it above
+            size_t next = length;
+            if (!dir.pending.empty() && dir.pending.begin()->first - current < length) {
+                next = static_cast<size_t>(dir.pending.begin()->first - current);
+            }
+            emit(conn, dir, data, next);
+            drainPending(conn, dir);
+            data += next;
+            length -= next;
+            offset += next;
+            continue;
+        }
+        if (dir.pendingBytes + length <= options.maxStreamBuffer && totalPending + length <= options.maxTotalBuffer) {
+            break;
+        }
+        // Over a cap: give up the oldest hole, with nothing buffered the hole before this segment
+        if (dir.pending.empty()) {
+            gap(conn, dir, offset - current);
+        }
+        else {
+            skipToPending(conn, dir);
+        }
+    }
+    if (length == 0) {
+        return;
+    }
+
+    // Buffer only the bytes no held segment covers yet, so overlaps keep the bytes that arrived first
+    const uint64_t first = offset;
+    const uint64_t end = offset + length;
+    auto next = dir.pending.upper_bound(offset);
+    if (next != dir.pending.begin()) {
+        auto previous = std::prev(next);
+        uint64_t covered = previous->first + previous->second.size();
+        if (covered > offset) {
+            offset = std::min(covered, end);
+        }
+    }
+    size_t stored = 0;
+    while (offset < end) {
+        uint64_t pieceEnd = next == dir.pending.end() ? end : std::min<uint64_t>(next->first, end);
+        if (pieceEnd > offset) {
+            const unsigned char* piece = data + (offset - first);
+            dir.pending.emplace_hint(next, offset, std::vector<unsigned char>(piece, piece + (pieceEnd - offset)));
+            stored += static_cast<size_t>(pieceEnd - offset);
+        }
+        if (next == dir.pending.end()) {
+            break;
+        }
+        offset = std::min<uint64_t>(next->first + next->second.size(), end);
+        ++next;
+    }
+    stats.retransmitted += length - stored;
+    if (stored > 0) {
+        dir.pendingBytes += stored;
+        totalPending += stored;
+        ++stats.out_of_order;
+    }
+}
+
+void TcpReassembler::drainPending(connection& conn, direction_state& dir) {
+    while (!dir.pending.empty()) {
+        auto first = dir.pending.begin();
+        uint64_t current = dir.stream.offset;
+        if (first->first > current) {
+            return;
+        }
+        const std::vector<unsigned char>& segment = first->second;
+        uint64_t end = first->first + segment.size();
+        if (end > current) {
+            size_t skip = static_cast<size_t>(current - first->first);
+            stats.retransmitted += skip;
+            emit(conn, dir, segment.data() + skip, segment.size() - skip);
+        }
+        else {
+            stats.retransmitted += segment.size();
+        }
+        dir.pendingBytes -= segment.size();
+        totalPending -= segment.size();
+        dir.pending.erase(first);
+    }
+}
+
+void TcpReassembler::skipToPending(connection& conn, direction_state& dir) {
+    if (dir.pending.empty()) {
+        return;
+    }
+    uint64_t next = dir.pending.begin()->first;
+    if (next > dir.stream.offset) {
+        gap(conn, dir, next - dir.stream.offset);
+    }
+    drainPending(conn, dir);
+}
+
+void TcpReassembler::emit(connection& conn, direction_state& dir, const unsigned char* data, size_t length) {
+    conn.handler->onData(dir.stream, data, length);
+    dir.stream.offset += length;
+    stats.delivered += length;
+}
+
+void TcpReassembler::gap(connection& conn, direction_state& dir, uint64_t length) {
+    conn.handler->onGap(dir.stream, static_cast<size_t>(length));
+    dir.stream.offset += length;
+    stats.gaps += length;
+}
+
+void TcpReassembler::close(connection& conn, direction_state& dir, StreamEnd reason) {
+    if (dir.state == STREAM_CLOSED) {
+        return;
+    }
+    if (dir.state == STREAM_OPEN) {
+        // Held data of a flow whose record was reused would be reported against the new flow
+        while (reason != StreamEnd::REUSED && !dir.pending.empty()) {
+            skipToPending(conn, dir);
+        }
+        if (reason != StreamEnd::REUSED && dir.finSeen && dir.stream.offset < dir.finOffset) {
+            gap(conn, dir, dir.finOffset - dir.stream.offset);
+        }
+        conn.handler->onClose(dir.stream, reason);
+    }
+    dir.state = STREAM_CLOSED;
+    release(dir);
+}
+
+void TcpReassembler::release(direction_state& dir) {
+    totalPending -= dir.pendingBytes;
+    dir.pendingBytes = 0;
+    dir.pending.clear();
+}
+
+void TcpReassembler::onFlowEnd(const flow_record& flow) {
+    auto it = connections.find(table.indexOf(&flow));
+    if (it == connections.end()) {
+        return;
+    }
+    connection& conn = it->second;
+    if (conn.hash == flow.hash && conn.firstSeenNs == flow.first_seen_ns) {
+        for (direction_state& dir : conn.directions) {
+            dir.stream.flow = &flow;
+            close(conn, dir, StreamEnd::EXPIRED);
+        }
+    }
+    else {
+        for (direction_state& dir : conn.directions) {
+            dir.stream.flow = &flow;
+            close(conn, dir, StreamEnd::REUSED);
+        }
+    }
+    connections.erase(it);
+}
+
+void TcpReassembler::flush() {
+    for (auto& entry : connections) {
+        connection& conn = entry.second;
+        const flow_record& flow = table.recordAt(entry.first);
+        for (direction_state& dir : conn.directions) {
+            dir.stream.flow = &flow;
+            close(conn, dir, StreamEnd::EXPIRED);
+        }
+    }
+    connections.clear();
+}
+
+tcp_reassembly_stats TcpReassembler::getStats() const {
+    tcp_reassembly_stats current = stats;
+    current.buffered = totalPending;
+    current.connections = connections.size();
+    return current;
+}
+
+void ReassemblyExpiryHandler::onExpired(const expired_flow* flows, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        reassembler.onFlowEnd(*flows[i].record);
+    }
+    if (next) {
+        next->onExpired(flows, count);
+    }
+}
+
+}  // namespace figkey
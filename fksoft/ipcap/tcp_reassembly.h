@@ -0,0 +1,179 @@
+﻿/**
+ * @file    tcp_reassembly.h
+ * @ingroup figkey
+ * @brief   TCP stream reassembly on top of FlowTable.
+ *          Each direction of a tracked connection is turned into an in-order byte stream. Segments that arrive
+ *          in order are handed to the stream handler straight from the capture buffer; only segments ahead of
+ *          the stream are copied and held until the hole before them is filled. Retransmitted bytes are
+ *          dropped, overlaps keep the bytes that arrived first. Buffered data is capped per direction and over
+ *          all connections: when a cap is hit the oldest hole is given up, reported as a gap, and the stream
+ *          goes on after it. Streams end on FIN once every byte before it arrived, on RST, or when the flow
+ *          leaves the table. A record reused before its flow ended closes the old streams as well.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#pragma once
+
+#ifndef FIGKEY_TCP_REASSEMBLY_HPP
+#define FIGKEY_TCP_REASSEMBLY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "flow_expiry.h"
+#include "flow_table.h"
+#include "packet_decoder.h"
+
+namespace figkey {
+
+enum class StreamEnd : uint8_t {
+    FIN,        // All data up to the FIN was delivered
+    RESET,      // RST in either direction
+    EXPIRED,    // The flow left the table or the capture ended
+    REUSED      // The flow's record went to another flow first, stream.flow is the new one and held data is dropped
+};
+
+// One direction of a connection as seen by a TcpStreamHandler
+struct tcp_stream {
+    const flow_record* flow;    // Valid during the callback only
+    uint8_t direction;          // 0 for data sent by endpoint a of flow->key
+    bool midstream;             // The SYN was not seen, offsets count from the first segment captured
+    uint64_t offset;            // Stream bytes delivered or skipped before the current callback
+    void* user;                 // Free for the handler, nullptr until it sets it
+};
+
+// Receives reassembled data. Called on the thread that tracks the flow
+class TcpStreamHandler {
+public:
+    virtual ~TcpStreamHandler() = default;
+
+    // length bytes following stream.offset, valid during the call only
+    virtual void onData(tcp_stream& stream, const unsigned char* data, size_t length) = 0;
+
+    // length bytes following stream.offset were lost, the next onData continues after them
+    virtual void onGap(tcp_stream& stream, size_t length) {
+        (void)stream;
+        (void)length;
+    }
+
+    // Last call for the direction, release whatever stream.user refers to
+    virtual void onClose(tcp_stream& stream, StreamEnd reason) {
+        (void)stream;
+        (void)reason;
+    }
+};
+
+struct TcpReassemblyOptions {
+    size_t maxStreamBuffer;     // Out-of-order bytes held per direction
+    size_t maxTotalBuffer;      // Out-of-order bytes held over all connections
+
+    TcpReassemblyOptions(size_t stream_buffer = 1 << 20, size_t total_buffer = 64 << 20)
+            : maxStreamBuffer(stream_buffer), maxTotalBuffer(total_buffer) {}
+};
+
+struct tcp_reassembly_stats {
+    uint64_t segments;          // Segments with payload
+    uint64_t delivered;         // Bytes handed to handlers
+    uint64_t in_order;          // Segments delivered without a copy
+    uint64_t out_of_order;      // Segments buffered until a hole was filled
+    uint64_t retransmitted;     // Payload bytes dropped because they were delivered or buffered already
+    uint64_t gaps;              // Bytes reported lost, including holes given up on a buffer cap
+    uint64_t buffered;          // Bytes currently held
+    size_t connections;         // Connections currently reassembled
+};
+
+class TcpReassembler {
+public:
+    TcpReassembler(FlowTable& flow_table, const TcpReassemblyOptions& options = TcpReassemblyOptions());
+
+    TcpReassembler(const TcpReassembler&) = delete;
+    TcpReassembler& operator=(const TcpReassembler&) = delete;
+
+    // Reassembles connections with port on either endpoint for handler, port 0 for every connection without a
+    // handler of its own. Connections nobody handles are not reassembled. Call before the first packet
+    void setHandler(TcpStreamHandler* handler, uint16_t port = 0);
+
+    // Call after FlowTable::update for every TCP packet, with the direction update returned and the captured
+    // data the packet was decoded from
+    void onPacket(flow_record* flow, int direction, const decoded_packet& packet, const unsigned char* data);
+
+    // Ends the streams of a flow about to be erased from the table
+    void onFlowEnd(const flow_record& flow);
+
+    // Ends every stream, e.g. when the capture stopped without flow expiry
+    void flush();
+
+    tcp_reassembly_stats getStats() const;
+
+private:
+    static constexpr uint8_t STREAM_NONE = 0;
+    static constexpr uint8_t STREAM_OPEN = 1;
+    static constexpr uint8_t STREAM_CLOSED = 2;
+
+    struct direction_state {
+        tcp_stream stream;
+        uint8_t state;
+        bool finSeen;
+        uint32_t baseSeq;       // Sequence number of stream offset 0
+        uint64_t finOffset;
+        size_t pendingBytes;
+        std::map<uint64_t, std::vector<unsigned char>> pending;    // Segments ahead of stream.offset by offset
+    };
+
+    struct connection {
+        uint64_t hash;          // Identifies the flow that owns the record index
+        uint64_t firstSeenNs;
+        TcpStreamHandler* handler;
+        direction_state directions[2];
+    };
+
+    FlowTable& table;
+    TcpReassemblyOptions options;
+    TcpStreamHandler* defaultHandler{nullptr};
+    std::vector<std::pair<uint16_t, TcpStreamHandler*>> portHandlers;
+    std::unordered_map<uint32_t, connection> connections;  // By flow record index
+    size_t totalPending{0};
+    tcp_reassembly_stats stats{};
+
+    TcpStreamHandler* handlerFor(const flow_record& flow) const;
+
+    // Puts the segment at stream offset into the stream: delivers it if it is next, buffers it otherwise
+    void addSegment(connection& conn, direction_state& dir, uint64_t offset, const unsigned char* data, size_t length);
+
+    // Delivers the buffered segments that became contiguous
+    void drainPending(connection& conn, direction_state& dir);
+
+    // Gives up the hole before the first buffered segment
+    void skipToPending(connection& conn, direction_state& dir);
+
+    void emit(connection& conn, direction_state& dir, const unsigned char* data, size_t length);
+
+    void gap(connection& conn, direction_state& dir, uint64_t length);
+
+    // Delivers what is buffered, gaps included, and ends the direction
+    void close(connection& conn, direction_state& dir, StreamEnd reason);
+
+    void release(direction_state& dir);
+};
+
+// Ends the streams of expired flows, then passes the batch on to next (may be nullptr)
+class ReassemblyExpiryHandler : public FlowExpiryHandler {
+public:
+    ReassemblyExpiryHandler(TcpReassembler& tcp_reassembler, FlowExpiryHandler* next_handler)
+            : reassembler(tcp_reassembler), next(next_handler) {}
+
+    void onExpired(const expired_flow* flows, size_t count) override;
+
+private:
+    TcpReassembler& reassembler;
+    FlowExpiryHandler* next;
+};
+
+}  // namespace figkey
+
+#endif // !FIGKEY_TCP_REASSEMBLY_HPP
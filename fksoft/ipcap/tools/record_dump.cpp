@@ -0,0 +1,193 @@
+/**
+ * @file    record_dump.cpp
+ * @ingroup figkey
+ * @brief   Renders binary record files written by ipcap --records as text.
+ *          One line per record: packet records show the timestamp (epoch seconds, tcpdump -tt style), the
+ *          addresses and ports, protocol, length and TCP flags; flow records show both endpoints, the counters
+ *          of each direction, duration and why the flow ended.
+ *
+ *          usage: record_dump <file>... [--packets|--flows] [--count N]
+ *            --packets   packet records only
+ *            --flows     flow records only
+ *            --count     stop after N records
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) figkey 2023-2033
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include "record_file.h"
+
+using namespace figkey;
+
+namespace {
+
+const char* ProtocolName(uint8_t protocol) {
+    switch (protocol) {
+    case 1: return "ICMP";
+    case 6: return "TCP";
+    case 17: return "UDP";
+    case 58: return "ICMPv6";
+    case 132: return "SCTP";
+    default: return nullptr;
+    }
+}
+
+const char* ReasonName(uint8_t reason) {
+    switch (static_cast<ExpiryReason>(reason)) {
+    case ExpiryReason::IDLE: return "idle";
+    case ExpiryReason::ACTIVE: return "active";
+    case ExpiryReason::TCP_CLOSED: return "closed";
+    case ExpiryReason::END: return "end";
+    default: return "?";
+    }
+}
+
+std::string Endpoint(uint8_t ip_version, const uint8_t* addr, uint16_t port, bool with_port) {
+    char text[INET6_ADDRSTRLEN];
+    inet_ntop(ip_version == 6 ? AF_INET6 : AF_INET, addr, text, sizeof(text));
+    if (!with_port) {
+        return text;
+    }
+    return ip_version == 6 ? "[" + std::string(text) + "]:" + std::to_string(port) : std::string(text) + ":" + std::to_string(port);
+}
+
+std::string TcpFlags(uint8_t flags) {
+    static const char names[] = "FSRPAUEC";
+    std::string text;
+    for (int i = 0; i < 8; ++i) {
+        if (flags & (1 << i)) {
+            text += names[i];
+        }
+    }
+    return text.empty() ? "-" : text;
+}
+
+void Protocol(char* text, size_t size, uint8_t protocol) {
+    const char* name = ProtocolName(protocol);
+    if (name) {
+        std::snprintf(text, size, "%s", name);
+    } else {
+        std::snprintf(text, size, "proto %u", protocol);
+    }
+}
+
+void PrintPacket(const binary_packet_record& r) {
+    char line[256];
+    if (r.ip_version == 0) {
+        std::printf("%llu.%09llu %s len %u\n", static_cast<unsigned long long>(r.timestamp_ns / 1000000000ULL),
+                    static_cast<unsigned long long>(r.timestamp_ns % 1000000000ULL),
+                    PacketDecoder::statusName(static_cast<DecodeStatus>(r.status)), r.length);
+        return;
+    }
+    bool ports = (r.flags & PKT_FLAG_TRANSPORT) && (r.protocol == 6 || r.protocol == 17 || r.protocol == 132);
+    char protocol[16];
+    Protocol(protocol, sizeof(protocol), r.protocol);
+    int n = std::snprintf(line, sizeof(line), "%llu.%09llu %s > %s %s len %u",
+                          static_cast<unsigned long long>(r.timestamp_ns / 1000000000ULL),
+                          static_cast<unsigned long long>(r.timestamp_ns % 1000000000ULL),
+                          Endpoint(r.ip_version, r.src_addr, r.src_port, ports).c_str(),
+                          Endpoint(r.ip_version, r.dst_addr, r.dst_port, ports).c_str(), protocol, r.length);
+    if (r.protocol == 6 && (r.flags & PKT_FLAG_TRANSPORT)) {
+        n += std::snprintf(line + n, sizeof(line) - n, " [%s]", TcpFlags(r.tcp_flags).c_str());
+    }
+    if (r.flags & PKT_FLAG_FRAGMENT) {
+        n += std::snprintf(line + n, sizeof(line) - n, " frag %u%s", r.fragment_offset,
+                           (r.flags & PKT_FLAG_MORE_FRAGMENTS) ? "+" : "");
+    }
+    if (r.vlan_id != 0) {
+        n += std::snprintf(line + n, sizeof(line) - n, " vlan %u", r.vlan_id);
+    }
+    if (r.flags & (PKT_FLAG_BAD_IP_CHECKSUM | PKT_FLAG_BAD_L4_CHECKSUM)) {
+        n += std::snprintf(line + n, sizeof(line) - n, " bad-%s-cksum",
+                           (r.flags & PKT_FLAG_BAD_IP_CHECKSUM) ? "ip" : "l4");
+    }
+    if (static_cast<DecodeStatus>(r.status) != DecodeStatus::OK) {
+        std::snprintf(line + n, sizeof(line) - n, " %s", PacketDecoder::statusName(static_cast<DecodeStatus>(r.status)));
+    }
+    std::printf("%s\n", line);
+}
+
+void PrintFlow(const binary_flow_record& r) {
+    bool ports = r.protocol == 6 || r.protocol == 17 || r.protocol == 132;
+    char protocol[16];
+    Protocol(protocol, sizeof(protocol), r.protocol);
+    uint64_t duration = r.last_seen_ns - r.first_seen_ns;
+    std::printf("%llu.%09llu flow %s <-> %s %s %llu/%llu packets %llu/%llu bytes %llu.%03llu s %s",
+                static_cast<unsigned long long>(r.first_seen_ns / 1000000000ULL),
+                static_cast<unsigned long long>(r.first_seen_ns % 1000000000ULL),
+                Endpoint(r.ip_version, r.addr_a, r.port_a, ports).c_str(),
+                Endpoint(r.ip_version, r.addr_b, r.port_b, ports).c_str(), protocol,
+                static_cast<unsigned long long>(r.packets[0]), static_cast<unsigned long long>(r.packets[1]),
+                static_cast<unsigned long long>(r.bytes[0]), static_cast<unsigned long long>(r.bytes[1]),
+                static_cast<unsigned long long>(duration / 1000000000ULL),
+                static_cast<unsigned long long>(duration / 1000000 % 1000), ReasonName(r.reason));
+    if (r.protocol == 6) {
+        std::printf(" [%s|%s]", TcpFlags(r.tcp_flags[0]).c_str(), TcpFlags(r.tcp_flags[1]).c_str());
+    }
+    std::printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> files;
+    bool packets = true;
+    bool flows = true;
+    uint64_t limit = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--packets") {
+            flows = false;
+        } else if (arg == "--flows") {
+            packets = false;
+        } else if (arg == "--count" && i + 1 < argc) {
+            limit = std::strtoull(argv[++i], nullptr, 10);
+        } else if (!arg.empty() && arg[0] != '-') {
+            files.push_back(arg);
+        } else {
+            files.clear();
+            break;
+        }
+    }
+    if (files.empty()) {
+        std::cerr << "usage: " << argv[0] << " <file>... [--packets|--flows] [--count N]" << std::endl;
+        return 1;
+    }
+
+    uint64_t shown = 0;
+    binary_packet_record packet;
+    binary_flow_record flow;
+    for (const std::string& path : files) {
+        RecordReader reader;
+        if (!reader.open(path)) {
+            std::cerr << reader.lastError() << std::endl;
+            return 1;
+        }
+        int type = 0;
+        while ((limit == 0 || shown < limit) && (type = reader.next(packet, flow)) > 0) {
+            if (type == RECORD_PACKET && packets) {
+                PrintPacket(packet);
+                ++shown;
+            } else if (type == RECORD_FLOW && flows) {
+                PrintFlow(flow);
+                ++shown;
+            }
+        }
+        if (type < 0) {
+            std::cerr << path << ": " << reader.lastError() << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -23,6 +23,7 @@
 #include <thread>
 #include <condition_variable>
 #include <chrono>
+#include <functional>
 #include <sstream>
 #include <iomanip>
 #include <filesystem>  // C++17 filesystem header for directory operations
@@ -30,6 +31,9 @@
 namespace opensource {
     namespace ctrlfrmb {
 
+// Type definition for the callback invoked with the path of a log file closed by rotation
+using FileRotateCallback = std::function<void(const std::string&)>;
+
 // Structure for configuring the file logger
 struct FileLoggerConfig {
     std::string filePath;      // Path to the directory where log files will be saved
@@ -38,6 +42,7 @@ struct FileLoggerConfig {
     size_t maxFileSize;        // Maximum size for a single log file
     uint16_t maxFileNumber;    // Maximum number of log files allowed, Default 0 means no restrictions
     bool useAsync;             // Flag to enable asynchronous logging
+    FileRotateCallback rotateCallback; // Optional hook for rotated files, e.g. to compress them
 
     FileLoggerConfig(std::string_view path, std::string_view name,
                      std::string_view extension, size_t maxSize, uint16_t maxNum = 0, bool async = false)
@@ -83,7 +88,7 @@ public:
             logQueue.emplace(message.begin(), message.end());
             condition.notify_one();
         } else {
-            std::lock_guard<std::mutex> lock(fileMutex);
+            // writeToLogFile takes fileMutex itself
             writeToLogFile(message);
         }
     }
@@ -99,6 +104,7 @@ public:
 private:
     FileLoggerConfig config;
     std::ofstream logFile;   // Output file stream for the log file
+    std::string currentFileName; // Path of the log file currently written
     size_t currentFileSize;  // Current size of the log file
     std::mutex fileMutex;    // Mutex for synchronizing file access
     std::queue<std::string> logQueue; // Queue for storing log messages in asynchronous mode
@@ -125,6 +131,9 @@ private:
 
         if (logFile.is_open()) {
             logFile.close();
+            if (config.rotateCallback) {
+                config.rotateCallback(currentFileName);
+            }
         }
 
         std::string newFileName = createLogFileName();
@@ -132,6 +141,7 @@ private:
         if (!logFile.is_open()) {
             std::cerr << "Failed to open log file: " << newFileName << std::endl;
         }
+        currentFileName = newFileName;
         currentFileSize = 0;
     }
 
@@ -0,0 +1,204 @@
+/**
+ * @file    log_context.hpp
+ * @ingroup opensource
+ * @brief   Thread-local logging context (MDC) for the Logger class.
+ *          Scoped fields such as interface name, session id or flow id are pushed onto a fixed-capacity
+ *          per-thread stack as typed values and only rendered to text by the Logger when a message
+ *          actually passes the level filter, so tagging log lines with context costs no allocation.
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) ctrlfrmb 2023-2033
+ */
+
+#pragma once
+
+#ifndef OPEN_SOURCE_LOG_CONTEXT_HPP
+#define OPEN_SOURCE_LOG_CONTEXT_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace opensource {
+namespace ctrlfrmb {
+
+// Thread-local stack of typed context fields
+class LogContext {
+public:
+    static constexpr size_t MAX_FIELDS = 16;     // Deeper pushes are ignored
+    static constexpr size_t MAX_TEXT_SIZE = 47;  // Longer string values are truncated
+
+    enum class FieldType : uint8_t {
+        INT,
+        UINT,
+        DOUBLE,
+        BOOL,
+        TEXT
+    };
+
+    // One context field; key must point to a string with static storage duration (usually a literal)
+    struct Field {
+        const char* key;
+        FieldType type;
+        uint8_t textSize;
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            bool b;
+            char text[MAX_TEXT_SIZE + 1];
+        };
+    };
+
+    // Pushes a field, returns false if the stack is full
+    template<typename T>
+    static bool push(const char* key, const T& value) {
+        Stack& stack = current();
+        if (stack.size >= MAX_FIELDS) {
+            ++stack.overflow;  // Keep pop() balanced with the push that was ignored
+            return false;
+        }
+        Field& field = stack.fields[stack.size++];
+        field.key = key;
+        assign(field, value);
+        return true;
+    }
+
+    // Pops the most recently pushed field
+    static void pop() {
+        Stack& stack = current();
+        if (stack.overflow > 0) {
+            --stack.overflow;
+        } else if (stack.size > 0) {
+            --stack.size;
+        }
+    }
+
+    // Replaces the value of the innermost field named key, e.g. a flow id that changes per packet
+    template<typename T>
+    static bool update(const char* key, const T& value) {
+        Stack& stack = current();
+        for (size_t i = stack.size; i > 0; --i) {
+            Field& field = stack.fields[i - 1];
+            if (field.key == key || std::strcmp(field.key, key) == 0) {
+                assign(field, value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Number of fields on the calling thread's stack
+    static size_t size() {
+        return current().size;
+    }
+
+    // Removes all fields of the calling thread
+    static void clear() {
+        Stack& stack = current();
+        stack.size = 0;
+        stack.overflow = 0;
+    }
+
+    // Renders the calling thread's fields as " {key=value key=value}", appends nothing if empty
+    static void appendTo(std::string& out) {
+        const Stack& stack = current();
+        if (stack.size == 0) {
+            return;
+        }
+        out += " {";
+        for (size_t i = 0; i < stack.size; ++i) {
+            const Field& field = stack.fields[i];
+            if (i > 0) {
+                out += ' ';
+            }
+            out += field.key;
+            out += '=';
+            appendValue(out, field);
+        }
+        out += '}';
+    }
+
+private:
+    struct Stack {
+        Field fields[MAX_FIELDS];
+        size_t size = 0;
+        size_t overflow = 0;
+    };
+
+    static Stack& current() {
+        static thread_local Stack stack;
+        return stack;
+    }
+
+    template<typename T>
+    static void assign(Field& field, const T& value) {
+        if constexpr (std::is_same_v<T, bool>) {
+            field.type = FieldType::BOOL;
+            field.b = value;
+        } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+            field.type = FieldType::INT;
+            field.i = static_cast<int64_t>(value);
+        } else if constexpr (std::is_integral_v<T>) {
+            field.type = FieldType::UINT;
+            field.u = static_cast<uint64_t>(value);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            field.type = FieldType::DOUBLE;
+            field.d = static_cast<double>(value);
+        } else {
+            // Strings are copied into the field, so the caller's buffer need not outlive the scope
+            std::string_view text(value);
+            field.type = FieldType::TEXT;
+            field.textSize = static_cast<uint8_t>(std::min(text.size(), MAX_TEXT_SIZE));
+            std::memcpy(field.text, text.data(), field.textSize);
+        }
+    }
+
+    static void appendValue(std::string& out, const Field& field) {
+        char buffer[32];
+        std::to_chars_result result{buffer, std::errc()};
+        switch (field.type) {
+        case FieldType::INT:
+            result = std::to_chars(buffer, buffer + sizeof(buffer), field.i);
+            break;
+        case FieldType::UINT:
+            result = std::to_chars(buffer, buffer + sizeof(buffer), field.u);
+            break;
+        case FieldType::DOUBLE:
+            result = std::to_chars(buffer, buffer + sizeof(buffer), field.d);
+            break;
+        case FieldType::BOOL:
+            out += field.b ? "true" : "false";
+            return;
+        case FieldType::TEXT:
+            out.append(field.text, field.textSize);
+            return;
+        }
+        out.append(buffer, result.ptr);
+    }
+};
+
+// Pushes a context field for the lifetime of the scope
+class LogContextScope {
+public:
+    template<typename T>
+    LogContextScope(const char* key, const T& value) {
+        LogContext::push(key, value);
+    }
+
+    ~LogContextScope() {
+        LogContext::pop();
+    }
+
+    LogContextScope(const LogContextScope&) = delete;
+    LogContextScope& operator=(const LogContextScope&) = delete;
+};
+
+}  // namespace ctrlfrmb
+}  // namespace opensource
+
+#endif // !OPEN_SOURCE_LOG_CONTEXT_HPP
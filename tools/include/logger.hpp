@@ -17,6 +17,7 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include "log_context.hpp"
 
 // Macro definition to enable Android logging
 // #define ENABLE_ANDROID_LOGGING
@@ -27,6 +28,16 @@
 #include "file_logger.hpp"
 #endif
 
+// Shared-memory logging for multi-process deployments and the non-blocking console sink are available on POSIX systems
+#if !defined(ENABLE_ANDROID_LOGGING) && (defined(__linux__) || defined(__APPLE__))
+#define ENABLE_SHARED_MEMORY_LOGGING
+#define ENABLE_CONSOLE_SINK
+#define ENABLE_LOG_SHIPPING
+#include "shm_log_ring.hpp"
+#include "console_sink.hpp"
+#include "log_shipper.hpp"
+#endif
+
 namespace opensource {
 namespace ctrlfrmb {
 
@@ -83,13 +94,79 @@ public:
     }
 #endif
 
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+    // Append log messages to the shared-memory ring created by a ShmLogWriter process,
+    // takes precedence over file logging while enabled
+    bool enableSharedMemoryWrite(const std::string& ringName) {
+        try {
+            shmRing = std::make_unique<ShmLogRing>(ringName, 0, false);
+            return true;
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to enable shared memory logging: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    // Disable shared-memory logging
+    void disableSharedMemoryWrite() {
+        shmRing.reset();
+    }
+#endif
+
+#ifdef ENABLE_CONSOLE_SINK
+    // Buffer console output in a background-drained ring instead of flushing std::cout per line,
+    // used whenever neither shared-memory nor file logging is enabled
+    bool enableConsoleSink(const ConsoleSinkConfig& config = ConsoleSinkConfig()) {
+        try {
+            consoleSink = std::make_unique<ConsoleSink>(config);
+            return true;
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to enable console sink: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    // Disable the console sink, output goes to std::cout again
+    void disableConsoleSink() {
+        consoleSink.reset();
+    }
+
+    // Console sink in use or nullptr, e.g. to read its drop counters
+    const ConsoleSink* getConsoleSink() const {
+        return consoleSink.get();
+    }
+#endif
+
+#ifdef ENABLE_LOG_SHIPPING
+    // Additionally stream every log message to a local collector
+    bool enableLogShipping(const LogShipperConfig& config) {
+        try {
+            logShipper = std::make_unique<LogShipper>(config);
+            return true;
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to enable log shipping: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    // Disable log shipping, waits briefly for queued records to be acknowledged
+    void disableLogShipping() {
+        logShipper.reset();
+    }
+
+    // Log shipper in use or nullptr
+    const LogShipper* getLogShipper() const {
+        return logShipper.get();
+    }
+#endif
+
     // Log methods for different levels
     void trace(const std::string& message) {
         if (LogLevel::TRACE >= currentLevel) {
 #ifdef ENABLE_ANDROID_LOGGING
             androidLogLevel = ANDROID_LOG_DEBUG;
 #endif
-            log("TRACE", message);
+            log(LogLevel::TRACE, "TRACE", message);
         }
     }
 
@@ -98,7 +175,7 @@ public:
 #ifdef ENABLE_ANDROID_LOGGING
             androidLogLevel = ANDROID_LOG_DEBUG;
 #endif
-            log("DEBUG", message);
+            log(LogLevel::DEBUG, "DEBUG", message);
         }
     }
 
@@ -107,7 +184,7 @@ public:
 #ifdef ENABLE_ANDROID_LOGGING
             androidLogLevel = ANDROID_LOG_INFO;
 #endif
-            log("INFO", message);
+            log(LogLevel::INFO, "INFO", message);
         }
     }
 
@@ -116,7 +193,7 @@ public:
 #ifdef ENABLE_ANDROID_LOGGING
             androidLogLevel = ANDROID_LOG_WARN;
 #endif
-            log("WARN", message);
+            log(LogLevel::WARN, "WARN", message);
         }
     }
 
@@ -125,7 +202,7 @@ public:
 #ifdef ENABLE_ANDROID_LOGGING
             androidLogLevel = ANDROID_LOG_ERROR;
 #endif
-            log("ERROR", message);
+            log(LogLevel::ERROR, "ERROR", message);
         }
     }
 
@@ -134,7 +211,7 @@ public:
 #ifdef ENABLE_ANDROID_LOGGING
             androidLogLevel = ANDROID_LOG_FATAL;
 #endif
-            log("FATAL", message);
+            log(LogLevel::FATAL, "FATAL", message);
         }
     }
 
@@ -147,19 +224,54 @@ private:
 #else
     std::unique_ptr<FileLogger> fileLogger;  // File logger instance
 #endif
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+    std::unique_ptr<ShmLogRing> shmRing;  // Shared-memory ring drained by the writer process
+#endif
+#ifdef ENABLE_CONSOLE_SINK
+    std::unique_ptr<ConsoleSink> consoleSink;  // Buffered console output
+#endif
+#ifdef ENABLE_LOG_SHIPPING
+    std::unique_ptr<LogShipper> logShipper;  // Streams records to a local collector
+#endif
 
     // Generic log output method
-    void log(const std::string& level, const std::string& message) {
-        std::string prefix = prefixCallback ? prefixCallback() : "";
-        std::string fullMessage = prefix + " [" + level + "]: " + message;
+    void log(LogLevel severity, const std::string& level, const std::string& message) {
+        // Reuse one buffer per thread so formatting does not allocate once it has grown
+        static thread_local std::string fullMessage;
+        fullMessage.clear();
+        if (prefixCallback) {
+            fullMessage += prefixCallback();
+        }
+        fullMessage += " [";
+        fullMessage += level;
+        fullMessage += "]: ";
+        fullMessage += message;
+        LogContext::appendTo(fullMessage);
+
+#ifdef ENABLE_LOG_SHIPPING
+        if (logShipper) {
+            logShipper->ship(fullMessage, static_cast<uint8_t>(severity));
+        }
+#endif
 
 #ifdef ENABLE_ANDROID_LOGGING
         __android_log_print(androidLogLevel, "LoggerTag", "%s", fullMessage.c_str());
 #else
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+        if (shmRing) {
+            shmRing->write(fullMessage);
+            return;
+        }
+#endif
         // Write to file if file logging is enabled
         if (fileLogger) {
             fileLogger->write(fullMessage);
         }
+#ifdef ENABLE_CONSOLE_SINK
+        else if (consoleSink) {
+            consoleSink->write(fullMessage, static_cast<uint8_t>(severity));
+        }
+#endif
         else {
             std::cout << fullMessage << std::endl;
         }
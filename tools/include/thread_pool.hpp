@@ -333,7 +333,7 @@ public:
         if (max_thread < 1)
             return -1;
 
-        if (min_thread > max_thread_)
+        if (min_thread > max_thread)
             return -2;
 
         if (wait_max_time < 1)
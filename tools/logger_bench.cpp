@@ -0,0 +1,435 @@
+/**
+ * @file    logger_bench.cpp
+ * @ingroup opensource
+ * @brief   Throughput and latency benchmark for Logger/FileLogger.
+ *          Drives the logger with 1..N producer threads in synchronous and asynchronous file mode
+ *          (and through the shared-memory ring drained by a ShmLogWriter where available), as well as
+ *          console output through std::cout versus the buffered ConsoleSink (stdout is sent to /dev/null),
+ *          with several message sizes and level filters, and reports messages/sec, bytes/sec,
+ *          per-call latency percentiles and peak resident memory for every scenario.
+ *
+ *          usage: logger_bench [--threads N] [--messages M] [--sizes 32,256,2048] [--prefix] [--context] [--direct]
+ *            --threads   highest producer thread count, runs 1,2,4.. up to N (default: hardware threads)
+ *            --messages  messages written by each producer thread (default: 20000)
+ *            --sizes     comma separated message payload sizes in bytes
+ *            --prefix    install the same ctime() prefix callback used by the TEST_LOGGER demo
+ *            --context   tag every message with iface/session/flow LogContext fields, flow changing per message
+ *            --direct    bypass Logger and call FileLogger::write (ShmLogRing::write in shm mode) directly
+ * @author  leiwei
+ * @date    2026.10.17
+ * Copyright (c) ctrlfrmb 2023-2033
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "logger.hpp"
+
+#if defined(__linux__)
+#include <fstream>
+#endif
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace opensource::ctrlfrmb;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+const char* BENCH_LOG_DIR = "bench_logs";
+const char* BENCH_SHM_RING = "/logger_bench_ring";
+
+// How the messages reach the log file
+enum class BenchMode {
+    SYNC,   // FileLogger writes in the calling thread
+    ASYNC,  // FileLogger queues to its worker thread
+    SHM,    // ShmLogRing, drained by a ShmLogWriter
+    COUT,   // No file logging, std::cout with a flush per line
+    CONSOLE // No file logging, ConsoleSink
+};
+
+const char* modeName(BenchMode mode) {
+    switch (mode) {
+    case BenchMode::SYNC: return "sync";
+    case BenchMode::ASYNC: return "async";
+    case BenchMode::SHM: return "shm";
+    case BenchMode::COUT: return "cout";
+    case BenchMode::CONSOLE: return "cons";
+    }
+    return "";
+}
+
+// One benchmark scenario
+struct BenchCase {
+    size_t threads;       // Number of producer threads
+    BenchMode mode;       // Write path under test
+    size_t messageSize;   // Payload size of each message
+    bool filtered;        // Messages are below the logger level and must be dropped by the filter
+};
+
+// Result of one scenario
+struct BenchResult {
+    double producerSeconds;  // Time until all producers returned
+    double totalSeconds;     // Time until the file logger drained and closed
+    uint64_t messages;       // Messages submitted
+    uint64_t bytes;          // Payload bytes submitted
+    uint64_t dropped;        // Messages dropped by a full shared-memory ring or console sink
+    uint64_t p50, p90, p99, p999, pmax; // Per-call latency in nanoseconds
+    size_t peakRssKb;        // Peak resident set size during the scenario, 0 if unavailable
+};
+
+// Returns the current resident set size in kilobytes
+size_t currentRssKb() {
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) / 1024;
+    }
+#endif
+    return 0;
+}
+
+// Samples the resident set size in the background and keeps the highest value seen
+class RssSampler {
+public:
+    RssSampler() : running(true), peak(currentRssKb()) {
+        sampler = std::thread([this] {
+            while (running.load(std::memory_order_relaxed)) {
+                update();
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        });
+    }
+
+    ~RssSampler() {
+        stop();
+    }
+
+    size_t stop() {
+        if (sampler.joinable()) {
+            running = false;
+            sampler.join();
+            update();
+        }
+        return peak;
+    }
+
+private:
+    std::atomic<bool> running;
+    std::atomic<size_t> peak;
+    std::thread sampler;
+
+    void update() {
+        size_t rss = currentRssKb();
+        if (rss > peak.load(std::memory_order_relaxed)) {
+            peak = rss;
+        }
+    }
+};
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+// Points stdout at /dev/null for the lifetime of the object, so console scenarios measure the logger and not the terminal
+class StdoutSilencer {
+public:
+    StdoutSilencer() : saved(-1) {
+#if defined(__linux__) || defined(__APPLE__)
+        std::cout.flush();
+        std::fflush(stdout);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            saved = dup(STDOUT_FILENO);
+            dup2(null, STDOUT_FILENO);
+            close(null);
+        }
+#endif
+    }
+
+    ~StdoutSilencer() {
+#if defined(__linux__) || defined(__APPLE__)
+        if (saved >= 0) {
+            std::cout.flush();
+            dup2(saved, STDOUT_FILENO);
+            close(saved);
+        }
+#endif
+    }
+
+private:
+    int saved;
+};
+
+BenchResult runCase(const BenchCase& bc, size_t messagesPerThread, bool usePrefix, bool useContext, bool direct) {
+    std::filesystem::remove_all(BENCH_LOG_DIR);
+    bool console = bc.mode == BenchMode::COUT || bc.mode == BenchMode::CONSOLE;
+    std::unique_ptr<StdoutSilencer> silencer;
+    if (console) {
+        silencer = std::make_unique<StdoutSilencer>();
+    }
+
+    // Rotate every 64MB and keep a handful of files, close to a production configuration
+    FileLoggerConfig config(BENCH_LOG_DIR, "bench", ".txt", 64 * 1024 * 1024, 4, bc.mode == BenchMode::ASYNC);
+    std::unique_ptr<Logger> logger;
+    std::unique_ptr<FileLogger> fileLogger;
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+    std::unique_ptr<ShmLogWriter> shmWriter;
+    std::unique_ptr<ShmLogRing> shmRing;
+    if (bc.mode == BenchMode::SHM) {
+        shmWriter = std::make_unique<ShmLogWriter>(BENCH_SHM_RING, 64 * 1024 * 1024, config);
+    }
+#endif
+    if (direct) {
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+        if (bc.mode == BenchMode::SHM) {
+            shmRing = std::make_unique<ShmLogRing>(BENCH_SHM_RING, 0, false);
+        } else
+#endif
+        fileLogger = std::make_unique<FileLogger>(config);
+    } else {
+        logger = std::make_unique<Logger>();
+        logger->setLevel(bc.filtered ? LogLevel::WARN : LogLevel::TRACE);
+        if (usePrefix) {
+            logger->setPrefixCallback([]() {
+                time_t now = time(nullptr);
+                return ctime(&now);
+            });
+        }
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+        if (bc.mode == BenchMode::SHM) {
+            logger->enableSharedMemoryWrite(BENCH_SHM_RING);
+        } else
+#endif
+#ifdef ENABLE_CONSOLE_SINK
+        if (bc.mode == BenchMode::CONSOLE) {
+            logger->enableConsoleSink(ConsoleSinkConfig(4 * 1024 * 1024, false));
+        } else
+#endif
+        if (!console) {
+            logger->enableFileWrite(config);
+        }
+    }
+
+    const std::string message(bc.messageSize, 'x');
+    std::vector<std::vector<uint64_t>> latencies(bc.threads);
+    for (auto& l : latencies) {
+        l.reserve(messagesPerThread);
+    }
+
+    RssSampler sampler;
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> producers;
+
+    for (size_t t = 0; t < bc.threads; ++t) {
+        producers.emplace_back([&, t] {
+            auto& lat = latencies[t];
+            if (useContext) {
+                LogContext::push("iface", "eth0");
+                LogContext::push("session", t);
+                LogContext::push("flow", 0);
+            }
+            ++ready;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (size_t i = 0; i < messagesPerThread; ++i) {
+                auto begin = Clock::now();
+                if (useContext) {
+                    LogContext::update("flow", i);
+                }
+                if (fileLogger) {
+                    fileLogger->write(message);
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+                } else if (shmRing) {
+                    shmRing->write(message);
+#endif
+                } else {
+                    logger->info(message);
+                }
+                auto end = Clock::now();
+                lat.push_back(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+            }
+            LogContext::clear();
+        });
+    }
+
+    while (ready.load() < bc.threads) {
+        std::this_thread::yield();
+    }
+    auto start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& p : producers) {
+        p.join();
+    }
+    auto producersDone = Clock::now();
+
+    // Destroying the logger joins the async worker, so this includes draining the queue
+    BenchResult result{};
+#ifdef ENABLE_CONSOLE_SINK
+    if (bc.mode == BenchMode::CONSOLE) {
+        result.dropped = logger->getConsoleSink()->dropped();
+        logger->disableConsoleSink();
+    }
+#endif
+    logger.reset();
+    fileLogger.reset();
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+    shmRing.reset();
+    if (shmWriter) {
+        result.dropped = shmWriter->getRing().dropped();
+        shmWriter.reset();
+    }
+#endif
+    auto drained = Clock::now();
+
+    result.peakRssKb = sampler.stop();
+    result.producerSeconds = std::chrono::duration<double>(producersDone - start).count();
+    result.totalSeconds = std::chrono::duration<double>(drained - start).count();
+    result.messages = static_cast<uint64_t>(messagesPerThread) * bc.threads;
+    result.bytes = result.messages * bc.messageSize;
+
+    std::vector<uint64_t> all;
+    all.reserve(result.messages);
+    for (auto& l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+        std::vector<uint64_t>().swap(l);
+    }
+    std::sort(all.begin(), all.end());
+    result.p50 = percentile(all, 0.50);
+    result.p90 = percentile(all, 0.90);
+    result.p99 = percentile(all, 0.99);
+    result.p999 = percentile(all, 0.999);
+    result.pmax = all.empty() ? 0 : all.back();
+    return result;
+}
+
+std::vector<size_t> parseSizes(const std::string& arg) {
+    std::vector<size_t> sizes;
+    size_t pos = 0;
+    while (pos < arg.size()) {
+        size_t comma = arg.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = arg.size();
+        }
+        size_t value = std::strtoul(arg.substr(pos, comma - pos).c_str(), nullptr, 10);
+        if (value > 0) {
+            sizes.push_back(value);
+        }
+        pos = comma + 1;
+    }
+    return sizes;
+}
+
+void printHeader() {
+    std::printf("%-7s %-5s %-6s %-8s %10s %12s %10s %12s %8s %8s %8s %8s %10s %10s %8s\n",
+                "threads", "mode", "size", "filter", "msg/s", "MB/s", "e2e msg/s", "e2e MB/s",
+                "p50ns", "p90ns", "p99ns", "p999ns", "max ns", "peakRSS KB", "dropped");
+}
+
+void printResult(const BenchCase& bc, const BenchResult& r) {
+    double mb = static_cast<double>(r.bytes) / (1024.0 * 1024.0);
+    std::printf("%-7zu %-5s %-6zu %-8s %10.0f %12.2f %10.0f %12.2f %8llu %8llu %8llu %8llu %10llu %10zu %8llu\n",
+                bc.threads, modeName(bc.mode), bc.messageSize, bc.filtered ? "dropped" : "passed",
+                static_cast<double>(r.messages) / r.producerSeconds, mb / r.producerSeconds,
+                static_cast<double>(r.messages) / r.totalSeconds, mb / r.totalSeconds,
+                static_cast<unsigned long long>(r.p50), static_cast<unsigned long long>(r.p90),
+                static_cast<unsigned long long>(r.p99), static_cast<unsigned long long>(r.p999),
+                static_cast<unsigned long long>(r.pmax), r.peakRssKb, static_cast<unsigned long long>(r.dropped));
+    std::fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t messagesPerThread = 20000;
+    std::vector<size_t> sizes{32, 256, 2048};
+    bool usePrefix = false;
+    bool useContext = false;
+    bool direct = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            maxThreads = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--messages" && i + 1 < argc) {
+            messagesPerThread = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            sizes = parseSizes(argv[++i]);
+        } else if (arg == "--prefix") {
+            usePrefix = true;
+        } else if (arg == "--context") {
+            useContext = true;
+        } else if (arg == "--direct") {
+            direct = true;
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--threads N] [--messages M] [--sizes 32,256,2048] [--prefix] [--context] [--direct]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    if (sizes.empty()) {
+        std::cerr << "No valid message size given." << std::endl;
+        return 1;
+    }
+
+    std::vector<size_t> threadCounts;
+    for (size_t t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::cout << "logger_bench: " << messagesPerThread << " messages per thread, "
+              << (direct ? "FileLogger::write" : "Logger::info") << (usePrefix ? ", ctime prefix" : "")
+              << (useContext ? ", log context" : "") << std::endl;
+    printHeader();
+
+    std::vector<BenchMode> modes{BenchMode::SYNC, BenchMode::ASYNC};
+#ifdef ENABLE_SHARED_MEMORY_LOGGING
+    modes.push_back(BenchMode::SHM);
+#endif
+    // Console output always goes through Logger
+    if (!direct) {
+        modes.push_back(BenchMode::COUT);
+#ifdef ENABLE_CONSOLE_SINK
+        modes.push_back(BenchMode::CONSOLE);
+#endif
+    }
+
+    for (BenchMode mode : modes) {
+        for (size_t threads : threadCounts) {
+            for (size_t size : sizes) {
+                // The level filter lives in Logger, FileLogger has nothing to filter
+                for (bool filtered : {false, true}) {
+                    if (filtered && direct) {
+                        continue;
+                    }
+                    BenchCase bc{threads, mode, size, filtered};
+                    printResult(bc, runCase(bc, messagesPerThread, usePrefix, useContext, direct));
+                }
+            }
+        }
+    }
+
+    std::filesystem::remove_all(BENCH_LOG_DIR);
+    return 0;
+}
@@ -1,8 +1,163 @@
 #include <iostream>
 //#define TEST_THREAD_POOL
 #define TEST_LOGGER
+//#define TEST_SHARED_LOGGER
+//#define TEST_LOG_SHIPPER
 
-#ifdef TEST_THREAD_POOL
+#ifdef TEST_LOG_SHIPPER
+#include <map>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "logger.hpp"
+
+// 最简单的日志收集端：按 (stream, session) 记录已收到的序号，每收到若干批次丢弃一批不确认并断开，以验证断点续传和重发
+static void runCollector(const char* path, std::atomic<bool>& stop, uint64_t& received) {
+    using namespace opensource::ctrlfrmb;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    listen(listener, 4);
+
+    std::map<std::string, uint64_t> expected;
+    while (!stop) {
+        pollfd lp{listener, POLLIN, 0};
+        if (poll(&lp, 1, 100) <= 0) {
+            continue;
+        }
+        int conn = accept(listener, nullptr, nullptr);
+        std::string in, key;
+        int batches = 0;
+        char buffer[65536];
+        ssize_t n;
+        while (!stop && batches < 20 && (n = recv(conn, buffer, sizeof(buffer), 0)) > 0) {
+            in.append(buffer, static_cast<size_t>(n));
+            while (in.size() >= ship::FRAME_HEADER_SIZE) {
+                uint32_t type = ship::getU32(in.data());
+                uint32_t length = ship::getU32(in.data() + 4);
+                if (in.size() < ship::FRAME_HEADER_SIZE + length) {
+                    break;
+                }
+                const char* body = in.data() + ship::FRAME_HEADER_SIZE;
+                std::string reply;
+                if (type == ship::HELLO) {
+                    key = std::string(body + 18, ship::getU16(body + 16)) + "/" + std::to_string(ship::getU64(body + 8));
+                    size_t off = ship::beginFrame(reply, ship::RESUME);
+                    ship::putU64(reply, expected[key]);
+                    ship::endFrame(reply, off);
+                } else if (type == ship::DATA) {
+                    if (batches == 19) {
+                        // Drop this batch unacknowledged, the shipper has to send it again after reconnecting
+                        ++batches;
+                        in.clear();
+                        break;
+                    }
+                    uint64_t first = ship::getU64(body);
+                    uint32_t count = ship::getU32(body + 8);
+                    // Records below the expected sequence are duplicates resent after a reconnect
+                    if (first <= expected[key] && first + count > expected[key]) {
+                        received += first + count - expected[key];
+                        expected[key] = first + count;
+                    }
+                    size_t off = ship::beginFrame(reply, ship::ACK);
+                    ship::putU64(reply, expected[key]);
+                    ship::endFrame(reply, off);
+                    ++batches;
+                }
+                send(conn, reply.data(), reply.size(), MSG_NOSIGNAL);
+                in.erase(0, ship::FRAME_HEADER_SIZE + length);
+            }
+        }
+        close(conn);
+    }
+    close(listener);
+    unlink(path);
+}
+
+int main() {
+    using namespace opensource::ctrlfrmb;
+    const char* socketPath = "/tmp/tools_log_collector.sock";
+    std::atomic<bool> stop{false};
+    uint64_t received = 0;
+    std::thread collector(runCollector, socketPath, std::ref(stop), std::ref(received));
+
+    Logger logger;
+    logger.setLevel(LogLevel::DEBUG);
+    logger.enableConsoleSink();
+    logger.enableLogShipping(LogShipperConfig(socketPath, "tools", ShipFormat::BINARY));
+
+    for (int i = 0; i < 200000; ++i) {
+        logger.debug("This is a debug message " + std::to_string(i));
+        if (i % 1000 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    const LogShipper* shipper = logger.getLogShipper();
+    for (int wait = 0; wait < 500 && shipper->acknowledged() < shipper->queued(); ++wait) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::cerr << "queued " << shipper->queued() << ", dropped " << shipper->dropped()
+              << ", acknowledged " << shipper->acknowledged() << ", resent " << shipper->resentRecords()
+              << ", reconnects " << shipper->reconnectCount() << std::endl;
+    // Every record got through, and the batches dropped by the collector were sent again
+    uint64_t queued = shipper->queued();
+    bool resent = shipper->acknowledged() == queued && shipper->resentRecords() > 0;
+    logger.disableLogShipping();
+    stop = true;
+    collector.join();
+    std::cerr << "collector received " << received << std::endl;
+    return resent && received == queued ? 0 : 1;
+}
+#elif defined(TEST_SHARED_LOGGER)
+#include <sys/wait.h>
+#include "logger.hpp"
+
+// 多个进程通过共享内存环形缓冲写日志，由父进程统一落盘
+// 先创建环形缓冲并 fork 子进程，之后才启动落盘线程，fork 时父进程中没有其他线程
+int main() {
+    using namespace opensource::ctrlfrmb;
+    const char* ringName = "/tools_log_ring";
+
+    {
+        FileLoggerConfig config("logs", "shmlog", ".txt", 1024 * 1024, 5);
+        ShmLogWriter writer(ringName, 4 * 1024 * 1024, config, false);
+
+        const int processCount = 4;
+        for (int p = 0; p < processCount; ++p) {
+            if (fork() == 0) {
+                int status = 0;
+                {
+                    // 子进程在 _exit 前析构 logger，从环形缓冲上解除挂接
+                    Logger logger;
+                    logger.setLevel(LogLevel::DEBUG);
+                    logger.setPrefixCallback([p]() {
+                        return "process " + std::to_string(p) + " pid " + std::to_string(getpid());
+                    });
+                    if (logger.enableSharedMemoryWrite(ringName)) {
+                        for (int i = 0; i < 100000; ++i) {
+                            logger.info("This is an info message " + std::to_string(i));
+                        }
+                    } else {
+                        status = 1;
+                    }
+                }
+                _exit(status);
+            }
+        }
+        writer.start();
+
+        for (int p = 0; p < processCount; ++p) {
+            wait(nullptr);
+        }
+        std::cout << "written " << writer.getRing().written() << ", dropped " << writer.getRing().dropped() << std::endl;
+    }
+    // 所有子进程都已回收，即使有子进程异常退出没有解除挂接，也由创建者删除共享内存
+    shm_unlink(ringName);
+    return 0;
+}
+#elif defined(TEST_THREAD_POOL)
 #include "thread_pool.hpp"  // 引入线程池头文件
 // 一个简单的函数，模拟一些工作
 void exampleFunction(int id) {